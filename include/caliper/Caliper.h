@@ -52,6 +52,12 @@ public:
     // --- Events (callback functions)
 
     /// \brief Holds the %Caliper callbacks for a channel.
+    ///
+    /// Annotation callbacks (pre_begin_evt, post_begin_evt, pre_set_evt,
+    /// and pre_end_evt) must be connected during service registration or
+    /// in post_init_evt: %Caliper only dispatches annotation events to
+    /// channels that had callbacks for them at the end of channel
+    /// initialization.
     struct Events {
         typedef util::callback<void(Caliper*,Channel*,const Attribute&)>
             attribute_cbvec;
@@ -128,6 +134,18 @@ public:
 
         /// \brief Modify snapshot records during flush.
         edit_snapshot_cbvec    postprocess_snapshot;
+        /// \brief Inspect each snapshot record of a flush before any of
+        ///   them is passed to postprocess_snapshot.
+        ///
+        /// Lets postprocessing services (e.g., symbollookup) collect the
+        /// data they need from all records of a flush, and then process it
+        /// as a batch in prepare_postprocess. When this is used, the flush
+        /// runs flush_evt twice: once for collect_postprocess, and once
+        /// for postprocess_snapshot and the output.
+        write_cbvec            collect_postprocess;
+        /// \brief Invoked after collect_postprocess has seen all records
+        ///   of a flush.
+        caliper_cbvec          prepare_postprocess;
 
         /// \brief Write output.
         ///
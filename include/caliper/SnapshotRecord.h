@@ -115,6 +115,14 @@ public:
         append(view.size(), view.data());
     }
 
+    /// \brief Reset the builder to an earlier state with \a len entries
+    ///   and \a skipped skipped entries, dropping everything appended
+    ///   since then
+    void rewind(size_t len, size_t skipped) {
+        m_len     = std::min(len, m_len);
+        m_skipped = std::min(skipped, m_skipped);
+    }
+
     SnapshotView view() const {
         return SnapshotView { m_len, m_data };
     }
@@ -15,6 +15,8 @@
 
 #include "caliper/SnapshotRecord.h"
 
+#include <cstddef>
+
 namespace cali
 {
 
@@ -26,6 +28,21 @@ class OutputStream;
 
 struct QuerySpec;
 
+/**
+ * \brief Tuning options for aggregate_over_mpi()
+ */
+struct AggregateOverMpiOptions
+{
+    /// \brief Maximum number of children per rank in the reduction tree
+    unsigned fanout     = 2;
+    /// \brief Reduce within each shared-memory node before reducing
+    ///   across nodes
+    bool     node_local = true;
+    /// \brief Size in bytes of the snapshot data chunks a rank sends to
+    ///   its parent
+    size_t   chunk_size = 1024*1024;
+};
+
 /**
  * \brief Perform cross-process aggregation over MPI
  *
@@ -39,6 +56,15 @@ struct QuerySpec;
  * This function is effectively a blocking collective operation over
  * \a comm with the usual MPI collective semantics.
  *
+ * The reduction runs over a k-nomial tree, optionally within each
+ * shared-memory node first and then across the nodes. Ranks only send
+ * the context tree nodes their parent doesn't already have, identified
+ * by a content hash, and stream their records in chunks so that
+ * transfers overlap with merging on the receiving side. The tuning
+ * options are read from the CALI_MPIREDUCE_FANOUT,
+ * CALI_MPIREDUCE_NODE_LOCAL, and CALI_MPIREDUCE_CHUNK_SIZE
+ * configuration variables.
+ *
  * \param db   Metadata information for \a a. The metadata database
  *    may be modified during the operation.
  * \param a    Provides the aggregation configuration and local input
@@ -52,6 +78,20 @@ struct QuerySpec;
 void
 aggregate_over_mpi(CaliperMetadataDB& db, Aggregator& a, MPI_Comm comm);
 
+/**
+ * \brief Perform cross-process aggregation over MPI with the given
+ *   tuning options
+ *
+ * Like aggregate_over_mpi(CaliperMetadataDB&, Aggregator&, MPI_Comm),
+ * but uses the given \a opts instead of the runtime configuration. All
+ * ranks must use the same options.
+ *
+ * \ingroup ReaderAPI
+ */
+
+void
+aggregate_over_mpi(CaliperMetadataDB& db, Aggregator& a, MPI_Comm comm, const AggregateOverMpiOptions& opts);
+
 void
 collective_flush(OutputStream&    stream,
                  Caliper&         c,
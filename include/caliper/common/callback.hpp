@@ -8,36 +8,83 @@
 #define UTIL_CALLBACK_HPP
 
 #include <functional>
+#include <memory>
+#include <utility>
 #include <vector>
 
 namespace util
 {
 
 template<class F>
-class callback
+class callback;
+
+/// \brief A list of callback functions
+///
+/// The callbacks are kept in a flat array of (function pointer, context)
+/// pairs. Invoking a callback is a single indirect call: for a callable
+/// object (e.g., a lambda) the function pointer is a small trampoline
+/// that calls the object directly, without going through
+/// std::function.
+template<class R, class... Args>
+class callback<R(Args...)>
 {
-    std::vector< std::function<F> > mCb;
+    typedef R (*invoke_fn)(void*, Args...);
+
+    struct Slot {
+        invoke_fn fn;
+        void*     ctx;
+    };
+
+    std::vector<Slot>                    mSlots;
+    std::vector< std::shared_ptr<void> > mObjs; ///< owns the connected callable objects
+
+    template<class Fn>
+    static R invoke(void* ctx, Args... a) {
+        return static_cast<R>((*static_cast<Fn*>(ctx))(a...));
+    }
 
 public:
 
-    void connect(std::function<F> f) {
-        mCb.push_back(f);
-    } 
+    /// \brief Add the callable object \a f (a lambda, function pointer,
+    ///   std::function, etc.)
+    template<class Fn>
+    void connect(Fn f) {
+        std::shared_ptr<Fn> p = std::make_shared<Fn>(std::move(f));
+
+        mSlots.push_back(Slot { &invoke<Fn>, p.get() });
+        mObjs.push_back(p);
+    }
+
+    /// \brief Add the callable object \a f in front of the existing
+    ///   callbacks, so it is invoked first
+    template<class Fn>
+    void connect_front(Fn f) {
+        std::shared_ptr<Fn> p = std::make_shared<Fn>(std::move(f));
+
+        mSlots.insert(mSlots.begin(), Slot { &invoke<Fn>, p.get() });
+        mObjs.push_back(p);
+    }
+
+    /// \brief Add the function \a fn. \a fn will be invoked with
+    ///   \a ctx as its first argument.
+    void connect(R (*fn)(void*, Args...), void* ctx) {
+        mSlots.push_back(Slot { fn, ctx });
+    }
 
     bool empty() const {
-        return mCb.empty();
+        return mSlots.empty();
     }
 
-    template<class... Args>
-    void operator()(Args&&... a) {
-        for ( auto& f : mCb )
-            f(a...);
+    template<class... CallArgs>
+    void operator()(CallArgs&&... a) {
+        for ( const Slot& s : mSlots )
+            s.fn(s.ctx, a...);
     }
 
-    template<class Op, class R, class... Args>
-    R accumulate(Op op, R init, Args&&... a) {
-        for ( auto& f : mCb )
-            init = Op(init, f(a...));
+    template<class Op, class T, class... CallArgs>
+    T accumulate(Op op, T init, CallArgs&&... a) {
+        for ( const Slot& s : mSlots )
+            init = Op(init, s.fn(s.ctx, a...));
 
         return init;
     }
@@ -10,6 +10,7 @@
 #include "QuerySpec.h"
 #include "RecordProcessor.h"
 
+#include <cstddef>
 #include <iostream>
 #include <memory>
 
@@ -34,6 +35,14 @@ public:
 
     void add(CaliperMetadataAccessInterface&, const EntryList&);
 
+    /// \brief Aggregate the \a count records in \a recs
+    ///
+    /// Same as calling add() for each record, but looks up the key
+    /// attributes and the thread's aggregation table only once, and
+    /// remembers the aggregation entries for records with the same
+    /// context tree references and key values.
+    void add(CaliperMetadataAccessInterface&, const EntryList* recs, std::size_t count);
+
     void operator()(CaliperMetadataAccessInterface& db, const EntryList& list) {
         add(db, list);
     }
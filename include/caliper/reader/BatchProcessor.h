@@ -0,0 +1,69 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file BatchProcessor.h
+/// \brief Defines the BatchProcessor class
+
+#ifndef CALI_BATCHPROCESSOR_H
+#define CALI_BATCHPROCESSOR_H
+
+#include "Aggregator.h"
+#include "QuerySpec.h"
+#include "RecordProcessor.h"
+
+#include <cstddef>
+#include <memory>
+
+namespace cali
+{
+
+class CaliperMetadataAccessInterface;
+
+/// \brief Runs the \a LET, \a WHERE, and \a AGGREGATE steps of a query
+///   on batches of records
+///
+/// Produces the same records as a Preprocessor, RecordSelector, and
+/// Aggregator chain, but buffers incoming records and processes them
+/// batch by batch. For each batch, it gathers the record entries into
+/// attribute, node, and value columns, resolves the attributes that the
+/// query refers to once, evaluates each \a LET kernel and \a WHERE
+/// condition over whole columns, and hands the selected records to the
+/// Aggregator in one call. If the \a LET clause uses a kernel that
+/// can't be evaluated on columns, the BatchProcessor runs the \a LET
+/// clause record by record with a Preprocessor instead.
+///
+/// The buffered records are lost unless flush() is called. A
+/// BatchProcessor must not be used by more than one thread at a time;
+/// copies share their buffer. Use one BatchProcessor per reader thread;
+/// they can all feed the same Aggregator.
+/// \ingroup ReaderAPI
+
+class BatchProcessor
+{
+    struct BatchProcessorImpl;
+    std::shared_ptr<BatchProcessorImpl> mP;
+
+public:
+
+    /// \brief Process records with \a spec and aggregate the
+    ///   selected records in \a aggr
+    BatchProcessor(const QuerySpec& spec, Aggregator& aggr, std::size_t batch_size = 1024);
+    /// \brief Process records with \a spec and pass the selected
+    ///   records on to \a push
+    BatchProcessor(const QuerySpec& spec, SnapshotProcessFn push, std::size_t batch_size = 1024);
+
+    ~BatchProcessor();
+
+    void add(CaliperMetadataAccessInterface&, const EntryList&);
+
+    void operator()(CaliperMetadataAccessInterface& db, const EntryList& rec) {
+        add(db, rec);
+    }
+
+    /// \brief Process the remaining buffered records
+    void flush(CaliperMetadataAccessInterface&);
+};
+
+} // namespace cali
+
+#endif
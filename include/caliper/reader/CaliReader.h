@@ -11,12 +11,17 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace cali
 {
 
 class CaliperMetadataDB;
 
+/// \brief Reads .cali streams into a CaliperMetadataDB
+///
+/// A CaliReader can read several streams one after another. Each
+/// stream is read independently, unless segment mode is enabled.
 class CaliReader
 {
     struct CaliReaderImpl;
@@ -30,8 +35,25 @@ public:
     bool error() const;
     std::string error_msg() const;
 
+    /// \brief Read streams as consecutive segments of one stream
+    ///
+    /// In segment mode, node IDs of previously read streams remain
+    /// valid, so the incremental segment files of a rolling output can
+    /// be read in order with one reader. Disabled by default.
+    void set_segment_mode(bool enable);
+
     void read(std::istream& is, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc);
     void read(const std::string& filename, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc);
+
+    /// \brief Read \a filename with multiple threads.
+    ///
+    /// Nodes and globals are read by a single thread. Snapshot records
+    /// are then split into chunks and processed by \a snap_procs.size()
+    /// threads, where thread \e t passes its records to \a snap_procs[t].
+    /// The snapshot processing functions therefore don't need to be
+    /// thread-safe among each other, but records are not processed in
+    /// file order.
+    void read(const std::string& filename, CaliperMetadataDB& db, NodeProcessFn node_proc, const std::vector<SnapshotProcessFn>& snap_procs);
 };
 
 } // namespace cali
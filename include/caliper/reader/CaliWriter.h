@@ -25,14 +25,28 @@ class CaliWriter
 
 public:
 
+    /// \brief Output format
+    enum Format {
+        Text,  ///< Line-oriented text .cali format
+        Binary ///< Binary block-structured .cali format
+    };
+
     CaliWriter()
         { }
     
-    CaliWriter(OutputStream& os);
+    CaliWriter(OutputStream& os, Format format = Text);
 
     ~CaliWriter();
 
     size_t num_written() const;
+
+    /// \brief Finish the current output stream and continue writing
+    ///   to \a os.
+    ///
+    /// Nodes that were written to a previous stream are not written
+    /// again, so the new stream is an incremental segment: it can only
+    /// be read together with (after) the previous segments.
+    void next_segment(OutputStream& os);
     
     void write_snapshot(const CaliperMetadataAccessInterface&,
                         const std::vector<Entry>&);
@@ -11,19 +11,257 @@
 
 #include "../common/Attribute.h"
 #include "../common/CaliperMetadataAccessInterface.h"
+#include "../common/Variant.h"
 
+#include <algorithm>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace cali
 {
 
 class Node;
-class Variant;
 
-typedef std::map<cali_id_t, cali_id_t> IdMap;
+/// \brief Maps node IDs of an input stream to node IDs in a
+///   CaliperMetadataDB
+///
+/// IDs that aren't in the map map to themselves. Input IDs are usually
+/// small and dense, so IDs below a limit are kept in a flat array and
+/// only larger IDs go into a hash table.
+///
+/// Provides the subset of the std::map<cali_id_t, cali_id_t> interface
+/// that IdMap users need (operator[], insert, find, begin/end). Unlike
+/// std::map, iteration order is only sorted for small IDs, inserting
+/// an ID invalidates iterators, and IDs can't be mapped to CALI_INV_ID.
+/// \ingroup ReaderAPI
+
+class IdMap
+{
+public:
+
+    typedef cali_id_t                             key_type;
+    typedef cali_id_t                             mapped_type;
+    typedef std::pair<const cali_id_t, cali_id_t> value_type;
+    typedef std::size_t                           size_type;
+
+private:
+
+    static constexpr cali_id_t MaxDenseId = 1 << 22;
+
+    typedef std::vector<value_type>                  DenseMap;  ///< second == CALI_INV_ID: not mapped
+    typedef std::unordered_map<cali_id_t, cali_id_t> SparseMap;
+
+    DenseMap  m_dense;
+    SparseMap m_sparse;
+    size_type m_size;
+
+    template<typename V, typename DenseIt, typename SparseIt>
+    class IteratorT
+    {
+        DenseIt  m_d;
+        DenseIt  m_dend;
+        SparseIt m_s;
+
+        void skip_unmapped() {
+            while (m_d != m_dend && m_d->second == CALI_INV_ID)
+                ++m_d;
+        }
+
+        template<typename, typename, typename> friend class IteratorT;
+
+    public:
+
+        typedef std::forward_iterator_tag iterator_category;
+        typedef IdMap::value_type         value_type;
+        typedef std::ptrdiff_t            difference_type;
+        typedef V*                        pointer;
+        typedef V&                        reference;
+
+        IteratorT(DenseIt d, DenseIt dend, SparseIt s)
+            : m_d(d), m_dend(dend), m_s(s)
+            {
+                skip_unmapped();
+            }
+
+        template<typename V2, typename D2, typename S2>
+        IteratorT(const IteratorT<V2, D2, S2>& it)
+            : m_d(it.m_d), m_dend(it.m_dend), m_s(it.m_s)
+            { }
+
+        reference operator*() const {
+            return m_d != m_dend ? *m_d : *m_s;
+        }
+
+        pointer operator->() const {
+            return &(**this);
+        }
+
+        IteratorT& operator++() {
+            if (m_d != m_dend) {
+                ++m_d;
+                skip_unmapped();
+            } else
+                ++m_s;
+
+            return *this;
+        }
+
+        IteratorT operator++(int) {
+            IteratorT tmp(*this);
+            ++(*this);
+            return tmp;
+        }
+
+        bool operator == (const IteratorT& it) const {
+            return m_d == it.m_d && m_s == it.m_s;
+        }
+
+        bool operator != (const IteratorT& it) const {
+            return !(*this == it);
+        }
+    };
+
+    void grow_dense(cali_id_t id) {
+        std::size_t n =
+            std::min<std::size_t>(std::max<std::size_t>(2*m_dense.size(), id+1), static_cast<std::size_t>(MaxDenseId));
+
+        m_dense.reserve(n);
+
+        for (std::size_t i = m_dense.size(); i < n; ++i)
+            m_dense.emplace_back(static_cast<cali_id_t>(i), CALI_INV_ID);
+    }
+
+public:
+
+    typedef IteratorT<value_type, DenseMap::iterator, SparseMap::iterator>                   iterator;
+    typedef IteratorT<const value_type, DenseMap::const_iterator, SparseMap::const_iterator> const_iterator;
+
+    IdMap()
+        : m_size(0)
+        { }
+
+    /// \brief Return the mapped ID for \a id
+    cali_id_t map(cali_id_t id) const {
+        if (id < m_dense.size()) {
+            cali_id_t ret = m_dense[id].second;
+            return ret == CALI_INV_ID ? id : ret;
+        }
+
+        if (m_sparse.empty())
+            return id;
+
+        auto it = m_sparse.find(id);
+        return it == m_sparse.end() ? id : it->second;
+    }
+
+    /// \brief Return a reference to the mapped ID for \a id, inserting
+    ///   a mapping to 0 if there is none, like std::map::operator[]
+    cali_id_t& operator[](cali_id_t id) {
+        if (id < MaxDenseId) {
+            if (id >= m_dense.size())
+                grow_dense(id);
+
+            if (m_dense[id].second == CALI_INV_ID) {
+                m_dense[id].second = 0;
+                ++m_size;
+            }
+
+            return m_dense[id].second;
+        }
+
+        auto ret = m_sparse.insert(std::make_pair(id, cali_id_t(0)));
+
+        if (ret.second)
+            ++m_size;
+
+        return ret.first->second;
+    }
+
+    /// \brief Add \a v if its ID isn't mapped yet, like std::map::insert
+    std::pair<iterator, bool> insert(const value_type& v) {
+        iterator it = find(v.first);
+
+        if (it != end())
+            return std::make_pair(it, false);
+
+        (*this)[v.first] = v.second;
+
+        return std::make_pair(find(v.first), true);
+    }
+
+    iterator find(cali_id_t id) {
+        if (id < m_dense.size()) {
+            if (m_dense[id].second == CALI_INV_ID)
+                return end();
+
+            return iterator(m_dense.begin()+id, m_dense.end(), m_sparse.begin());
+        }
+
+        auto it = m_sparse.find(id);
+        return it == m_sparse.end() ? end() : iterator(m_dense.end(), m_dense.end(), it);
+    }
+
+    const_iterator find(cali_id_t id) const {
+        if (id < m_dense.size()) {
+            if (m_dense[id].second == CALI_INV_ID)
+                return end();
+
+            return const_iterator(m_dense.begin()+id, m_dense.end(), m_sparse.begin());
+        }
+
+        auto it = m_sparse.find(id);
+        return it == m_sparse.end() ? end() : const_iterator(m_dense.end(), m_dense.end(), it);
+    }
+
+    size_type count(cali_id_t id) const {
+        return find(id) == end() ? 0 : 1;
+    }
+
+    size_type erase(cali_id_t id) {
+        if (id < m_dense.size()) {
+            if (m_dense[id].second == CALI_INV_ID)
+                return 0;
+
+            m_dense[id].second = CALI_INV_ID;
+            --m_size;
+            return 1;
+        }
+
+        size_type ret = m_sparse.erase(id);
+        m_size -= ret;
+        return ret;
+    }
+
+    iterator begin() {
+        return iterator(m_dense.begin(), m_dense.end(), m_sparse.begin());
+    }
+
+    iterator end() {
+        return iterator(m_dense.end(), m_dense.end(), m_sparse.end());
+    }
+
+    const_iterator begin() const {
+        return const_iterator(m_dense.begin(), m_dense.end(), m_sparse.begin());
+    }
+
+    const_iterator end() const {
+        return const_iterator(m_dense.end(), m_dense.end(), m_sparse.end());
+    }
+
+    size_type size() const { return m_size;      }
+    bool      empty() const { return m_size == 0; }
+
+    void clear() {
+        m_dense.clear();
+        m_sparse.clear();
+        m_size = 0;
+    }
+};
 
 /// \brief Maintains a context tree and provides metadata information.
 /// \ingroup ReaderAPI
@@ -55,6 +293,27 @@ public:
                                const std::string& data,
                                IdMap&          idmap);
 
+    /// \brief Un-mapped node information for merge_nodes()
+    struct NodeInfo {
+        cali_id_t node_id;
+        cali_id_t attr_id;
+        cali_id_t parent_id;
+        Variant   value;
+    };
+
+    /// \brief Merge \a n nodes from an input stream
+    ///
+    /// Nodes may refer to nodes earlier in the same batch. This takes
+    /// the database locks once for the whole batch rather than for each
+    /// node. If \a out is given, it receives the merged nodes, or
+    /// nullptr for invalid node records.
+    ///
+    /// \return The number of nodes merged successfully
+    std::size_t merge_nodes   (std::size_t     n,
+                               const NodeInfo  nodes[],
+                               IdMap&          idmap,
+                               Node*           out[] = nullptr);
+
     EntryList   merge_snapshot(size_t          n_nodes,
                                const cali_id_t node_ids[],
                                size_t          n_imm,
@@ -67,17 +326,31 @@ public:
     EntryList   merge_snapshot(const CaliperMetadataAccessInterface& db,
                                const std::vector<Entry>& rec);
 
+    /// \brief Merge attribute \a attr from metadata DB \a db into this
+    ///   metadata DB
+    ///
+    /// Use this to make attributes known that no merged record refers to,
+    /// e.g. attributes that a query on \a db created.
+    Attribute   import_attribute(const CaliperMetadataAccessInterface& db,
+                                 const Attribute& attr);
+
     Entry       merge_entry   (cali_id_t       node_id,
                                const IdMap&    idmap);
     Entry       merge_entry   (cali_id_t       attr_id,
                                const std::string& data,
                                const IdMap&    idmap);
+    Entry       merge_entry   (cali_id_t       attr_id,
+                               const Variant&  v_data,
+                               const IdMap&    idmap);
 
     void        merge_global  (cali_id_t       node_id,
                                const IdMap&    idmap);
     void        merge_global  (cali_id_t       attr_id,
                                const std::string& data,
                                const IdMap&    idmap);
+    void        merge_global  (cali_id_t       attr_id,
+                               const Variant&  v_data,
+                               const IdMap&    idmap);
 
     //
     // --- Query API
@@ -121,8 +121,12 @@ AnnotationBinding::end_cb(Caliper* c, Channel* chn, const Attribute& attr, const
 {
     if (!::has_marker(attr, m_marker_attr))
         return;
-    if (m_filter && !m_filter->pass(value))
-        return;
+    if (m_filter) {
+        // the value on end comes from the blackboard, see EventTrigger
+        bool pass = attr.store_as_value() ? m_filter->pass(value) : m_filter->pass_node_value(value);
+        if (!pass)
+            return;
+    }
 
     this->on_end(c, chn, attr, value);
 }
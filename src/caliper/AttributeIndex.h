@@ -0,0 +1,157 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+#pragma once
+
+#ifndef CALI_ATTRIBUTEINDEX_H
+#define CALI_ATTRIBUTEINDEX_H
+
+#include "caliper/common/Attribute.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cali
+{
+
+/// \brief Name -> attribute index with lock-free lookups
+///
+/// Lookups read an immutable, published open-addressing hash table and
+/// never block. Inserts must be serialized by the caller (Caliper uses
+/// the global attribute lock). An insert either publishes a new item in
+/// a free slot of the current table, or, when the table is half full,
+/// builds a table of twice the size and publishes it. Old tables and
+/// items are only released in the destructor, so readers can keep using
+/// a table or item pointer they obtained earlier. Because the tables
+/// grow geometrically, the retired tables take at most as much memory
+/// as the current one.
+class AttributeIndex
+{
+public:
+
+    struct Item {
+        std::string name;
+        std::size_t hash;
+        Attribute   attr;
+    };
+
+private:
+
+    struct Table {
+        std::size_t mask;
+        std::unique_ptr< std::atomic<const Item*>[] > slots;
+
+        explicit Table(std::size_t size)
+            : mask(size - 1),
+              slots(new std::atomic<const Item*>[size])
+            {
+                for (std::size_t i = 0; i < size; ++i)
+                    slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+    };
+
+    std::atomic<const Table*>             m_table;
+
+    // writer-side data (protected by the caller's lock)
+    std::vector< std::unique_ptr<Table> > m_tables;
+    std::vector< std::unique_ptr<Item>  > m_items;
+
+    static void put(const Table* t, const Item* item, std::memory_order order) {
+        std::size_t i = item->hash & t->mask;
+
+        while (t->slots[i].load(std::memory_order_relaxed))
+            i = (i + 1) & t->mask;
+
+        t->slots[i].store(item, order);
+    }
+
+public:
+
+    /// \brief FNV-1a hash of a name
+    static std::size_t hash(const char* name, std::size_t len) {
+        uint64_t h = 0xcbf29ce484222325ull;
+
+        for (std::size_t i = 0; i < len; ++i) {
+            h ^= static_cast<unsigned char>(name[i]);
+            h *= 0x100000001b3ull;
+        }
+
+        return static_cast<std::size_t>(h);
+    }
+
+    AttributeIndex()
+        : m_table(nullptr)
+        {
+            m_tables.emplace_back(new Table(64));
+            m_table.store(m_tables.back().get(), std::memory_order_release);
+        }
+
+    AttributeIndex(const AttributeIndex&) = delete;
+    AttributeIndex& operator = (const AttributeIndex&) = delete;
+
+    /// \brief Find the item for \a name with precomputed hash \a h.
+    ///   Lock-free; can be called concurrently with insert().
+    const Item* find(const char* name, std::size_t len, std::size_t h) const {
+        const Table* t = m_table.load(std::memory_order_acquire);
+
+        for (std::size_t i = h & t->mask; ; i = (i + 1) & t->mask) {
+            const Item* item = t->slots[i].load(std::memory_order_acquire);
+
+            if (!item)
+                return nullptr;
+            if (item->hash == h && item->name.size() == len && std::memcmp(item->name.data(), name, len) == 0)
+                return item;
+        }
+    }
+
+    const Item* find(const std::string& name) const {
+        return find(name.data(), name.size(), hash(name.data(), name.size()));
+    }
+
+    /// \brief Add \a attr under \a name. The caller must make sure that
+    ///   \a name is not in the index yet and that inserts are serialized.
+    const Item* insert(const std::string& name, const Attribute& attr) {
+        std::size_t h = hash(name.data(), name.size());
+
+        m_items.emplace_back(new Item { name, h, attr });
+        const Item* item = m_items.back().get();
+
+        const Table* t = m_tables.back().get();
+
+        if (2 * m_items.size() > t->mask + 1) {
+            // grow: fill a new table privately, then publish it
+            Table* n = new Table(2 * (t->mask + 1));
+            m_tables.emplace_back(n);
+
+            for (const auto& p : m_items)
+                put(n, p.get(), std::memory_order_relaxed);
+
+            m_table.store(n, std::memory_order_release);
+        } else {
+            put(t, item, std::memory_order_release);
+        }
+
+        return item;
+    }
+
+    /// \brief Number of items. Requires the writer lock.
+    std::size_t size() const {
+        return m_items.size();
+    }
+
+    /// \brief Call \a fn(const Item&) for all items in insertion order.
+    ///   Requires the writer lock.
+    template<typename Fn>
+    void for_each(Fn fn) const {
+        for (const auto& p : m_items)
+            fn(*p);
+    }
+};
+
+} // namespace cali
+
+#endif
@@ -5,125 +5,199 @@
 
 #include "caliper/SnapshotRecord.h"
 
+#include <algorithm>
 #include <iostream>
 
 #ifdef _WIN32
 #include <intrin.h>
-#pragma intrinsic(_BitScanForward)
+#pragma intrinsic(_BitScanForward64)
 namespace {
-int first_high_bit(int x)
+inline int count_trailing_zeros(uint64_t x)
 {
-    unsigned long const mask = static_cast<unsigned long>(x);
     unsigned long index;
-    unsigned char is_non_zero = _BitScanForward(&index, mask);
-    if (is_non_zero) {
-        return index + 1;
-    }
-    return 0;
+    _BitScanForward64(&index, x);
+    return static_cast<int>(index);
 }
 }
 #else
-#include <strings.h>
 namespace {
-int first_high_bit(int x)
+inline int count_trailing_zeros(uint64_t x)
 {
-    return ffs(x);
+    return __builtin_ctzll(x);
 }
 }
 #endif
 
 using namespace cali;
 
-void
-Blackboard::add(cali_id_t key, const Entry& value, bool include_in_snapshots)
+Blackboard::Segment::Segment(size_t cap)
+    : capacity    { cap },
+      max_entries { cap - cap/8 - 1 }, // keep probe sequences short
+      num_entries { 0 },
+      slots       { new Slot[cap] },
+      toc         { new std::atomic<uint64_t>[(cap+63)/64] },
+      next        { nullptr }
 {
-    size_t I = find_free_slot(key);
+    for (size_t i = 0; i < (cap+63)/64; ++i)
+        toc[i].store(0, std::memory_order_relaxed);
+}
 
-    if (num_entries + (Nmax/10+10) > Nmax) {
-        ++num_skipped; // Uh oh, we're full
-        return;
-    }
+Blackboard::Segment::~Segment()
+{
+    delete next.load();
+}
 
-    hashtable[I].key   = key;
-    hashtable[I].value = value;
+Blackboard::Blackboard(WriterMode mode, unsigned num_stripes)
+    : m_mode        { mode },
+      m_num_stripes { std::max(num_stripes, 1u) },
+      m_stripes     { new Stripe[std::max(num_stripes, 1u)] },
+      ucount        { 0 }
+{
+    size_t cap = std::max<size_t>(Nmax / m_num_stripes, 61);
 
-    if (include_in_snapshots) {
-        toc[I/32] |= (1 << (I%32));
-        toctoc    |= (1 << (I/32));
-    }
+    for (unsigned i = 0; i < m_num_stripes; ++i)
+        m_stripes[i].head = new Segment(cap);
+}
 
-    ++num_entries;
-    max_num_entries = std::max(num_entries, max_num_entries);
+Blackboard::~Blackboard()
+{
 }
 
 void
-Blackboard::set(cali_id_t key, const Entry& value, bool include_in_snapshots)
+Blackboard::add(Stripe& s, cali_id_t key, const Entry& value, bool include_in_snapshots)
 {
-    std::lock_guard<util::spinlock>
-        g(lock);
+    Segment* seg = s.head;
 
-    size_t I = find_existing_entry(key);
+    while (seg->num_entries >= seg->max_entries) {
+        Segment* next = seg->next.load(std::memory_order_relaxed);
 
-    if (hashtable[I].key == key)
-        hashtable[I].value = value;
-    else
-        add(key, value, include_in_snapshots);
+        if (!next) {
+            //   We're full: add an overflow segment. Readers may walk
+            // into it as soon as it's published, so initialize it first.
+            next = new Segment(4*seg->capacity + 1);
+            seg->next.store(next, std::memory_order_release);
+            ++s.num_segments;
+        }
+
+        seg = next;
+    }
+
+    size_t I = seg->find(key, hkey(key));
+
+    seg->slots[I].store(value);
+    seg->slots[I].key.store(key, std::memory_order_relaxed);
 
-    ++ucount;
+    if (include_in_snapshots)
+        seg->set_toc(I);
+
+    ++seg->num_entries;
+    ++s.num_entries;
+    s.max_num_entries = std::max(s.num_entries, s.max_num_entries);
 }
 
 void
-Blackboard::del(cali_id_t key)
+Blackboard::remove(Stripe& s, Segment* seg, size_t I)
 {
-    std::lock_guard<util::spinlock>
-        g(lock);
-
-    size_t I = find_existing_entry(key);
+    //   Backward-shift deletion: move entries that were displaced past
+    // the deleted slot back so their probe sequences stay unbroken.
 
-    if (hashtable[I].key != key)
-        return;
+    const size_t N = seg->capacity;
 
     {
         size_t j = I;
         while (true) {
-            j = (j+1) % Nmax;
-            if (hashtable[j].key == CALI_INV_ID)
+            j = (j+1) % N;
+            uint64_t kj = seg->slots[j].key.load(std::memory_order_relaxed);
+            if (kj == CALI_INV_ID)
                 break;
-            size_t k = hashtable[j].key % Nmax;
+            size_t k = seg->home(hkey(kj));
             if ((j > I && (k <= I || k > j)) || (j < I && (k <= I && k > j))) {
-                hashtable[I] = hashtable[j];
+                seg->slots[I].copy_from(seg->slots[j]);
+
+                if (seg->test_toc(j))
+                    seg->set_toc(I);
+                else
+                    seg->clear_toc(I);
+
                 I = j;
             }
         }
     }
 
-    hashtable[I].key   = CALI_INV_ID;
-    hashtable[I].value = Entry();
+    seg->slots[I].key.store(CALI_INV_ID, std::memory_order_relaxed);
+    seg->slots[I].store(Entry());
+    seg->clear_toc(I);
 
-    --num_entries;
-    ++ucount;
+    --seg->num_entries;
+    --s.num_entries;
+}
 
-    toc[I/32] &= ~(1 << (I%32));
-    if (toc[I/32] == 0)
-        toctoc &= ~(1 << (I/32));
+void
+Blackboard::set(cali_id_t key, const Entry& value, bool include_in_snapshots)
+{
+    Stripe& s = stripe(key);
+
+    lock_stripe(s);
+    s.begin_write();
+
+    size_t   I   = 0;
+    Segment* seg = find_existing_entry(s, key, &I);
+
+    if (seg)
+        seg->slots[I].store(value);
+    else
+        add(s, key, value, include_in_snapshots);
+
+    s.end_write();
+    unlock_stripe(s);
+
+    update_count();
+}
+
+void
+Blackboard::del(cali_id_t key)
+{
+    Stripe& s = stripe(key);
+
+    lock_stripe(s);
+
+    size_t   I   = 0;
+    Segment* seg = find_existing_entry(s, key, &I);
+
+    if (seg) {
+        s.begin_write();
+        remove(s, seg, I);
+        s.end_write();
+    }
+
+    unlock_stripe(s);
+
+    if (seg)
+        update_count();
 }
 
 Entry
 Blackboard::exchange(cali_id_t key, const Entry& value, bool include_in_snapshots)
 {
-    std::lock_guard<util::spinlock>
-        g(lock);
-
-    size_t  I = find_existing_entry(key);
+    Stripe& s = stripe(key);
     Entry ret;
 
-    if (hashtable[I].key == key) {
-        ret = hashtable[I].value;
-        hashtable[I].value = value;
+    lock_stripe(s);
+    s.begin_write();
+
+    size_t   I   = 0;
+    Segment* seg = find_existing_entry(s, key, &I);
+
+    if (seg) {
+        ret = seg->slots[I].load();
+        seg->slots[I].store(value);
     } else
-        add(key, value, include_in_snapshots);
+        add(s, key, value, include_in_snapshots);
+
+    s.end_write();
+    unlock_stripe(s);
 
-    ++ucount;
+    update_count();
 
     return ret;
 }
@@ -131,33 +205,81 @@ Blackboard::exchange(cali_id_t key, const Entry& value, bool include_in_snapshot
 void
 Blackboard::snapshot(SnapshotBuilder& rec) const
 {
-    std::lock_guard<util::spinlock>
-        g(lock);
+    for (unsigned n = 0; n < m_num_stripes; ++n) {
+        const Stripe& s = m_stripes[n];
+
+        size_t len0     = rec.size();
+        size_t skipped0 = rec.skipped();
+
+        for (int tries = 0; tries < MaxTries; ++tries) {
+            if (tries >= SpinTries)
+                std::this_thread::yield();
+
+            unsigned s0 = s.seq.load(std::memory_order_acquire);
+
+            if (s0 & 1)
+                continue;
 
-    int tmptoc = toctoc;
+            rec.rewind(len0, skipped0);
 
-    while (tmptoc) {
-        int i = first_high_bit(tmptoc) - 1;
-        tmptoc &= ~(1 << i);
+            //   Walk the occupied slots in the toc bitfields one 64-bit
+            // word at a time, skipping empty words entirely
+            for (const Segment* seg = s.head; seg; seg = seg->next.load(std::memory_order_acquire)) {
+                const size_t nwords = (seg->capacity+63)/64;
 
-        int tmp = toc[i];
-        while (tmp) {
-            int j = first_high_bit(tmp) - 1;
-            tmp &= ~(1 << j);
+                for (size_t i = 0; i < nwords; ++i) {
+                    uint64_t w = seg->toc[i].load(std::memory_order_relaxed);
 
-            rec.append(hashtable[i*32+j].value);
+                    while (w) {
+                        size_t I = i*64 + count_trailing_zeros(w);
+                        w &= w - 1;
+
+                        if (I < seg->capacity)
+                            rec.append(seg->slots[I].load());
+                    }
+                }
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (s.seq.load(std::memory_order_relaxed) == s0)
+                break;
+
+            // don't leave a torn copy behind if we give up
+            rec.rewind(len0, skipped0);
         }
     }
 }
 
+size_t
+Blackboard::num_overflow_segments() const
+{
+    size_t ret = 0;
+
+    for (unsigned n = 0; n < m_num_stripes; ++n)
+        ret += m_stripes[n].num_segments;
+
+    return ret;
+}
+
 std::ostream&
 Blackboard::print_statistics(std::ostream& os) const
 {
-    os << "max " << max_num_entries
-       << " entries (" << 100.0*max_num_entries/Nmax << "% occupancy).";
+    size_t max_entries = 0;
+    size_t capacity    = 0;
+
+    for (unsigned n = 0; n < m_num_stripes; ++n) {
+        max_entries += m_stripes[n].max_num_entries;
+        capacity    += m_stripes[n].head->capacity;
+    }
+
+    os << "max " << max_entries
+       << " entries (" << 100.0*max_entries/capacity << "% occupancy).";
+
+    size_t segments = num_overflow_segments();
 
-    if (num_skipped > 0)
-        os << " " << num_skipped << " entries skipped!";
+    if (segments > 0)
+        os << " " << segments << " overflow segments added.";
 
     return os;
 }
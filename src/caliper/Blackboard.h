@@ -17,84 +17,257 @@
 
 #include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <mutex>
+#include <memory>
+#include <thread>
+#include <type_traits>
 
 namespace cali
 {
 
 class SnapshotBuilder;
 
+/// \brief Hash table of the currently set attribute entries
+///
+/// The table is split into one or more stripes by key. Each stripe is
+/// protected by a sequence lock: readers (get() and snapshot()) never
+/// lock, they retry if a writer modified the stripe while they were
+/// reading it. A SingleWriter blackboard (e.g., a thread blackboard) may
+/// only be modified by one thread at a time, and writers don't lock
+/// either. In a MultiWriter blackboard, writers lock the stripe they
+/// modify, so writers using different stripes don't contend.
+///
+/// Each stripe starts with a fixed-size primary table. When it fills up,
+/// new entries go into an overflow segment (four times as large as the
+/// previous one) instead of being dropped. Segments are kept until the
+/// blackboard is destroyed, so a racing reader never touches freed
+/// memory.
+///
+/// Readers give up after a bounded number of retries, which makes them
+/// safe to use in a signal handler that interrupted a writer.
 class Blackboard {
-    constexpr static size_t Nmax = 1021;
+public:
+
+    enum WriterMode {
+        SingleWriter, MultiWriter
+    };
+
+private:
+
+    constexpr static size_t   Nmax       = 1021;
+    constexpr static int      SpinTries  = 64;
+    constexpr static int      MaxTries   = 10000;
+    constexpr static unsigned EntryWords = (sizeof(Entry) + 7) / 8;
+
+#if !defined(__GNUC__) || defined(__clang__) || __GNUC__ >= 5
+    static_assert(std::is_trivially_copyable<Entry>::value, "Blackboard requires a trivially copyable Entry");
+#endif
+
+    struct Slot {
+        std::atomic<uint64_t> key;
+        std::atomic<uint64_t> words[EntryWords];
+
+        Slot()
+            : key(CALI_INV_ID)
+            {
+                for (unsigned i = 0; i < EntryWords; ++i)
+                    words[i].store(0, std::memory_order_relaxed);
+            }
+
+        void copy_from(const Slot& other) {
+            key.store(other.key.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+            for (unsigned i = 0; i < EntryWords; ++i)
+                words[i].store(other.words[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+
+        void store(const Entry& e) {
+            uint64_t buf[EntryWords] = { 0 };
+            std::memcpy(buf, &e, sizeof(Entry));
+
+            for (unsigned i = 0; i < EntryWords; ++i)
+                words[i].store(buf[i], std::memory_order_relaxed);
+        }
+
+        Entry load() const {
+            uint64_t buf[EntryWords];
+
+            for (unsigned i = 0; i < EntryWords; ++i)
+                buf[i] = words[i].load(std::memory_order_relaxed);
+
+            Entry e;
+            std::memcpy(&e, buf, sizeof(Entry));
+            return e;
+        }
+    };
+
+    /// \brief An open-addressing hash table segment
+    struct Segment {
+        size_t                    capacity;
+        size_t                    max_entries;
+        size_t                    num_entries;
+
+        std::unique_ptr<Slot[]>   slots;
+
+        //   The toc ("table of contents") array is a bitfield that
+        // indicates which slots are occupied by entries that go into
+        // snapshots. We use it to speed up iterating over all entries
+        // in snapshot().
+        std::unique_ptr<std::atomic<uint64_t>[]> toc;
+
+        std::atomic<Segment*>     next;  ///< overflow segment
+
+        explicit Segment(size_t cap);
+        ~Segment();
+
+        size_t home(uint64_t hkey) const {
+            return hkey % capacity;
+        }
+
+        /// \brief Return the slot for \a key, or the empty slot where it
+        ///   would go. \a hkey is the stripe-local hash key.
+        size_t find(uint64_t key, uint64_t hkey) const {
+            size_t I = home(hkey);
 
-    struct blackboard_entry_t {
-        cali_id_t key   { CALI_INV_ID };
-        Entry     value { };
+            for (uint64_t k = slots[I].key.load(std::memory_order_relaxed); k != key && k != CALI_INV_ID; k = slots[I].key.load(std::memory_order_relaxed))
+                I = (I+1) % capacity;
+
+            return I;
+        }
+
+        void set_toc(size_t I) {
+            toc[I/64].store(toc[I/64].load(std::memory_order_relaxed) | (static_cast<uint64_t>(1) << (I%64)), std::memory_order_relaxed);
+        }
+
+        void clear_toc(size_t I) {
+            toc[I/64].store(toc[I/64].load(std::memory_order_relaxed) & ~(static_cast<uint64_t>(1) << (I%64)), std::memory_order_relaxed);
+        }
+
+        bool test_toc(size_t I) const {
+            return toc[I/64].load(std::memory_order_relaxed) & (static_cast<uint64_t>(1) << (I%64));
+        }
+    };
+
+    struct Stripe {
+        std::atomic<unsigned>     seq;
+        Segment*                  head;
+        util::spinlock            lock;
+
+        size_t                    num_entries;
+        size_t                    max_num_entries;
+        size_t                    num_segments;
+
+        char                      padding[64]; ///< avoid false sharing between stripes
+
+        Stripe()
+            : seq(0), head(nullptr), num_entries(0), max_num_entries(0), num_segments(0)
+            { }
+
+        ~Stripe() {
+            delete head;
+        }
+
+        // --- writer side
+
+        void begin_write() {
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        void end_write() {
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
     };
 
-    blackboard_entry_t hashtable[Nmax];
+    WriterMode                m_mode;
+    unsigned                  m_num_stripes;
+    std::unique_ptr<Stripe[]> m_stripes;
 
-    //   The toc ("table of contents") array is a bitfield that
-    // indicates which elements in the hashtable are occupied. We use
-    // it to speed up iterating over all entries in snapshot().
-    //   Similarly, toctoc indicates which elements in toc are
-    // occupied.
-    int      toc[(Nmax+31)/32];
-    int      toctoc;
+    std::atomic<int>          ucount; // update count
 
-    size_t   num_entries;
-    size_t   max_num_entries;
+    Stripe& stripe(cali_id_t key) {
+        return m_stripes[key % m_num_stripes];
+    }
 
-    size_t   num_skipped;
+    const Stripe& stripe(cali_id_t key) const {
+        return m_stripes[key % m_num_stripes];
+    }
 
-    std::atomic<int>   ucount; // update count
+    uint64_t hkey(cali_id_t key) const {
+        return key / m_num_stripes;
+    }
 
-    mutable util::spinlock lock;
+    /// \brief Find the segment and slot holding \a key. Returns nullptr
+    ///   if \a key is not in the stripe.
+    Segment* find_existing_entry(const Stripe& s, cali_id_t key, size_t* slot) const {
+        uint64_t h = hkey(key);
 
-    inline size_t find_existing_entry(cali_id_t key) const {
-        size_t I = key % Nmax;
+        for (Segment* seg = s.head; seg; seg = seg->next.load(std::memory_order_acquire)) {
+            size_t I = seg->find(key, h);
 
-        while (hashtable[I].key != key && hashtable[I].key != CALI_INV_ID)
-            I = (I+1) % Nmax;
+            if (seg->slots[I].key.load(std::memory_order_relaxed) == key) {
+                *slot = I;
+                return seg;
+            }
+        }
 
-        return I;
+        return nullptr;
     }
 
-    inline size_t find_free_slot(cali_id_t key) const {
-        size_t I = key % Nmax;
+    void add(Stripe& s, cali_id_t key, const Entry& value, bool include_in_snapshots);
+    void remove(Stripe& s, Segment* seg, size_t I);
 
-        while (hashtable[I].key != CALI_INV_ID)
-            I = (I+1) % Nmax;
+    void update_count() {
+        if (m_mode == MultiWriter)
+            ucount.fetch_add(1, std::memory_order_release);
+        else
+            ucount.store(ucount.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
 
-        return I;
+    void lock_stripe(Stripe& s) {
+        if (m_mode == MultiWriter)
+            s.lock.lock();
     }
 
-    void add(cali_id_t key, const Entry& value, bool include_in_snapshot);
+    void unlock_stripe(Stripe& s) {
+        if (m_mode == MultiWriter)
+            s.lock.unlock();
+    }
 
 public:
 
-    Blackboard()
-        : hashtable       {   },
-          toc             { 0 },
-          toctoc          { 0 },
-          num_entries     { 0 },
-          max_num_entries { 0 },
-          num_skipped     { 0 },
-          ucount          { 0 }
-        { }
+    explicit Blackboard(WriterMode mode = SingleWriter, unsigned num_stripes = 1);
+
+    ~Blackboard();
+
+    Blackboard(const Blackboard&) = delete;
+    Blackboard& operator = (const Blackboard&) = delete;
 
     inline Entry
     get(cali_id_t key) const {
-        std::lock_guard<util::spinlock>
-            g(lock);
+        const Stripe& s = stripe(key);
+
+        for (int tries = 0; tries < MaxTries; ++tries) {
+            if (tries >= SpinTries)
+                std::this_thread::yield();
+
+            unsigned s0 = s.seq.load(std::memory_order_acquire);
+
+            if (s0 & 1)
+                continue;
+
+            size_t   I   = 0;
+            Segment* seg = find_existing_entry(s, key, &I);
+            Entry    ret = seg ? seg->slots[I].load() : Entry();
 
-        size_t I = find_existing_entry(key);
+            std::atomic_thread_fence(std::memory_order_acquire);
 
-        if (hashtable[I].key != key)
-            return Entry();
+            if (s.seq.load(std::memory_order_relaxed) == s0)
+                return ret;
+        }
 
-        return hashtable[I].value;
+        return Entry();
     }
 
     void    set(cali_id_t key, const Entry& value, bool include_in_snapshots);
@@ -104,9 +277,11 @@ public:
 
     void    snapshot(SnapshotBuilder& rec) const;
 
-    size_t  num_skipped_entries() const { return num_skipped; }
+    /// \brief Number of overflow segments allocated because a primary
+    ///   table filled up
+    size_t  num_overflow_segments() const;
 
-    int     count() const { return ucount.load(); }
+    int     count() const { return ucount.load(std::memory_order_acquire); }
 
     std::ostream& print_statistics(std::ostream& os) const;
 };
@@ -10,6 +10,7 @@
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
+#include "AttributeIndex.h"
 #include "Blackboard.h"
 #include "MetadataTree.h"
 
@@ -21,8 +22,10 @@
 
 #include <signal.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstring>
 #include <cstdlib>
 #include <iostream>
@@ -164,23 +167,106 @@ struct Channel::ChannelImpl
     RuntimeConfig                   config;
     Events                          events;          ///< callbacks
 
+    /// \brief Annotation events with subscribed callbacks
+    enum EventBits {
+        PreBeginEvt  = 1,
+        PostBeginEvt = 2,
+        PreSetEvt    = 4,
+        PreEndEvt    = 8
+    };
+
+    unsigned                        subscriptions;   ///< EventBits bitmask
+
     bool                            flush_on_exit;
 
     Blackboard                      channel_blackboard;
 
+    // --- rolling output
+
+    std::chrono::steady_clock::duration rolling_interval;   ///< 0: no time trigger
+    uint64_t                        rolling_size;           ///< bytes; 0: no size trigger
+    std::atomic<uint64_t>           rolling_bytes;          ///< snapshot data since the last segment
+    std::atomic<int64_t>            rolling_start;          ///< start of the current segment (steady_clock ticks)
+    std::atomic<bool>               rolling_busy;
+    uint64_t                        rolling_segment;
+    Attribute                       segment_attr;
+
     ChannelImpl(cali_id_t _id, const char* _name, const RuntimeConfig& cfg)
         : id(_id),
           name(_name),
           active(true),
-          config(cfg)
+          config(cfg),
+          subscriptions(0),
+          channel_blackboard(Blackboard::MultiWriter),
+          rolling_bytes(0),
+          rolling_start(std::chrono::steady_clock::now().time_since_epoch().count()),
+          rolling_busy(false),
+          rolling_segment(0)
         {
             ConfigSet cali_cfg =
                 config.init("channel", s_configdata);
 
             flush_on_exit =
                 cali_cfg.get("flush_on_exit").to_bool();
+
+            rolling_interval =
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(cali_cfg.get("rolling_interval").to_double()));
+            rolling_size =
+                cali_cfg.get("rolling_size").to_uint() * 1024 * 1024;
         }
 
+    unsigned update_subscriptions() {
+        subscriptions =
+            (events.pre_begin_evt.empty()  ? 0 : PreBeginEvt ) |
+            (events.post_begin_evt.empty() ? 0 : PostBeginEvt) |
+            (events.pre_set_evt.empty()    ? 0 : PreSetEvt   ) |
+            (events.pre_end_evt.empty()    ? 0 : PreEndEvt   );
+
+        return subscriptions;
+    }
+
+    bool is_rolling() const {
+        return rolling_interval.count() > 0 || rolling_size > 0;
+    }
+
+    /// \brief Account for a new snapshot with \a n entries. Returns true
+    ///   if the caller should write a segment now.
+    bool rolling_segment_due(size_t n) {
+        uint64_t bytes = rolling_bytes.fetch_add(n * sizeof(Entry)) + n * sizeof(Entry);
+
+        bool due = (rolling_size > 0 && bytes >= rolling_size);
+
+        if (!due && rolling_interval.count() > 0)
+            due = (std::chrono::steady_clock::now().time_since_epoch().count() - rolling_start.load()
+                   >= rolling_interval.count());
+
+        // only one thread writes the segment
+        return due && !rolling_busy.exchange(true);
+    }
+
+    /// \brief Flush the channel as the next output segment, then clear
+    ///   its buffers
+    void write_segment(Caliper* c, Channel* chn) {
+        if (segment_attr == Attribute::invalid)
+            segment_attr =
+                c->create_attribute("cali.segment", CALI_TYPE_UINT,
+                                    CALI_ATTR_GLOBAL      |
+                                    CALI_ATTR_SKIP_EVENTS |
+                                    CALI_ATTR_ASVALUE);
+
+        c->set(chn, segment_attr, Variant(cali_make_variant_from_uint(rolling_segment)));
+
+        Log(2).stream() << name << ": Writing output segment " << rolling_segment << std::endl;
+
+        c->flush_and_write(chn, SnapshotView());
+        c->clear(chn);
+
+        ++rolling_segment;
+        rolling_bytes.store(0);
+        rolling_start.store(std::chrono::steady_clock::now().time_since_epoch().count());
+    }
+
     ~ChannelImpl()
         {
             if (Log::verbosity() >= 2) {
@@ -200,6 +286,17 @@ const ConfigSet::Entry Channel::ChannelImpl::s_configdata[] = {
       "Flush Caliper buffers at program exit",
       "Flush Caliper buffers at program exit"
     },
+    { "rolling_interval", CALI_TYPE_DOUBLE, "0",
+      "Write an output segment every N seconds",
+      "Rolling output: flush and clear the channel every N seconds. "
+      "Each flush writes a new output segment. 0 disables the time trigger."
+    },
+    { "rolling_size", CALI_TYPE_UINT, "0",
+      "Write an output segment every N MiB of snapshot data",
+      "Rolling output: flush and clear the channel after it has processed "
+      "approximately N MiB of snapshot data. "
+      "Each flush writes a new output segment. 0 disables the size trigger."
+    },
     ConfigSet::Terminator
 };
 
@@ -264,11 +361,33 @@ struct Caliper::ThreadData
     bool           is_initial_thread;
     bool           stack_error;
 
+    // small direct-mapped cache for attribute name lookups
+    static constexpr size_t AttrCacheSize = 16;
+
+    const AttributeIndex::Item* attr_cache[AttrCacheSize];
+
     ThreadData(bool initial_thread = false)
         : process_bb_count(-1),
           is_initial_thread(initial_thread),
           stack_error(false)
-        { }
+        {
+            std::fill_n(attr_cache, AttrCacheSize, nullptr);
+        }
+
+    const AttributeIndex::Item* find_attribute(const AttributeIndex& index, const std::string& name) {
+        size_t hash = AttributeIndex::hash(name.data(), name.size());
+        const AttributeIndex::Item* &c = attr_cache[hash % AttrCacheSize];
+
+        if (c && c->hash == hash && c->name == name)
+            return c;
+
+        const AttributeIndex::Item* item = index.find(name.data(), name.size(), hash);
+
+        if (item)
+            c = item;
+
+        return item;
+    }
 
     ~ThreadData() {
         if (Log::verbosity() >= 2)
@@ -317,24 +436,47 @@ struct Caliper::GlobalData
 
     bool                               allow_region_overlap;
 
+    // attribute_index lookups are lock-free; attribute_lock serializes inserts
     mutable std::mutex                 attribute_lock;
-    map<string, Attribute>             attribute_map;
+    AttributeIndex                     attribute_index;
 
     map<string, int>                   attribute_prop_presets;
     int                                attribute_default_scope;
 
+    //   The process blackboard is written concurrently by all threads:
+    // stripe it so updates of different attributes don't contend
     Blackboard                         process_blackboard;
 
     vector< std::unique_ptr<Channel> > channels;
 
+    /// \brief The channels subscribed to each annotation event
+    struct EventDispatch {
+        vector<Channel*>               pre_begin;
+        vector<Channel*>               post_begin;
+        vector<Channel*>               pre_set;
+        vector<Channel*>               pre_end;
+    };
+
+    //   Annotation events only visit the channels in the current dispatch
+    // lists. Lookups are lock-free; updates (on channel creation and
+    // deletion) are serialized with dispatch_lock and publish new lists.
+    // Old lists are kept until the end so readers never see freed memory.
+    std::atomic<const EventDispatch*>  event_dispatch;
+    vector< std::unique_ptr<EventDispatch> > event_dispatch_lists;
+    std::mutex                         dispatch_lock;
+
     vector< ThreadData*              > thread_data;
     std::mutex                         thread_data_lock;
 
     // --- constructor
 
     GlobalData(ThreadData* sT)
-          : attribute_default_scope { CALI_ATTR_SCOPE_THREAD }
+          : attribute_default_scope { CALI_ATTR_SCOPE_THREAD },
+            process_blackboard { Blackboard::MultiWriter, 8 },
+            event_dispatch { nullptr }
     {
+        update_event_dispatch();
+
         // put the attribute [name,type,prop] attributes in the map
 
         Attribute name_attr =
@@ -344,9 +486,35 @@ struct Caliper::GlobalData
         Attribute prop_attr =
             Attribute::make_attribute(sT->tree.node(Attribute::PROP_ATTR_ID));
 
-        attribute_map.insert(make_pair(name_attr.name(), name_attr));
-        attribute_map.insert(make_pair(prop_attr.name(), prop_attr));
-        attribute_map.insert(make_pair(type_attr.name(), type_attr));
+        attribute_index.insert(name_attr.name(), name_attr);
+        attribute_index.insert(prop_attr.name(), prop_attr);
+        attribute_index.insert(type_attr.name(), type_attr);
+    }
+
+    void update_event_dispatch() {
+        std::lock_guard<std::mutex>
+            g(dispatch_lock);
+
+        EventDispatch* d = new EventDispatch;
+
+        for (auto& chn : channels) {
+            if (!chn)
+                continue;
+
+            unsigned s = chn->mP->update_subscriptions();
+
+            if (s & Channel::ChannelImpl::PreBeginEvt)
+                d->pre_begin.push_back(chn.get());
+            if (s & Channel::ChannelImpl::PostBeginEvt)
+                d->post_begin.push_back(chn.get());
+            if (s & Channel::ChannelImpl::PreSetEvt)
+                d->pre_set.push_back(chn.get());
+            if (s & Channel::ChannelImpl::PreEndEvt)
+                d->pre_end.push_back(chn.get());
+        }
+
+        event_dispatch_lists.emplace_back(d);
+        event_dispatch.store(d, std::memory_order_release);
     }
 
     ~GlobalData() {
@@ -697,12 +865,9 @@ Caliper::create_attribute(const std::string& name, cali_attr_type type, int prop
 
     // Check if an attribute with this name already exists
     {
-        std::lock_guard<std::mutex>
-            ga(sG->attribute_lock);
-
-        auto it = sG->attribute_map.find(name);
-        if (it != sG->attribute_map.end())
-            return it->second;
+        const AttributeIndex::Item* item = sT->find_attribute(sG->attribute_index, name);
+        if (item)
+            return item->attr;
     }
 
     Node* node = nullptr;
@@ -750,12 +915,12 @@ Caliper::create_attribute(const std::string& name, cali_attr_type type, int prop
         std::lock_guard<std::mutex>
             ga(sG->attribute_lock);
 
-        auto it = sG->attribute_map.lower_bound(name);
+        const AttributeIndex::Item* item = sG->attribute_index.find(name);
 
-        if (it == sG->attribute_map.end() || it->first != name)
-            sG->attribute_map.insert(it, std::make_pair(name, Attribute::make_attribute(node)));
-        else
-            return it->second;
+        if (item)
+            return item->attr;
+
+        sG->attribute_index.insert(name, Attribute::make_attribute(node));
     }
 
     // Create attribute object
@@ -774,10 +939,8 @@ Caliper::attribute_exists(const std::string& name) const
 {
     std::lock_guard<::siglock>
         gs(sT->lock);
-    std::lock_guard<std::mutex>
-        ga(sG->attribute_lock);
 
-    return (sG->attribute_map.find(name) != sG->attribute_map.end());
+    return sT->find_attribute(sG->attribute_index, name) != nullptr;
 }
 
 Attribute
@@ -785,12 +948,10 @@ Caliper::get_attribute(const std::string& name) const
 {
     std::lock_guard<::siglock>
         gs(sT->lock);
-    std::lock_guard<std::mutex>
-        ga(sG->attribute_lock);
 
-    auto it = sG->attribute_map.find(name);
+    const AttributeIndex::Item* item = sT->find_attribute(sG->attribute_index, name);
 
-    return it != sG->attribute_map.end() ? it->second : Attribute::invalid;
+    return item ? item->attr : Attribute::invalid;
 }
 
 Attribute
@@ -810,10 +971,16 @@ Caliper::get_all_attributes() const
         g_a(sG->attribute_lock);
 
     std::vector<Attribute> ret;
-    ret.reserve(sG->attribute_map.size());
+    ret.reserve(sG->attribute_index.size());
 
-    for (auto it : sG->attribute_map)
-        ret.push_back(it.second);
+    sG->attribute_index.for_each([&ret](const AttributeIndex::Item& item){
+            ret.push_back(item.attr);
+        });
+
+    // the index is in creation order; return attributes sorted by name
+    std::sort(ret.begin(), ret.end(), [](const Attribute& a, const Attribute& b){
+            return strcmp(a.name_c_str(), b.name_c_str()) < 0;
+        });
 
     return ret;
 }
@@ -918,6 +1085,14 @@ Caliper::push_snapshot(Channel* channel, SnapshotView trigger_info)
     sT->snapshot.builder().append(sT->process_snapshot.view());
 
     channel->mP->events.process_snapshot(this, channel, trigger_info, sT->snapshot.view());
+
+    // rolling output: we can't flush from a signal handler, so defer
+    // the segment to the next regular snapshot in that case
+    if (channel->mP->is_rolling() && !m_is_signal && channel->is_active())
+        if (channel->mP->rolling_segment_due(sT->snapshot.view().size())) {
+            channel->mP->write_segment(this, channel);
+            channel->mP->rolling_busy.store(false);
+        }
 }
 
 void
@@ -931,8 +1106,24 @@ Caliper::flush(Channel* chn, SnapshotView flush_info, SnapshotFlushFn proc_fn)
     if (chn->mP->events.postprocess_snapshot.empty()) {
         chn->mP->events.flush_evt(this, chn, flush_info, proc_fn);
     } else {
-        chn->mP->events.flush_evt(this, chn, flush_info, [this,chn,proc_fn](CaliperMetadataAccessInterface&, const std::vector<Entry>& rec) {
-                std::vector<Entry> mrec(rec);
+        //   Let batch postprocessing services look at all records first.
+        // This takes an extra flush pass, but unlike buffering the records
+        // it needs no memory beyond what the services collect.
+        if (!chn->mP->events.collect_postprocess.empty()) {
+            chn->mP->events.flush_evt(this, chn, flush_info, [this,chn](CaliperMetadataAccessInterface&, const std::vector<Entry>& rec) {
+                    chn->mP->events.collect_postprocess(this, chn, SnapshotView(rec.size(), rec.data()));
+                });
+        }
+
+        chn->mP->events.prepare_postprocess(this, chn);
+
+        //   Postprocessing modifies the record, so we need a copy. Reuse
+        // one buffer for all records rather than allocating a new one for
+        // each.
+        std::vector<Entry> mrec;
+
+        chn->mP->events.flush_evt(this, chn, flush_info, [this,chn,proc_fn,&mrec](CaliperMetadataAccessInterface&, const std::vector<Entry>& rec) {
+                mrec.assign(rec.begin(), rec.end());
 
                 chn->mP->events.postprocess_snapshot(this, chn, mrec);
                 proc_fn(*this, mrec);
@@ -986,11 +1177,14 @@ Caliper::begin(const Attribute& attr, const Variant& data)
     std::lock_guard<::siglock>
         g(sT->lock);
 
+    const GlobalData::EventDispatch* dispatch =
+        sG->event_dispatch.load(std::memory_order_acquire);
+
     // invoke callbacks
     if (run_events)
-        for (auto& channel : sG->channels)
-            if (channel && channel->is_active())
-                channel->mP->events.pre_begin_evt(this, channel.get(), attr, data);
+        for (Channel* channel : dispatch->pre_begin)
+            if (channel->is_active())
+                channel->mP->events.pre_begin_evt(this, channel, attr, data);
 
     if (scope == CALI_ATTR_SCOPE_THREAD)
         handle_begin(attr, data, prop, sT->thread_blackboard, sT->tree);
@@ -999,9 +1193,9 @@ Caliper::begin(const Attribute& attr, const Variant& data)
 
     // invoke callbacks
     if (run_events)
-        for (auto& channel : sG->channels)
-            if (channel && channel->is_active())
-                channel->mP->events.post_begin_evt(this, channel.get(), attr, data);
+        for (Channel* channel : dispatch->post_begin)
+            if (channel->is_active())
+                channel->mP->events.post_begin_evt(this, channel, attr, data);
 }
 
 void
@@ -1037,9 +1231,9 @@ Caliper::end(const Attribute& attr)
 
     // invoke callbacks
     if (run_events)
-        for (auto& channel : sG->channels)
-            if (channel && channel->is_active())
-                channel->mP->events.pre_end_evt(this, channel.get(), attr, current.entry.value());
+        for (Channel* channel : sG->event_dispatch.load(std::memory_order_acquire)->pre_end)
+            if (channel->is_active())
+                channel->mP->events.pre_end_evt(this, channel, attr, current.entry.value());
 
     handle_end(attr, prop, current.merged_entry, key, *blackboard, sT->tree);
 }
@@ -1078,9 +1272,9 @@ Caliper::end_with_value_check(const Attribute& attr, const Variant& data)
 
     // invoke callbacks
     if (run_events)
-        for (auto& channel : sG->channels)
-            if (channel && channel->is_active())
-                channel->mP->events.pre_end_evt(this, channel.get(), attr, current.entry.value());
+        for (Channel* channel : sG->event_dispatch.load(std::memory_order_acquire)->pre_end)
+            if (channel->is_active())
+                channel->mP->events.pre_end_evt(this, channel, attr, current.entry.value());
 
     handle_end(attr, prop, current.merged_entry, key, *blackboard, sT->tree);
 }
@@ -1101,9 +1295,9 @@ Caliper::set(const Attribute& attr, const Variant& data)
 
     // invoke callbacks
     if (run_events)
-        for (auto& channel : sG->channels)
-            if (channel && channel->is_active())
-                channel->mP->events.pre_set_evt(this, channel.get(), attr, data);
+        for (Channel* channel : sG->event_dispatch.load(std::memory_order_acquire)->pre_set)
+            if (channel->is_active())
+                channel->mP->events.pre_set_evt(this, channel, attr, data);
 
     if (scope == CALI_ATTR_SCOPE_THREAD)
         handle_set(attr, data, prop, sT->thread_blackboard, sT->tree);
@@ -1360,6 +1554,9 @@ Caliper::create_channel(const char* name, const RuntimeConfig& cfg)
 
     channel->mP->events.post_init_evt(this, channel);
 
+    // services may connect annotation callbacks in post_init
+    sG->update_event_dispatch();
+
     return channel;
 }
 
@@ -1397,7 +1594,10 @@ Caliper::delete_channel(Channel* chn)
     Log(1).stream() << "Releasing channel " << chn->name() << std::endl;
 
     chn->mP->events.finish_evt(this, chn);
-    sG->channels[chn->id()].reset();
+
+    // remove the channel from the dispatch lists before deleting it
+    std::unique_ptr<Channel> tmp(std::move(sG->channels[chn->id()]));
+    sG->update_event_dispatch();
 }
 
 void
@@ -1436,8 +1636,12 @@ Caliper::finalize()
         if (chnI) {
             Channel* channel = chnI.get();
 
-            if (channel->is_active() && channel->mP->flush_on_exit)
-                flush_and_write(channel, SnapshotView());
+            if (channel->is_active() && channel->mP->flush_on_exit) {
+                if (channel->mP->is_rolling())
+                    channel->mP->write_segment(this, channel);
+                else
+                    flush_and_write(channel, SnapshotView());
+            }
 
             delete_channel(channel);
         }
@@ -0,0 +1,330 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+// ChannelMetadataAccess implementation
+
+#include "ChannelMetadataAccess.h"
+
+#include "caliper/common/Node.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+using namespace cali;
+
+struct ChannelMetadataAccess::ChannelMetadataAccessImpl
+{
+    Caliper* m_c;
+    Channel* m_channel;
+
+    //   The overlay: nodes created by the query pipeline. m_nodes[i] has
+    // ID FirstOverlayId+i. Overlay trees hang off m_root; they never link
+    // into the runtime tree.
+    Node                               m_root;
+    std::vector<Node*>                 m_nodes;
+    std::vector<char*>                 m_strings;
+    Node*                              m_type_nodes[CALI_MAXTYPE+1] = { 0 };
+    std::map<std::string, Node*>       m_attributes;
+    mutable std::mutex                 m_lock;
+
+    std::map<std::string, std::string> m_attr_aliases;
+    std::map<std::string, std::string> m_attr_units;
+
+    Attribute                          m_alias_attr;
+    Attribute                          m_unit_attr;
+
+    static bool is_overlay_id(cali_id_t id) {
+        return id >= FirstOverlayId && id != CALI_INV_ID;
+    }
+
+    Node* overlay_node(cali_id_t id) const {
+        // NOTE: We assume that m_lock is locked!
+        cali_id_t i = id - FirstOverlayId;
+        return i < m_nodes.size() ? m_nodes[i] : nullptr;
+    }
+
+    Variant copy_data(const Variant& data) {
+        // NOTE: We assume that m_lock is locked!
+        if (data.type() != CALI_TYPE_STRING && data.type() != CALI_TYPE_USR)
+            return data;
+
+        char* ptr = new char[data.size() + 1];
+        std::memcpy(ptr, data.data(), data.size());
+        ptr[data.size()] = '\0';
+        m_strings.push_back(ptr);
+
+        return Variant(data.type(), ptr, data.size());
+    }
+
+    /// \brief Find or create the overlay child of \a parent with
+    ///   \a attr_id and \a data
+    Node* get_child(cali_id_t attr_id, const Variant& data, Node* parent) {
+        // NOTE: We assume that m_lock is locked!
+        Node* node = parent->first_child();
+
+        for ( ; node && !node->equals(attr_id, data); node = node->next_sibling())
+            ;
+
+        if (!node) {
+            node = new Node(FirstOverlayId + m_nodes.size(), attr_id, copy_data(data));
+            m_nodes.push_back(node);
+            parent->append(node);
+        }
+
+        return node;
+    }
+
+    /// \brief Return the overlay copy of the path to \a node
+    Node* overlay_path(const Node* node) {
+        // NOTE: We assume that m_lock is locked!
+        if (!node || node->id() == CALI_INV_ID)
+            return &m_root;
+        if (is_overlay_id(node->id()))
+            return const_cast<Node*>(node);
+
+        Node* parent = overlay_path(node->parent());
+        return get_child(node->attribute(), node->data(), parent);
+    }
+
+    Node* type_node(cali_attr_type type) {
+        // NOTE: We assume that m_lock is locked!
+        if (!m_type_nodes[type])
+            m_type_nodes[type] = get_child(Attribute::TYPE_ATTR_ID, Variant(type), &m_root);
+
+        return m_type_nodes[type];
+    }
+
+    Attribute find_attribute(const std::string& name) const {
+        // NOTE: We assume that m_lock is locked!
+        auto it = m_attributes.find(name);
+        return it == m_attributes.end() ? Attribute::invalid : Attribute::make_attribute(it->second);
+    }
+
+    Attribute create_attribute_locked(const std::string& name, cali_attr_type type, int prop,
+                                      int meta, const Attribute* meta_attr, const Variant* meta_data)
+    {
+        // NOTE: We assume that m_lock is locked!
+        Attribute attr = find_attribute(name);
+
+        if (attr != Attribute::invalid)
+            return attr;
+
+        //   Like CaliperMetadataDB, return an existing attribute: e.g., the
+        // count() kernel's result is the runtime's "count" attribute if the
+        // aggregate service created one
+        attr = m_c->get_attribute(name);
+
+        if (attr != Attribute::invalid)
+            return attr;
+        if (type < 0 || type > CALI_MAXTYPE)
+            return Attribute::invalid;
+
+        Node* parent = type_node(type);
+
+        for (int i = 0; i < meta; ++i)
+            parent = get_child(meta_attr[i].id(), meta_data[i], parent);
+
+        auto unit_it = m_attr_units.find(name);
+        if (unit_it != m_attr_units.end() && m_unit_attr != Attribute::invalid) {
+            Variant v_unit(CALI_TYPE_STRING, unit_it->second.data(), unit_it->second.size());
+            parent = get_child(m_unit_attr.id(), v_unit, parent);
+        }
+        auto alias_it = m_attr_aliases.find(name);
+        if (alias_it != m_attr_aliases.end() && m_alias_attr != Attribute::invalid) {
+            Variant v_alias(CALI_TYPE_STRING, alias_it->second.data(), alias_it->second.size());
+            parent = get_child(m_alias_attr.id(), v_alias, parent);
+        }
+
+        parent = get_child(Attribute::PROP_ATTR_ID, Variant(prop), parent);
+
+        Node* node = get_child(Attribute::NAME_ATTR_ID, Variant(CALI_TYPE_STRING, name.data(), name.size()), parent);
+
+        m_attributes.insert(std::make_pair(name, node));
+
+        return Attribute::make_attribute(node);
+    }
+
+    /// \brief Use the runtime's metadata attribute \a name if it has
+    ///   one, or create it in the overlay
+    Attribute get_meta_attribute(const char* name) {
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        return create_attribute_locked(name, CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS, 0, nullptr, nullptr);
+    }
+
+    Node* node(cali_id_t id) const {
+        if (!is_overlay_id(id))
+            return m_c->node(id);
+
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        return overlay_node(id);
+    }
+
+    Attribute get_attribute(cali_id_t id) const {
+        if (!is_overlay_id(id))
+            return m_c->get_attribute(id);
+
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        return Attribute::make_attribute(overlay_node(id));
+    }
+
+    Attribute get_attribute(const std::string& name) const {
+        {
+            std::lock_guard<std::mutex>
+                g(m_lock);
+
+            Attribute attr = find_attribute(name);
+
+            if (attr != Attribute::invalid)
+                return attr;
+        }
+
+        return m_c->get_attribute(name);
+    }
+
+    std::vector<Attribute> get_all_attributes() const {
+        std::vector<Attribute> ret = m_c->get_all_attributes();
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_lock);
+
+            // overlay attributes hide runtime attributes with the same name
+            ret.erase(std::remove_if(ret.begin(), ret.end(), [this](const Attribute& a){
+                        return m_attributes.count(a.name()) > 0;
+                    }), ret.end());
+
+            for (const auto &p : m_attributes)
+                ret.push_back(Attribute::make_attribute(p.second));
+        }
+
+        std::sort(ret.begin(), ret.end(), [](const Attribute& a, const Attribute& b){
+                return strcmp(a.name_c_str(), b.name_c_str()) < 0;
+            });
+
+        return ret;
+    }
+
+    Attribute create_attribute(const std::string& name, cali_attr_type type, int prop,
+                               int meta, const Attribute* meta_attr, const Variant* meta_data)
+    {
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        return create_attribute_locked(name, type, prop, meta, meta_attr, meta_data);
+    }
+
+    Node* make_tree_entry(std::size_t n, const Node* nodelist[], Node* parent) {
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        Node* node = nullptr;
+
+        if (n > 0)
+            parent = overlay_path(parent);
+
+        for (std::size_t i = 0; i < n; ++i)
+            node = parent = get_child(nodelist[i]->attribute(), nodelist[i]->data(), parent);
+
+        return node;
+    }
+
+    ChannelMetadataAccessImpl(Caliper* c, Channel* channel)
+        : m_c(c), m_channel(channel), m_root { CALI_INV_ID, CALI_INV_ID, { } }
+    {
+        m_alias_attr = get_meta_attribute("attribute.alias");
+        m_unit_attr  = get_meta_attribute("attribute.unit");
+    }
+
+    ~ChannelMetadataAccessImpl() {
+        for (Node* n : m_nodes)
+            delete n;
+        for (char* str : m_strings)
+            delete[] str;
+    }
+};
+
+constexpr cali_id_t ChannelMetadataAccess::FirstOverlayId;
+
+ChannelMetadataAccess::ChannelMetadataAccess(Caliper* c, Channel* channel)
+    : mP(new ChannelMetadataAccessImpl(c, channel))
+{ }
+
+ChannelMetadataAccess::~ChannelMetadataAccess()
+{
+    mP.reset();
+}
+
+Node*
+ChannelMetadataAccess::node(cali_id_t id) const
+{
+    return mP->node(id);
+}
+
+Attribute
+ChannelMetadataAccess::get_attribute(cali_id_t id) const
+{
+    return mP->get_attribute(id);
+}
+
+Attribute
+ChannelMetadataAccess::get_attribute(const std::string& name) const
+{
+    return mP->get_attribute(name);
+}
+
+std::vector<Attribute>
+ChannelMetadataAccess::get_all_attributes() const
+{
+    return mP->get_all_attributes();
+}
+
+Attribute
+ChannelMetadataAccess::create_attribute(const std::string& name,
+                                        cali_attr_type     type,
+                                        int                prop,
+                                        int                meta,
+                                        const Attribute*   meta_attr,
+                                        const Variant*     meta_data)
+{
+    return mP->create_attribute(name, type, prop, meta, meta_attr, meta_data);
+}
+
+Node*
+ChannelMetadataAccess::make_tree_entry(std::size_t n, const Node* nodelist[], Node* parent)
+{
+    return mP->make_tree_entry(n, nodelist, parent);
+}
+
+std::vector<Entry>
+ChannelMetadataAccess::get_globals()
+{
+    return mP->m_c->get_globals(mP->m_channel);
+}
+
+void
+ChannelMetadataAccess::add_attribute_aliases(const std::map<std::string, std::string>& aliases)
+{
+    std::lock_guard<std::mutex>
+        g(mP->m_lock);
+
+    for (const auto &p : aliases)
+        mP->m_attr_aliases[p.first] = p.second;
+}
+
+void
+ChannelMetadataAccess::add_attribute_units(const std::map<std::string, std::string>& units)
+{
+    std::lock_guard<std::mutex>
+        g(mP->m_lock);
+
+    for (const auto &p : units)
+        mP->m_attr_units[p.first] = p.second;
+}
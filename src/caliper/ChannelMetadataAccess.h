@@ -0,0 +1,77 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file ChannelMetadataAccess.h
+/// Runtime metadata access for in-process report pipelines
+///
+
+#pragma once
+
+#include "caliper/Caliper.h"
+
+#include "caliper/common/CaliperMetadataAccessInterface.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+namespace cali
+{
+
+/// \brief Lets query pipelines work directly on the Caliper runtime's
+///   metadata when flushing a channel in-process
+///
+/// Records from Caliper::flush() refer to the runtime's context tree.
+/// Running the Preprocessor, RecordSelector, Aggregator, and formatters
+/// against this view instead of merging each record into a
+/// CaliperMetadataDB first avoids copying the referenced nodes into a
+/// second tree.
+///
+/// The view never modifies the runtime. Attributes and nodes that the
+/// pipeline creates, e.g. LET and aggregation results, go into a small
+/// overlay owned by the view. Overlay node IDs start at FirstOverlayId,
+/// far above the runtime's IDs. As in CaliperMetadataDB, creating an
+/// attribute that already exists returns the existing one, and new
+/// attributes get the alias and unit metadata added with
+/// add_attribute_aliases() and add_attribute_units(). Records that
+/// reference overlay nodes can be merged into a CaliperMetadataDB with
+/// merge_snapshot(), e.g. for cross-process aggregation. The view must
+/// outlive any use of its records.
+class ChannelMetadataAccess : public CaliperMetadataAccessInterface
+{
+    struct ChannelMetadataAccessImpl;
+    std::unique_ptr<ChannelMetadataAccessImpl> mP;
+
+public:
+
+    static constexpr cali_id_t FirstOverlayId = cali_id_t(1) << 40;
+
+    ChannelMetadataAccess(Caliper* c, Channel* channel);
+
+    ~ChannelMetadataAccess();
+
+    Node* node(cali_id_t id) const override;
+
+    Attribute get_attribute(cali_id_t id) const override;
+    Attribute get_attribute(const std::string& name) const override;
+
+    std::vector<Attribute> get_all_attributes() const override;
+
+    Attribute create_attribute(const std::string& name,
+                               cali_attr_type     type,
+                               int                prop,
+                               int                meta,
+                               const Attribute*   meta_attr,
+                               const Variant*     meta_data) override;
+
+    Node* make_tree_entry(std::size_t n, const Node* nodelist[], Node* parent = nullptr) override;
+
+    std::vector<Entry> get_globals() override;
+
+    /// \brief Add attribute aliases for attributes created in the view
+    void add_attribute_aliases(const std::map<std::string, std::string>& aliases);
+    /// \brief Add attribute units for attributes created in the view
+    void add_attribute_units(const std::map<std::string, std::string>& units);
+};
+
+} // namespace cali
@@ -27,6 +27,8 @@ MetadataTree::GlobalData::GlobalData(MemoryPool& pool)
       root(CALI_INV_ID, CALI_INV_ID, Variant()),
       next_block(1),
       node_blocks(0),
+      child_index(nullptr),
+      child_index_mask(0),
       g_mempool(pool)
 {
     num_blocks  = config.get("num_blocks").to_uint();
@@ -34,6 +36,21 @@ MetadataTree::GlobalData::GlobalData(MemoryPool& pool)
 
     node_blocks = new NodeBlock[num_blocks];
 
+    size_t index_size = config.get("child_index_size").to_uint();
+
+    if (index_size > 0) {
+        // round up to power of 2
+        size_t n = 1;
+        while (n < index_size)
+            n *= 2;
+
+        child_index = new std::atomic<IndexEntry*>[n];
+        child_index_mask = n - 1;
+
+        for (size_t i = 0; i < n; ++i)
+            child_index[i].store(nullptr, std::memory_order_relaxed);
+    }
+
     Node* chunk = pool.aligned_alloc<Node>(nodes_per_block);
 
     static const struct NodeInfo {
@@ -66,6 +83,8 @@ MetadataTree::GlobalData::GlobalData(MemoryPool& pool)
         else
             root.append(node);
 
+        index_child(this, pool, node);
+
         if (info->attr_id == 9 /* type node */)
             type_nodes[info->data.to_attr_type()] = node;
     }
@@ -76,6 +95,7 @@ MetadataTree::GlobalData::GlobalData(MemoryPool& pool)
 
 MetadataTree::GlobalData::~GlobalData()
 {
+    delete[] child_index;
     delete[] node_blocks;
 }
 
@@ -140,6 +160,92 @@ bool MetadataTree::have_free_nodeblock(size_t n)
     return true;
 }
 
+//
+// --- Child index
+//
+
+size_t
+MetadataTree::hash_child(cali_id_t parent, cali_id_t attr, const Variant& value)
+{
+    uint64_t h = parent * 0x9e3779b97f4a7c15ull;
+    h ^= attr + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+
+    // hash the value bytes: for non-string types, the unused bytes of the
+    // variant's value union may be uninitialized
+    const unsigned char* p = static_cast<const unsigned char*>(value.data());
+
+    for (size_t i = 0, n = value.size(); i < n; ++i)
+        h = (h ^ p[i]) * 0x100000001b3ull;
+
+    h ^= static_cast<uint64_t>(value.type()) << 56;
+
+    return static_cast<size_t>(h ^ (h >> 29));
+}
+
+void
+MetadataTree::index_child(GlobalData* g, MemoryPool& pool, Node* node)
+{
+    if (!g->child_index)
+        return;
+
+    IndexEntry* e = pool.aligned_alloc<IndexEntry>();
+
+    if (!e)
+        return;
+
+    Node* parent = node->parent();
+    size_t h = hash_child(parent ? parent->id() : CALI_INV_ID, node->attribute(), node->data());
+    std::atomic<IndexEntry*>& head = g->child_index[h & g->child_index_mask];
+
+    e->node = node;
+    e->next = head.load(std::memory_order_relaxed);
+
+    while (!head.compare_exchange_weak(e->next, e,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed))
+        ;
+}
+
+Node*
+MetadataTree::find_child(Node* parent, cali_id_t attr, const Variant& value) const
+{
+    //   Narrow nodes are searched linearly. Once a node has more than
+    // a few children, look the child up in the hash index.
+
+    const int max_linear = 8;
+
+    Node* node = parent->first_child();
+
+    for (int i = 0; node && i < max_linear; node = node->next_sibling(), ++i)
+        if (node->equals(attr, value))
+            return node;
+
+    if (!node)
+        return nullptr;
+
+    GlobalData* g = mG.load();
+
+    if (g->child_index) {
+        size_t h = hash_child(parent->id(), attr, value);
+
+        for (IndexEntry* e = g->child_index[h & g->child_index_mask].load(std::memory_order_acquire); e; e = e->next)
+            if (e->node->parent() == parent && e->node->equals(attr, value))
+                return e->node;
+
+        //   Nodes are appended to the tree before they are indexed, so
+        // the index may miss a node that was just added by another
+        // thread. That's fine: we may create a duplicate node then, as
+        // we may without the index.
+        return nullptr;
+    }
+
+    for ( ; node; node = node->next_sibling())
+        if (node->equals(attr, value))
+            return node;
+
+    return nullptr;
+}
+
 //
 // --- Modifying tree operations
 //
@@ -193,8 +299,10 @@ MetadataTree::create_path(const Attribute& attr, size_t n, const Variant* data,
         node = new(m_nodeblock->chunk + index)
             Node((m_nodeblock - g->node_blocks) * g->nodes_per_block + index, attr.id(), Variant(type, dptr, size));
 
-        if (parent)
+        if (parent) {
             parent->append(node);
+            index_child(g, m_mempool, node);
+        }
 
         parent = node;
     }
@@ -223,8 +331,10 @@ MetadataTree::create_child(const Attribute& attr, const Variant& value, Node* pa
     Node* node = new(m_nodeblock->chunk + index)
         Node((m_nodeblock - g->node_blocks) * g->nodes_per_block + index, attr.id(), value.copy(ptr));
 
-    if (parent)
+    if (parent) {
         parent->append(node);
+        index_child(g, m_mempool, node);
+    }
 
     ++m_num_nodes;
 
@@ -239,9 +349,7 @@ MetadataTree::get_path(const Attribute& attr, size_t n, const Variant* data, Nod
 
     for (size_t i = 0; i < n; ++i) {
         parent = node;
-
-        for (node = parent->first_child(); node && !node->equals(attr.id(), data[i]); node = node->next_sibling())
-            ;
+        node   = find_child(parent, attr.id(), data[i]);
 
         if (!node)
             break;
@@ -276,8 +384,7 @@ MetadataTree::get_or_copy_node(const Node* from, Node* parent)
 
     Node* node = nullptr;
 
-    for ( node = parent->first_child(); node && !node->equals(from->attribute(), from->data()); node = node->next_sibling())
-        ;
+    node = find_child(parent, from->attribute(), from->data());
 
     if (!node) {
         if (!have_free_nodeblock(1))
@@ -289,6 +396,7 @@ MetadataTree::get_or_copy_node(const Node* from, Node* parent)
             Node((m_nodeblock - g->node_blocks) * g->nodes_per_block + index, from->attribute(), from->data());
 
         parent->append(node);
+        index_child(g, m_mempool, node);
 
         ++m_num_nodes;
     }
@@ -355,13 +463,9 @@ MetadataTree::get_child(const Attribute& attr, const Variant& val, Node* parent)
     if (!parent)
         parent = root();
 
-    cali_id_t attr_id = attr.id();
+    Node* node = find_child(parent, attr.id(), val);
 
-    for (Node* node = parent->first_child(); node; node = node->next_sibling())
-        if (node->equals(attr_id, val))
-            return node;
-
-    return create_child(attr, val, parent);
+    return node ? node : create_child(attr, val, parent);
 }
 
 void MetadataTree::release()
@@ -396,5 +500,11 @@ const ConfigSet::Entry MetadataTree::GlobalData::s_configdata[] = {
       "Maximum number of context tree node blocks",
       "Maximum number of context tree node blocks"
     },
+    { "child_index_size", CALI_TYPE_UINT, "65536",
+      "Number of buckets in the context tree child index",
+      "Number of buckets in the context tree child index. "
+      "The index speeds up child lookups for nodes with many children. "
+      "Set to 0 to disable the index."
+    },
     ConfigSet::Terminator
 };
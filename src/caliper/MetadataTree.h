@@ -26,6 +26,14 @@ class MetadataTree
         size_t index;
     };
 
+    //   Entry in the (parent, attribute, value) -> child hash index.
+    // Entries are only ever added, with a CAS on the bucket head, so
+    // the index is lock-free just like the tree itself.
+    struct IndexEntry {
+        Node*       node;
+        IndexEntry* next;
+    };
+
     struct GlobalData {
         static const ConfigSet::Entry s_configdata[];
 
@@ -40,6 +48,9 @@ class MetadataTree
 
         Node*                   type_nodes[CALI_MAXTYPE+1];
 
+        std::atomic<IndexEntry*>* child_index;
+        size_t                  child_index_mask;
+
         //   Shared copy of the initial thread's mempool.
         // Used to merge in the pools of deleted threads.
         MemoryPool              g_mempool;
@@ -59,6 +70,11 @@ class MetadataTree
 
     bool  have_free_nodeblock(size_t n);
 
+    static size_t hash_child(cali_id_t parent, cali_id_t attr, const Variant& value);
+    static void   index_child(GlobalData* g, MemoryPool& pool, Node* node);
+
+    Node* find_child(Node* parent, cali_id_t attr, const Variant& value) const;
+
     Node* create_path(const Attribute& attr, size_t n, const Variant data[], Node* parent);
     Node* create_child(const Attribute& attr, const Variant& value, Node* parent);
     Node* get_or_copy_node(const Node* from, Node* parent = nullptr);
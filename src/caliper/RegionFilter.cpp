@@ -7,8 +7,15 @@
 
 #include "../common/util/parse_util.h"
 
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
 #include <iostream>
+#include <map>
+#include <regex>
 #include <sstream>
+#include <vector>
 
 using namespace cali;
 
@@ -56,6 +63,913 @@ public:
     }
 };
 
+
+/// \brief A trie over the match() and startswith() patterns
+///
+/// The trie is stored as a flat array of nodes with sorted outgoing
+/// edges. A lookup walks the region name once: it succeeds as soon as
+/// it reaches a startswith() pattern end, or at the end of the name if
+/// a match() pattern ends there.
+class LiteralTrie
+{
+    struct TrieNode {
+        uint32_t first_edge;
+        uint32_t num_edges;
+        bool     is_match;
+        bool     is_prefix;
+    };
+
+    struct Edge {
+        unsigned char c;
+        uint32_t      next;
+    };
+
+    std::vector<TrieNode> m_nodes;
+    std::vector<Edge>     m_edges;
+
+public:
+
+    LiteralTrie()
+        { }
+
+    LiteralTrie(const std::vector<std::string>& match, const std::vector<std::string>& startswith) {
+        struct BuildNode {
+            std::map<unsigned char, uint32_t> children;
+            bool is_match  = false;
+            bool is_prefix = false;
+        };
+
+        std::vector<BuildNode> tmp(1);
+
+        auto insert = [&tmp](const std::string& word) -> BuildNode& {
+                uint32_t n = 0;
+
+                for (char c : word) {
+                    auto it = tmp[n].children.find(static_cast<unsigned char>(c));
+
+                    if (it == tmp[n].children.end()) {
+                        uint32_t next = static_cast<uint32_t>(tmp.size());
+                        tmp[n].children.emplace(static_cast<unsigned char>(c), next);
+                        tmp.emplace_back();
+                        n = next;
+                    } else {
+                        n = it->second;
+                    }
+                }
+
+                return tmp[n];
+            };
+
+        for (const auto &w : match)
+            insert(w).is_match = true;
+        for (const auto &w : startswith)
+            insert(w).is_prefix = true;
+
+        m_nodes.reserve(tmp.size());
+
+        for (const BuildNode& b : tmp) {
+            TrieNode n { static_cast<uint32_t>(m_edges.size()), static_cast<uint32_t>(b.children.size()), b.is_match, b.is_prefix };
+
+            for (const auto &p : b.children)
+                m_edges.push_back(Edge { p.first, p.second });
+
+            m_nodes.push_back(n);
+        }
+    }
+
+    bool empty() const {
+        return m_nodes.empty();
+    }
+
+    bool match(const char* str, size_t len) const {
+        uint32_t n = 0;
+
+        for (size_t i = 0; i < len; ++i) {
+            const TrieNode& node = m_nodes[n];
+
+            if (node.is_prefix)
+                return true;
+
+            const Edge* begin = m_edges.data() + node.first_edge;
+            const Edge* end   = begin + node.num_edges;
+            unsigned char c   = static_cast<unsigned char>(str[i]);
+
+            const Edge* e =
+                std::lower_bound(begin, end, c, [](const Edge& e, unsigned char c){ return e.c < c; });
+
+            if (e == end || e->c != c)
+                return false;
+
+            n = e->next;
+        }
+
+        return m_nodes[n].is_match || m_nodes[n].is_prefix;
+    }
+};
+
+typedef std::bitset<256> CharSet;
+
+/// \brief Parse tree for the regular expression subset the DFA supports
+struct RegexNode {
+    enum Op { Set, Empty, Cat, Alt, Star, Plus, Quest } op;
+    int              set;  ///< CharSet index for Set nodes
+    std::vector<int> kids; ///< RegexNode indices
+};
+
+/// \brief Parses an ECMAScript regular expression into a RegexNode tree
+///
+/// Supports literals, escapes, ".", bracket expressions, groups,
+/// alternation and the *, +, ?, and {m,n} quantifiers. Everything
+/// else (back-references, assertions, lookahead, non-ASCII input, ...)
+/// makes parse() return false; those patterns are left to std::regex.
+/// The parser relies on the pattern having been validated by std::regex
+/// before.
+class RegexParser
+{
+    std::string m_pattern;
+    size_t      m_pos;
+    int         m_depth;
+    bool        m_ok;
+
+    std::vector<RegexNode>& m_nodes;
+    std::vector<CharSet>&   m_sets;
+
+    static const size_t MaxNodes = 20000;
+
+    int add(RegexNode::Op op, int set = -1, std::vector<int> kids = std::vector<int>()) {
+        if (m_nodes.size() >= MaxNodes) {
+            m_ok = false;
+            return 0;
+        }
+
+        m_nodes.push_back(RegexNode { op, set, std::move(kids) });
+        return static_cast<int>(m_nodes.size() - 1);
+    }
+
+    int add_set(const CharSet& set) {
+        m_sets.push_back(set);
+        return add(RegexNode::Set, static_cast<int>(m_sets.size() - 1));
+    }
+
+    bool at_end() const {
+        return m_pos >= m_pattern.size();
+    }
+
+    char peek() const {
+        return m_pattern[m_pos];
+    }
+
+    static CharSet class_set(char c) {
+        CharSet set;
+
+        switch (c) {
+        case 'd': case 'D':
+            for (int i = '0'; i <= '9'; ++i)
+                set.set(i);
+            break;
+        case 'w': case 'W':
+            for (int i = '0'; i <= '9'; ++i)
+                set.set(i);
+            for (int i = 'a'; i <= 'z'; ++i)
+                set.set(i);
+            for (int i = 'A'; i <= 'Z'; ++i)
+                set.set(i);
+            set.set('_');
+            break;
+        case 's': case 'S':
+            for (char s : std::string(" \t\n\v\f\r"))
+                set.set(static_cast<unsigned char>(s));
+            break;
+        }
+
+        if (c == 'D' || c == 'W' || c == 'S')
+            set.flip();
+
+        return set;
+    }
+
+    static int hexval(char c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    /// \brief Parse the escape sequence after a '\'. Returns the set of
+    ///   matching characters.
+    CharSet parse_escape() {
+        CharSet set;
+
+        if (at_end()) {
+            m_ok = false;
+            return set;
+        }
+
+        char c = m_pattern[m_pos++];
+
+        switch (c) {
+        case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+            return class_set(c);
+        case 't':
+            set.set('\t');
+            break;
+        case 'n':
+            set.set('\n');
+            break;
+        case 'r':
+            set.set('\r');
+            break;
+        case 'f':
+            set.set('\f');
+            break;
+        case 'v':
+            set.set('\v');
+            break;
+        case '0':
+            set.set(0);
+            break;
+        case 'x':
+        {
+            int hi = m_pos + 1 < m_pattern.size() ? hexval(m_pattern[m_pos])   : -1;
+            int lo = m_pos + 1 < m_pattern.size() ? hexval(m_pattern[m_pos+1]) : -1;
+
+            if (hi < 0 || lo < 0 || hi > 7)
+                m_ok = false;
+            else
+                set.set(16*hi + lo);
+
+            m_pos += 2;
+        }
+            break;
+        default:
+            // escaped punctuation is a literal; escaped letters and digits
+            // we don't know (\b, \B, \1, \c, \u, ...) are not supported
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+                m_ok = false;
+            else
+                set.set(static_cast<unsigned char>(c));
+        }
+
+        return set;
+    }
+
+    int parse_bracket() {
+        CharSet set;
+        bool negate = false;
+
+        if (!at_end() && peek() == '^') {
+            negate = true;
+            ++m_pos;
+        }
+
+        //   "[]" and "[^]" are special in ECMAScript; leave them to
+        // std::regex
+        if (!at_end() && peek() == ']')
+            m_ok = false;
+
+        while (m_ok && !at_end() && peek() != ']') {
+            //   Read a class atom. Multi-character escapes (\d etc.)
+            // can't be range endpoints.
+            int lo = -1;
+            char c = m_pattern[m_pos++];
+
+            if (c == '\\') {
+                if (!at_end() && peek() == 'b') {
+                    ++m_pos;
+                    lo = '\b';
+                } else {
+                    CharSet esc = parse_escape();
+
+                    if (esc.count() == 1) {
+                        for (int i = 0; i < 256; ++i)
+                            if (esc.test(i))
+                                lo = i;
+                    } else {
+                        set |= esc;
+
+                        if (m_pos + 1 < m_pattern.size() && peek() == '-' && m_pattern[m_pos+1] != ']')
+                            m_ok = false;
+
+                        continue;
+                    }
+                }
+            } else if (c == '[' && !at_end() && (peek() == ':' || peek() == '=' || peek() == '.')) {
+                m_ok = false; // POSIX classes
+                break;
+            } else {
+                lo = static_cast<unsigned char>(c);
+            }
+
+            if (m_pos + 1 < m_pattern.size() && peek() == '-' && m_pattern[m_pos+1] != ']') {
+                ++m_pos;
+                int hi = -1;
+                c = m_pattern[m_pos++];
+
+                if (c == '\\') {
+                    CharSet esc = parse_escape();
+
+                    if (esc.count() != 1) {
+                        m_ok = false;
+                        break;
+                    }
+
+                    for (int i = 0; i < 256; ++i)
+                        if (esc.test(i))
+                            hi = i;
+                } else {
+                    hi = static_cast<unsigned char>(c);
+                }
+
+                if (hi < lo) {
+                    m_ok = false;
+                    break;
+                }
+
+                for (int i = lo; i <= hi; ++i)
+                    set.set(i);
+            } else {
+                set.set(lo);
+            }
+        }
+
+        if (at_end()) {
+            m_ok = false;
+            return 0;
+        }
+
+        ++m_pos; // ']'
+
+        if (negate)
+            set.flip();
+
+        return add_set(set);
+    }
+
+    int parse_atom() {
+        char c = m_pattern[m_pos++];
+
+        switch (c) {
+        case '(':
+        {
+            if (!at_end() && peek() == '?') {
+                if (m_pos + 1 < m_pattern.size() && m_pattern[m_pos+1] == ':') {
+                    m_pos += 2;
+                } else {
+                    m_ok = false; // lookahead
+                    return 0;
+                }
+            }
+
+            ++m_depth;
+            int n = parse_alt();
+            --m_depth;
+
+            if (at_end() || peek() != ')') {
+                m_ok = false;
+                return 0;
+            }
+
+            ++m_pos;
+            return n;
+        }
+        case '[':
+            return parse_bracket();
+        case '.':
+        {
+            CharSet set;
+            set.set();
+            set.reset('\n');
+            set.reset('\r');
+            return add_set(set);
+        }
+        case '\\':
+            return add_set(parse_escape());
+        case '^':
+            // regex_match() always matches the entire string, so
+            // anchors are no-ops where they can only match at the ends
+            if (m_pos != 1)
+                m_ok = false;
+            return add(RegexNode::Empty);
+        case '$':
+            if (m_pos != m_pattern.size() || m_depth > 0)
+                m_ok = false;
+            return add(RegexNode::Empty);
+        case '*': case '+': case '?': case '{': case ')':
+            m_ok = false;
+            return 0;
+        default:
+        {
+            CharSet set;
+            set.set(static_cast<unsigned char>(c));
+            return add_set(set);
+        }
+        }
+    }
+
+    bool parse_count(unsigned* val) {
+        size_t start = m_pos;
+        *val = 0;
+
+        while (!at_end() && peek() >= '0' && peek() <= '9' && *val < 10000)
+            *val = 10 * (*val) + (m_pattern[m_pos++] - '0');
+
+        return m_pos > start && *val < 10000;
+    }
+
+    int parse_repeat() {
+        int n = parse_atom();
+
+        while (m_ok && !at_end()) {
+            char c = peek();
+
+            if (c == '*') {
+                ++m_pos;
+                n = add(RegexNode::Star, -1, { n });
+            } else if (c == '+') {
+                ++m_pos;
+                n = add(RegexNode::Plus, -1, { n });
+            } else if (c == '?') {
+                ++m_pos;
+                n = add(RegexNode::Quest, -1, { n });
+            } else if (c == '{') {
+                ++m_pos;
+
+                unsigned lo = 0, hi = 0;
+                bool unbounded = false;
+
+                if (!parse_count(&lo)) {
+                    m_ok = false;
+                    break;
+                }
+
+                hi = lo;
+
+                if (!at_end() && peek() == ',') {
+                    ++m_pos;
+
+                    if (!at_end() && peek() == '}')
+                        unbounded = true;
+                    else if (!parse_count(&hi) || hi < lo) {
+                        m_ok = false;
+                        break;
+                    }
+                }
+
+                if (at_end() || peek() != '}') {
+                    m_ok = false;
+                    break;
+                }
+
+                ++m_pos;
+
+                //   Expand the counted repetition: lo copies of the atom,
+                // then either a star or (hi - lo) optional copies.
+                // Children may be shared since the tree is immutable.
+                std::vector<int> kids(lo, n);
+
+                if (unbounded)
+                    kids.push_back(add(RegexNode::Star, -1, { n }));
+                else
+                    for (unsigned i = lo; i < hi; ++i)
+                        kids.push_back(add(RegexNode::Quest, -1, { n }));
+
+                n = add(RegexNode::Cat, -1, std::move(kids));
+            } else {
+                break;
+            }
+
+            // lazy quantifiers accept the same strings
+            if (!at_end() && peek() == '?' && m_nodes[n].op != RegexNode::Set)
+                ++m_pos;
+        }
+
+        return n;
+    }
+
+    int parse_cat() {
+        std::vector<int> kids;
+
+        while (m_ok && !at_end() && peek() != '|' && peek() != ')')
+            kids.push_back(parse_repeat());
+
+        return add(RegexNode::Cat, -1, std::move(kids));
+    }
+
+    int parse_alt() {
+        std::vector<int> kids { parse_cat() };
+
+        while (m_ok && !at_end() && peek() == '|') {
+            ++m_pos;
+            kids.push_back(parse_cat());
+        }
+
+        return kids.size() == 1 ? kids.front() : add(RegexNode::Alt, -1, std::move(kids));
+    }
+
+public:
+
+    RegexParser(const std::string& pattern, std::vector<RegexNode>& nodes, std::vector<CharSet>& sets)
+        : m_pattern { pattern },
+          m_pos     { 0 },
+          m_depth   { 0 },
+          m_ok      { true },
+          m_nodes   { nodes },
+          m_sets    { sets }
+        { }
+
+    /// \brief Parse the pattern. Returns the root node index, or -1 if
+    ///   the pattern uses unsupported features.
+    int parse() {
+        for (char c : m_pattern)
+            if (static_cast<unsigned char>(c) >= 0x80)
+                return -1;
+
+        int n = parse_alt();
+
+        return (m_ok && at_end()) ? n : -1;
+    }
+};
+
+/// \brief A DFA for a set of regular expressions
+///
+/// The patterns are combined into a single Thompson NFA, which is
+/// converted into a DFA with the subset construction when the filter is
+/// created. Input bytes are mapped to equivalence classes first to keep
+/// the transition table small. Matching is a single table lookup per
+/// input byte.
+class RegexDFA
+{
+    struct NfaState {
+        enum Type { Char, Split, Match } type;
+        int set;
+        int out;
+        int out1;
+    };
+
+    std::vector<int>  m_table;     ///< [state * num_classes + class] -> state, -1 = reject
+    std::vector<bool> m_accept;
+    unsigned char     m_class[256];
+    int               m_num_classes;
+
+    static const size_t MaxNfaStates = 20000;
+    static const size_t MaxDfaStates = 4096;
+
+    // --- NFA construction
+
+    struct Nfa {
+        std::vector<NfaState>   states;
+        const std::vector<RegexNode>& nodes;
+        bool ok;
+
+        explicit Nfa(const std::vector<RegexNode>& n)
+            : nodes(n), ok(true)
+            { }
+
+        int add(NfaState::Type type, int set) {
+            if (states.size() >= MaxNfaStates)
+                ok = false;
+
+            states.push_back(NfaState { type, set, -1, -1 });
+            return static_cast<int>(states.size() - 1);
+        }
+
+        //   Dangling outs are tracked as state index times two, plus one
+        // for out1, since pointers into the state vector would be
+        // invalidated when it grows.
+        void patch(const std::vector<int>& dangling, int target) {
+            for (int d : dangling)
+                if (d & 1)
+                    states[d >> 1].out1 = target;
+                else
+                    states[d >> 1].out  = target;
+        }
+
+        /// \brief Compile node \a n. Returns start state; appends the
+        ///   dangling outs to \a out. A start of -1 means the empty string.
+        int compile(int n, std::vector<int>& out) {
+            if (!ok)
+                return -1;
+
+            const RegexNode& node = nodes[n];
+
+            switch (node.op) {
+            case RegexNode::Set:
+            {
+                int s = add(NfaState::Char, node.set);
+                out.push_back(2*s);
+                return s;
+            }
+            case RegexNode::Empty:
+                return split_empty(out);
+            case RegexNode::Cat:
+            {
+                if (node.kids.empty())
+                    return split_empty(out);
+
+                std::vector<int> d;
+                int start = compile(node.kids.front(), d);
+
+                for (size_t i = 1; ok && i < node.kids.size(); ++i) {
+                    std::vector<int> d2;
+                    int s = compile(node.kids[i], d2);
+                    patch(d, s);
+                    d.swap(d2);
+                }
+
+                out.insert(out.end(), d.begin(), d.end());
+                return start;
+            }
+            case RegexNode::Alt:
+            {
+                int start = compile(node.kids.front(), out);
+
+                for (size_t i = 1; ok && i < node.kids.size(); ++i) {
+                    int s = add(NfaState::Split, -1);
+                    int k = compile(node.kids[i], out);
+                    states[s].out  = start;
+                    states[s].out1 = k;
+                    start = s;
+                }
+
+                return start;
+            }
+            case RegexNode::Star:
+            case RegexNode::Quest:
+            case RegexNode::Plus:
+            {
+                int s = add(NfaState::Split, -1);
+                std::vector<int> d;
+                int k = compile(node.kids.front(), d);
+                states[s].out = k;
+
+                if (node.op == RegexNode::Quest) {
+                    out.insert(out.end(), d.begin(), d.end());
+                    out.push_back(2*s+1);
+                    return s;
+                }
+
+                patch(d, s);
+                out.push_back(2*s+1);
+
+                return node.op == RegexNode::Star ? s : states[s].out;
+            }
+            }
+
+            return -1;
+        }
+
+        int split_empty(std::vector<int>& out) {
+            //   A split state with both outs dangling works as an
+            // epsilon state for the empty string
+            int s = add(NfaState::Split, -1);
+            out.push_back(2*s);
+            out.push_back(2*s+1);
+            return s;
+        }
+
+        /// \brief Add the non-split states reachable from \a s to \a set
+        void closure(int s, std::vector<int>& set, std::vector<bool>& seen) const {
+            std::vector<int> stack { s };
+
+            while (!stack.empty()) {
+                s = stack.back();
+                stack.pop_back();
+
+                if (s < 0 || seen[s])
+                    continue;
+
+                seen[s] = true;
+
+                if (states[s].type == NfaState::Split) {
+                    stack.push_back(states[s].out1);
+                    stack.push_back(states[s].out);
+                } else {
+                    set.push_back(s);
+                }
+            }
+        }
+    };
+
+public:
+
+    RegexDFA()
+        : m_num_classes { 0 }
+        { }
+
+    bool empty() const {
+        return m_accept.empty();
+    }
+
+    /// \brief Build the DFA for \a patterns. Patterns the DFA doesn't
+    ///   support are returned in \a rejected.
+    void compile(const std::vector<std::string>& patterns, std::vector<std::string>& rejected) {
+        std::vector<RegexNode> nodes;
+        std::vector<CharSet>   sets;
+        std::vector<int>       roots;
+
+        for (const std::string& p : patterns) {
+            size_t num_nodes = nodes.size();
+            size_t num_sets  = sets.size();
+
+            int root = RegexParser(p, nodes, sets).parse();
+
+            if (root < 0) {
+                nodes.resize(num_nodes);
+                sets.resize(num_sets);
+                rejected.push_back(p);
+            } else {
+                roots.push_back(root);
+            }
+        }
+
+        if (roots.empty())
+            return;
+
+        nodes.push_back(RegexNode { RegexNode::Alt, -1, roots });
+
+        Nfa nfa(nodes);
+        std::vector<int> dangling;
+        int start = nfa.compile(static_cast<int>(nodes.size() - 1), dangling);
+        nfa.patch(dangling, nfa.add(NfaState::Match, -1));
+
+        if (!nfa.ok) {
+            rejected.insert(rejected.end(), patterns.begin(), patterns.end());
+            return;
+        }
+
+        // --- Compute the byte equivalence classes
+
+        {
+            std::vector<int> cls(256, 0);
+            int num_classes = 1;
+
+            for (const CharSet& set : sets) {
+                std::map<std::pair<int,bool>, int> refined;
+
+                for (int c = 0; c < 256; ++c) {
+                    auto it = refined.emplace(std::make_pair(cls[c], set.test(c)), static_cast<int>(refined.size())).first;
+                    cls[c] = it->second;
+                }
+
+                num_classes = static_cast<int>(refined.size());
+            }
+
+            for (int c = 0; c < 256; ++c)
+                m_class[c] = static_cast<unsigned char>(cls[c]);
+
+            m_num_classes = num_classes;
+        }
+
+        std::vector<int> rep(m_num_classes);
+
+        for (int c = 255; c >= 0; --c)
+            rep[m_class[c]] = c;
+
+        // --- Subset construction
+
+        std::map<std::vector<int>, int> dstates;
+        std::vector< std::vector<int> > worklist;
+
+        auto get_state = [&](std::vector<int>& set) -> int {
+                std::sort(set.begin(), set.end());
+                auto ret = dstates.emplace(set, static_cast<int>(worklist.size()));
+
+                if (ret.second) {
+                    worklist.push_back(set);
+
+                    bool accept = false;
+                    for (int s : set)
+                        if (nfa.states[s].type == NfaState::Match)
+                            accept = true;
+
+                    m_accept.push_back(accept);
+                    m_table.resize(m_table.size() + m_num_classes, -1);
+                }
+
+                return ret.first->second;
+            };
+
+        {
+            std::vector<int>  set;
+            std::vector<bool> seen(nfa.states.size(), false);
+            nfa.closure(start, set, seen);
+            get_state(set);
+        }
+
+        for (size_t d = 0; d < worklist.size(); ++d) {
+            if (worklist.size() > MaxDfaStates) {
+                m_table.clear();
+                m_accept.clear();
+                rejected.insert(rejected.end(), patterns.begin(), patterns.end());
+                return;
+            }
+
+            for (int c = 0; c < m_num_classes; ++c) {
+                std::vector<int>  set;
+                std::vector<bool> seen(nfa.states.size(), false);
+
+                for (int s : worklist[d]) {
+                    const NfaState& st = nfa.states[s];
+
+                    if (st.type == NfaState::Char && sets[st.set].test(rep[c]))
+                        nfa.closure(st.out, set, seen);
+                }
+
+                if (!set.empty()) {
+                    int next = get_state(set);
+                    m_table[d * m_num_classes + c] = next;
+                }
+            }
+        }
+    }
+
+    bool match(const char* str, size_t len) const {
+        int s = 0;
+
+        for (size_t i = 0; i < len; ++i) {
+            s = m_table[s * m_num_classes + m_class[static_cast<unsigned char>(str[i])]];
+
+            if (s < 0)
+                return false;
+        }
+
+        return m_accept[s];
+    }
+};
+
+} // namespace [anonymous]
+
+struct RegionFilter::Filter {
+    std::vector< std::string > startswith;
+    std::vector< std::string > match;
+    std::vector< std::string > regex_patterns;
+
+    LiteralTrie                trie;
+    RegexDFA                   dfa;
+    std::vector< std::regex  > regex;   ///< patterns the DFA doesn't support
+
+    void compile() {
+        if (!(match.empty() && startswith.empty()))
+            trie = LiteralTrie(match, startswith);
+
+        std::vector<std::string> rejected;
+        dfa.compile(regex_patterns, rejected);
+
+        for (const auto &s : rejected)
+            regex.push_back(std::regex(s));
+    }
+};
+
+/// \brief Direct-mapped verdict cache for pass_node_value()
+///
+/// Each slot holds the key (the node value's address) shifted left by
+/// one with the verdict in the low bit, so slots can be read and
+/// written atomically without locks. User-space addresses never use the
+/// highest bit.
+struct RegionFilter::VerdictCache {
+    static const size_t Size = 1024;
+
+    std::atomic<uint64_t> slots[Size];
+
+    VerdictCache() {
+        for (size_t i = 0; i < Size; ++i)
+            slots[i].store(0, std::memory_order_relaxed);
+    }
+
+    static size_t index(uint64_t key) {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 54) & (Size - 1);
+    }
+};
+
+RegionFilter::RegionFilter(std::shared_ptr<Filter> iflt, std::shared_ptr<Filter> eflt)
+    : m_include_filters { iflt },
+      m_exclude_filters { eflt }
+{
+    if (has_filters())
+        m_cache = std::make_shared<VerdictCache>();
+}
+
+bool
+RegionFilter::pass_node_value(const Variant& val) const
+{
+    uint64_t key = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(val.data()));
+
+    if (!m_cache || key == 0)
+        return pass(val);
+
+    std::atomic<uint64_t>& slot = m_cache->slots[VerdictCache::index(key)];
+    uint64_t e = slot.load(std::memory_order_relaxed);
+
+    if ((e >> 1) == key)
+        return (e & 1) != 0;
+
+    bool ret = pass(val);
+    slot.store((key << 1) | (ret ? 1 : 0), std::memory_order_relaxed);
+
+    return ret;
 }
 
 std::pair<std::shared_ptr<RegionFilter::Filter>, std::string>
@@ -94,8 +1008,12 @@ RegionFilter::parse_filter_config(std::istream& is)
             auto args = argparse.parse(is);
             if (!argparse.error()) {
                 try {
-                    for (const auto &s : args)
-                        ret.regex.push_back(std::regex(s));
+                    // check the syntax with std::regex, even if we end up
+                    // matching with the DFA
+                    for (const auto &s : args) {
+                        std::regex check(s);
+                        ret.regex_patterns.push_back(s);
+                    }
                 } catch (const std::regex_error& e) {
                     error = true;
                     error_msg = e.what();
@@ -115,8 +1033,10 @@ RegionFilter::parse_filter_config(std::istream& is)
         is.unget();
 
     std::shared_ptr<Filter> retp;
-    if (!error && !(ret.match.empty() && ret.startswith.empty() && ret.regex.empty()))
+    if (!error && !(ret.match.empty() && ret.startswith.empty() && ret.regex_patterns.empty())) {
+        ret.compile();
         retp = std::make_shared<Filter>(std::move(ret));
+    }
 
     return std::make_pair(retp, error_msg);
 }
@@ -125,19 +1045,16 @@ bool
 RegionFilter::match(const Variant& val, const Filter& filter)
 {
     //   We assume val is a string. Variant strings aren't
-    // 0-terminated, hence the more complicated comparisons
+    // 0-terminated, hence the explicit length
     const char* strp = static_cast<const char*>(val.data());
 
-    for (const auto &w : filter.startswith)
-        if (val.size() >= w.size() && w.compare(0, w.size(), strp, w.size()) == 0)
-            return true;
-
-    for (const auto &w : filter.match)
-        if (val.size() == w.size() && w.compare(0, w.size(), strp, w.size()) == 0)
-            return true;
+    if (!filter.trie.empty() && filter.trie.match(strp, val.size()))
+        return true;
+    if (!filter.dfa.empty() && filter.dfa.match(strp, val.size()))
+        return true;
 
     for (const auto &r : filter.regex)
-        if (std::regex_match(std::string(strp, val.size()), r) == true)
+        if (std::regex_match(strp, strp + val.size(), r) == true)
             return true;
 
     return false;
@@ -7,9 +7,7 @@
 
 #include <iostream>
 #include <memory>
-#include <regex>
 #include <string>
-#include <vector>
 
 namespace cali
 {
@@ -17,25 +15,29 @@ namespace cali
 class Variant;
 
 /// \brief Implements region (string) filtering
+///
+/// The filter patterns are compiled when the filter is created: the
+/// \c match and \c startswith patterns go into a single trie, and the
+/// \c regex patterns into a single DFA. Matching a region name is
+/// therefore linear in the length of the name, independent of the
+/// number of patterns. Regular expressions using features the DFA
+/// doesn't support (e.g., back-references or lookahead) fall back to
+/// std::regex.
 class RegionFilter
 {
-    struct Filter {
-        std::vector< std::string > startswith;
-        std::vector< std::string > match;
-        std::vector< std::regex  > regex;
-    };
+    struct Filter;
+    struct VerdictCache;
+
+    std::shared_ptr<Filter>       m_include_filters;
+    std::shared_ptr<Filter>       m_exclude_filters;
 
-    std::shared_ptr<Filter> m_include_filters;
-    std::shared_ptr<Filter> m_exclude_filters;
+    std::shared_ptr<VerdictCache> m_cache;
 
     static std::pair<std::shared_ptr<Filter>, std::string> parse_filter_config(std::istream& is);
 
     static bool match(const Variant& val, const Filter&);
 
-    RegionFilter(std::shared_ptr<Filter> iflt, std::shared_ptr<Filter> eflt)
-        : m_include_filters { iflt },
-          m_exclude_filters { eflt }
-        { }
+    RegionFilter(std::shared_ptr<Filter> iflt, std::shared_ptr<Filter> eflt);
 
 public:
 
@@ -49,6 +51,16 @@ public:
         return true;
     }
 
+    /// \brief Like pass(), but caches the verdict for each context tree
+    ///   node.
+    ///
+    /// \a val must be the value of a context tree node, e.g. the value
+    /// of a region attribute's blackboard entry. The cache is keyed by
+    /// the address of the node's value, which identifies the node and
+    /// stays valid and unchanged for the lifetime of the Caliper
+    /// instance. Do not use this for values that point to user memory.
+    bool pass_node_value(const Variant& val) const;
+
     bool has_filters() const {
         return m_exclude_filters || m_include_filters;
     }
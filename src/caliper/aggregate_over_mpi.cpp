@@ -7,12 +7,18 @@
 #include "caliper/reader/CaliperMetadataDB.h"
 
 #include "caliper/common/Node.h"
+#include "caliper/common/RuntimeConfig.h"
 
 #include "../common/CompressedSnapshotRecord.h"
 #include "../common/NodeBuffer.h"
 #include "../common/SnapshotBuffer.h"
 
-#include <set>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 using namespace cali;
 
@@ -20,10 +26,97 @@ using namespace cali;
 namespace
 {
 
+//   Message tags. A child sends TagHashes, the parent answers with
+// TagUnknown, then the child sends TagNodes and a sequence of
+// TagSnapshots chunks terminated by an empty chunk.
+const int TagHashes    = 1;
+const int TagUnknown   = 2;
+const int TagNodes     = 3;
+const int TagSnapshots = 4;
+
+const ConfigSet::Entry s_configdata[] = {
+    { "fanout", CALI_TYPE_UINT, "2",
+      "Maximum number of children per rank in the reduction tree",
+      "Maximum number of children per rank in the reduction tree"
+    },
+    { "node_local", CALI_TYPE_BOOL, "true",
+      "Reduce within each shared-memory node first",
+      "Reduce within each shared-memory node first, then across nodes"
+    },
+    { "chunk_size", CALI_TYPE_UINT, "1048576",
+      "Snapshot data transfer chunk size in bytes",
+      "Snapshot data transfer chunk size in bytes"
+    },
+    ConfigSet::Terminator
+};
+
+/// \brief Computes content hashes for context tree nodes
+///
+/// A node's hash covers its attribute, value, and parent, so nodes with
+/// the same content path have the same hash on every rank regardless of
+/// their node IDs.
+class NodeHasher
+{
+    const CaliperMetadataAccessInterface& m_db;
+    std::vector<uint64_t>                 m_hashes; ///< indexed by node id; 0: not computed yet
+
+    static uint64_t mix(uint64_t h, uint64_t v) {
+        h ^= v + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        return h;
+    }
+
+public:
+
+    NodeHasher(const CaliperMetadataAccessInterface& db)
+        : m_db(db)
+        { }
+
+    uint64_t hash(const Node* node) {
+        if (!node || node->id() == CALI_INV_ID)
+            return 0;
+
+        cali_id_t id = node->id();
+
+        if (id < m_hashes.size() && m_hashes[id] != 0)
+            return m_hashes[id];
+
+        //   Attribute nodes with a forward or self reference are the
+        // bootstrap nodes, which are the same everywhere
+        uint64_t a = node->attribute() < id ? hash(m_db.node(node->attribute())) : node->attribute();
+        uint64_t h = mix(mix(hash(node->parent()), a), node->data().type());
+
+        Variant v = node->data();
+        const unsigned char* p = static_cast<const unsigned char*>(v.data());
+
+        for (size_t i = 0; p && i < v.size(); ++i)
+            h = (h ^ p[i]) * 0x100000001B3ull;
+
+        h = mix(h, v.size());
+        h = h ? h : 1;
+
+        if (id >= m_hashes.size())
+            m_hashes.resize(std::max<size_t>(2*m_hashes.size(), id+1), 0);
+
+        m_hashes[id] = h;
+
+        return h;
+    }
+
+    void set(cali_id_t id, uint64_t h) {
+        if (id >= m_hashes.size())
+            m_hashes.resize(std::max<size_t>(2*m_hashes.size(), id+1), 0);
+
+        m_hashes[id] = h;
+    }
+};
+
 void recursive_append_path(const CaliperMetadataAccessInterface& db,
                            const Node* node,
-                           NodeBuffer& buf,
-                           std::set<cali_id_t>& written_nodes)
+                           std::vector<const Node*>& nodes,
+                           std::unordered_set<cali_id_t>& written_nodes)
 {
     if (!node || node->id() == CALI_INV_ID)
         return;
@@ -31,109 +124,112 @@ void recursive_append_path(const CaliperMetadataAccessInterface& db,
         return;
 
     if (node->attribute() < node->id())
-        recursive_append_path(db, db.node(node->attribute()), buf, written_nodes);
+        recursive_append_path(db, db.node(node->attribute()), nodes, written_nodes);
 
-    recursive_append_path(db, node->parent(), buf, written_nodes);
+    recursive_append_path(db, node->parent(), nodes, written_nodes);
 
     if (written_nodes.count(node->id()) > 0)
         return;
 
     written_nodes.insert(node->id());
-    buf.append(node);
-}    
+    nodes.push_back(node);
+}
 
-void pack_and_send(int dest, CaliperMetadataAccessInterface& db, Aggregator& aggregator, MPI_Comm comm)
+void send_to_parent(int dest, CaliperMetadataDB& db, Aggregator& aggregator, size_t chunk_size, MPI_Comm comm)
 {
-    NodeBuffer     nodebuf;
-    SnapshotBuffer snapbuf;
+    // --- Pack the records into chunks, and collect the nodes they use
 
-    std::set<cali_id_t> written_nodes;
+    std::vector<const Node*>                     nodes;
+    std::unordered_set<cali_id_t>                written_nodes;
+    std::vector< std::unique_ptr<SnapshotBuffer> > chunks;
 
     aggregator.flush(db,
-                     [&nodebuf,&snapbuf,&written_nodes](CaliperMetadataAccessInterface& db,
-                                                        const EntryList& list)
+                     [&](CaliperMetadataAccessInterface& db, const EntryList& list)
                      {
                          for (const Entry& e : list)
                              if (e.node())
-                                 recursive_append_path(db, e.node(), nodebuf, written_nodes);
+                                 recursive_append_path(db, e.node(), nodes, written_nodes);
                              else if (e.is_immediate())
-                                 recursive_append_path(db, db.node(e.attribute()), nodebuf, written_nodes);
+                                 recursive_append_path(db, db.node(e.attribute()), nodes, written_nodes);
 
-                         snapbuf.append(CompressedSnapshotRecord(list.size(), list.data()));
-                     });
+                         if (chunks.empty() || chunks.back()->size() >= chunk_size)
+                             chunks.emplace_back(new SnapshotBuffer);
 
-    {
-        unsigned nodecount = nodebuf.count();
+                         chunks.back()->append(CompressedSnapshotRecord(list.size(), list.data()));
+                     });
 
-        MPI_Send(&nodecount, 1, MPI_UNSIGNED,
-                 dest, 1, comm);
-        // Work with pre-3.0 MPIs that take non-const void* :-/
-        MPI_Send(const_cast<unsigned char*>(nodebuf.data()), nodebuf.size(), MPI_BYTE,
-                 dest, 2, comm);
-    }
+    // --- Send the node hashes, and find out which nodes the parent doesn't know
 
     {
-        unsigned snapcount = snapbuf.count();
+        NodeHasher            hasher(db);
+        std::vector<uint64_t> msg(2*nodes.size());
 
-        MPI_Send(&snapcount, 1, MPI_UNSIGNED,
-                 dest, 3, comm);
-        MPI_Send(const_cast<unsigned char*>(snapbuf.data()), snapbuf.size(), MPI_BYTE,
-                 dest, 4, comm);
-    }        
-}
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            msg[2*i]   = nodes[i]->id();
+            msg[2*i+1] = hasher.hash(nodes[i]);
+        }
 
+        MPI_Send(msg.data(), static_cast<int>(msg.size()), MPI_UINT64_T, dest, TagHashes, comm);
+    }
 
-size_t receive_and_merge_nodes(int source, CaliperMetadataDB& db, IdMap& idmap, MPI_Comm comm)
-{
-    unsigned count;
+    std::vector<unsigned char> unknown((nodes.size()+7)/8);
 
-    MPI_Recv(&count, 1, MPI_UNSIGNED,
-             source, 1, comm, MPI_STATUS_IGNORE);
+    MPI_Recv(unknown.data(), static_cast<int>(unknown.size()), MPI_BYTE, dest, TagUnknown, comm, MPI_STATUS_IGNORE);
 
-    MPI_Status status;
-    int size;
+    NodeBuffer nodebuf;
 
-    MPI_Probe(source, 2, comm, &status);
-    MPI_Get_count(&status, MPI_BYTE, &size);
+    for (size_t i = 0; i < nodes.size(); ++i)
+        if (unknown[i/8] & (1 << (i%8)))
+            nodebuf.append(nodes[i]);
 
-    NodeBuffer nodebuf;
+    // --- Send the unknown nodes and the snapshot chunks without waiting in between
 
-    MPI_Recv(nodebuf.import(size, count), size, MPI_BYTE,
-             source, 2, comm, MPI_STATUS_IGNORE);
+    std::vector<MPI_Request> reqs;
+    reqs.reserve(chunks.size() + 2);
 
-    nodebuf.for_each([&db,&idmap](const NodeBuffer::NodeInfo& info)
-                     {
-                         db.merge_node(info.node_id, info.attr_id, info.parent_id, info.value, idmap);
-                     });
+    reqs.push_back(MPI_REQUEST_NULL);
+    // Work with pre-3.0 MPIs that take non-const void* :-/
+    MPI_Isend(const_cast<unsigned char*>(nodebuf.data()), static_cast<int>(nodebuf.size()), MPI_BYTE,
+              dest, TagNodes, comm, &reqs.back());
 
-    return nodebuf.size();
-}
+    for (const auto& chunk : chunks) {
+        reqs.push_back(MPI_REQUEST_NULL);
+        MPI_Isend(const_cast<unsigned char*>(chunk->data()), static_cast<int>(chunk->size()), MPI_BYTE,
+                  dest, TagSnapshots, comm, &reqs.back());
+    }
 
-size_t receive_and_merge_snapshots(int source, 
-                                   CaliperMetadataDB& db, const IdMap& idmap, 
-                                   SnapshotProcessFn snap_fn,
-                                   MPI_Comm comm)
-{
-    unsigned count;
+    reqs.push_back(MPI_REQUEST_NULL);
+    MPI_Isend(nullptr, 0, MPI_BYTE, dest, TagSnapshots, comm, &reqs.back());
 
-    MPI_Recv(&count, 3, MPI_UNSIGNED,
-             source, 3, comm, MPI_STATUS_IGNORE);
+    MPI_Waitall(static_cast<int>(reqs.size()), reqs.data(), MPI_STATUSES_IGNORE);
+}
 
-    MPI_Status status;
-    int size;
+/// \brief Receiver side of the reduction: tracks which nodes (by content
+///   hash) we already have
+struct NodeIndex {
+    NodeHasher                             hasher;
+    std::unordered_map<uint64_t, cali_id_t> ids; ///< content hash -> node id
 
-    MPI_Probe(source, 4, comm, &status);
-    MPI_Get_count(&status, MPI_BYTE, &size);
+    NodeIndex(CaliperMetadataDB& db)
+        : hasher(db)
+        {
+            for (cali_id_t id = 0; ; ++id) {
+                const Node* node = db.node(id);
 
-    SnapshotBuffer snapbuf;
+                if (!node)
+                    break;
 
-    MPI_Recv(snapbuf.import(size, count), size, MPI_BYTE,
-             source, 4, comm, MPI_STATUS_IGNORE);
+                ids.emplace(hasher.hash(node), id);
+            }
+        }
+};
 
+void merge_chunk(const std::vector<unsigned char>& buf, int size, CaliperMetadataDB& db, const IdMap& idmap, SnapshotProcessFn& snap_fn)
+{
     size_t pos = 0;
 
-    for (size_t i = 0; i < snapbuf.count(); ++i) {
-        CompressedSnapshotRecordView view(snapbuf.data()+pos, &pos);
+    while (pos < static_cast<size_t>(size)) {
+        CompressedSnapshotRecordView view(buf.data()+pos, &pos);
 
         // currently 127 entries is the max for compressed snapshots
         cali_id_t node_ids[128];
@@ -147,45 +243,202 @@ size_t receive_and_merge_snapshots(int source,
                                       view.num_immediates(), attr_ids, values,
                                       idmap));
     }
+}
+
+void receive_from_child(NodeIndex& index, CaliperMetadataDB& db, SnapshotProcessFn snap_fn, MPI_Comm comm)
+{
+    // --- Take the next child that's ready, and tell it which nodes to send
+
+    MPI_Status status;
+    int count = 0;
+
+    MPI_Probe(MPI_ANY_SOURCE, TagHashes, comm, &status);
+    MPI_Get_count(&status, MPI_UINT64_T, &count);
+
+    int src = status.MPI_SOURCE;
+
+    std::vector<uint64_t> hashes(count);
+    MPI_Recv(hashes.data(), count, MPI_UINT64_T, src, TagHashes, comm, MPI_STATUS_IGNORE);
+
+    size_t                     num_nodes = hashes.size() / 2;
+    std::vector<unsigned char> unknown((num_nodes+7)/8, 0);
+    std::vector<uint64_t>      unknown_hashes;
+    IdMap                      idmap;
+
+    for (size_t i = 0; i < num_nodes; ++i) {
+        auto it = index.ids.find(hashes[2*i+1]);
+
+        if (it != index.ids.end()) {
+            idmap[hashes[2*i]] = it->second;
+        } else {
+            unknown[i/8] |= (1 << (i%8));
+            unknown_hashes.push_back(hashes[2*i+1]);
+        }
+    }
 
-    return snapbuf.size();
+    MPI_Send(unknown.data(), static_cast<int>(unknown.size()), MPI_BYTE, src, TagUnknown, comm);
+
+    // --- Merge the new nodes
+
+    {
+        int size = 0;
+
+        MPI_Probe(src, TagNodes, comm, &status);
+        MPI_Get_count(&status, MPI_BYTE, &size);
+
+        NodeBuffer nodebuf;
+
+        MPI_Recv(nodebuf.import(size, unknown_hashes.size()), size, MPI_BYTE,
+                 src, TagNodes, comm, MPI_STATUS_IGNORE);
+
+        std::vector<CaliperMetadataDB::NodeInfo> infos;
+        infos.reserve(unknown_hashes.size());
+
+        nodebuf.for_each([&infos](const NodeBuffer::NodeInfo& info)
+                         {
+                             infos.push_back(CaliperMetadataDB::NodeInfo { info.node_id, info.attr_id, info.parent_id, info.value });
+                         });
+
+        std::vector<Node*> merged(infos.size(), nullptr);
+
+        db.merge_nodes(infos.size(), infos.data(), idmap, merged.data());
+
+        for (size_t i = 0; i < merged.size() && i < unknown_hashes.size(); ++i)
+            if (merged[i]) {
+                index.ids.emplace(unknown_hashes[i], merged[i]->id());
+                index.hasher.set(merged[i]->id(), unknown_hashes[i]);
+            }
+    }
+
+    //   Merge the snapshot chunks. We post the receive for the next chunk
+    // before merging the current one so the transfer overlaps with the
+    // merge.
+
+    std::vector<unsigned char> buf[2];
+    int                        size[2] = { 0, 0 };
+    MPI_Request                req = MPI_REQUEST_NULL;
+    int                        cur = 0;
+
+    auto post_next = [&](int b) {
+        MPI_Probe(src, TagSnapshots, comm, &status);
+        MPI_Get_count(&status, MPI_BYTE, &size[b]);
+
+        buf[b].resize(std::max<size_t>(buf[b].size(), size[b]));
+        MPI_Irecv(buf[b].data(), size[b], MPI_BYTE, src, TagSnapshots, comm, &req);
+    };
+
+    post_next(cur);
+
+    while (true) {
+        MPI_Wait(&req, MPI_STATUS_IGNORE);
+
+        if (size[cur] == 0)
+            break;
+
+        post_next(1-cur);
+        merge_chunk(buf[cur], size[cur], db, idmap, snap_fn);
+
+        cur = 1-cur;
+    }
 }
 
-size_t receive_and_merge(int source, CaliperMetadataDB& db, SnapshotProcessFn snap_fn, MPI_Comm comm)
+/// \brief k-nomial tree reduction to rank 0 of \a comm
+void reduce_tree(CaliperMetadataDB& db, Aggregator& aggr, MPI_Comm comm, unsigned fanout, size_t chunk_size)
 {
-    IdMap  idmap;
-    size_t bytes = 0;
+    int commsize = 1;
+    int rank = 0;
+
+    MPI_Comm_size(comm, &commsize);
+    MPI_Comm_rank(comm, &rank);
+
+    const int k = static_cast<int>(std::max(fanout, 2u));
+
+    int parent      = -1;
+    int numchildren = 0;
+
+    for (long stride = 1; stride < commsize; stride *= k) {
+        if (rank % (k*stride) != 0) {
+            parent = static_cast<int>(rank - rank % (k*stride));
+            break;
+        }
+
+        for (int j = 1; j < k && rank + j*stride < commsize; ++j)
+            ++numchildren;
+    }
+
+    if (numchildren > 0) {
+        NodeIndex index(db);
 
-    bytes += receive_and_merge_nodes(source, db, idmap, comm);
-    bytes += receive_and_merge_snapshots(source, db, idmap, snap_fn, comm);
+        for (int i = 0; i < numchildren; ++i)
+            receive_from_child(index, db, aggr, comm);
+    }
 
-    return bytes;
+    if (parent >= 0)
+        send_to_parent(parent, db, aggr, chunk_size, comm);
 }
 
-    
 } // namespace [anonymous]
 
 namespace cali
 {
 
 void
-aggregate_over_mpi(CaliperMetadataDB& metadb, Aggregator& aggr, MPI_Comm comm)
+aggregate_over_mpi(CaliperMetadataDB& metadb, Aggregator& aggr, MPI_Comm comm, const AggregateOverMpiOptions& opts)
 {
-    int commsize;
-    int rank;
+    size_t chunk_size = std::max<size_t>(opts.chunk_size, 1024);
 
-    MPI_Comm_size(comm, &commsize);
-    MPI_Comm_rank(comm, &rank);
-    
-    for (int step = 0, steppow2 = 1; steppow2 < commsize; ++step, steppow2 *= 2) {
-        // receive and merge
-        if (rank % (2*steppow2) == 0 && rank + steppow2 < commsize)
-            ::receive_and_merge(rank + steppow2, metadb, aggr, comm);
-
-        // send up the tree (happens only in one step for each rank, and never for rank 0)
-        if (rank % steppow2 == 0 && rank % (2*steppow2) != 0)
-            ::pack_and_send(rank - steppow2, metadb, aggr, comm);
+#if MPI_VERSION >= 3
+    if (opts.node_local) {
+        int rank = 0;
+        MPI_Comm_rank(comm, &rank);
+
+        //   Reduce within each shared-memory node first, then across the
+        // node leaders. The split keys keep rank 0 of comm as the root of
+        // both stages.
+
+        MPI_Comm local_comm;
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &local_comm);
+
+        reduce_tree(metadb, aggr, local_comm, opts.fanout, chunk_size);
+
+        int local_rank = 0;
+        MPI_Comm_rank(local_comm, &local_rank);
+
+        MPI_Comm leader_comm;
+        MPI_Comm_split(comm, local_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leader_comm);
+
+        if (leader_comm != MPI_COMM_NULL) {
+            reduce_tree(metadb, aggr, leader_comm, opts.fanout, chunk_size);
+            MPI_Comm_free(&leader_comm);
+        }
+
+        MPI_Comm_free(&local_comm);
+
+        return;
     }
+#endif
+
+    // use a private communicator so we don't match any application messages
+    MPI_Comm tree_comm;
+    MPI_Comm_dup(comm, &tree_comm);
+
+    reduce_tree(metadb, aggr, tree_comm, opts.fanout, chunk_size);
+
+    MPI_Comm_free(&tree_comm);
+}
+
+void
+aggregate_over_mpi(CaliperMetadataDB& metadb, Aggregator& aggr, MPI_Comm comm)
+{
+    ConfigSet config = RuntimeConfig::get_default_config().init("mpireduce", ::s_configdata);
+
+    AggregateOverMpiOptions opts;
+
+    opts.fanout     = config.get("fanout").to_uint();
+    opts.node_local = config.get("node_local").to_bool();
+    opts.chunk_size = config.get("chunk_size").to_uint();
+
+    aggregate_over_mpi(metadb, aggr, comm, opts);
 }
 
 }
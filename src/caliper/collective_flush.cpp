@@ -16,6 +16,8 @@
 
 #include "caliper/cali-mpi.h"
 
+#include "ChannelMetadataAccess.h"
+
 #include <mpi.h>
 
 using namespace cali;
@@ -40,17 +42,30 @@ collective_flush(OutputStream& stream, Caliper& c, Channel& channel, SnapshotVie
     RecordSelector    cross_filter(cross_query);
     RecordSelector    local_filter(local_query);
 
-    // flush this rank's caliper data into local aggregator
-    c.flush(&channel, flush_info, [&db,&local_agg,&local_pp,&local_filter](CaliperMetadataAccessInterface& in_db, const std::vector<Entry>& rec){
-            EntryList mrec = local_pp.process(db, db.merge_snapshot(in_db, rec));
+    //   Flush this rank's caliper data into the local aggregator. This
+    // works directly on the runtime metadata: only the (much fewer)
+    // local aggregation results are merged into db.
+    ChannelMetadataAccess runtime_db(&c, &channel);
+
+    runtime_db.add_attribute_aliases(cross_query.aliases);
+    runtime_db.add_attribute_units(cross_query.units);
 
-            if (local_filter.pass(db, mrec))
-                local_agg.add(db, mrec);
+    c.flush(&channel, flush_info, [&runtime_db,&local_agg,&local_pp,&local_filter](CaliperMetadataAccessInterface&, const std::vector<Entry>& rec){
+            EntryList mrec = local_pp.process(runtime_db, rec);
+
+            if (local_filter.pass(runtime_db, mrec))
+                local_agg.add(runtime_db, mrec);
         });
 
-    // flush local aggregator results into cross-process aggregator
-    local_agg.flush(db, [&cross_agg,&cross_pp,&cross_filter](CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec){
-            EntryList mrec = cross_pp.process(db, rec);
+    //   Make the runtime attributes and the ones the local query created
+    // (e.g. LET results) known in db even if no local result refers to
+    // them: the cross-process query looks them up by name.
+    for (const Attribute& attr : runtime_db.get_all_attributes())
+        db.import_attribute(runtime_db, attr);
+
+    // Flush local aggregator results into the cross-process aggregator
+    local_agg.flush(runtime_db, [&db,&cross_agg,&cross_pp,&cross_filter](CaliperMetadataAccessInterface& in_db, const std::vector<Entry>& rec){
+            EntryList mrec = cross_pp.process(db, db.merge_snapshot(in_db, rec));
 
             if (cross_filter.pass(db, mrec))
                 cross_agg.add(db, mrec);
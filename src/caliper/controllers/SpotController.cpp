@@ -18,6 +18,8 @@
 #include <caliper/common/OutputStream.h>
 #include <caliper/common/StringConverter.h>
 
+#include "../ChannelMetadataAccess.h"
+
 #include "../../common/util/file_util.h"
 
 using namespace cali;
@@ -44,6 +46,9 @@ parse_spec(const char* query)
 }
 
 /// \brief Perform process-local aggregation of channel data into \a output_agg
+///
+/// The local aggregation works directly on the runtime metadata; only
+/// its results are merged into \a db.
 void
 local_aggregate(const char* query, Caliper& c, Channel* channel, CaliperMetadataDB& db, Aggregator& output_agg) {
     QuerySpec      spec(parse_spec(query));
@@ -52,15 +57,23 @@ local_aggregate(const char* query, Caliper& c, Channel* channel, CaliperMetadata
     Preprocessor   prp(spec);
     Aggregator     agg(spec);
 
-    c.flush(channel, SnapshotView(), [&db,&filter,&prp,&agg](CaliperMetadataAccessInterface& in_db, const std::vector<Entry>& rec){
-            EntryList mrec = prp.process(db, db.merge_snapshot(in_db, rec));
+    ChannelMetadataAccess runtime_db(&c, channel);
+
+    c.flush(channel, SnapshotView(), [&runtime_db,&filter,&prp,&agg](CaliperMetadataAccessInterface&, const std::vector<Entry>& rec){
+            EntryList mrec = prp.process(runtime_db, rec);
 
-            if (filter.pass(db, mrec))
-                agg.add(db, mrec);
+            if (filter.pass(runtime_db, mrec))
+                agg.add(runtime_db, mrec);
         });
 
+    // the output query may refer to attributes no intermediate result has
+    for (const Attribute& attr : runtime_db.get_all_attributes())
+        db.import_attribute(runtime_db, attr);
+
     // write intermediate results into output aggregator
-    agg.flush(db, output_agg);
+    agg.flush(runtime_db, [&db,&output_agg](CaliperMetadataAccessInterface& in_db, const std::vector<Entry>& rec){
+            output_agg.add(db, db.merge_snapshot(in_db, rec));
+        });
 }
 
 //
@@ -0,0 +1,112 @@
+#include "../AttributeIndex.h"
+
+#include "caliper/Caliper.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cali;
+
+TEST(AttributeIndexTest, InsertAndFind) {
+    Caliper c;
+
+    Attribute attr_a = c.create_attribute("idx.test.a", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute attr_b = c.create_attribute("idx.test.b", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    AttributeIndex index;
+
+    EXPECT_EQ(index.find("idx.test.a"), nullptr);
+
+    // insert enough items to make the index grow a few times
+    for (int i = 0; i < 500; ++i)
+        index.insert(std::string("idx.") + std::to_string(i), (i % 2 == 0 ? attr_a : attr_b));
+
+    EXPECT_EQ(index.size(), 500u);
+
+    for (int i = 0; i < 500; ++i) {
+        const AttributeIndex::Item* item = index.find(std::string("idx.") + std::to_string(i));
+
+        ASSERT_NE(item, nullptr);
+        EXPECT_EQ(item->name, std::string("idx.") + std::to_string(i));
+        EXPECT_EQ(item->attr, (i % 2 == 0 ? attr_a : attr_b));
+    }
+
+    EXPECT_EQ(index.find("idx.500"), nullptr);
+    EXPECT_EQ(index.find("idx."), nullptr);
+
+    int count = 0;
+    index.for_each([&count](const AttributeIndex::Item& item){
+            EXPECT_EQ(item.name, std::string("idx.") + std::to_string(count));
+            ++count;
+        });
+
+    EXPECT_EQ(count, 500);
+}
+
+TEST(AttributeIndexTest, ConcurrentFind) {
+    Caliper c;
+
+    Attribute attr = c.create_attribute("idx.test.c", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    AttributeIndex index;
+    index.insert("idx.c.first", attr);
+
+    std::atomic<bool> done(false);
+    std::atomic<int>  errors(0);
+
+    auto reader = [&](){
+            while (!done.load()) {
+                const AttributeIndex::Item* item = index.find("idx.c.first");
+                if (!item || item->attr != attr)
+                    ++errors;
+            }
+        };
+
+    std::thread t1(reader);
+    std::thread t2(reader);
+
+    for (int i = 0; i < 2000; ++i)
+        index.insert(std::string("idx.c.") + std::to_string(i), attr);
+
+    done.store(true);
+
+    t1.join();
+    t2.join();
+
+    EXPECT_EQ(errors.load(), 0);
+    EXPECT_NE(index.find("idx.c.1999"), nullptr);
+}
+
+TEST(AttributeIndexTest, CaliperLookup) {
+    Caliper c;
+
+    Attribute attr = c.create_attribute("idx.test.caliper", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    // repeated lookups go through the thread-local cache
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(c.get_attribute("idx.test.caliper"), attr);
+        EXPECT_TRUE(c.attribute_exists("idx.test.caliper"));
+    }
+
+    EXPECT_EQ(c.create_attribute("idx.test.caliper", CALI_TYPE_STRING, CALI_ATTR_DEFAULT), attr);
+    EXPECT_EQ(c.get_attribute("idx.test.caliper.nope"), Attribute::invalid);
+}
+
+TEST(AttributeIndexTest, GetAllAttributesSorted) {
+    Caliper c;
+
+    c.create_attribute("idx.test.sort.c", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    c.create_attribute("idx.test.sort.a", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    c.create_attribute("idx.test.sort.b", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    std::vector<Attribute> attrs = c.get_all_attributes();
+
+    ASSERT_FALSE(attrs.empty());
+
+    for (size_t i = 1; i < attrs.size(); ++i)
+        EXPECT_LT(attrs[i-1].name(), attrs[i].name());
+}
@@ -5,6 +5,9 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+#include <vector>
+
 using namespace cali;
 
 TEST(BlackboardTest, BasicFunctionality) {
@@ -75,7 +78,7 @@ TEST(BlackboardTest, BasicFunctionality) {
     EXPECT_EQ(view.get(attr_ref).node()->id(), node_c->id());
     EXPECT_EQ(view.get(attr_imm).value().to_int(), 1122);
 
-    EXPECT_EQ(bb.num_skipped_entries(), 0);
+    EXPECT_EQ(bb.num_overflow_segments(), 0);
 
     bb.print_statistics(std::cout) << std::endl;
 }
@@ -92,7 +95,7 @@ TEST(BlackboardTest, Exchange) {
     EXPECT_EQ(bb.exchange(attr_imm.id(), Entry(attr_imm, Variant(24)), true).value().to_int(), 42);
     EXPECT_EQ(bb.get(attr_imm.id()).value().to_int(), 24);
 
-    EXPECT_EQ(bb.num_skipped_entries(), 0);
+    EXPECT_EQ(bb.num_overflow_segments(), 0);
 }
 
 TEST(BlackboardTest, Overflow) {
@@ -106,7 +109,7 @@ TEST(BlackboardTest, Overflow) {
         bb.set(attr.id(), Entry(attr, Variant(i)), true);
     }
 
-    EXPECT_GT(bb.num_skipped_entries(), 0);
+    EXPECT_GT(bb.num_overflow_segments(), 0);
 
     for (int i = 0; i < 1100; ++i) {
         Attribute attr =
@@ -173,3 +176,40 @@ TEST(BlackboardTest, Snapshot) {
 
     EXPECT_EQ(rec.builder().skipped(), 0);
 }
+
+TEST(BlackboardTest, StripedConcurrentWriters) {
+    Caliper    c;
+    Blackboard bb(Blackboard::MultiWriter, 8);
+
+    const int num_threads = 4;
+    const int num_attrs   = 64;
+
+    std::vector<Attribute> attrs;
+
+    for (int i = 0; i < num_threads * num_attrs; ++i)
+        attrs.push_back(c.create_attribute(std::string("bb.mt.")+std::to_string(i), CALI_TYPE_INT, CALI_ATTR_ASVALUE));
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&bb,&attrs,t](){
+                for (int n = 0; n < 100; ++n)
+                    for (int i = t*num_attrs; i < (t+1)*num_attrs; ++i) {
+                        bb.set(attrs[i].id(), Entry(attrs[i], Variant(n)), true);
+                        if (n < 99)
+                            bb.del(attrs[i].id());
+                    }
+            });
+
+    for (auto& t : threads)
+        t.join();
+
+    for (const Attribute& attr : attrs)
+        EXPECT_EQ(bb.get(attr.id()).value().to_int(), 99);
+
+    FixedSizeSnapshotRecord<num_threads*num_attrs> rec;
+    bb.snapshot(rec.builder());
+
+    EXPECT_EQ(rec.view().size(), num_threads * num_attrs);
+    EXPECT_EQ(bb.count(), num_threads * num_attrs * 199);
+}
@@ -109,3 +109,48 @@ TEST(MetadataTreeTest, ReplaceAll) {
 
     tree.print_statistics(std::cout) << std::endl;
 }
+
+TEST(MetadataTreeTest, WideTree) {
+    Caliper c;
+
+    Attribute str_attr =
+        c.create_attribute("test.metatree.wide.str", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute int_attr =
+        c.create_attribute("test.metatree.wide.int", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    MetadataTree tree;
+
+    Node* parent = tree.get_child(str_attr, Variant(CALI_TYPE_STRING, "wide", 4), tree.root());
+    ASSERT_NE(parent, nullptr);
+
+    std::vector<Node*> children;
+
+    for (int i = 0; i < 1000; ++i) {
+        Node* node = tree.get_child(int_attr, Variant(i), parent);
+
+        ASSERT_NE(node, nullptr);
+        EXPECT_EQ(node->parent(), parent);
+
+        children.push_back(node);
+    }
+
+    // lookups in a wide node must find the existing children
+
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(tree.get_child(int_attr, Variant(i), parent), children[i]);
+
+        std::string s = std::to_string(i);
+        Variant v(CALI_TYPE_STRING, s.data(), s.size());
+
+        const Node* nodelist[2] = { parent, children[i] };
+        EXPECT_EQ(tree.get_path(2, nodelist, nullptr), children[i]);
+        EXPECT_EQ(tree.get_path(str_attr, 1, &v, parent), tree.get_child(str_attr, v, parent));
+    }
+
+    int count = 0;
+
+    for (Node* node = parent->first_child(); node; node = node->next_sibling())
+        ++count;
+
+    EXPECT_EQ(count, 2000);
+}
@@ -67,3 +67,50 @@ TEST(PostprocessSnapshotTest, PostprocessSnapshot)
 
     c.delete_channel(channel);
 }
+
+TEST(PostprocessSnapshotTest, CollectAndPreparePostprocess)
+{
+    RuntimeConfig cfg;
+    cfg.allow_read_env(false);
+
+    Caliper c;
+    Channel* channel = c.create_channel("test.prepare_postprocess", cfg);
+
+    Attribute snapshot_attr =
+        c.create_attribute("tps.snapshot.val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    int num_collected = 0;
+    int num_prepared  = -1;
+    std::vector<int> prepared_at_postprocess;
+
+    channel->events().flush_evt.connect(::flush_cb);
+    channel->events().collect_postprocess.connect(
+        [&](Caliper*, Channel*, SnapshotView rec){
+            if (rec.get(snapshot_attr).value().to_int() == 49)
+                ++num_collected;
+        });
+    channel->events().prepare_postprocess.connect(
+        [&](Caliper*, Channel*){
+            num_prepared = num_collected;
+        });
+    channel->events().postprocess_snapshot.connect(
+        [&](Caliper*, Channel*, std::vector<Entry>&){
+            prepared_at_postprocess.push_back(num_prepared);
+        });
+
+    std::vector< std::vector<Entry> > output;
+
+    c.flush(channel, SnapshotView(), [&output](CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec){
+            output.push_back(rec);
+        });
+
+    // collect sees each record once, and all records are collected
+    // before the first one is postprocessed
+    EXPECT_EQ(num_collected, 1);
+    EXPECT_EQ(num_prepared,  1);
+    ASSERT_EQ(prepared_at_postprocess.size(), 1);
+    EXPECT_EQ(prepared_at_postprocess.front(), 1);
+    EXPECT_EQ(output.size(), 1);
+
+    c.delete_channel(channel);
+}
@@ -4,6 +4,8 @@
 
 #include <gtest/gtest.h>
 
+#include <regex>
+
 using namespace cali;
 
 TEST(RegionFilterTest, IncludeExclude) {
@@ -79,3 +81,71 @@ TEST(RegionFilterTest, ParseError) {
     ASSERT_FALSE(p.second.empty());
     EXPECT_STREQ(p.second.c_str(), "in match(): missing ')'");
 }
+
+TEST(RegionFilterTest, RegexDFA) {
+    const char* patterns[] = {
+        "a|ab|abc",
+        "(foo|bar)+_[0-9]{2,3}",
+        "[^x-z]*\\.cpp",
+        "\\w+::\\w+\\(\\)",
+        "^loop[.]?\\d*$",
+        "x{0}y?",
+        "(?:ab)*c",
+        "MPI_(Send|Recv|Wait)(all)?"
+    };
+
+    const char* inputs[] = {
+        "", "a", "ab", "abc", "abcd", "foo_12", "barfoo_123", "foo_1", "foo_1234",
+        "main.cpp", "x.cpp", "cali::foo()", "cali::foo", "loop", "loop.", "loop.42",
+        "loop42", "y", "yy", "abababc", "abac", "MPI_Wait", "MPI_Waitall", "MPI_Bcast",
+        "ab\n", "foo\nbar_12"
+    };
+
+    for (const char* p : patterns) {
+        // backslashes need to be escaped in the filter config
+        std::string cfg("regex(\"");
+        for (const char* c = p; *c; ++c) {
+            if (*c == '\\')
+                cfg.push_back('\\');
+            cfg.push_back(*c);
+        }
+        cfg.append("\")");
+
+        auto f = RegionFilter::from_config(cfg, "");
+        ASSERT_TRUE(f.second.empty()) << p;
+
+        std::regex r(p);
+
+        for (const char* s : inputs)
+            EXPECT_EQ(f.first.pass(Variant(s)), std::regex_match(s, r)) << "pattern " << p << ", input " << s;
+    }
+}
+
+TEST(RegionFilterTest, RegexFallback) {
+    // back-references are not supported by the DFA and fall back to std::regex
+    auto p = RegionFilter::from_config("regex(\"(ab)\\\\1\"),startswith(mpi_)", "");
+
+    ASSERT_TRUE(p.second.empty());
+
+    RegionFilter f(p.first);
+
+    EXPECT_TRUE  (f.pass( Variant("abab"    )));
+    EXPECT_FALSE (f.pass( Variant("abba"    )));
+    EXPECT_TRUE  (f.pass( Variant("mpi_send")));
+}
+
+TEST(RegionFilterTest, NodeValueCache) {
+    auto p = RegionFilter::from_config("startswith(foo)", "match(foobar)");
+
+    ASSERT_TRUE(p.second.empty());
+
+    RegionFilter f(p.first);
+
+    const char* s[] = { "foo", "foobar", "bar" };
+
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_TRUE  (f.pass_node_value( Variant(s[0]) ));
+        EXPECT_FALSE (f.pass_node_value( Variant(s[1]) ));
+        EXPECT_FALSE (f.pass_node_value( Variant(s[2]) ));
+    }
+}
@@ -501,7 +501,8 @@ cali_variant_compare(cali_variant_t lhs, cali_variant_t rhs)
                 return (cmp ? cmp : (lhssize - rhssize));
             }
         case CALI_TYPE_INT:
-            return lhs.value.v_int - rhs.value.v_int;
+            /* don't subtract: the 64-bit difference may not fit in an int */
+            return (lhs.value.v_int < rhs.value.v_int ? -1 : (lhs.value.v_int > rhs.value.v_int ? 1 : 0));
         case CALI_TYPE_ADDR:
         case CALI_TYPE_UINT:
             {
@@ -520,7 +521,7 @@ cali_variant_compare(cali_variant_t lhs, cali_variant_t rhs)
         case CALI_TYPE_TYPE:
             return ((int) lhs.value.v_type) - ((int) rhs.value.v_type);
         case CALI_TYPE_PTR:
-            return (int) ((char const*)(lhs.value.unmanaged_ptr)  - (char const*)(rhs.value.unmanaged_ptr));
+            return (lhs.value.unmanaged_ptr < rhs.value.unmanaged_ptr ? -1 : (lhs.value.unmanaged_ptr > rhs.value.unmanaged_ptr ? 1 : 0));
         }
     }
 
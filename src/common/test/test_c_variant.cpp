@@ -193,6 +193,13 @@ TEST(C_Variant_Test, Compare) {
     EXPECT_GT(cali_variant_compare(v_int_l, v_int_s), 0);
     EXPECT_EQ(cali_variant_compare(v_int_s, v_int_s), 0);
 
+    // the difference doesn't fit in an int
+    cali_variant_t v_int_min = cali_make_variant_from_int64(-4000000000000LL);
+    cali_variant_t v_int_max = cali_make_variant_from_int64( 4000000000000LL);
+
+    EXPECT_LT(cali_variant_compare(v_int_min, v_int_max), 0);
+    EXPECT_GT(cali_variant_compare(v_int_max, v_int_min), 0);
+
     cali_variant_t v_dbl_s = cali_make_variant_from_double(-42);
     cali_variant_t v_dbl_l = cali_make_variant_from_double(4000);
 
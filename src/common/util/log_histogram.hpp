@@ -0,0 +1,211 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file  log_histogram.hpp
+/// \brief Fixed-size, mergeable log-linear histogram
+
+#ifndef UTIL_LOG_HISTOGRAM_HPP
+#define UTIL_LOG_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+namespace util
+{
+
+/// \brief A fixed-memory log-linear (HDR-style) histogram.
+///
+/// Bin boundaries are global and data-independent: each power of two
+/// is split into 2^SubBucketBits linear sub-buckets, so a bin's width
+/// is at most 1/8 of its lower bound. Any two histograms can therefore
+/// be merged bin by bin.
+///
+/// The histogram keeps a window of NumBins consecutive bins. When a
+/// value falls above the window, the window moves up and the lowest
+/// bins collapse into the new lowest bin (as in DDSketch). This keeps
+/// the high tail, which is what percentiles like p99 are computed
+/// from, at full accuracy. Values <= 0 are counted separately.
+///
+/// The class does not allocate and is safe to use in signal handlers.
+class log_histogram
+{
+public:
+
+    static const int SubBucketBits = 3;
+    static const int SubBuckets    = 1 << SubBucketBits;
+    static const int NumBins       = 64;
+
+private:
+
+    int      m_offset; ///< global index of m_bins[0]
+    uint64_t m_zero;   ///< count of values <= 0
+    uint64_t m_count;  ///< total count of values > 0
+    uint64_t m_bins[NumBins];
+
+    void move_window(int offset) {
+        uint64_t tmp[NumBins] = { 0 };
+
+        for (int i = 0; i < NumBins; ++i) {
+            if (m_bins[i] == 0)
+                continue;
+
+            int j = std::max(m_offset + i - offset, 0);
+
+            if (j < NumBins)
+                tmp[j] += m_bins[i];
+        }
+
+        std::copy(tmp, tmp + NumBins, m_bins);
+        m_offset = offset;
+    }
+
+    int highest_bin() const {
+        for (int i = NumBins - 1; i >= 0; --i)
+            if (m_bins[i] > 0)
+                return i;
+        return -1;
+    }
+
+public:
+
+    log_histogram() {
+        clear();
+    }
+
+    void clear() {
+        m_offset = 0;
+        m_zero   = 0;
+        m_count  = 0;
+        std::fill(m_bins, m_bins + NumBins, static_cast<uint64_t>(0));
+    }
+
+    /// \brief Return the global bin index for a value \a val > 0.
+    static int bin_index(double val) {
+        int    exp  = 0;
+        double frac = std::frexp(val, &exp); // val = frac * 2^exp, frac in [0.5,1)
+
+        return (exp - 1) * SubBuckets + static_cast<int>((2.0 * frac - 1.0) * SubBuckets);
+    }
+
+    /// \brief Return the lower bound of the global bin \a index.
+    static double bin_lower_bound(int index) {
+        int exp = index >= 0 ? index / SubBuckets : -((SubBuckets - 1 - index) / SubBuckets);
+        int sub = index - exp * SubBuckets;
+
+        return std::ldexp(1.0 + static_cast<double>(sub) / SubBuckets, exp);
+    }
+
+    static double bin_upper_bound(int index) {
+        return bin_lower_bound(index + 1);
+    }
+
+    /// \brief Add \a count occurences of the global bin \a index.
+    void add_bin(int index, uint64_t count) {
+        if (count == 0)
+            return;
+
+        if (m_count == 0) {
+            //   first value: place it in the middle of the window so
+            // that nearby values can be added without moving it
+            m_offset = index - NumBins / 2;
+        } else if (index >= m_offset + NumBins) {
+            move_window(index - NumBins + 1);
+        } else if (index < m_offset) {
+            int hi = highest_bin();
+
+            if (m_offset + hi - index < NumBins)
+                move_window(index);
+        }
+
+        m_bins[std::max(index - m_offset, 0)] += count;
+        m_count += count;
+    }
+
+    void add_zero(uint64_t count) {
+        m_zero += count;
+    }
+
+    void add(double val) {
+        if (val > 0.0)
+            add_bin(bin_index(val), 1);
+        else
+            ++m_zero;
+    }
+
+    void merge(const log_histogram& other) {
+        add_zero(other.m_zero);
+
+        for (int i = 0; i < NumBins; ++i)
+            add_bin(other.m_offset + i, other.m_bins[i]);
+    }
+
+    uint64_t count() const {
+        return m_count + m_zero;
+    }
+
+    uint64_t zero_count() const {
+        return m_zero;
+    }
+
+    /// \brief Call \a fn(index, count) for each non-empty bin in
+    ///   ascending order.
+    template<typename Fn>
+    void for_each_bin(Fn fn) const {
+        for (int i = 0; i < NumBins; ++i)
+            if (m_bins[i] > 0)
+                fn(m_offset + i, m_bins[i]);
+    }
+
+    /// \brief Estimate the \a q quantile (0 <= q <= 1).
+    ///
+    /// Returns the midpoint of the bin containing the quantile, or 0 if
+    /// the quantile falls into the values <= 0.
+    double quantile(double q) const {
+        uint64_t total = count();
+
+        if (total == 0)
+            return 0.0;
+
+        uint64_t rank = static_cast<uint64_t>(std::ceil(std::min(std::max(q, 0.0), 1.0) * total));
+        rank = std::max(rank, static_cast<uint64_t>(1));
+        uint64_t sum  = m_zero;
+
+        if (rank <= sum)
+            return 0.0;
+
+        for (int i = 0; i < NumBins; ++i) {
+            sum += m_bins[i];
+
+            if (sum >= rank)
+                return 0.5 * (bin_lower_bound(m_offset + i) + bin_upper_bound(m_offset + i));
+        }
+
+        return bin_upper_bound(m_offset + NumBins - 1);
+    }
+};
+
+/// \brief Parse a percentile between 0 and 100, e.g. "99" or "99.9",
+///   into a quantile for log_histogram::quantile()
+///
+/// Returns \a false if \a str is not a number between 0 and 100.
+inline bool parse_percentile(const std::string& str, double* q)
+{
+    if (str.empty() || str.find_first_not_of("0123456789.") != std::string::npos)
+        return false;
+
+    char*  end = nullptr;
+    double p   = std::strtod(str.c_str(), &end);
+
+    if (end != str.c_str() + str.size() || !(p >= 0.0 && p <= 100.0))
+        return false;
+
+    *q = p / 100.0;
+    return true;
+}
+
+} // namespace util
+
+#endif
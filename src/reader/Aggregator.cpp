@@ -11,17 +11,25 @@
 #include "caliper/common/CaliperMetadataAccessInterface.h"
 #include "caliper/common/Log.h"
 #include "caliper/common/Node.h"
+#include "caliper/common/StringConverter.h"
 
 #include "caliper/common/cali_types.h"
 
+#include "../common/util/log_histogram.hpp"
 #include "../common/util/vlenc.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstring>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <thread>
 
 using namespace cali;
 using namespace std;
@@ -82,6 +90,10 @@ public:
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) = 0;
     virtual void append_result(CaliperMetadataAccessInterface& db, EntryList& list) = 0;
+
+    /// \brief Merge the state of \a other, which is a kernel created by
+    ///   the same config, into this kernel
+    virtual void merge(AggregateKernel* other) = 0;
 };
 
 class AggregateKernelConfig
@@ -147,16 +159,20 @@ public:
     }
 
     void append_result(CaliperMetadataAccessInterface& db, EntryList& list) {
-        uint64_t count = m_count.load();
+        uint64_t count = m_count;
 
         if (count > 0)
             list.push_back(Entry(m_config->attribute(db),
                                  Variant(CALI_TYPE_UINT, &count, sizeof(uint64_t))));
     }
 
+    virtual void merge(AggregateKernel* other) {
+        m_count += static_cast<CountKernel*>(other)->m_count;
+    }
+
 private:
 
-    std::atomic<uint64_t> m_count;
+    uint64_t m_count;
     Config*  m_config;
 };
 
@@ -219,9 +235,6 @@ public:
     const AggregateKernelConfig* config() { return m_config; }
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-
         Attribute count_attr = m_config->get_count_attr(db);
 
         for (const Entry& e : list)
@@ -240,10 +253,13 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        m_count += static_cast<ScaledCountKernel*>(other)->m_count;
+    }
+
 private:
 
     uint64_t   m_count;
-    std::mutex m_lock;
 
     Config*    m_config;
 };
@@ -320,9 +336,6 @@ public:
     const AggregateKernelConfig* config() { return m_config; }
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& rec) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-
         Attribute target_attr = m_config->get_target_attr(db);
 
         if (target_attr == Attribute::invalid)
@@ -347,11 +360,19 @@ public:
             rec.push_back(Entry(m_config->get_sum_attr(db), m_sum));
     }
 
+    virtual void merge(AggregateKernel* other) {
+        SumKernel* o = static_cast<SumKernel*>(other);
+
+        if (o->m_count > 0) {
+            m_sum   += o->m_sum;
+            m_count += o->m_count;
+        }
+    }
+
 private:
 
     unsigned   m_count;
     Variant    m_sum;
-    std::mutex m_lock;
     Config*    m_config;
 };
 
@@ -431,9 +452,6 @@ public:
     const AggregateKernelConfig* config() { return m_config; }
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-
         Attribute target_attr = m_config->get_target_attr(db);
         Attribute sum_attr = m_config->get_sum_attr(db);
 
@@ -452,13 +470,18 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        ScaledSumKernel* o = static_cast<ScaledSumKernel*>(other);
+
+        m_sum   += o->m_sum;
+        m_count += o->m_count;
+    }
+
 private:
 
     unsigned   m_count;
     double     m_sum;
 
-    std::mutex m_lock;
-
     Config*    m_config;
 };
 
@@ -539,9 +562,6 @@ public:
     const AggregateKernelConfig* config() { return m_config; }
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-
         Attribute target_attr = m_config->get_target_attr(db);
         StatisticsAttributes stat_attr;
 
@@ -585,10 +605,16 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        MinKernel* o = static_cast<MinKernel*>(other);
+
+        if (!o->m_min.empty() && (m_min.empty() || o->m_min < m_min))
+            m_min = o->m_min;
+    }
+
 private:
 
     Variant    m_min;
-    std::mutex m_lock;
     Config*    m_config;
 };
 
@@ -669,9 +695,6 @@ public:
     const AggregateKernelConfig* config() { return m_config; }
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-
         Attribute target_attr = m_config->get_target_attr(db);
         StatisticsAttributes stat_attr;
 
@@ -715,10 +738,16 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        MaxKernel* o = static_cast<MaxKernel*>(other);
+
+        if (!o->m_max.empty() && (m_max.empty() || o->m_max > m_max))
+            m_max = o->m_max;
+    }
+
 private:
 
     Variant    m_max;
-    std::mutex m_lock;
     Config*    m_config;
 };
 
@@ -797,9 +826,6 @@ public:
     const AggregateKernelConfig* config() { return m_config; }
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-
         Attribute target_attr = m_config->get_target_attr(db);
         StatisticsAttributes stat_attr;
 
@@ -831,13 +857,18 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        AvgKernel* o = static_cast<AvgKernel*>(other);
+
+        m_sum   += o->m_sum;
+        m_count += o->m_count;
+    }
+
 private:
 
     unsigned   m_count;
     double     m_sum;
 
-    std::mutex m_lock;
-
     Config*    m_config;
 };
 
@@ -935,9 +966,6 @@ public:
     const AggregateKernelConfig* config() { return m_config; }
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-
         auto tattrs = m_config->get_target_attributes(db);
         auto sattrs = m_config->get_sum_attributes(db);
 
@@ -967,14 +995,20 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        ScaledRatioKernel* o = static_cast<ScaledRatioKernel*>(other);
+
+        m_sum1  += o->m_sum1;
+        m_sum2  += o->m_sum2;
+        m_count += o->m_count;
+    }
+
 private:
 
     double  m_sum1;
     double  m_sum2;
     int     m_count;
 
-    std::mutex m_lock;
-
     Config* m_config;
 };
 
@@ -1136,12 +1170,19 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        // the total is kept in the config and doesn't need to be merged
+        PercentTotalKernel* o = static_cast<PercentTotalKernel*>(other);
+
+        m_sum  += o->m_sum;
+        m_isum += o->m_isum;
+    }
+
 private:
 
     double     m_sum;
     double     m_isum; // inclusive sum
 
-    std::mutex m_lock;
     Config*    m_config;
 };
 
@@ -1208,9 +1249,6 @@ public:
     const AggregateKernelConfig* config() { return m_config; }
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& rec) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-
         if (m_val.empty()) {
             Attribute target_attr = m_config->get_target_attr(db);
 
@@ -1237,11 +1275,19 @@ public:
             rec.push_back(Entry(m_config->get_any_attr(db), m_val));
     }
 
+    virtual void merge(AggregateKernel* other) {
+        AnyKernel* o = static_cast<AnyKernel*>(other);
+
+        if (m_count == 0)
+            m_val = o->m_val;
+
+        m_count += o->m_count;
+    }
+
 private:
 
     unsigned   m_count;
     Variant    m_val;
-    std::mutex m_lock;
     Config*    m_config;
 };
 
@@ -1313,9 +1359,6 @@ public:
     const AggregateKernelConfig* config() { return m_config; }
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-
         Attribute target_attr = m_config->get_target_attr(db);
         StatisticsAttributes stat_attr;
 
@@ -1353,17 +1396,261 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        VarianceKernel* o = static_cast<VarianceKernel*>(other);
+
+        m_sum   += o->m_sum;
+        m_sqsum += o->m_sqsum;
+        m_count += o->m_count;
+    }
+
 private:
 
     unsigned   m_count;
     double     m_sum;
     double     m_sqsum;
 
-    std::mutex m_lock;
-
     Config*    m_config;
 };
 
+//
+// --- HistogramKernel
+//
+
+//   Keeps a log-linear histogram of the target attribute, and computes
+// a percentile from it. Reads both raw values and hdr.bin.<i>#<attr>
+// histogram bins (as written by the aggregate service or by another
+// histogram kernel), so histograms can be merged across aggregation
+// steps. Only one kernel per target attribute writes out the bins.
+
+class HistogramKernel : public AggregateKernel {
+public:
+
+    class Config : public AggregateKernelConfig {
+        std::string m_target_attr_name;
+        Attribute   m_target_attr;
+
+        std::string m_percentile;
+        double      m_quantile;
+        Attribute   m_percentile_attr;
+
+        bool        m_write_bins;
+
+        //   Map attribute IDs to histogram bin indices. Other attributes
+        // map to NotABin. The aggregation threads cache the indices they
+        // looked up (see get_bin_index()), so they rarely need the lock.
+        std::map<cali_id_t, int> m_bin_index_map;
+        std::map<int, Attribute> m_bin_attrs;
+        std::mutex               m_bin_lock;
+
+        uint64_t                 m_id; ///< unique config ID for the thread-local bin index cache
+
+        static uint64_t next_id() {
+            static std::atomic<uint64_t> s_next_id(1);
+            return s_next_id++;
+        }
+
+        int find_bin_index(CaliperMetadataAccessInterface& db, cali_id_t attr_id) {
+            std::lock_guard<std::mutex>
+                g(m_bin_lock);
+
+            auto it = m_bin_index_map.find(attr_id);
+
+            if (it != m_bin_index_map.end())
+                return it->second;
+
+            int index = NotABin;
+            std::string name = db.get_attribute(attr_id).name();
+            std::string suffix = std::string("#") + m_target_attr_name;
+
+            if (name.size() > 8 + suffix.size() &&
+                name.compare(0, 8, "hdr.bin.") == 0 &&
+                name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                std::string idxstr = name.substr(8, name.size() - 8 - suffix.size());
+
+                if (idxstr == "zero")
+                    index = ZeroBin;
+                else {
+                    bool ok = false;
+                    int  i  = StringConverter(idxstr).to_int(&ok);
+
+                    if (ok)
+                        index = i;
+                }
+            }
+
+            m_bin_index_map[attr_id] = index;
+            return index;
+        }
+
+    public:
+
+        static const int NotABin = std::numeric_limits<int>::min();
+        static const int ZeroBin = std::numeric_limits<int>::max();
+
+        Attribute get_target_attr(CaliperMetadataAccessInterface& db) {
+            if (m_target_attr == Attribute::invalid)
+                m_target_attr = db.get_attribute(m_target_attr_name);
+            return m_target_attr;
+        }
+
+        const std::string& target_attr_name() const {
+            return m_target_attr_name;
+        }
+
+        int get_bin_index(CaliperMetadataAccessInterface& db, cali_id_t attr_id) {
+            //   Direct-mapped per-thread cache. Config IDs are never
+            // re-used, so entries of destroyed configs don't match.
+            struct BinCache {
+                uint64_t  id;
+                cali_id_t attr_id;
+                int       index;
+            };
+
+            static const std::size_t CacheSize = 64;
+
+            static thread_local BinCache t_cache[CacheSize];
+
+            BinCache& c = t_cache[(attr_id ^ m_id) % CacheSize];
+
+            if (c.id == m_id && c.attr_id == attr_id)
+                return c.index;
+
+            int index = find_bin_index(db, attr_id);
+            c = BinCache { m_id, attr_id, index };
+
+            return index;
+        }
+
+        Attribute get_bin_attr(CaliperMetadataAccessInterface& db, int index) {
+            std::lock_guard<std::mutex>
+                g(m_bin_lock);
+
+            auto it = m_bin_attrs.find(index);
+
+            if (it != m_bin_attrs.end())
+                return it->second;
+
+            std::string name =
+                std::string("hdr.bin.") + (index == ZeroBin ? std::string("zero") : std::to_string(index))
+                + "#" + m_target_attr_name;
+
+            Attribute attr =
+                db.create_attribute(name, CALI_TYPE_UINT, CALI_ATTR_SKIP_EVENTS | CALI_ATTR_ASVALUE);
+
+            m_bin_attrs[index] = attr;
+            m_bin_index_map[attr.id()] = index;
+
+            return attr;
+        }
+
+        Attribute get_percentile_attr(CaliperMetadataAccessInterface& db) {
+            if (m_percentile_attr == Attribute::invalid)
+                m_percentile_attr =
+                    db.create_attribute(std::string("p") + m_percentile + "#" + m_target_attr_name,
+                                        CALI_TYPE_DOUBLE, CALI_ATTR_SKIP_EVENTS | CALI_ATTR_ASVALUE);
+
+            return m_percentile_attr;
+        }
+
+        bool   has_percentile() const { return !m_percentile.empty(); }
+        double percentile() const     { return m_quantile; }
+
+        bool   write_bins() const     { return m_write_bins; }
+        void   set_write_bins(bool b) { m_write_bins = b; }
+
+        AggregateKernel* make_kernel() {
+            return new HistogramKernel(this);
+        }
+
+        Config(const std::string& name, const std::string& percentile)
+            : m_target_attr_name(name),
+              m_target_attr(Attribute::invalid),
+              m_percentile(percentile),
+              m_quantile(0.0),
+              m_percentile_attr(Attribute::invalid),
+              m_write_bins(true),
+              m_id(next_id())
+            { }
+
+        static AggregateKernelConfig* create(const std::vector<std::string>& cfg) {
+            return new Config(cfg.front(), std::string());
+        }
+
+        static AggregateKernelConfig* create_percentile(const std::vector<std::string>& cfg) {
+            Config* config = new Config(cfg.front(), cfg.size() > 1 ? cfg[1] : std::string("50"));
+
+            if (!util::parse_percentile(config->m_percentile, &config->m_quantile)) {
+                Log(0).stream() << "aggregator: Error: invalid percentile \"" << config->m_percentile
+                                << "\" for " << cfg.front() << ": expected a number between 0 and 100"
+                                << std::endl;
+
+                delete config;
+                return nullptr;
+            }
+
+            return config;
+        }
+    };
+
+    HistogramKernel(Config* config)
+        : m_config(config)
+        { }
+
+    const AggregateKernelConfig* config() { return m_config; }
+
+    virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        Attribute target_attr = m_config->get_target_attr(db);
+
+        for (const Entry& e : list) {
+            if (!e.is_immediate())
+                continue;
+
+            if (target_attr != Attribute::invalid && e.attribute() == target_attr.id()) {
+                m_hist.add(e.value().to_double());
+            } else {
+                int index = m_config->get_bin_index(db, e.attribute());
+
+                if (index == Config::ZeroBin)
+                    m_hist.add_zero(e.value().to_uint());
+                else if (index != Config::NotABin)
+                    m_hist.add_bin(index, e.value().to_uint());
+            }
+        }
+    }
+
+    virtual void append_result(CaliperMetadataAccessInterface& db, EntryList& list) {
+        if (m_hist.count() == 0)
+            return;
+
+        if (m_config->has_percentile())
+            list.push_back(Entry(m_config->get_percentile_attr(db), Variant(m_hist.quantile(m_config->percentile()))));
+
+        if (m_config->write_bins()) {
+            if (m_hist.zero_count() > 0)
+                list.push_back(Entry(m_config->get_bin_attr(db, Config::ZeroBin),
+                                     Variant(cali_make_variant_from_uint(m_hist.zero_count()))));
+
+            m_hist.for_each_bin([this,&db,&list](int index, uint64_t count){
+                    list.push_back(Entry(m_config->get_bin_attr(db, index),
+                                         Variant(cali_make_variant_from_uint(count))));
+                });
+        }
+    }
+
+    virtual void merge(AggregateKernel* other) {
+        m_hist.merge(static_cast<HistogramKernel*>(other)->m_hist);
+    }
+
+private:
+
+    util::log_histogram m_hist;
+    Config*             m_config;
+};
+
+const int HistogramKernel::Config::NotABin;
+const int HistogramKernel::Config::ZeroBin;
+
 enum KernelID {
     Count         = 0,
     Sum           = 1,
@@ -1381,15 +1668,18 @@ enum KernelID {
     IRatio        = 13,
     IMin          = 14,
     IMax          = 15,
-    Variance      = 16
+    Variance      = 16,
+    Histogram     = 17,
+    Percentile    = 18
 };
 
-#define MAX_KERNEL_ID Variance
+#define MAX_KERNEL_ID Percentile
 
 const char* kernel_args[]  = { "attribute" };
 const char* sratio_args[]  = { "numerator", "denominator", "scale" };
 const char* scale_args[]   = { "attribute", "scale" };
 const char* scount_args[]  = { "scale" };
+const char* pctile_args[]  = { "attribute", "percentile" };
 
 const QuerySpec::FunctionSignature kernel_signatures[] = {
     { KernelID::Count,         "count",         0, 0, nullptr      },
@@ -1409,6 +1699,8 @@ const QuerySpec::FunctionSignature kernel_signatures[] = {
     { KernelID::IMin,          "inclusive_min", 1, 1, kernel_args  },
     { KernelID::IMax,          "inclusive_max", 1, 1, kernel_args  },
     { KernelID::Variance,      "variance",      1, 1, kernel_args  },
+    { KernelID::Histogram,     "histogram",     1, 1, kernel_args  },
+    { KernelID::Percentile,    "percentile",    2, 2, pctile_args  },
 
     QuerySpec::FunctionSignatureTerminator
 };
@@ -1434,6 +1726,8 @@ const struct KernelInfo {
     { "inclusive_min",   MinKernel::Config::create_inclusive },
     { "inclusive_max",   MaxKernel::Config::create_inclusive },
     { "variance",        VarianceKernel::Config::create      },
+    { "histogram",       HistogramKernel::Config::create     },
+    { "percentile",      HistogramKernel::Config::create_percentile },
 
     { 0, 0 }
 };
@@ -1451,19 +1745,238 @@ struct Aggregator::AggregatorImpl
 
     bool                   m_select_all;
     bool                   m_select_nested;
+    bool                   m_have_inclusive;
 
     vector<AggregateKernelConfig*> m_kernel_configs;
 
     struct AggregateEntry {
         std::vector<Entry> key;
         std::vector< std::unique_ptr<AggregateKernel> > kernels;
+        std::size_t hash;
         std::size_t next_entry_idx;
     };
 
-    std::vector< std::shared_ptr<AggregateEntry> > m_entries;
+    /// \brief The aggregation entries a record updates: the entry for its
+    ///   key, and the entries for the parent paths for inclusive kernels
+    struct EntryRef {
+        AggregateEntry* entry;
+        std::vector<AggregateEntry*> parents;
+    };
+
+    /// \brief Cache of the aggregation entries for a record signature
+    ///
+    /// A record's signature is its reference entries and the immediate
+    /// entries selected for the key, in record order. Records with the
+    /// same signature have the same aggregation key, so batch processing
+    /// can skip building the key and its context tree node for all but
+    /// the first of them. The cache must be cleared when the set of key
+    /// attributes changes.
+    class KeyCache {
+        struct CacheEntry {
+            std::vector<Entry> signature;
+            std::size_t        hash;
+            EntryRef           ref;
+            std::size_t        next_entry_idx;
+        };
+
+        std::vector<CacheEntry>  m_entries; // m_entries[0] is unused
+        std::vector<std::size_t> m_hashmap;
+        std::size_t              m_num_key_attrs;
+
+        static constexpr std::size_t MaxEntries = 1 << 20;
+
+        void rehash(std::size_t size) {
+            m_hashmap.assign(size, static_cast<std::size_t>(0));
+
+            for (std::size_t i = 1; i < m_entries.size(); ++i) {
+                std::size_t bucket = m_entries[i].hash % size;
+                m_entries[i].next_entry_idx = m_hashmap[bucket];
+                m_hashmap[bucket] = i;
+            }
+        }
+
+    public:
+
+        KeyCache() {
+            clear();
+        }
+
+        /// \brief Clear the cache if the number of resolved key
+        ///   attributes differs from the last call
+        void check_key_attributes(std::size_t num_key_attrs) {
+            if (num_key_attrs != m_num_key_attrs) {
+                clear();
+                m_num_key_attrs = num_key_attrs;
+            }
+        }
+
+        const EntryRef* find(const std::vector<Entry>& signature, std::size_t hash) const {
+            for (std::size_t i = m_hashmap[hash % m_hashmap.size()]; i; i = m_entries[i].next_entry_idx) {
+                const CacheEntry& e = m_entries[i];
+
+                if (e.hash == hash && signature == e.signature)
+                    return &e.ref;
+            }
+
+            return nullptr;
+        }
+
+        void insert(const std::vector<Entry>& signature, std::size_t hash, const EntryRef& ref) {
+            if (m_entries.size() > MaxEntries)
+                clear();
+            if (m_entries.size() > m_hashmap.size())
+                rehash(2 * m_hashmap.size());
+
+            std::size_t bucket = hash % m_hashmap.size();
+
+            m_entries.push_back(CacheEntry { signature, hash, ref, m_hashmap[bucket] });
+            m_hashmap[bucket] = m_entries.size() - 1;
+        }
+
+        void clear() {
+            m_entries.clear();
+            m_entries.emplace_back();
+            m_hashmap.assign(4096, static_cast<std::size_t>(0));
+            m_num_key_attrs = 0;
+        }
+    };
+
+    /// \brief Hash table of aggregation entries.
+    ///
+    /// Each thread aggregates into its own table, so lookups and kernel
+    /// updates don't need any locking. The tables are merged in flush().
+    class AggregationTable {
+        std::vector< std::unique_ptr<AggregateEntry> > m_entries; // m_entries[0] is unused
+        std::vector<std::size_t> m_hashmap;
+
+        KeyCache m_key_cache;
+
+        void rehash(std::size_t size) {
+            m_hashmap.assign(size, static_cast<std::size_t>(0));
+
+            for (std::size_t i = 1; i < m_entries.size(); ++i) {
+                std::size_t bucket = m_entries[i]->hash % size;
+                m_entries[i]->next_entry_idx = m_hashmap[bucket];
+                m_hashmap[bucket] = i;
+            }
+        }
+
+    public:
+
+        AggregationTable() {
+            clear();
+        }
+
+        AggregateEntry* find(const std::vector<Entry>& key, std::size_t hash) const {
+            for (std::size_t i = m_hashmap[hash % m_hashmap.size()]; i; i = m_entries[i]->next_entry_idx) {
+                AggregateEntry* e = m_entries[i].get();
+
+                if (e->hash == hash && key == e->key)
+                    return e;
+            }
+
+            return nullptr;
+        }
+
+        AggregateEntry* insert(std::unique_ptr<AggregateEntry> e) {
+            if (m_entries.size() > m_hashmap.size())
+                rehash(2 * m_hashmap.size());
+
+            std::size_t bucket = e->hash % m_hashmap.size();
+
+            e->next_entry_idx = m_hashmap[bucket];
+            m_hashmap[bucket] = m_entries.size();
+            m_entries.push_back(std::move(e));
+
+            return m_entries.back().get();
+        }
+
+        /// \brief Move or merge all entries of \a other into this table
+        void merge(AggregationTable& other) {
+            for (std::size_t i = 1; i < other.m_entries.size(); ++i) {
+                std::unique_ptr<AggregateEntry>& e = other.m_entries[i];
+                AggregateEntry* target = find(e->key, e->hash);
+
+                if (target) {
+                    for (std::size_t k = 0; k < target->kernels.size(); ++k)
+                        target->kernels[k]->merge(e->kernels[k].get());
+                } else {
+                    insert(std::move(e));
+                }
+            }
+
+            other.clear();
+        }
+
+        void clear() {
+            m_entries.clear();
+            m_entries.emplace_back(nullptr);
+            m_hashmap.assign(4096, static_cast<std::size_t>(0));
+            m_key_cache.clear();
+        }
+
+        KeyCache& key_cache() {
+            return m_key_cache;
+        }
+
+        template<typename Fn>
+        void for_each(Fn fn) const {
+            for (std::size_t i = 1; i < m_entries.size(); ++i)
+                fn(*m_entries[i]);
+        }
+    };
+
+    std::vector< std::unique_ptr<AggregationTable> > m_tables;
+    std::map<std::thread::id, AggregationTable*>     m_thread_tables;
+    std::mutex m_tables_lock;
+
+    uint64_t   m_id; ///< unique instance ID for the thread-local table cache
+
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> s_next_id(1);
+        return s_next_id++;
+    }
+
+    /// \brief Return the calling thread's aggregation table
+    AggregationTable* local_table() {
+        //   Cache the last few tables the thread used. Aggregator IDs are
+        // never re-used, so entries of destroyed aggregators don't match.
+        struct TableCache {
+            uint64_t          id;
+            AggregationTable* table;
+        };
+
+        static const int CacheSize = 4;
 
-    std::vector<std::size_t> m_hashmap;
-    std::mutex m_entries_lock;
+        static thread_local TableCache t_cache[CacheSize];
+        static thread_local int        t_next;
+
+        for (int i = 0; i < CacheSize; ++i)
+            if (t_cache[i].id == m_id)
+                return t_cache[i].table;
+
+        AggregationTable* table = nullptr;
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_tables_lock);
+
+            auto it = m_thread_tables.find(std::this_thread::get_id());
+
+            if (it != m_thread_tables.end()) {
+                table = it->second;
+            } else {
+                m_tables.emplace_back(new AggregationTable);
+                table = m_tables.back().get();
+                m_thread_tables.emplace(std::this_thread::get_id(), table);
+            }
+        }
+
+        t_cache[t_next] = TableCache { m_id, table };
+        t_next = (t_next + 1) % CacheSize;
+
+        return table;
+    }
 
     //
     // --- parse config
@@ -1507,7 +2020,10 @@ struct Aggregator::AggregatorImpl
         case QuerySpec::AggregationSelection::List:
             for (const QuerySpec::AggregationOp& k : spec.aggregate.list) {
                 if (k.op.id >= 0 && k.op.id <= MAX_KERNEL_ID) {
-                    m_kernel_configs.push_back((*::kernel_list[k.op.id].create)(k.args));
+                    AggregateKernelConfig* k_cfg = (*::kernel_list[k.op.id].create)(k.args);
+
+                    if (k_cfg)
+                        m_kernel_configs.push_back(k_cfg);
                 } else {
                     Log(0).stream() << "aggregator: Error: Unknown aggregation kernel "
                                     << k.op.id << " (" << (k.op.name ? k.op.name : "") << ")"
@@ -1518,6 +2034,22 @@ struct Aggregator::AggregatorImpl
         case QuerySpec::AggregationSelection::None:
             break;
         }
+
+        //   Only the first histogram/percentile kernel for each attribute
+        // writes out histogram bins to avoid counting them twice when
+        // the results get merged again
+        std::set<std::string> hist_attrs;
+
+        m_have_inclusive = false;
+
+        for (AggregateKernelConfig* k_cfg : m_kernel_configs) {
+            m_have_inclusive = m_have_inclusive || k_cfg->is_inclusive();
+
+            HistogramKernel::Config* h_cfg = dynamic_cast<HistogramKernel::Config*>(k_cfg);
+
+            if (h_cfg)
+                h_cfg->set_write_bins(hist_attrs.insert(h_cfg->target_attr_name()).second);
+        }
     }
 
     //
@@ -1559,51 +2091,35 @@ struct Aggregator::AggregatorImpl
         return false;
     }
 
-    std::shared_ptr<AggregateEntry>
-    get_aggregation_entry(std::vector<const Node*>::const_iterator nodes_begin,
+    AggregateEntry*
+    get_aggregation_entry(AggregationTable* table,
+                          std::vector<const Node*>::const_iterator nodes_begin,
                           std::vector<const Node*>::const_iterator nodes_end,
                           const std::vector<Entry>& immediates,
                           CaliperMetadataAccessInterface& db)
     {
         std::vector<Entry> key = make_key(nodes_begin, nodes_end, immediates, db);
-        std::size_t hash = hash_key(key) % m_hashmap.size();
+        std::size_t hash = hash_key(key);
 
-        {
-            std::lock_guard<std::mutex>
-                g(m_entries_lock);
-
-            for (size_t i = m_hashmap[hash]; i; i = m_entries[i]->next_entry_idx) {
-                auto e = m_entries[i];
-                if (key == e->key)
-                    return e;
-            }
-        }
+        AggregateEntry* entry = table->find(key, hash);
 
-        std::vector< std::unique_ptr<AggregateKernel> > kernels;
-        kernels.reserve(m_kernel_configs.size());
+        if (entry)
+            return entry;
 
-        for (AggregateKernelConfig* k_cfg : m_kernel_configs)
-            kernels.emplace_back(k_cfg->make_kernel());
-
-        std::lock_guard<std::mutex>
-            g(m_entries_lock);
+        std::unique_ptr<AggregateEntry> e(new AggregateEntry);
 
-        auto e = std::make_shared<AggregateEntry>();
+        e->key  = std::move(key);
+        e->hash = hash;
+        e->kernels.reserve(m_kernel_configs.size());
 
-        e->key = std::move(key);
-        e->kernels = std::move(kernels);
-        e->next_entry_idx = m_hashmap[hash];
-
-        size_t idx = m_entries.size();
-        m_entries.push_back(e);
-        m_hashmap[hash] = idx;
+        for (AggregateKernelConfig* k_cfg : m_kernel_configs)
+            e->kernels.emplace_back(k_cfg->make_kernel());
 
-        return e;
+        return table->insert(std::move(e));
     }
 
-    void process(CaliperMetadataAccessInterface& db, const EntryList& rec) {
-        std::vector<Attribute>   key_attrs = update_key_attributes(db);
-
+    /// \brief Find or create the aggregation entries for \a rec
+    EntryRef find_entries(CaliperMetadataAccessInterface& db, const std::vector<Attribute>& key_attrs, AggregationTable* table, const EntryList& rec) {
         // --- Unravel nodes, filter for key attributes
 
         std::vector<const Node*> nodes;
@@ -1636,29 +2152,87 @@ struct Aggregator::AggregatorImpl
         std::sort(immediates.begin(), immediates.end(), [](const Entry& a, const Entry& b){
                 return a.attribute() < b.attribute(); } );
 
-        auto entry = get_aggregation_entry(nodes.begin(), nodes.end(), immediates, db);
+        EntryRef ref;
 
-        if (!entry)
-            return;
+        ref.entry = get_aggregation_entry(table, nodes.begin(), nodes.end(), immediates, db);
+
+        // for inclusive kernels, aggregate for all parent nodes as well
+        if (m_have_inclusive && nodes.begin() != nonnested_begin) {
+            auto it = nodes.begin();
+
+            for (++it; it != nonnested_begin; ++it)
+                ref.parents.push_back(get_aggregation_entry(table, it, nodes.end(), immediates, db));
+        }
+
+        return ref;
+    }
 
-        // --- Aggregate
+    void aggregate(CaliperMetadataAccessInterface& db, const EntryRef& ref, const EntryList& rec) {
+        AggregateEntry* entry = ref.entry;
 
         for (size_t k = 0; k < entry->kernels.size(); ++k) {
             entry->kernels[k]->aggregate(db, rec);
 
-            // for inclusive kernels, aggregate for all parent nodes as well
-            if (entry->kernels[k]->config()->is_inclusive() && nodes.begin() != nonnested_begin) {
-                auto it = nodes.begin();
+            if (entry->kernels[k]->config()->is_inclusive())
+                for (AggregateEntry* p_entry : ref.parents)
+                    p_entry->kernels[k]->parent_aggregate(db, rec);
+        }
+    }
+
+    void process(CaliperMetadataAccessInterface& db, const EntryList& rec) {
+        std::vector<Attribute> key_attrs = update_key_attributes(db);
+        AggregationTable*      table     = local_table();
 
-                for (++it; it != nonnested_begin; ++it) {
-                    auto p_entry = get_aggregation_entry(it, nodes.end(), immediates, db);
+        aggregate(db, find_entries(db, key_attrs, table, rec), rec);
+    }
 
-                    if (!p_entry)
-                        break;
+    void process(CaliperMetadataAccessInterface& db, const EntryList* recs, std::size_t count) {
+        std::vector<Attribute> key_attrs = update_key_attributes(db);
+        AggregationTable*      table     = local_table();
+        KeyCache&              cache     = table->key_cache();
 
-                    p_entry->kernels[k]->parent_aggregate(db, rec);
+        cache.check_key_attributes(key_attrs.size());
+
+        //   Records in a batch typically have few distinct immediate
+        // attributes, so remember which of them are key attributes
+        std::vector< std::pair<cali_id_t, bool> > imm_is_key;
+        std::vector<Entry> signature;
+
+        for (std::size_t i = 0; i < count; ++i) {
+            const EntryList& rec = recs[i];
+
+            signature.clear();
+
+            for (const Entry& e : rec) {
+                if (e.is_reference()) {
+                    signature.push_back(e);
+                } else if (e.is_immediate()) {
+                    cali_id_t attr_id = e.attribute();
+                    auto it = std::find_if(imm_is_key.begin(), imm_is_key.end(),
+                                           [attr_id](const std::pair<cali_id_t, bool>& p) {
+                                               return p.first == attr_id;
+                                           });
+
+                    if (it == imm_is_key.end()) {
+                        imm_is_key.emplace_back(attr_id, is_key(db, key_attrs, attr_id));
+                        it = imm_is_key.end() - 1;
+                    }
+
+                    if (it->second)
+                        signature.push_back(e);
                 }
             }
+
+            std::size_t     hash = hash_key(signature);
+            const EntryRef* ref  = cache.find(signature, hash);
+
+            if (ref) {
+                aggregate(db, *ref, rec);
+            } else {
+                EntryRef new_ref = find_entries(db, key_attrs, table, rec);
+                cache.insert(signature, hash, new_ref);
+                aggregate(db, new_ref, rec);
+            }
         }
     }
 
@@ -1667,37 +2241,57 @@ struct Aggregator::AggregatorImpl
     //
 
     void flush(CaliperMetadataAccessInterface& db, const SnapshotProcessFn push) {
-        // NOTE: No locking: we assume flush() runs serially!
+        // NOTE: We assume flush() runs serially, and not concurrently
+        // with process()!
 
-        for (auto entry : m_entries) {
-            if (!entry)
-                continue;
+        AggregationTable* table = nullptr;
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_tables_lock);
+
+            if (m_tables.empty())
+                return;
+
+            //   Merge all thread-local tables into the first one and drop
+            // the others, so that a second flush doesn't see their entries
+            // again. Threads that used a dropped table get a new one.
+
+            table = m_tables.front().get();
 
-            std::vector<Entry> rec(entry->key);
+            for (std::size_t t = 1; t < m_tables.size(); ++t)
+                table->merge(*m_tables[t]);
 
-            for (auto const &k : entry->kernels)
-                k->append_result(db, rec);
+            m_tables.resize(1);
 
-            push(db, rec);
+            for (auto it = m_thread_tables.begin(); it != m_thread_tables.end(); )
+                if (it->second != table)
+                    it = m_thread_tables.erase(it);
+                else
+                    ++it;
+
+            // invalidate the thread-local table caches
+            m_id = next_id();
         }
+
+        table->for_each([&db,&push](const AggregateEntry& entry){
+                std::vector<Entry> rec(entry.key);
+
+                for (auto const &k : entry.kernels)
+                    k->append_result(db, rec);
+
+                push(db, rec);
+            });
     }
 
     AggregatorImpl()
-        : m_select_all(false)
-    {
-        m_entries.reserve(4096);
-        m_hashmap.assign(4096, static_cast<size_t>(0));
-        m_entries.push_back(std::shared_ptr<AggregateEntry>(nullptr));
-    }
+        : m_select_all(false), m_have_inclusive(false), m_id(next_id())
+    { }
 
     AggregatorImpl(const QuerySpec& spec)
-        : m_select_all(false)
+        : m_select_all(false), m_have_inclusive(false), m_id(next_id())
     {
         configure(spec);
-
-        m_entries.reserve(4096);
-        m_hashmap.assign(4096, static_cast<size_t>(0));
-        m_entries.push_back(std::shared_ptr<AggregateEntry>(nullptr));
     }
 
     ~AggregatorImpl() {
@@ -1730,6 +2324,12 @@ Aggregator::add(CaliperMetadataAccessInterface& db, const EntryList& list)
     mP->process(db, list);
 }
 
+void
+Aggregator::add(CaliperMetadataAccessInterface& db, const EntryList* recs, std::size_t count)
+{
+    mP->process(db, recs, count);
+}
+
 const QuerySpec::FunctionSignature*
 Aggregator::aggregation_defs()
 {
@@ -1774,6 +2374,10 @@ Aggregator::get_aggregation_attribute_name(const QuerySpec::AggregationOp& op)
         return std::string("imax#") + op.args[0];
     case KernelID::Variance:
         return std::string("variance#") + op.args[0];
+    case KernelID::Histogram:
+        return std::string("hdr.bin#") + op.args[0];
+    case KernelID::Percentile:
+        return std::string("p") + op.args[1] + std::string("#") + op.args[0];
     }
 
     return std::string();
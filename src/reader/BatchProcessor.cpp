@@ -0,0 +1,585 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+// BatchProcessor implementation
+
+#include "caliper/reader/BatchProcessor.h"
+
+#include "caliper/reader/Preprocessor.h"
+#include "caliper/reader/QuerySpec.h"
+
+#include "caliper/common/Attribute.h"
+#include "caliper/common/CaliperMetadataAccessInterface.h"
+#include "caliper/common/Node.h"
+
+#include "caliper/common/cali_types.h"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+bool match_value(QuerySpec::Condition::Op op, const Variant& val, const Variant& ref)
+{
+    switch (op) {
+    case QuerySpec::Condition::Op::Exist:
+    case QuerySpec::Condition::Op::NotExist:
+        return true;
+    case QuerySpec::Condition::Op::Equal:
+    case QuerySpec::Condition::Op::NotEqual:
+        return val == ref;
+    case QuerySpec::Condition::Op::LessThan:
+        return val < ref;
+    case QuerySpec::Condition::Op::GreaterThan:
+        return val > ref;
+    case QuerySpec::Condition::Op::LessOrEqual:
+        return val < ref || val == ref;
+    case QuerySpec::Condition::Op::GreaterOrEqual:
+        return val > ref || val == ref;
+    default:
+        return false;
+    }
+}
+
+/// \brief Convert the values in \a in into doubles for the numeric
+///   kernels. \a has is 1 for the records that have a value.
+void to_doubles(const std::vector<Variant>& in, std::vector<double>& x, std::vector<unsigned char>& has)
+{
+    const std::size_t n = in.size();
+
+    x.resize(n);
+    has.resize(n);
+
+    for (std::size_t r = 0; r < n; ++r) {
+        has[r] = in[r].empty() ? 0 : 1;
+        x[r]   = in[r].to_double();
+    }
+}
+
+} // namespace [anonymous]
+
+struct BatchProcessor::BatchProcessorImpl
+{
+    /// \brief A WHERE or LET IF condition with its resolved attribute
+    struct Clause {
+        QuerySpec::Condition cond;
+        Attribute            attr;
+        Variant              value;
+    };
+
+    /// \brief The LET kernels, in the order of the Preprocessor's kernel IDs
+    enum class Kernel {
+        ScaledRatio, Scale, Truncate, First, Sum, Leaf
+    };
+
+    static bool is_batch_kernel(int id) {
+        return id >= static_cast<int>(Kernel::ScaledRatio) && id <= static_cast<int>(Kernel::Leaf);
+    }
+
+    /// \brief A LET operation with its resolved attributes
+    struct LetOp {
+        Kernel                   kernel;
+        std::string              res_name;
+        Attribute                res_attr;
+        std::vector<std::string> arg_names;
+        std::vector<Attribute>   args;
+        double                   param;
+        Clause                   cond;
+    };
+
+    std::vector<LetOp>  m_let_ops;
+    std::vector<Clause> m_where;
+
+    std::unique_ptr<Preprocessor> m_preprocessor; ///< runs the LET clause per record if it has kernels we can't batch
+
+    std::unique_ptr<Aggregator> m_aggr;
+    SnapshotProcessFn           m_push;
+
+    // --- the current batch
+
+    std::vector<EntryList>   m_recs; ///< record buffer, re-used across batches
+    std::size_t              m_count;
+
+    //   Entry columns: one element per entry of all records in the batch,
+    // in record order, followed by the LET results
+    std::vector<std::uint32_t> m_col_rec;   ///< record index
+    std::vector<cali_id_t>     m_col_attr;  ///< attribute of immediate entries, CALI_INV_ID for references
+    std::vector<const Node*>   m_col_node;  ///< node of reference entries, nullptr for immediates
+    std::vector<Variant>       m_col_value; ///< value of immediate entries
+
+    // --- per-record scratch columns
+
+    std::vector<unsigned char> m_mask;
+    std::vector<unsigned char> m_cond;
+    std::vector<unsigned char> m_hit;
+    std::vector<unsigned char> m_ok;
+    std::vector<unsigned char> m_has_a;
+    std::vector<unsigned char> m_has_b;
+    std::vector<double>        m_x_a;
+    std::vector<double>        m_x_b;
+    std::vector<double>        m_res;
+    std::vector< std::vector<Variant> > m_vals;
+
+    void configure(const QuerySpec& spec) {
+        bool batch_let = true;
+
+        for (const QuerySpec::PreprocessSpec& pspec : spec.preprocess_ops)
+            if (!is_batch_kernel(pspec.op.op.id))
+                batch_let = false;
+
+        if (!batch_let)
+            m_preprocessor.reset(new Preprocessor(spec));
+
+        for (const QuerySpec::PreprocessSpec& pspec : spec.preprocess_ops) {
+            if (!batch_let)
+                break;
+
+            const std::vector<std::string>& args = pspec.op.args;
+
+            LetOp op { static_cast<Kernel>(pspec.op.op.id), pspec.target, Attribute::invalid, args, { }, 1.0,
+                       Clause { pspec.cond, Attribute::invalid, Variant() } };
+
+            switch (op.kernel) {
+            case Kernel::ScaledRatio:
+                if (args.size() > 2)
+                    op.param = std::stod(args[2]);
+                break;
+            case Kernel::Scale:
+                op.param = std::stod(args[1]);
+                break;
+            case Kernel::Truncate:
+                if (args.size() > 1)
+                    op.param = std::stod(args[1]);
+                break;
+            default:
+                break;
+            }
+
+            op.args.assign(op.arg_names.size(), Attribute::invalid);
+            m_let_ops.push_back(op);
+        }
+
+        if (spec.filter.selection == QuerySpec::FilterSelection::List)
+            for (const QuerySpec::Condition& cond : spec.filter.list)
+                m_where.push_back(Clause { cond, Attribute::invalid, Variant() });
+    }
+
+    //
+    // --- columns
+    //
+
+    void gather_columns() {
+        m_col_rec.clear();
+        m_col_attr.clear();
+        m_col_node.clear();
+        m_col_value.clear();
+
+        for (std::size_t r = 0; r < m_count; ++r)
+            for (const Entry& e : m_recs[r]) {
+                m_col_rec.push_back(static_cast<std::uint32_t>(r));
+
+                if (e.is_immediate()) {
+                    m_col_attr.push_back(e.attribute());
+                    m_col_node.push_back(nullptr);
+                    m_col_value.push_back(e.value());
+                } else {
+                    m_col_attr.push_back(CALI_INV_ID);
+                    m_col_node.push_back(e.node());
+                    m_col_value.push_back(Variant());
+                }
+            }
+    }
+
+    void append(std::size_t r, const Attribute& attr, const Variant& val) {
+        m_recs[r].push_back(Entry(attr, val));
+
+        m_col_rec.push_back(static_cast<std::uint32_t>(r));
+        m_col_attr.push_back(attr.id());
+        m_col_node.push_back(nullptr);
+        m_col_value.push_back(val);
+    }
+
+    /// \brief Gather the first value of \a attr in each record into \a out
+    void gather(const Attribute& attr, std::vector<Variant>& out) {
+        out.assign(m_count, Variant());
+
+        if (attr == Attribute::invalid)
+            return;
+
+        const cali_id_t   id = attr.id();
+        const std::size_t n  = m_col_attr.size();
+
+        for (std::size_t i = 0; i < n; ++i) {
+            Variant& v = out[m_col_rec[i]];
+
+            if (!v.empty())
+                continue;
+
+            if (m_col_attr[i] == id)
+                v = m_col_value[i];
+            else if (m_col_node[i])
+                for (const Node* node = m_col_node[i]; node && node->id() != CALI_INV_ID; node = node->parent())
+                    if (node->attribute() == id) {
+                        v = node->data();
+                        break;
+                    }
+        }
+    }
+
+    //
+    // --- WHERE and LET IF conditions
+    //
+
+    void resolve(const CaliperMetadataAccessInterface& db, Clause& clause) {
+        if (clause.attr != Attribute::invalid)
+            return;
+
+        clause.attr = db.get_attribute(clause.cond.attr_name);
+
+        if (clause.attr != Attribute::invalid)
+            clause.value = Variant::from_string(clause.attr.type(), clause.cond.value.c_str(), nullptr);
+    }
+
+    /// \brief Clear \a mask for the records that don't match \a clause
+    void select(const CaliperMetadataAccessInterface& db, Clause& clause, std::vector<unsigned char>& mask) {
+        const QuerySpec::Condition::Op op = clause.cond.op;
+
+        if (op == QuerySpec::Condition::Op::None)
+            return;
+
+        resolve(db, clause);
+
+        const unsigned char negate =
+            (op == QuerySpec::Condition::Op::NotExist || op == QuerySpec::Condition::Op::NotEqual) ? 1 : 0;
+
+        m_hit.assign(m_count, 0);
+
+        if (clause.attr != Attribute::invalid) {
+            const cali_id_t   id = clause.attr.id();
+            const std::size_t n  = m_col_attr.size();
+
+            for (std::size_t i = 0; i < n; ++i) {
+                if (m_col_attr[i] == id) {
+                    if (match_value(op, m_col_value[i], clause.value))
+                        m_hit[m_col_rec[i]] = 1;
+                } else if (m_col_node[i]) {
+                    for (const Node* node = m_col_node[i]; node && node->id() != CALI_INV_ID; node = node->parent())
+                        if (node->attribute() == id && match_value(op, node->data(), clause.value)) {
+                            m_hit[m_col_rec[i]] = 1;
+                            break;
+                        }
+                }
+            }
+        }
+
+        for (std::size_t r = 0; r < m_count; ++r)
+            mask[r] &= m_hit[r] ^ negate;
+    }
+
+    //
+    // --- LET kernels
+    //
+
+    void resolve(const CaliperMetadataAccessInterface& db, LetOp& op) {
+        for (std::size_t i = 0; i < op.args.size(); ++i)
+            if (op.args[i] == Attribute::invalid)
+                op.args[i] = db.get_attribute(op.arg_names[i]);
+    }
+
+    void make_result_attr(CaliperMetadataAccessInterface& db, LetOp& op, cali_attr_type type, int prop = 0) {
+        if (op.res_attr == Attribute::invalid)
+            op.res_attr = db.create_attribute(op.res_name, type, prop | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_ASVALUE);
+    }
+
+    /// \brief Append the double results in m_res for the records marked
+    ///   in m_ok
+    void append_results(CaliperMetadataAccessInterface& db, LetOp& op) {
+        for (std::size_t r = 0; r < m_count; ++r)
+            if (m_ok[r]) {
+                make_result_attr(db, op, CALI_TYPE_DOUBLE);
+                append(r, op.res_attr, Variant(m_res[r]));
+            }
+    }
+
+    void scaled_ratio(CaliperMetadataAccessInterface& db, LetOp& op) {
+        gather(op.args[0], m_vals[0]);
+        gather(op.args[1], m_vals[1]);
+        to_doubles(m_vals[0], m_x_a, m_has_a);
+        to_doubles(m_vals[1], m_x_b, m_has_b);
+
+        const double scale = op.param;
+        const std::size_t n = m_count;
+
+        m_ok.resize(n);
+        m_res.resize(n);
+
+        for (std::size_t r = 0; r < n; ++r)
+            m_ok[r] = m_cond[r] & m_has_a[r] & m_has_b[r] & (std::fabs(m_x_b[r]) > 0.0 ? 1 : 0);
+        for (std::size_t r = 0; r < n; ++r)
+            m_res[r] = scale * (m_x_a[r] / (m_ok[r] ? m_x_b[r] : 1.0));
+
+        append_results(db, op);
+    }
+
+    void scale(CaliperMetadataAccessInterface& db, LetOp& op) {
+        gather(op.args[0], m_vals[0]);
+        to_doubles(m_vals[0], m_x_a, m_has_a);
+
+        const double scale = op.param;
+        const std::size_t n = m_count;
+
+        m_ok.resize(n);
+        m_res.resize(n);
+
+        for (std::size_t r = 0; r < n; ++r)
+            m_ok[r] = m_cond[r] & m_has_a[r];
+        for (std::size_t r = 0; r < n; ++r)
+            m_res[r] = scale * m_x_a[r];
+
+        append_results(db, op);
+    }
+
+    void truncate(CaliperMetadataAccessInterface& db, LetOp& op) {
+        gather(op.args[0], m_vals[0]);
+        to_doubles(m_vals[0], m_x_a, m_has_a);
+
+        const double factor = op.param;
+        const std::size_t n = m_count;
+
+        m_ok.resize(n);
+        m_res.resize(n);
+
+        for (std::size_t r = 0; r < n; ++r)
+            m_ok[r] = m_cond[r] & m_has_a[r];
+        for (std::size_t r = 0; r < n; ++r)
+            m_res[r] = m_x_a[r] - std::fmod(m_x_a[r], factor);
+
+        cali_attr_type type = op.args[0].type();
+
+        if (!(type == CALI_TYPE_INT || type == CALI_TYPE_UINT))
+            type = CALI_TYPE_DOUBLE;
+
+        for (std::size_t r = 0; r < n; ++r) {
+            if (!m_ok[r])
+                continue;
+
+            make_result_attr(db, op, type);
+
+            Variant v_res(m_res[r]);
+
+            if (type == CALI_TYPE_INT)
+                v_res = cali_make_variant_from_int(static_cast<int>(m_res[r]));
+            else if (type == CALI_TYPE_UINT)
+                v_res = cali_make_variant_from_uint(static_cast<uint64_t>(std::fabs(m_res[r])));
+
+            append(r, op.res_attr, v_res);
+        }
+    }
+
+    void first(CaliperMetadataAccessInterface& db, LetOp& op) {
+        for (std::size_t i = 0; i < op.args.size(); ++i)
+            gather(op.args[i], m_vals[i]);
+
+        for (std::size_t r = 0; r < m_count; ++r) {
+            if (!m_cond[r])
+                continue;
+
+            for (std::size_t i = 0; i < op.args.size(); ++i)
+                if (!m_vals[i][r].empty()) {
+                    make_result_attr(db, op, op.args[i].type());
+                    append(r, op.res_attr, m_vals[i][r]);
+                    break;
+                }
+        }
+    }
+
+    void sum(CaliperMetadataAccessInterface& db, LetOp& op) {
+        for (std::size_t i = 0; i < op.args.size(); ++i)
+            gather(op.args[i], m_vals[i]);
+
+        for (std::size_t r = 0; r < m_count; ++r) {
+            if (!m_cond[r])
+                continue;
+
+            Variant v_sum;
+
+            for (std::size_t i = 0; i < op.args.size(); ++i)
+                if (!m_vals[i][r].empty())
+                    v_sum += m_vals[i][r];
+
+            if (!v_sum.empty()) {
+                make_result_attr(db, op, v_sum.type());
+                append(r, op.res_attr, v_sum);
+            }
+        }
+    }
+
+    void leaf(CaliperMetadataAccessInterface& db, LetOp& op) {
+        const bool use_path = op.arg_names.empty();
+
+        for (std::size_t r = 0; r < m_count; ++r) {
+            if (!m_cond[r])
+                continue;
+
+            if (op.res_attr == Attribute::invalid) {
+                cali_attr_type type = CALI_TYPE_STRING;
+                int prop = 0;
+
+                if (!use_path) {
+                    op.args[0] = db.get_attribute(op.arg_names[0]);
+                    if (op.args[0] == Attribute::invalid)
+                        continue;
+                    type  = op.args[0].type();
+                    prop |= op.args[0].properties();
+                    prop &= ~CALI_ATTR_NESTED;
+                }
+
+                make_result_attr(db, op, type, prop);
+            }
+
+            const EntryList& rec = m_recs[r];
+
+            for (std::size_t i = 0; i < rec.size(); ++i) {
+                // copy: append() may reallocate the record
+                Entry e_target = use_path ? get_path_entry(db, rec[i]) : rec[i].get(op.args[0]);
+
+                if (!e_target.empty() && op.res_attr.type() == e_target.value().type()) {
+                    append(r, op.res_attr, e_target.value());
+                    break;
+                }
+            }
+        }
+    }
+
+    void apply(CaliperMetadataAccessInterface& db, LetOp& op) {
+        m_cond.assign(m_count, 1);
+        select(db, op.cond, m_cond);
+
+        resolve(db, op);
+
+        if (m_vals.size() < op.args.size())
+            m_vals.resize(op.args.size());
+
+        switch (op.kernel) {
+        case Kernel::ScaledRatio:
+            scaled_ratio(db, op);
+            break;
+        case Kernel::Scale:
+            scale(db, op);
+            break;
+        case Kernel::Truncate:
+            truncate(db, op);
+            break;
+        case Kernel::First:
+            first(db, op);
+            break;
+        case Kernel::Sum:
+            sum(db, op);
+            break;
+        case Kernel::Leaf:
+            leaf(db, op);
+            break;
+        }
+    }
+
+    //
+    // --- batch processing
+    //
+
+    void process(CaliperMetadataAccessInterface& db) {
+        if (m_count == 0)
+            return;
+
+        std::size_t num_selected = m_count;
+
+        if (m_preprocessor)
+            for (std::size_t r = 0; r < m_count; ++r)
+                m_recs[r] = m_preprocessor->process(db, m_recs[r]);
+
+        if (!m_let_ops.empty() || !m_where.empty()) {
+            gather_columns();
+
+            for (LetOp& op : m_let_ops)
+                apply(db, op);
+
+            m_mask.assign(m_count, 1);
+
+            for (Clause& clause : m_where)
+                select(db, clause, m_mask);
+
+            // move the selected records to the front, keeping their order
+
+            num_selected = 0;
+
+            for (std::size_t r = 0; r < m_count; ++r)
+                if (m_mask[r]) {
+                    if (r != num_selected)
+                        std::swap(m_recs[num_selected], m_recs[r]);
+                    ++num_selected;
+                }
+        }
+
+        if (m_aggr)
+            m_aggr->add(db, m_recs.data(), num_selected);
+        else
+            for (std::size_t r = 0; r < num_selected; ++r)
+                m_push(db, m_recs[r]);
+
+        m_count = 0;
+    }
+
+    void add(CaliperMetadataAccessInterface& db, const EntryList& rec) {
+        m_recs[m_count].assign(rec.begin(), rec.end());
+
+        if (++m_count == m_recs.size())
+            process(db);
+    }
+
+    BatchProcessorImpl(const QuerySpec& spec, Aggregator& aggr, std::size_t batch_size)
+        : m_aggr(new Aggregator(aggr)),
+          m_recs(batch_size > 0 ? batch_size : 1),
+          m_count(0)
+    {
+        configure(spec);
+    }
+
+    BatchProcessorImpl(const QuerySpec& spec, SnapshotProcessFn push, std::size_t batch_size)
+        : m_push(push),
+          m_recs(batch_size > 0 ? batch_size : 1),
+          m_count(0)
+    {
+        configure(spec);
+    }
+};
+
+
+BatchProcessor::BatchProcessor(const QuerySpec& spec, Aggregator& aggr, std::size_t batch_size)
+    : mP(new BatchProcessorImpl(spec, aggr, batch_size))
+{ }
+
+BatchProcessor::BatchProcessor(const QuerySpec& spec, SnapshotProcessFn push, std::size_t batch_size)
+    : mP(new BatchProcessorImpl(spec, push, batch_size))
+{ }
+
+BatchProcessor::~BatchProcessor()
+{
+    mP.reset();
+}
+
+void
+BatchProcessor::add(CaliperMetadataAccessInterface& db, const EntryList& rec)
+{
+    mP->add(db, rec);
+}
+
+void
+BatchProcessor::flush(CaliperMetadataAccessInterface& db)
+{
+    mP->process(db);
+}
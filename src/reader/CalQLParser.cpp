@@ -7,6 +7,8 @@
 #include "caliper/reader/FormatProcessor.h"
 #include "caliper/reader/Preprocessor.h"
 
+#include "caliper/common/StringConverter.h"
+
 #include "../common/util/parse_util.h"
 
 #include <algorithm>
@@ -97,7 +99,8 @@ struct CalQLParser::CalQLParserImpl
         Select,
         Sort,
         Where,
-        Let
+        Let,
+        Limit
     };
 
     Clause get_clause_from_word(const std::string& w) {
@@ -111,6 +114,7 @@ struct CalQLParser::CalQLParserImpl
             { "order",     Sort      },
             { "where",     Where     },
             { "let",       Let       },
+            { "limit",     Limit     },
 
             { nullptr,     None      }
         };
@@ -607,6 +611,19 @@ struct CalQLParser::CalQLParserImpl
             parse_clause_from_word(next_keyword, is);
     }
 
+    void
+    parse_limit(std::istream& is) {
+        std::string w = util::read_word(is, ",;=<>()\n");
+
+        bool ok = !w.empty() && std::all_of(w.begin(), w.end(), ::isdigit);
+        uint64_t n = ok ? StringConverter(w).to_uint(&ok) : 0;
+
+        if (!ok || n == 0)
+            set_error("Expected positive integer for LIMIT, got \"" + w + "\"", is);
+        else
+            spec.limit = static_cast<std::size_t>(n);
+    }
+
     void
     parse_clause(Clause clause, std::istream& is) {
         switch (clause) {
@@ -633,6 +650,9 @@ struct CalQLParser::CalQLParserImpl
         case Let:
             parse_let(is);
             break;
+        case Limit:
+            parse_limit(is);
+            break;
         case None:
             // do nothing
             break;
@@ -690,6 +710,7 @@ struct CalQLParser::CalQLParserImpl
         spec.filter.selection    = QuerySpec::FilterSelection::None;
         spec.sort.selection      = QuerySpec::SortSelection::None;
         spec.format.opt          = QuerySpec::FormatSpec::Default;
+        spec.limit               = 0;
     }
 };
 
@@ -0,0 +1,163 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+///@file CaliBinaryFormat.h
+/// Definitions for the binary .cali (v2) container format
+
+#ifndef CALI_CALIBINARYFORMAT_H
+#define CALI_CALIBINARYFORMAT_H
+
+#include "caliper/common/Variant.h"
+
+#include "../common/util/vlenc.h"
+
+#include <cstring>
+#include <string>
+
+namespace cali
+{
+
+/// \brief Binary .cali file layout
+///
+/// A binary .cali file is a sequence of segments. Each segment is
+///
+///   magic (8 bytes)
+///   block*
+///   index block
+///   trailer (16 bytes)
+///
+/// A block is \c [type:u8][payload size:vlenc][record count:vlenc][payload].
+/// All integers in block payloads use the variable-length encoding from
+/// util/vlenc.h.
+///
+/// - String blocks ('S') hold a list of \c [len][bytes] strings. The
+///   strings are numbered consecutively across all string blocks of a
+///   segment.
+/// - Node blocks ('N') hold \c [id][attr][parent+1][value] node records.
+/// - Snapshot ('C') and globals ('G') blocks hold records in the layout
+///   used by CompressedSnapshotRecord: \c [n_refs][ref*][n_imm][attr,value]*,
+///   except that string values refer to the string table instead of
+///   holding pointers.
+/// - The index block ('X') lists \c [type][offset][count] for each block
+///   in the segment, with the offset relative to the segment start.
+///
+/// Blocks only refer to strings and nodes defined in earlier blocks, so
+/// a file can be read sequentially. The trailer holds the index block
+/// offset as a little-endian 64-bit value followed by the end marker.
+namespace calibin
+{
+
+const unsigned char Magic[8]   = { 0x89, 'C', 'A', 'L', 'I', 0x1a, 0x02, 0x00 };
+const unsigned char EndMark[8] = { 0x1a, 'C', 'A', 'L', 'I', 'X', 0x02, 0x00 };
+
+const size_t TrailerSize = 16;
+
+enum BlockType : unsigned char {
+    StringBlock   = 'S',
+    NodeBlock     = 'N',
+    SnapshotBlock = 'C',
+    GlobalsBlock  = 'G',
+    IndexBlock    = 'X'
+};
+
+inline bool
+has_magic(const unsigned char* buf, size_t len)
+{
+    return len >= sizeof(Magic) && std::memcmp(buf, Magic, sizeof(Magic)) == 0;
+}
+
+inline void
+append_u64(std::string& buf, uint64_t val)
+{
+    unsigned char tmp[10];
+    buf.append(reinterpret_cast<const char*>(tmp), vlenc_u64(val, tmp));
+}
+
+/// \brief Read a vlenc value from [\a p, \a end), or return false if the
+///   buffer ends before the value
+inline bool
+read_u64(const unsigned char* &p, const unsigned char* end, uint64_t* val)
+{
+    size_t n = 0;
+
+    if (end - p >= 10) {
+        *val = vldec_u64(p, &n);
+    } else {
+        // slow path near the end of the buffer: check every byte
+        *val = 0;
+
+        for ( ; p + n < end && n < 10; ++n) {
+            *val |= static_cast<uint64_t>(p[n] & 0x7F) << (7*n);
+
+            if (!(p[n] & 0x80))
+                break;
+        }
+
+        if (p + n == end || n == 10)
+            return false;
+
+        ++n;
+    }
+
+    p += n;
+    return true;
+}
+
+inline uint64_t
+zigzag_encode(int64_t val)
+{
+    return (static_cast<uint64_t>(val) << 1) ^ static_cast<uint64_t>(val >> 63);
+}
+
+inline int64_t
+zigzag_decode(uint64_t val)
+{
+    return static_cast<int64_t>(val >> 1) ^ -static_cast<int64_t>(val & 1);
+}
+
+/// \brief Append the encoding of non-string value \a v to \a buf
+///
+/// Layout is \c [type:u8][payload]. Strings must be handled by the caller
+/// (the payload is the string table index). User-defined data is dropped.
+inline void
+append_value(std::string& buf, const Variant& v)
+{
+    cali_attr_type type = v.type();
+    cali_variant_t cv   = v.c_variant();
+
+    buf.push_back(static_cast<char>(type));
+
+    switch (type) {
+    case CALI_TYPE_INT:
+        append_u64(buf, zigzag_encode(cv.value.v_int));
+        break;
+    case CALI_TYPE_DOUBLE:
+    {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &cv.value.v_double, sizeof(double));
+
+        for (int i = 0; i < 8; ++i)
+            buf.push_back(static_cast<char>((bits >> (8*i)) & 0xFF));
+    }
+        break;
+    case CALI_TYPE_UINT:
+    case CALI_TYPE_ADDR:
+    case CALI_TYPE_PTR:
+        append_u64(buf, cv.value.v_uint);
+        break;
+    case CALI_TYPE_BOOL:
+        append_u64(buf, cv.value.v_bool ? 1 : 0);
+        break;
+    case CALI_TYPE_TYPE:
+        append_u64(buf, static_cast<uint64_t>(cv.value.v_type));
+        break;
+    default:
+        break;
+    }
+}
+
+} // namespace calibin
+
+} // namespace cali
+
+#endif
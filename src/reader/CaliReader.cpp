@@ -5,15 +5,27 @@
 
 #include "caliper/reader/CaliperMetadataDB.h"
 
+#include "CaliBinaryFormat.h"
+
 #include "caliper/common/Log.h"
 #include "caliper/common/StringConverter.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace cali;
 using namespace std;
 
@@ -21,12 +33,12 @@ namespace
 {
 
 class fast_istringstream {
-    std::string::iterator it_;
-    std::string::iterator end_;
+    const char* it_;
+    const char* end_;
 
 public:
 
-    fast_istringstream(std::string::iterator b, std::string::iterator e)
+    fast_istringstream(const char* b, const char* e)
         : it_ { b }, end_ { e }
         { }
 
@@ -130,19 +142,371 @@ read_string_list(fast_istringstream& is)
     return ret;
 }
 
+/// \brief Decodes a binary .cali buffer in place
+///
+/// Numeric values are decoded directly from the buffer; string values
+/// point into the buffer until they are merged into the metadata DB.
+class BinaryBlockReader
+{
+    const unsigned char* m_begin;
+    const unsigned char* m_end;
+
+    /// string tables of all segments
+    std::vector<Variant> m_strings;
+    /// start of the current segment's string table in m_strings
+    size_t m_string_base;
+
+    IdMap& m_idmap;
+
+    std::string m_error_msg;
+    std::mutex  m_error_lock;
+
+    bool fail(const std::string& msg) {
+        std::lock_guard<std::mutex>
+            g(m_error_lock);
+
+        m_error_msg = msg;
+        return false;
+    }
+
+    bool read_value(const unsigned char* &p, const unsigned char* end, size_t string_base, Variant& v) {
+        if (p == end)
+            return fail("Unexpected end of block");
+
+        cali_attr_type type = static_cast<cali_attr_type>(*p++);
+        uint64_t u = 0;
+
+        cali_variant_t cv;
+        cv.type_and_size = type;
+        cv.value.v_uint  = 0;
+
+        switch (type) {
+        case CALI_TYPE_INV:
+            v = Variant();
+            return true;
+        case CALI_TYPE_USR:
+            v = Variant(CALI_TYPE_USR, nullptr, 0);
+            return true;
+        case CALI_TYPE_STRING:
+            if (!calibin::read_u64(p, end, &u) || u >= m_strings.size() - string_base)
+                return fail("Invalid string reference");
+            v = m_strings[string_base + u];
+            return true;
+        case CALI_TYPE_DOUBLE:
+            if (end - p < 8)
+                return fail("Unexpected end of block");
+            for (int i = 0; i < 8; ++i)
+                u |= static_cast<uint64_t>(p[i]) << (8*i);
+            p += 8;
+            std::memcpy(&cv.value.v_double, &u, sizeof(double));
+            break;
+        case CALI_TYPE_INT:
+            if (!calibin::read_u64(p, end, &u))
+                return fail("Unexpected end of block");
+            cv.value.v_int = calibin::zigzag_decode(u);
+            break;
+        case CALI_TYPE_UINT:
+        case CALI_TYPE_ADDR:
+        case CALI_TYPE_PTR:
+            if (!calibin::read_u64(p, end, &u))
+                return fail("Unexpected end of block");
+            cv.value.v_uint = u;
+            break;
+        case CALI_TYPE_BOOL:
+            if (!calibin::read_u64(p, end, &u))
+                return fail("Unexpected end of block");
+            cv = cali_make_variant_from_bool(u != 0);
+            break;
+        case CALI_TYPE_TYPE:
+            if (!calibin::read_u64(p, end, &u))
+                return fail("Unexpected end of block");
+            cv = cali_make_variant_from_type(static_cast<cali_attr_type>(u));
+            break;
+        default:
+            return fail("Invalid value type");
+        }
+
+        v = Variant(cv);
+        return true;
+    }
+
+    bool read_strings(const unsigned char* p, const unsigned char* end, uint64_t count) {
+        m_strings.reserve(m_strings.size() + count);
+
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t len = 0;
+
+            if (!calibin::read_u64(p, end, &len) || static_cast<uint64_t>(end - p) < len)
+                return fail("Invalid string block");
+
+            m_strings.push_back(Variant(CALI_TYPE_STRING, p, len));
+            p += len;
+        }
+
+        return true;
+    }
+
+    bool read_nodes(const unsigned char* p, const unsigned char* end, uint64_t count,
+                    CaliperMetadataDB& db, NodeProcessFn& node_proc) {
+        //   Decode the whole block first and merge it in one batch so we
+        // take the metadata DB locks only once
+        std::vector<CaliperMetadataDB::NodeInfo> infos(count);
+
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t id = 0, attr = 0, parent = 0;
+
+            if (!calibin::read_u64(p, end, &id) || !calibin::read_u64(p, end, &attr) ||
+                !calibin::read_u64(p, end, &parent))
+                return fail("Invalid node record");
+            if (!read_value(p, end, m_string_base, infos[i].value))
+                return false;
+
+            infos[i].node_id   = id;
+            infos[i].attr_id   = attr;
+            infos[i].parent_id = parent == 0 ? CALI_INV_ID : parent - 1;
+        }
+
+        std::vector<Node*> nodes(count, nullptr);
+
+        if (db.merge_nodes(count, infos.data(), m_idmap, nodes.data()) < count)
+            return fail("Invalid node record");
+
+        for (const Node* node : nodes)
+            node_proc(db, node);
+
+        return true;
+    }
+
+    bool read_records(const unsigned char* p, const unsigned char* end, uint64_t count, bool globals,
+                      size_t string_base, CaliperMetadataDB& db, const SnapshotProcessFn& snap_proc) {
+        const IdMap& idmap = m_idmap;
+        std::vector<Entry> rec;
+
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t nr = 0, ni = 0, id = 0;
+
+            rec.clear();
+
+            if (!calibin::read_u64(p, end, &nr))
+                return fail("Invalid snapshot record");
+
+            for (uint64_t r = 0; r < nr; ++r) {
+                if (!calibin::read_u64(p, end, &id))
+                    return fail("Invalid snapshot record");
+
+                if (globals)
+                    db.merge_global(id, idmap);
+                else
+                    rec.push_back(db.merge_entry(id, idmap));
+            }
+
+            if (!calibin::read_u64(p, end, &ni))
+                return fail("Invalid snapshot record");
+
+            for (uint64_t r = 0; r < ni; ++r) {
+                Variant v_data;
+
+                if (!calibin::read_u64(p, end, &id))
+                    return fail("Invalid snapshot record");
+                if (!read_value(p, end, string_base, v_data))
+                    return false;
+
+                if (globals)
+                    db.merge_global(id, v_data, idmap);
+                else
+                    rec.push_back(db.merge_entry(id, v_data, idmap));
+            }
+
+            if (!globals)
+                snap_proc(db, rec);
+        }
+
+        return true;
+    }
+
+public:
+
+    /// \brief A snapshot block whose processing was deferred
+    struct SnapshotBlockRef {
+        const unsigned char* begin;
+        const unsigned char* end;
+        uint64_t count;
+        size_t   string_base;
+    };
+
+    BinaryBlockReader(const unsigned char* buf, size_t len, IdMap& idmap)
+        : m_begin(buf), m_end(buf + len), m_string_base(0), m_idmap(idmap)
+        { }
+
+    std::string error_msg() const {
+        return m_error_msg;
+    }
+
+    /// \brief Read the buffer sequentially.
+    ///
+    /// If \a deferred is given, snapshot blocks are not processed but
+    /// appended to \a deferred. They can be processed later (and in
+    /// parallel) with read_snapshot_block(), once all nodes are known.
+    bool read(CaliperMetadataDB& db, NodeProcessFn& node_proc, SnapshotProcessFn& snap_proc,
+              std::vector<SnapshotBlockRef>* deferred = nullptr) {
+        const unsigned char* p = m_begin;
+
+        while (p < m_end) {
+            if (!calibin::has_magic(p, m_end - p))
+                return fail("Invalid binary .cali segment");
+
+            p += sizeof(calibin::Magic);
+            m_string_base = m_strings.size();
+
+            bool segment_done = false;
+
+            while (!segment_done) {
+                if (p == m_end)
+                    return fail("Truncated binary .cali file (missing block index)");
+
+                unsigned char type = *p++;
+                uint64_t size = 0, count = 0;
+
+                if (!calibin::read_u64(p, m_end, &size) || !calibin::read_u64(p, m_end, &count) ||
+                    static_cast<uint64_t>(m_end - p) < size)
+                    return fail("Truncated binary .cali block");
+
+                const unsigned char* block_end = p + size;
+                bool ok = true;
+
+                switch (type) {
+                case calibin::StringBlock:
+                    ok = read_strings(p, block_end, count);
+                    break;
+                case calibin::NodeBlock:
+                    ok = read_nodes(p, block_end, count, db, node_proc);
+                    break;
+                case calibin::SnapshotBlock:
+                    if (deferred)
+                        deferred->push_back(SnapshotBlockRef { p, block_end, count, m_string_base });
+                    else
+                        ok = read_records(p, block_end, count, false, m_string_base, db, snap_proc);
+                    break;
+                case calibin::GlobalsBlock:
+                    ok = read_records(p, block_end, count, true, m_string_base, db, snap_proc);
+                    break;
+                case calibin::IndexBlock:
+                    // we read blocks sequentially and don't need the index
+                    if (static_cast<size_t>(m_end - block_end) < calibin::TrailerSize ||
+                        !std::equal(calibin::EndMark, calibin::EndMark + 8, block_end + 8))
+                        return fail("Invalid binary .cali trailer");
+                    block_end += calibin::TrailerSize;
+                    segment_done = true;
+                    break;
+                default:
+                    // skip unknown block types
+                    break;
+                }
+
+                if (!ok)
+                    return false;
+
+                p = block_end;
+            }
+        }
+
+        return true;
+    }
+
+    bool read_snapshot_block(const SnapshotBlockRef& block, CaliperMetadataDB& db, const SnapshotProcessFn& snap_proc) {
+        return read_records(block.begin, block.end, block.count, false, block.string_base, db, snap_proc);
+    }
+};
+
+/// \brief Run \a fn(task, thread) for tasks [0, \a num_tasks) on
+///   \a num_threads threads
+template<typename Fn>
+void run_parallel(size_t num_tasks, size_t num_threads, Fn fn)
+{
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+
+    auto thread_fn = [&](size_t t) {
+            for (size_t i = next++; i < num_tasks; i = next++)
+                fn(i, t);
+        };
+
+    for (size_t t = 1; t < std::min(num_threads, num_tasks); ++t)
+        threads.emplace_back(thread_fn, t);
+
+    thread_fn(0);
+
+    for (auto& t : threads)
+        t.join();
+}
+
+/// \brief Read-only memory mapping of a file
+class MappedFile
+{
+    void*  m_addr;
+    size_t m_len;
+
+public:
+
+    MappedFile(const std::string& filename)
+        : m_addr(nullptr), m_len(0)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+
+        if (fd < 0)
+            return;
+
+        struct stat st;
+
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (addr != MAP_FAILED) {
+                m_addr = addr;
+                m_len  = st.st_size;
+            }
+        }
+
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (m_addr)
+            munmap(m_addr, m_len);
+    }
+
+    const unsigned char* data() const { return static_cast<const unsigned char*>(m_addr); }
+    size_t size() const { return m_len; }
+};
+
 } // namespace [anonymous]
 
 struct CaliReader::CaliReaderImpl
 {
     bool m_error;
     std::string m_error_msg;
+    std::mutex  m_error_lock;
     unsigned int m_num_read;
 
+    // file node ID -> DB node ID. In segment mode, this is kept across
+    // read() calls so that incremental output segments can be read one
+    // after another.
+    IdMap m_idmap;
+    bool  m_segments;
+
     CaliReaderImpl()
-        : m_error { false }
+        : m_error { false }, m_segments { false }
         { }
 
+    void begin_stream() {
+        if (!m_segments)
+            m_idmap.clear();
+    }
+
     void set_error(const std::string& msg) {
+        std::lock_guard<std::mutex>
+            g(m_error_lock);
+
         m_error = true;
         m_error_msg = msg;
     }
@@ -180,7 +544,7 @@ struct CaliReader::CaliReaderImpl
             set_error("Invalid node record");
     }
 
-    void read_snapshot(fast_istringstream& is, CaliperMetadataDB& db, IdMap& idmap, SnapshotProcessFn snap_proc)
+    void read_snapshot(fast_istringstream& is, CaliperMetadataDB& db, const IdMap& idmap, const SnapshotProcessFn& snap_proc)
     {
         std::vector<cali_id_t>   refs;
         std::vector<cali_id_t>   attr;
@@ -250,14 +614,110 @@ struct CaliReader::CaliReaderImpl
         }
     }
 
+    void read_binary(const unsigned char* buf, size_t len, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc) {
+        BinaryBlockReader reader(buf, len, m_idmap);
+
+        if (!reader.read(db, node_proc, snap_proc))
+            set_error(reader.error_msg());
+    }
+
     void read(std::istream& is, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc) {
-        IdMap idmap;
+        if (is.peek() == calibin::Magic[0]) {
+            // binary format: we need the whole stream in memory
+            std::string buf { std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>() };
+            read_binary(reinterpret_cast<const unsigned char*>(buf.data()), buf.size(), db, node_proc, snap_proc);
+            return;
+        }
 
         for (std::string line; std::getline(is, line); ) {
             if (line.empty())
                 continue;
-            fast_istringstream isstream { line.begin(), line.end() };
-            read_record(isstream, db, idmap, node_proc, snap_proc);
+            fast_istringstream isstream { line.data(), line.data() + line.size() };
+            read_record(isstream, db, m_idmap, node_proc, snap_proc);
+        }
+    }
+
+    void read_binary_parallel(const unsigned char* buf, size_t len, CaliperMetadataDB& db, NodeProcessFn node_proc, const std::vector<SnapshotProcessFn>& snap_procs) {
+        BinaryBlockReader reader(buf, len, m_idmap);
+        std::vector<BinaryBlockReader::SnapshotBlockRef> blocks;
+
+        // read strings, nodes, and globals first; then process the
+        // snapshot blocks in parallel
+
+        SnapshotProcessFn snap_proc = snap_procs.front();
+
+        if (!reader.read(db, node_proc, snap_proc, &blocks)) {
+            set_error(reader.error_msg());
+            return;
+        }
+
+        std::atomic<bool> ok(true);
+
+        run_parallel(blocks.size(), snap_procs.size(), [&](size_t i, size_t t){
+                if (!reader.read_snapshot_block(blocks[i], db, snap_procs[t]))
+                    ok.store(false);
+            });
+
+        if (!ok.load())
+            set_error(reader.error_msg());
+    }
+
+    void read_text_parallel(const char* buf, size_t len, CaliperMetadataDB& db, NodeProcessFn node_proc, const std::vector<SnapshotProcessFn>& snap_procs) {
+        const size_t ChunkSize = 4096; // lines per chunk
+
+        IdMap& idmap = m_idmap;
+        SnapshotProcessFn snap_proc = snap_procs.front();
+        std::vector< std::pair<const char*, const char*> > snapshot_lines;
+
+        // Nodes must be defined before use. Merge nodes and globals in
+        // order and collect the snapshot records for later.
+
+        for (const char* p = buf, *end = buf + len; p < end; ) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+
+            if (!eol)
+                eol = end;
+
+            if (eol > p) {
+                fast_istringstream is { p, eol };
+
+                if (is.matches(10, "__rec=ctx,"))
+                    snapshot_lines.push_back(std::make_pair(p + 10, eol));
+                else
+                    read_record(is, db, idmap, node_proc, snap_proc);
+            }
+
+            p = eol + 1;
+        }
+
+        size_t num_chunks = (snapshot_lines.size() + ChunkSize - 1) / ChunkSize;
+
+        run_parallel(num_chunks, snap_procs.size(), [&](size_t i, size_t t){
+                size_t end = std::min(snapshot_lines.size(), (i + 1) * ChunkSize);
+
+                for (size_t l = i * ChunkSize; l < end; ++l) {
+                    fast_istringstream is { snapshot_lines[l].first, snapshot_lines[l].second };
+                    read_snapshot(is, db, idmap, snap_procs[t]);
+                }
+            });
+    }
+
+    void read_parallel(const std::string& filename, CaliperMetadataDB& db, NodeProcessFn node_proc, const std::vector<SnapshotProcessFn>& snap_procs) {
+        MappedFile file(filename);
+
+        if (file.data() == nullptr) {
+            std::ifstream is(filename.c_str());
+
+            if (!is) {
+                set_error(std::string("Cannot open file ") + filename);
+                return;
+            }
+
+            read(is, db, node_proc, snap_procs.front());
+        } else if (calibin::has_magic(file.data(), file.size())) {
+            read_binary_parallel(file.data(), file.size(), db, node_proc, snap_procs);
+        } else {
+            read_text_parallel(reinterpret_cast<const char*>(file.data()), file.size(), db, node_proc, snap_procs);
         }
     }
 };
@@ -281,18 +741,36 @@ CaliReader::error_msg() const
     return mP->m_error_msg;
 }
 
+void
+CaliReader::set_segment_mode(bool enable)
+{
+    mP->m_segments = enable;
+}
+
 void
 CaliReader::read(std::istream& is, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc)
 {
+    mP->begin_stream();
     mP->read(is, db, node_proc, snap_proc);
 }
 
 void
 CaliReader::read(const std::string& filename, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc)
 {
+    mP->begin_stream();
+
     if (filename.empty())
         mP->read(std::cin, db, node_proc, snap_proc);
     else {
+        {
+            MappedFile file(filename);
+
+            if (calibin::has_magic(file.data(), file.size())) {
+                mP->read_binary(file.data(), file.size(), db, node_proc, snap_proc);
+                return;
+            }
+        }
+
         std::ifstream is(filename.c_str());
 
         if (!is) {
@@ -303,4 +781,16 @@ CaliReader::read(const std::string& filename, CaliperMetadataDB& db, NodeProcess
 
         mP->read(is, db, node_proc, snap_proc);
     }
-}
\ No newline at end of file
+}
+
+void
+CaliReader::read(const std::string& filename, CaliperMetadataDB& db, NodeProcessFn node_proc, const std::vector<SnapshotProcessFn>& snap_procs)
+{
+    if (filename.empty() || snap_procs.size() < 2)
+        read(filename, db, node_proc, snap_procs.empty() ?
+             [](CaliperMetadataAccessInterface&,const EntryList&){ } : snap_procs.front());
+    else {
+        mP->begin_stream();
+        mP->read_parallel(filename, db, node_proc, snap_procs);
+    }
+}
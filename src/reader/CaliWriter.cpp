@@ -1,7 +1,7 @@
 // Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
 // See top-level LICENSE file for details.
 
-// CsvWriter implementation
+// CaliWriter implementation
 
 #include "caliper/reader/CaliWriter.h"
 
@@ -9,10 +9,15 @@
 #include "caliper/common/Node.h"
 #include "caliper/common/OutputStream.h"
 
+#include "CaliBinaryFormat.h"
+
 #include "../common/util/format_util.h"
 
+#include <algorithm>
+#include <memory>
 #include <mutex>
 #include <set>
+#include <unordered_map>
 
 using namespace cali;
 
@@ -64,6 +69,179 @@ void write_record_content(std::ostream& os, const char* record_type, int nr, int
     os << '\n';
 }
 
+/// \brief Buffers records for the binary .cali format and writes them
+///   out in blocks
+class BinaryBlockWriter
+{
+    struct Block {
+        std::string buf;
+        uint64_t    count;
+
+        Block()
+            : count(0)
+            { }
+    };
+
+    struct IndexEntry {
+        unsigned char type;
+        uint64_t      offset;
+        uint64_t      count;
+    };
+
+    static const size_t MaxBufferedBytes = 1024 * 1024;
+
+    Block m_strings;
+    Block m_nodes;
+    Block m_snapshots;
+    Block m_globals;
+
+    std::unordered_map<std::string, uint64_t> m_string_idx;
+
+    std::vector<IndexEntry> m_index;
+    uint64_t m_pos; ///< bytes written in the current segment
+
+    uint64_t string_index(const char* str, size_t len) {
+        if (len > 0 && str[len-1] == '\0')
+            --len;
+
+        auto ret = m_string_idx.emplace(std::string(str, len), m_string_idx.size());
+
+        if (ret.second) {
+            calibin::append_u64(m_strings.buf, len);
+            m_strings.buf.append(str, len);
+            ++m_strings.count;
+        }
+
+        return ret.first->second;
+    }
+
+    void append_value(std::string& buf, const Variant& v) {
+        if (v.type() == CALI_TYPE_STRING) {
+            uint64_t idx = string_index(static_cast<const char*>(v.data()), v.size());
+            buf.push_back(static_cast<char>(CALI_TYPE_STRING));
+            calibin::append_u64(buf, idx);
+        } else {
+            calibin::append_value(buf, v);
+        }
+    }
+
+    void write_raw(std::ostream& os, const void* data, size_t len) {
+        os.write(static_cast<const char*>(data), len);
+        m_pos += len;
+    }
+
+    void write_block(std::ostream& os, unsigned char type, Block& block) {
+        if (block.count == 0)
+            return;
+
+        if (m_pos == 0)
+            write_raw(os, calibin::Magic, sizeof(calibin::Magic));
+
+        m_index.push_back(IndexEntry { type, m_pos, block.count });
+
+        std::string hdr(1, static_cast<char>(type));
+        calibin::append_u64(hdr, block.buf.size());
+        calibin::append_u64(hdr, block.count);
+
+        write_raw(os, hdr.data(), hdr.size());
+        write_raw(os, block.buf.data(), block.buf.size());
+
+        block.buf.clear();
+        block.count = 0;
+    }
+
+    void write_blocks(std::ostream& os) {
+        // strings and nodes must go before the records that refer to them
+        write_block(os, calibin::StringBlock,   m_strings);
+        write_block(os, calibin::NodeBlock,     m_nodes);
+        write_block(os, calibin::SnapshotBlock, m_snapshots);
+        write_block(os, calibin::GlobalsBlock,  m_globals);
+    }
+
+    void check_flush(std::ostream& os) {
+        size_t bytes =
+            m_strings.buf.size() + m_nodes.buf.size() + m_snapshots.buf.size() + m_globals.buf.size();
+
+        if (bytes > MaxBufferedBytes)
+            write_blocks(os);
+    }
+
+public:
+
+    BinaryBlockWriter()
+        : m_pos(0)
+        { }
+
+    void write_node(std::ostream& os, const Node* node) {
+        std::string& buf = m_nodes.buf;
+
+        calibin::append_u64(buf, node->id());
+        calibin::append_u64(buf, node->attribute());
+
+        cali_id_t parent = CALI_INV_ID;
+
+        if (node->parent() && node->parent()->id() != CALI_INV_ID)
+            parent = node->parent()->id();
+
+        calibin::append_u64(buf, parent == CALI_INV_ID ? 0 : parent + 1);
+        append_value(buf, node->data());
+
+        ++m_nodes.count;
+        check_flush(os);
+    }
+
+    void write_record(std::ostream& os, bool globals, int nr, int ni, const std::vector<Entry>& rec) {
+        Block& block = globals ? m_globals : m_snapshots;
+
+        calibin::append_u64(block.buf, nr);
+
+        for (const Entry& e : rec)
+            if (e.is_reference())
+                calibin::append_u64(block.buf, e.node()->id());
+
+        calibin::append_u64(block.buf, ni);
+
+        for (const Entry& e : rec)
+            if (e.is_immediate()) {
+                calibin::append_u64(block.buf, e.attribute());
+                append_value(block.buf, e.value());
+            }
+
+        ++block.count;
+        check_flush(os);
+    }
+
+    /// \brief Write out remaining blocks, the block index, and the trailer
+    void finish(std::ostream& os) {
+        write_blocks(os);
+
+        if (m_pos == 0)
+            return;
+
+        Block index;
+
+        for (const IndexEntry& e : m_index) {
+            index.buf.push_back(static_cast<char>(e.type));
+            calibin::append_u64(index.buf, e.offset);
+            calibin::append_u64(index.buf, e.count);
+            ++index.count;
+        }
+
+        uint64_t index_pos = m_pos;
+        write_block(os, calibin::IndexBlock, index);
+
+        unsigned char trailer[calibin::TrailerSize];
+
+        for (int i = 0; i < 8; ++i)
+            trailer[i] = static_cast<unsigned char>((index_pos >> (8*i)) & 0xFF);
+
+        std::copy(calibin::EndMark, calibin::EndMark + 8, trailer + 8);
+        write_raw(os, trailer, sizeof(trailer));
+
+        os.flush();
+    }
+};
+
 } // namespace [anonymous]
 
 struct CaliWriter::CaliWriterImpl
@@ -75,12 +253,43 @@ struct CaliWriter::CaliWriterImpl
     std::mutex    m_written_nodes_lock;
 
     std::size_t   m_num_written;
+    std::size_t   m_segment_written; ///< records written to the current stream
 
+    std::unique_ptr<BinaryBlockWriter> m_binary;
 
-    CaliWriterImpl(OutputStream& os)
+
+    CaliWriterImpl(OutputStream& os, CaliWriter::Format format)
         : m_os(os),
-          m_num_written(0)
-    { }
+          m_num_written(0),
+          m_segment_written(0)
+    {
+        if (format == CaliWriter::Binary)
+            m_binary.reset(new BinaryBlockWriter);
+    }
+
+    ~CaliWriterImpl()
+    {
+        if (m_binary && m_segment_written > 0)
+            m_binary->finish(*m_os.stream());
+    }
+
+    void next_segment(OutputStream& os)
+    {
+        std::lock_guard<std::mutex>
+            g(m_os_lock);
+
+        if (m_segment_written > 0) {
+            if (m_binary) {
+                m_binary->finish(*m_os.stream());
+                m_binary.reset(new BinaryBlockWriter);
+            }
+
+            m_os.stream()->flush();
+        }
+
+        m_os = os;
+        m_segment_written = 0;
+    }
 
     void recursive_write_node(const CaliperMetadataAccessInterface& db, cali_id_t id)
     {
@@ -113,8 +322,12 @@ struct CaliWriter::CaliWriterImpl
 
             std::ostream* real_os = m_os.stream();
 
-            ::write_node_content(*real_os, node);
+            if (m_binary)
+                m_binary->write_node(*real_os, node);
+            else
+                ::write_node_content(*real_os, node);
             ++m_num_written;
+            ++m_segment_written;
         }
 
         {
@@ -129,7 +342,7 @@ struct CaliWriter::CaliWriterImpl
     }
 
     void write_entrylist(const CaliperMetadataAccessInterface& db,
-                         const char* record_type,
+                         bool globals,
                          const std::vector<Entry>& rec)
     {
         // write node entries; count the number of ref and immediate entries
@@ -155,15 +368,19 @@ struct CaliWriter::CaliWriterImpl
 
             std::ostream* real_os = m_os.stream();
 
-            ::write_record_content(*real_os, record_type, nr, ni, rec);
+            if (m_binary)
+                m_binary->write_record(*real_os, globals, nr, ni, rec);
+            else
+                ::write_record_content(*real_os, globals ? "globals" : "ctx", nr, ni, rec);
             ++m_num_written;
+            ++m_segment_written;
         }
     }
 };
 
 
-CaliWriter::CaliWriter(OutputStream& os)
-    : mP(new CaliWriterImpl(os))
+CaliWriter::CaliWriter(OutputStream& os, Format format)
+    : mP(new CaliWriterImpl(os, format))
 { }
 
 CaliWriter::~CaliWriter()
@@ -176,12 +393,17 @@ size_t CaliWriter::num_written() const
     return mP ? mP->m_num_written : 0;
 }
 
+void CaliWriter::next_segment(OutputStream& os)
+{
+    mP->next_segment(os);
+}
+
 void CaliWriter::write_snapshot(const CaliperMetadataAccessInterface& db, const std::vector<Entry>& list)
 {
-    mP->write_entrylist(db, "ctx", list);
+    mP->write_entrylist(db, false, list);
 }
 
 void CaliWriter::write_globals(const CaliperMetadataAccessInterface& db, const std::vector<Entry>& list)
 {
-    mP->write_entrylist(db, "globals", list);
+    mP->write_entrylist(db, true, list);
 }
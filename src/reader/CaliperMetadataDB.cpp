@@ -24,8 +24,7 @@ namespace
 
 inline cali_id_t
 map_id(cali_id_t id, const IdMap& idmap) {
-    auto it = idmap.find(id);
-    return it == idmap.end() ? id : it->second;
+    return idmap.map(id);
 }
 
 } // namespace
@@ -130,12 +129,18 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
 
     /// \brief Make string variant from string database
     Variant make_string_variant(const char* str, size_t len) {
-        if (len > 0 && str[len-1] == '\0')
-            --len;
-
         std::lock_guard<std::mutex>
             g(m_string_db_lock);
 
+        return make_string_variant_locked(str, len);
+    }
+
+    Variant make_string_variant_locked(const char* str, size_t len) {
+        // NOTE: We assume that m_string_db_lock is locked!
+
+        if (len > 0 && str[len-1] == '\0')
+            --len;
+
         auto it = std::lower_bound(m_string_db.begin(), m_string_db.end(), str,
                                    [len](const char* a, const char* b) {
                                        return strncmp(a, b, len) < 0;
@@ -173,10 +178,13 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         return ret;
     }
 
-    /// Merge node given by un-mapped node info from stream with given \a idmap into DB
+    /// Merge node with mapped attribute and parent IDs into DB.
     /// If \a v_data is a string, it must already be in the string database!
-    Node* merge_node(cali_id_t node_id, cali_id_t attr_id, cali_id_t prnt_id, const Variant& v_data) {
-        if (attribute(attr_id) == Attribute::invalid)
+    /// Sets \a new_node if the node was created.
+    Node* merge_node_locked(cali_id_t node_id, cali_id_t attr_id, cali_id_t prnt_id, const Variant& v_data, bool* new_node) {
+        // NOTE: We assume that m_node_lock is locked!
+
+        if (attr_id >= m_nodes.size() || !Attribute::make_attribute(m_nodes[attr_id]))
             attr_id = CALI_INV_ID;
 
         if (node_id == CALI_INV_ID || attr_id == CALI_INV_ID || v_data.empty()) {
@@ -192,9 +200,6 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         Node* parent = &m_root;
 
         if (prnt_id != CALI_INV_ID) {
-            std::lock_guard<std::mutex>
-                g(m_node_lock);
-
             if (prnt_id >= m_nodes.size()) {
                 Log(0).stream() << "CaliperMetadataDB::merge_node(): Invalid parent node " << prnt_id << " for "
                                 <<  "id="       << node_id
@@ -208,6 +213,25 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
             parent = m_nodes[prnt_id];
         }
 
+        Node* node = nullptr;
+
+        for ( node = parent->first_child(); node && !node->equals(attr_id, v_data); node = node->next_sibling() )
+            ;
+
+        if (!node) {
+            node      = create_node(attr_id, v_data, parent);
+            *new_node = true;
+        }
+
+        return node;
+    }
+
+    /// Merge node given by un-mapped node info from stream with given \a idmap into DB
+    /// If \a v_data is a string, it must already be in the string database!
+    Node* merge_node(cali_id_t node_id, cali_id_t attr_id, cali_id_t prnt_id, const Variant& v_data, IdMap& idmap) {
+        attr_id = ::map_id(attr_id, idmap);
+        prnt_id = ::map_id(prnt_id, idmap);
+
         Node* node     = nullptr;
         bool  new_node = false;
 
@@ -215,15 +239,15 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
             std::lock_guard<std::mutex>
                 g(m_node_lock);
 
-            for ( node = parent->first_child(); node && !node->equals(attr_id, v_data); node = node->next_sibling() )
-                ;
-
-            if (!node) {
-                node     = create_node(attr_id, v_data, parent);
-                new_node = true;
-            }
+            node = merge_node_locked(node_id, attr_id, prnt_id, v_data, &new_node);
         }
 
+        if (!node)
+            return nullptr;
+
+        if (node_id != node->id())
+            idmap.insert(std::make_pair(node_id, node->id()));
+
         if (new_node && node->attribute() == Attribute::NAME_ATTR_ID) {
             std::lock_guard<std::mutex>
                 g(m_attribute_lock);
@@ -234,18 +258,61 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         return node;
     }
 
-    /// Merge node given by un-mapped node info from stream with given \a idmap into DB
-    /// If \a v_data is a string, it must already be in the string database!
-    Node* merge_node(cali_id_t node_id, cali_id_t attr_id, cali_id_t prnt_id, const Variant& v_data, IdMap& idmap) {
-        attr_id = ::map_id(attr_id, idmap);
-        prnt_id = ::map_id(prnt_id, idmap);
+    size_t merge_nodes(size_t n, const CaliperMetadataDB::NodeInfo nodes[], IdMap& idmap, Node* out[]) {
+        std::vector<Variant> values(n);
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_string_db_lock);
 
-        Node* node = merge_node(node_id, attr_id, prnt_id, v_data);
+            for (size_t i = 0; i < n; ++i) {
+                const Variant& v = nodes[i].value;
 
-        if (node_id != node->id())
-            idmap.insert(make_pair(node_id, node->id()));
+                if (v.type() == CALI_TYPE_STRING)
+                    values[i] = make_string_variant_locked(static_cast<const char*>(v.data()), v.size());
+                else
+                    values[i] = v;
+            }
+        }
 
-        return node;
+        std::vector<Node*> new_attributes;
+        size_t num_merged = 0;
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_node_lock);
+
+            for (size_t i = 0; i < n; ++i) {
+                bool  new_node = false;
+                Node* node =
+                    merge_node_locked(nodes[i].node_id,
+                                      ::map_id(nodes[i].attr_id, idmap),
+                                      ::map_id(nodes[i].parent_id, idmap),
+                                      values[i], &new_node);
+
+                if (out)
+                    out[i] = node;
+                if (!node)
+                    continue;
+
+                ++num_merged;
+
+                if (nodes[i].node_id != node->id())
+                    idmap.insert(std::make_pair(nodes[i].node_id, node->id()));
+                if (new_node && node->attribute() == Attribute::NAME_ATTR_ID)
+                    new_attributes.push_back(node);
+            }
+        }
+
+        if (!new_attributes.empty()) {
+            std::lock_guard<std::mutex>
+                g(m_attribute_lock);
+
+            for (Node* node : new_attributes)
+                m_attributes.insert(make_pair(string(node->data().to_string()), node));
+        }
+
+        return num_merged;
     }
 
     EntryList merge_snapshot(size_t n_nodes, const cali_id_t node_ids[],
@@ -255,10 +322,17 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         EntryList list;
         list.reserve(n_nodes + n_imm);
 
-        for (size_t i = 0; i < n_nodes; ++i)
-            list.push_back(Entry(node(::map_id(node_ids[i], idmap))));
-        for (size_t i = 0; i < n_imm; ++i)
-            list.push_back(Entry(attribute(::map_id(attr_ids[i], idmap)), values[i]));
+        std::lock_guard<std::mutex>
+            g(m_node_lock);
+
+        for (size_t i = 0; i < n_nodes; ++i) {
+            cali_id_t id = ::map_id(node_ids[i], idmap);
+            list.push_back(Entry(id < m_nodes.size() ? m_nodes[id] : nullptr));
+        }
+        for (size_t i = 0; i < n_imm; ++i) {
+            cali_id_t id = ::map_id(attr_ids[i], idmap);
+            list.push_back(Entry(id < m_nodes.size() ? Attribute::make_attribute(m_nodes[id]) : Attribute::invalid, values[i]));
+        }
 
         return list;
     }
@@ -279,7 +353,24 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         if (v_data.type() == CALI_TYPE_STRING)
             v_data = make_string_variant(static_cast<const char*>(v_data.data()), v_data.size());
 
-        return merge_node(node->id(), attr_node->id(), parent ? parent->id() : CALI_INV_ID, v_data);
+        bool  new_node = false;
+        Node* ret      = nullptr;
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_node_lock);
+
+            ret = merge_node_locked(node->id(), attr_node->id(), parent ? parent->id() : CALI_INV_ID, v_data, &new_node);
+        }
+
+        if (new_node && ret->attribute() == Attribute::NAME_ATTR_ID) {
+            std::lock_guard<std::mutex>
+                g(m_attribute_lock);
+
+            m_attributes.insert(make_pair(string(ret->data().to_string()), ret));
+        }
+
+        return ret;
     }
 
     EntryList merge_snapshot(const CaliperMetadataAccessInterface& db,
@@ -544,6 +635,12 @@ CaliperMetadataDB::merge_node(cali_id_t node_id, cali_id_t attr_id, cali_id_t pr
     return mP->merge_node(node_id, attr_id, prnt_id, v_data, idmap);
 }
 
+size_t
+CaliperMetadataDB::merge_nodes(size_t n, const NodeInfo nodes[], IdMap& idmap, Node* out[])
+{
+    return mP->merge_nodes(n, nodes, idmap, out);
+}
+
 Node*
 CaliperMetadataDB::merge_node(cali_id_t node_id, cali_id_t attr_id, cali_id_t prnt_id, const std::string& data, IdMap& idmap)
 {
@@ -573,6 +670,12 @@ CaliperMetadataDB::merge_snapshot(const CaliperMetadataAccessInterface& db,
     return mP->merge_snapshot(db, rec);
 }
 
+Attribute
+CaliperMetadataDB::import_attribute(const CaliperMetadataAccessInterface& db, const Attribute& attr)
+{
+    return Attribute::make_attribute(mP->recursive_merge_node(attr.node(), db));
+}
+
 Entry
 CaliperMetadataDB::merge_entry(cali_id_t node_id, const IdMap& idmap)
 {
@@ -587,6 +690,22 @@ CaliperMetadataDB::merge_entry(cali_id_t attr_id, const std::string& data, const
     return attr ? Entry(attr, mP->make_variant(attr.type(), data)) : Entry();
 }
 
+Entry
+CaliperMetadataDB::merge_entry(cali_id_t attr_id, const Variant& value, const IdMap& idmap)
+{
+    Attribute attr = mP->attribute(::map_id(attr_id, idmap));
+
+    if (!attr)
+        return Entry();
+
+    Variant v_data = value;
+
+    if (v_data.type() == CALI_TYPE_STRING)
+        v_data = mP->make_string_variant(static_cast<const char*>(value.data()), value.size());
+
+    return Entry(attr, v_data);
+}
+
 void
 CaliperMetadataDB::merge_global(cali_id_t node_id, const IdMap& idmap)
 {
@@ -601,6 +720,22 @@ CaliperMetadataDB::merge_global(cali_id_t attr_id, const std::string& data, cons
         mP->set_global(attr, mP->make_variant(attr.type(), data));
 }
 
+void
+CaliperMetadataDB::merge_global(cali_id_t attr_id, const Variant& value, const IdMap& idmap)
+{
+    Attribute attr = mP->attribute(::map_id(attr_id, idmap));
+
+    if (!attr)
+        return;
+
+    Variant v_data = value;
+
+    if (v_data.type() == CALI_TYPE_STRING)
+        v_data = mP->make_string_variant(static_cast<const char*>(value.data()), value.size());
+
+    mP->set_global(attr, v_data);
+}
+
 Node*
 CaliperMetadataDB::node(cali_id_t id) const
 {
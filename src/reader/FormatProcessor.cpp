@@ -15,11 +15,14 @@
 #include "caliper/common/CaliperMetadataAccessInterface.h"
 #include "caliper/common/OutputStream.h"
 
+#include <atomic>
+
 using namespace cali;
 
 namespace
 {
 
+const char* cali_kernel_args[]   = { "binary" };
 const char* format_kernel_args[] = { "format", "title" };
 const char* tree_kernel_args[]   = { "path-attributes", "column-width", "print-globals" };
 const char* table_kernel_args[]  = { "column-width", "print-globals" };
@@ -36,7 +39,7 @@ enum FormatterID {
 };
 
 const QuerySpec::FunctionSignature formatters[] = {
-    { FormatterID::Cali,      "cali",       0, 0, nullptr },
+    { FormatterID::Cali,      "cali",       0, 1, cali_kernel_args },
     { FormatterID::Cali,      "csv",        0, 0, nullptr }, // keep old "csv" name for backwards compatibility
     { FormatterID::Json,      "json",       0, 6, json_kernel_args },
     { FormatterID::Expand,    "expand",     0, 0, nullptr },
@@ -54,8 +57,8 @@ class CaliFormatter : public Formatter
 
 public:
 
-    CaliFormatter(OutputStream& os)
-        : m_writer(CaliWriter(os))
+    CaliFormatter(OutputStream& os, CaliWriter::Format format = CaliWriter::Text)
+        : m_writer(CaliWriter(os, format))
     { }
 
     void process_record(CaliperMetadataAccessInterface& db, const EntryList& list) {
@@ -74,13 +77,20 @@ struct FormatProcessor::FormatProcessorImpl
     Formatter*   m_formatter;
     OutputStream m_stream;
 
+    // Record limit for formatters that don't handle LIMIT themselves.
+    // These write records in input order, so we pass on the first ones.
+    std::size_t              m_limit;
+    std::atomic<std::size_t> m_count;
+
     void create_formatter(const QuerySpec& spec) {
         if (spec.format.opt == QuerySpec::FormatSpec::Default) {
             m_formatter = new CaliFormatter(m_stream);
         } else {
             switch (spec.format.formatter.id) {
             case FormatterID::Cali:
-                m_formatter = new CaliFormatter(m_stream);
+                m_formatter =
+                    new CaliFormatter(m_stream, spec.format.kwargs.count("binary") > 0 ?
+                                      CaliWriter::Binary : CaliWriter::Text);
                 break;
             case FormatterID::Json:
                 m_formatter = new JsonFormatter(m_stream, spec);
@@ -93,9 +103,11 @@ struct FormatProcessor::FormatProcessorImpl
                 break;
             case FormatterID::Table:
                 m_formatter = new TableFormatter(spec);
+                m_limit     = 0;
                 break;
             case FormatterID::Tree:
                 m_formatter = new TreeFormatter(spec);
+                m_limit     = 0;
                 break;
             case FormatterID::JsonSplit:
                 m_formatter = new JsonSplitFormatter(spec);
@@ -105,7 +117,7 @@ struct FormatProcessor::FormatProcessorImpl
     }
 
     FormatProcessorImpl(OutputStream& stream, const QuerySpec& spec)
-        : m_formatter(nullptr), m_stream(stream)
+        : m_formatter(nullptr), m_stream(stream), m_limit(spec.limit), m_count(0)
     {
         create_formatter(spec);
     }
@@ -135,6 +147,8 @@ FormatProcessor::formatter_defs()
 void
 FormatProcessor::process_record(CaliperMetadataAccessInterface& db, const EntryList& rec)
 {
+    if (mP->m_limit > 0 && mP->m_count.fetch_add(1) >= mP->m_limit)
+        return;
     if (mP->m_formatter)
         mP->m_formatter->process_record(db, rec);
 }
@@ -18,7 +18,9 @@ Variant
 SnapshotTreeNode::min_val(const Attribute& key)
 {
     {
-        auto it = m_v_min.find(key);
+        auto it = std::find_if(m_v_min.begin(), m_v_min.end(), [&key](const std::pair<Attribute,Variant>& p){
+                return p.first == key;
+            });
         if (it != m_v_min.end())
             return it->second;
     }
@@ -37,7 +39,7 @@ SnapshotTreeNode::min_val(const Attribute& key)
     for (SnapshotTreeNode* node = first_child(); node; node = node->next_sibling())
         val = val ? std::min(val, node->min_val(key)) : node->min_val(key);
 
-    m_v_min[key] = val;
+    m_v_min.push_back(std::make_pair(key, val));
     return val;
 }
 
@@ -45,7 +47,9 @@ Variant
 SnapshotTreeNode::max_val(const Attribute& key)
 {
     {
-        auto it = m_v_max.find(key);
+        auto it = std::find_if(m_v_max.begin(), m_v_max.end(), [&key](const std::pair<Attribute,Variant>& p){
+                return p.first == key;
+            });
         if (it != m_v_max.end())
             return it->second;
     }
@@ -64,7 +68,7 @@ SnapshotTreeNode::max_val(const Attribute& key)
     for (SnapshotTreeNode* node = first_child(); node; node = node->next_sibling())
         val = val ? std::max(val, node->max_val(key)) : node->max_val(key);
 
-    m_v_max[key] = val;
+    m_v_max.push_back(std::make_pair(key, val));
     return val;
 }
 
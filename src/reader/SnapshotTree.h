@@ -13,6 +13,8 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <utility>
+#include <vector>
 
 namespace cali
 {
@@ -64,8 +66,9 @@ class SnapshotTreeNode : public util::LockfreeIntrusiveTree<SnapshotTreeNode>
 
     std::vector<Record> m_records;
 
-    std::map<Attribute, Variant> m_v_min;
-    std::map<Attribute, Variant> m_v_max;
+    // cached min_val()/max_val() results; there are only a few sort keys
+    std::vector< std::pair<Attribute, Variant> > m_v_min;
+    std::vector< std::pair<Attribute, Variant> > m_v_max;
 
     void add_record(const Record& rec) {
         m_records.push_back(rec);
@@ -42,8 +42,76 @@ struct TableFormatter::TableImpl
             { }
     };
 
+    /// \brief A table cell. Holds the value of an immediate entry or of
+    ///   a single path node. If the value is spread over several nested
+    ///   nodes of the column attribute, \a node points to the innermost
+    ///   one and the "a/b/c" path string is only built for output.
+    struct Cell {
+        Variant     value;
+        const Node* node;
+
+        Cell()
+            : node(nullptr)
+            { }
+
+        bool empty() const {
+            return node == nullptr && value.empty();
+        }
+
+        std::string to_string() const {
+            if (!node)
+                return value.to_string();
+
+            std::string str;
+
+            for (const Node* n = node; n; n = n->parent())
+                if (n->attribute() == node->attribute())
+                    str = n->data().to_string().append(str.empty() ? "" : "/").append(str);
+
+            return str;
+        }
+    };
+
+    /// \brief A row's value in a sort column, computed once per row.
+    ///   Strings and "a/b/c" paths compare as strings; other values
+    ///   compare as Variants. Cells of different types (e.g., empty
+    ///   ones) are ordered by type, as in Variant comparisons.
+    struct SortKey {
+        cali_attr_type type;
+        Variant        value;
+        std::string    str;
+
+        explicit SortKey(const Cell& cell) {
+            if (cell.node || cell.value.type() == CALI_TYPE_STRING) {
+                type = CALI_TYPE_STRING;
+                str  = cell.to_string();
+            } else {
+                type  = cell.value.type();
+                value = cell.value;
+            }
+        }
+
+        int compare(const SortKey& other) const {
+            if (type != other.type)
+                return type < other.type ? -1 : 1;
+            if (type == CALI_TYPE_STRING)
+                return str.compare(other.str);
+
+            return value < other.value ? -1 : (other.value < value ? 1 : 0);
+        }
+    };
+
+    struct Row {
+        std::vector<Cell>    cells;
+        std::vector<SortKey> sort_keys; // one per m_sort_cols entry
+        std::size_t          seq;       // insertion order, keeps the sort stable
+    };
+
     std::vector<Column>                     m_cols;
-    std::vector< std::vector<std::string> > m_rows;
+    std::vector<Row>                        m_rows;
+
+    /// \brief (column index, order) of the sort columns
+    std::vector< std::pair<std::size_t, QuerySpec::SortSpec::Order> > m_sort_cols;
 
     std::mutex                              m_col_lock;
     std::mutex                              m_row_lock;
@@ -56,10 +124,21 @@ struct TableFormatter::TableImpl
 
     bool                                    m_print_globals;
 
+    std::size_t                             m_limit;
+    std::size_t                             m_num_rows;
+
     int column_width(int base) const {
         return std::max(m_max_column_width > 0 ? std::min(base, m_max_column_width) : base, 4);
     }
 
+    void update_sort_columns() {
+        m_sort_cols.clear();
+
+        for (std::vector<Column>::size_type c = 0; c < m_cols.size(); ++c)
+            if (m_cols[c].sort_order != QuerySpec::SortSpec::Order::None)
+                m_sort_cols.emplace_back(c, m_cols[c].sort_order);
+    }
+
     void parse(const std::string& field_string, const std::string& sort_string) {
         std::vector<std::string> fields;
 
@@ -95,6 +174,7 @@ struct TableFormatter::TableImpl
         m_auto_column = false;
 
         m_aliases = spec.aliases;
+        m_limit   = spec.limit;
 
         // Set max column width
 
@@ -129,6 +209,8 @@ struct TableFormatter::TableImpl
             break;
         }
 
+        update_sort_columns();
+
         // Fill header columns
 
         switch (spec.select.selection) {
@@ -185,7 +267,7 @@ struct TableFormatter::TableImpl
         m_cols.emplace_back(name, alias, alias.size(), attr, true);
     }
 
-    std::vector<Column> update_columns(CaliperMetadataAccessInterface& db, const EntryList& list) {
+    std::vector<Attribute> update_columns(CaliperMetadataAccessInterface& db, const EntryList& list) {
         std::lock_guard<std::mutex>
             g(m_col_lock);
 
@@ -203,71 +285,128 @@ struct TableFormatter::TableImpl
 
         // Check if we can look up attribute object from name
 
-        for (Column& col : m_cols)
+        std::vector<Attribute> attrs;
+        attrs.reserve(m_cols.size());
+
+        for (Column& col : m_cols) {
             if (col.attr == Attribute::invalid)
                 col.attr = db.get_attribute(col.name);
 
-        return m_cols;
+            attrs.push_back(col.attr);
+        }
+
+        return attrs;
+    }
+
+    /// \brief Strict output order of two rows
+    ///
+    /// Rows are ordered as if stable-sorted by each sort column in turn,
+    /// i.e. the last sort column is the primary key.
+    bool row_before(const Row& lhs, const Row& rhs) const {
+        for (std::size_t i = m_sort_cols.size(); i-- > 0; ) {
+            int cmp = lhs.sort_keys[i].compare(rhs.sort_keys[i]);
+
+            if (cmp != 0)
+                return m_sort_cols[i].second == QuerySpec::SortSpec::Order::Ascending ? cmp < 0 : cmp > 0;
+        }
+
+        return lhs.seq < rhs.seq;
+    }
+
+    /// \brief Add a row. Keeps at most \a m_limit rows if a limit is set:
+    ///   the first ones if there are no sort columns, otherwise the top
+    ///   ones using a heap with the last row in output order on top.
+    void push_row(Row&& row) {
+        // NOTE: assumes m_row_lock is held
+
+        row.seq = m_num_rows++;
+
+        if (m_limit == 0 || m_sort_cols.empty()) {
+            if (m_limit == 0 || m_rows.size() < m_limit)
+                m_rows.push_back(std::move(row));
+            return;
+        }
+
+        auto cmp = [this](const Row& lhs, const Row& rhs){
+                return row_before(lhs, rhs);
+            };
+
+        if (m_rows.size() < m_limit) {
+            m_rows.push_back(std::move(row));
+            std::push_heap(m_rows.begin(), m_rows.end(), cmp);
+        } else if (row_before(row, m_rows.front())) {
+            std::pop_heap(m_rows.begin(), m_rows.end(), cmp);
+            m_rows.back() = std::move(row);
+            std::push_heap(m_rows.begin(), m_rows.end(), cmp);
+        }
     }
 
     void add(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::vector<Column> cols = update_columns(db, list);
-        std::vector<std::string> row(cols.size());
+        if (m_limit > 0 && m_sort_cols.empty()) {
+            std::lock_guard<std::mutex>
+                g(m_row_lock);
+
+            // without sorting, we keep the first m_limit rows
+            if (m_rows.size() >= m_limit)
+                return;
+        }
+
+        std::vector<Attribute> attrs = update_columns(db, list);
+
+        Row  row;
+        row.cells.resize(attrs.size());
 
         bool active = false;
-        bool update_max_width = false;
 
-        for (std::vector<Column>::size_type c = 0; c < cols.size(); ++c) {
-            if (cols[c].attr == Attribute::invalid)
+        for (std::vector<Attribute>::size_type c = 0; c < attrs.size(); ++c) {
+            if (attrs[c] == Attribute::invalid)
                 continue;
 
-            std::string val;
+            cali_id_t attr_id = attrs[c].id();
+            Cell&     cell    = row.cells[c];
 
             for (Entry e : list) {
                 if (e.is_reference()) {
-                    std::string str;
+                    int count = 0;
 
                     for (const Node* node = e.node(); node; node = node->parent())
-                        if (node->attribute() == cols[c].attr.id())
-                            str = node->data().to_string().append(str.empty() ? "" : "/").append(str);
+                        if (node->attribute() == attr_id) {
+                            if (count++ == 0)
+                                cell.node = node;
+                            else
+                                break;
+                        }
+
+                    if (count == 1) {
+                        // a single path node: keep its typed value
+                        cell.value = cell.node->data();
+                        cell.node  = nullptr;
+                    }
 
-                    if (!str.empty()) {
-                        val = str;
+                    if (count > 0)
                         break;
-                    }
-                } else if (e.attribute() == cols[c].attr.id()) {
-                    val = e.value().to_string();
+                } else if (e.attribute() == attr_id) {
+                    cell.value = e.value();
                     break;
                 }
             }
 
-            if (!val.empty()) {
+            if (!cell.empty())
                 active = true;
-                row[c] = val;
-
-                size_t width = val.length();
-
-                if (width > cols[c].width) {
-                    cols[c].width    = width;
-                    update_max_width = true;
-                }
-            }
         }
 
         if (active) {
-            std::lock_guard<std::mutex>
-                g(m_row_lock);
+            static const Cell empty_cell;
 
-            m_rows.push_back(std::move(row));
-        }
+            row.sort_keys.reserve(m_sort_cols.size());
+
+            for (const auto &p : m_sort_cols)
+                row.sort_keys.emplace_back(p.first < row.cells.size() ? row.cells[p.first] : empty_cell);
 
-        if (update_max_width) {
             std::lock_guard<std::mutex>
-                g(m_col_lock);
+                g(m_row_lock);
 
-            for (std::vector<Column>::size_type c = 0; c < cols.size(); ++c)
-                if (cols[c].width > m_cols[c].width)
-                    m_cols[c].width = cols[c].width;
+            push_row(std::move(row));
         }
     }
 
@@ -275,25 +414,25 @@ struct TableFormatter::TableImpl
         // NOTE: No locking, assume flush() runs serially
 
         // sort rows
-        // NOTE: This is REALLY slow (potentially converts strings to numbers on every comparison)
 
-        for (std::vector<Column>::size_type c = 0; c < m_cols.size(); ++c)
-            if (m_cols[c].sort_order == QuerySpec::SortSpec::Order::Ascending)
-                std::stable_sort(m_rows.begin(), m_rows.end(),
-                                 [c,this](const std::vector<std::string>& lhs, const std::vector<std::string>& rhs){
-                                     if (c >= lhs.size() || c >= rhs.size())
-                                         return lhs.size() < rhs.size();
-                                     cali_attr_type type = this->m_cols[c].attr.type();
-                                     return Variant::from_string(type, lhs[c].c_str()) < Variant::from_string(type, rhs[c].c_str());
-                                 });
-            else if (m_cols[c].sort_order == QuerySpec::SortSpec::Order::Descending)
-                std::stable_sort(m_rows.begin(), m_rows.end(),
-                                 [c,this](const std::vector<std::string>& lhs, const std::vector<std::string>& rhs){
-                                     if (c >= lhs.size() || c >= rhs.size())
-                                         return lhs.size() > rhs.size();
-                                     cali_attr_type type = this->m_cols[c].attr.type();
-                                     return Variant::from_string(type, lhs[c].c_str()) > Variant::from_string(type, rhs[c].c_str());
-                                 });
+        if (!m_sort_cols.empty()) {
+            auto cmp = [this](const Row& lhs, const Row& rhs){
+                    return row_before(lhs, rhs);
+                };
+
+            if (m_limit > 0)
+                std::sort_heap(m_rows.begin(), m_rows.end(), cmp);
+            else
+                std::sort(m_rows.begin(), m_rows.end(), cmp);
+        }
+
+        // update column widths. Values are formatted again for printing
+        // so we don't have to keep the strings for all rows.
+
+        for (const Row& row : m_rows)
+            for (std::vector<Cell>::size_type c = 0; c < row.cells.size(); ++c)
+                if (m_cols[c].print && !row.cells[c].empty())
+                    m_cols[c].width = std::max(m_cols[c].width, row.cells[c].to_string().length());
 
         // print header
 
@@ -307,13 +446,13 @@ struct TableFormatter::TableImpl
 
         // print rows
 
-        for (auto row : m_rows) {
-            for (std::vector<Column>::size_type c = 0; c < row.size(); ++c) {
+        for (const Row& row : m_rows) {
+            for (std::vector<Cell>::size_type c = 0; c < row.cells.size(); ++c) {
                 if (!m_cols[c].print)
                     continue;
 
                 int            width = column_width(m_cols[c].width);
-                std::string    str = util::clamp_string(row[c], width);
+                std::string    str = util::clamp_string(row.cells[c].empty() ? std::string() : row.cells[c].to_string(), width);
                 cali_attr_type t   = m_cols[c].attr.type();
                 bool           align_right = (t == CALI_TYPE_INT  ||
                                               t == CALI_TYPE_UINT ||
@@ -330,7 +469,7 @@ struct TableFormatter::TableImpl
     }
 
     TableImpl()
-        : m_max_column_width(60), m_print_globals(false)
+        : m_max_column_width(60), m_print_globals(false), m_limit(0), m_num_rows(0)
         { }
 };
 
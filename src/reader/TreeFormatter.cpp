@@ -61,6 +61,20 @@ struct TreeFormatter::TreeFormatterImpl
 
     std::mutex               m_path_key_lock;
 
+    /// \brief A record kept for output when a LIMIT is set
+    struct PendingRecord {
+        EntryList            rec;
+        std::vector<Variant> keys; // values of the sort attributes
+        std::size_t          seq;  // insertion order
+    };
+
+    std::size_t                m_limit;
+    std::size_t                m_num_records;
+    std::vector<PendingRecord> m_pending;   // heap with the last record in output order on top
+    std::vector<Attribute>     m_sort_keys; // sort attributes, looked up lazily
+
+    std::mutex                 m_pending_lock;
+
 
     int column_width(int base) const {
         return std::max(m_max_column_width > 0 ? std::min(base, m_max_column_width) : base, 4);
@@ -115,6 +129,9 @@ struct TreeFormatter::TreeFormatterImpl
         }
 
         m_path_keys.assign(m_path_key_names.size(), Attribute::invalid);
+
+        m_limit = spec.limit;
+        m_sort_keys.assign(spec.sort.list.size(), Attribute::invalid);
     }
 
     std::vector<Attribute> get_path_keys(const CaliperMetadataAccessInterface& db) {
@@ -142,26 +159,153 @@ struct TreeFormatter::TreeFormatterImpl
         return path_keys;
     }
 
-    void add(const CaliperMetadataAccessInterface& db, const EntryList& list) {
-        const SnapshotTreeNode* node = nullptr;
-
-        if (m_use_nested) {
-            node = m_tree.add_snapshot(db, list, [](const Attribute& attr,const Variant&){
+    SnapshotTree::IsPathPredicateFn get_path_predicate(const CaliperMetadataAccessInterface& db) {
+        if (m_use_nested)
+            return [](const Attribute& attr, const Variant&){
                     return attr.is_nested();
-                });
-        } else {
-            auto path_keys = get_path_keys(db);
+                };
 
-            node = m_tree.add_snapshot(db, list, [&path_keys](const Attribute& attr, const Variant&){
-                    return (std::find(std::begin(path_keys), std::end(path_keys),
-                                      attr) != std::end(path_keys));
-                });
+        auto path_keys = get_path_keys(db);
+
+        return [path_keys](const Attribute& attr, const Variant&){
+                return (std::find(std::begin(path_keys), std::end(path_keys),
+                                  attr) != std::end(path_keys));
+            };
+    }
+
+    /// \brief Return \a true if \a list has an entry on the tree path,
+    ///   i.e. if SnapshotTree::add_snapshot() would add it
+    static bool has_path(const CaliperMetadataAccessInterface& db,
+                         const EntryList& list,
+                         const SnapshotTree::IsPathPredicateFn& is_path) {
+        auto check = [&db,&is_path](cali_id_t attr_id, const Variant& val){
+                Attribute attr = db.get_attribute(attr_id);
+                return attr != Attribute::invalid && is_path(attr, val);
+            };
+
+        for (const Entry& e : list)
+            if (e.is_immediate()) {
+                if (check(e.attribute(), e.value()))
+                    return true;
+            } else {
+                for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent())
+                    if (check(node->attribute(), node->data()))
+                        return true;
+            }
+
+        return false;
+    }
+
+    std::vector<Attribute> get_sort_keys(const CaliperMetadataAccessInterface& db) {
+        std::lock_guard<std::mutex>
+            g(m_pending_lock);
+
+        for (std::vector<Attribute>::size_type i = 0; i < m_sort_keys.size(); ++i)
+            if (m_sort_keys[i] == Attribute::invalid)
+                m_sort_keys[i] = db.get_attribute(m_spec.sort.list[i].attribute);
+
+        return m_sort_keys;
+    }
+
+    /// \brief Strict output order of two pending records
+    ///
+    /// Like the tree node sort, records that don't have a sort key go
+    /// last, and the last sort attribute is the primary key.
+    bool record_before(const PendingRecord& lhs, const PendingRecord& rhs) const {
+        for (std::size_t i = lhs.keys.size(); i > 0; --i) {
+            const Variant& l = lhs.keys[i-1];
+            const Variant& r = rhs.keys[i-1];
+
+            if (l.empty() != r.empty())
+                return r.empty();
+            if (l.empty())
+                continue;
+
+            QuerySpec::SortSpec::Order order = m_spec.sort.list[i-1].order;
+
+            if (order == QuerySpec::SortSpec::Order::Ascending) {
+                if (l < r)
+                    return true;
+                if (r < l)
+                    return false;
+            } else if (order == QuerySpec::SortSpec::Order::Descending) {
+                if (l > r)
+                    return true;
+                if (r > l)
+                    return false;
+            }
         }
 
-        if (!node)
+        return lhs.seq < rhs.seq;
+    }
+
+    /// \brief Keep \a list if it is among the first \a m_limit records
+    ///   in output order
+    void add_limited(const CaliperMetadataAccessInterface& db, const EntryList& list) {
+        if (!has_path(db, list, get_path_predicate(db)))
             return;
 
-        // update column widths
+        PendingRecord pending;
+
+        {
+            auto sort_keys = get_sort_keys(db);
+            pending.keys.resize(sort_keys.size());
+
+            for (std::vector<Attribute>::size_type i = 0; i < sort_keys.size(); ++i) {
+                if (sort_keys[i] == Attribute::invalid)
+                    continue;
+
+                cali_id_t id = sort_keys[i].id();
+
+                for (const Entry& e : list) {
+                    if (e.is_immediate()) {
+                        if (e.attribute() == id)
+                            pending.keys[i] = e.value();
+                    } else {
+                        for (const Node* node = e.node(); node; node = node->parent())
+                            if (node->attribute() == id) {
+                                pending.keys[i] = node->data();
+                                break;
+                            }
+                    }
+
+                    if (!pending.keys[i].empty())
+                        break;
+                }
+            }
+        }
+
+        auto cmp = [this](const PendingRecord& lhs, const PendingRecord& rhs){
+                return record_before(lhs, rhs);
+            };
+
+        std::lock_guard<std::mutex>
+            g(m_pending_lock);
+
+        pending.seq = m_num_records++;
+
+        if (m_pending.size() < m_limit) {
+            pending.rec = list;
+            m_pending.push_back(std::move(pending));
+            std::push_heap(m_pending.begin(), m_pending.end(), cmp);
+        } else if (record_before(pending, m_pending.front())) {
+            pending.rec = list;
+            std::pop_heap(m_pending.begin(), m_pending.end(), cmp);
+            m_pending.back() = std::move(pending);
+            std::push_heap(m_pending.begin(), m_pending.end(), cmp);
+        }
+    }
+
+    void add(const CaliperMetadataAccessInterface& db, const EntryList& list) {
+        if (m_limit > 0)
+            add_limited(db, list);
+        else
+            m_tree.add_snapshot(db, list, get_path_predicate(db));
+    }
+
+    /// \brief Set up column names and widths from the records in the tree
+    void update_column_info(const CaliperMetadataAccessInterface& db, const SnapshotTreeNode* node) {
+        Attribute alias_attr = db.get_attribute("attribute.alias");
 
         for (auto &data : node->records()) {
             for (auto &entry : data) {
@@ -175,7 +319,7 @@ struct TreeFormatter::TreeFormatterImpl
                     if (ait != m_spec.aliases.end())
                         name = ait->second;
                     else {
-                        Variant v = entry.first.get(db.get_attribute("attribute.alias"));
+                        Variant v = entry.first.get(alias_attr);
 
                         if (!v.empty())
                             name = v.to_string();
@@ -188,6 +332,9 @@ struct TreeFormatter::TreeFormatterImpl
                     it->second.width = std::max(it->second.width, len);
             }
         }
+
+        for (node = node->first_child(); node; node = node->next_sibling())
+            update_column_info(db, node);
     }
 
     void
@@ -318,6 +465,25 @@ struct TreeFormatter::TreeFormatterImpl
     }
 
     void flush(const CaliperMetadataAccessInterface& db, std::ostream& os) {
+        //
+        // build the tree from the kept records, in their original order
+        //
+
+        if (m_limit > 0) {
+            std::sort(m_pending.begin(), m_pending.end(), [](const PendingRecord& lhs, const PendingRecord& rhs){
+                    return lhs.seq < rhs.seq;
+                });
+
+            auto is_path = get_path_predicate(db);
+
+            for (const PendingRecord& p : m_pending)
+                m_tree.add_snapshot(db, p.rec, is_path);
+
+            m_pending.clear();
+        }
+
+        update_column_info(db, m_tree.root());
+
         //
         // establish order of attribute columns
         //
@@ -399,7 +565,9 @@ struct TreeFormatter::TreeFormatterImpl
           m_path_column_width(0),
           m_max_column_width(48),
           m_use_nested(true),
-          m_print_globals(false)
+          m_print_globals(false),
+          m_limit(0),
+          m_num_records(0)
     {
         configure(spec);
     }
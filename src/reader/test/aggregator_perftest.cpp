@@ -0,0 +1,164 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+// -- aggregator-perftest
+//
+// Micro-benchmark for the reader-side Aggregator.
+//
+// Generates a set of snapshot records with a given number of distinct
+// aggregation keys, then aggregates them with 1, 2, 4, ... threads
+// sharing a single Aggregator and prints throughput and speedup for
+// each thread count. With a batch size, each thread feeds the Aggregator
+// through its own BatchProcessor.
+//
+// Usage: aggregator-perftest [records] [keys] [max threads] [batch size]
+
+#include "caliper/reader/Aggregator.h"
+#include "caliper/reader/BatchProcessor.h"
+#include "caliper/reader/CalQLParser.h"
+#include "caliper/reader/CaliperMetadataDB.h"
+
+#include "caliper/common/Node.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+std::vector<EntryList>
+make_records(CaliperMetadataDB& db, std::size_t num_records, std::size_t num_keys)
+{
+    Attribute region_attr =
+        db.create_attribute("region", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute time_attr   =
+        db.create_attribute("time",   CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    //   Make a two-level region tree with num_keys leaf nodes to get
+    // num_keys distinct aggregation keys
+
+    Variant v_main("main");
+    Node* root = db.make_tree_entry(1, &region_attr, &v_main);
+
+    std::vector<std::string> names(num_keys);
+    std::vector<Node*>       nodes(num_keys);
+
+    for (std::size_t k = 0; k < num_keys; ++k) {
+        names[k] = std::string("region.") + std::to_string(k);
+        Variant v_name(names[k].c_str());
+        nodes[k] = db.make_tree_entry(1, &region_attr, &v_name, root);
+    }
+
+    std::vector<EntryList> records;
+    records.reserve(num_records);
+
+    for (std::size_t i = 0; i < num_records; ++i) {
+        EntryList rec;
+
+        rec.push_back(Entry(nodes[(i * 7919) % num_keys]));
+        rec.push_back(Entry(time_attr, Variant(static_cast<double>(i % 1000))));
+
+        records.push_back(std::move(rec));
+    }
+
+    return records;
+}
+
+double
+run(CaliperMetadataDB& db, const QuerySpec& spec, const std::vector<EntryList>& records, unsigned num_threads, std::size_t batch_size, std::size_t* num_results)
+{
+    Aggregator agg(spec);
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto thread_fn = [&](unsigned t) {
+            std::size_t chunk = (records.size() + num_threads - 1) / num_threads;
+            std::size_t end   = std::min(records.size(), (t + 1) * chunk);
+
+            if (batch_size > 0) {
+                BatchProcessor proc(spec, agg, batch_size);
+
+                for (std::size_t i = t * chunk; i < end; ++i)
+                    proc.add(db, records[i]);
+
+                proc.flush(db);
+            } else {
+                for (std::size_t i = t * chunk; i < end; ++i)
+                    agg.add(db, records[i]);
+            }
+        };
+
+    std::vector<std::thread> threads;
+
+    for (unsigned t = 0; t < num_threads; ++t)
+        threads.emplace_back(thread_fn, t);
+    for (auto& t : threads)
+        t.join();
+
+    std::size_t count = 0;
+    agg.flush(db, [&count](CaliperMetadataAccessInterface&, const EntryList&){ ++count; });
+
+    auto end = std::chrono::steady_clock::now();
+
+    *num_results = count;
+
+    return std::chrono::duration<double>(end - start).count();
+}
+
+} // namespace [anonymous]
+
+int main(int argc, char* argv[])
+{
+    std::size_t num_records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+    std::size_t num_keys    = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+    unsigned    max_threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 64;
+    std::size_t batch_size  = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 0;
+
+    if (num_records == 0 || num_keys == 0 || max_threads == 0) {
+        std::cerr << "Usage: " << argv[0] << " [records] [keys] [max threads] [batch size]" << std::endl;
+        return 1;
+    }
+
+    CalQLParser parser("select region,count(),sum(time),min(time),max(time),avg(time) group by region");
+
+    if (parser.error()) {
+        std::cerr << "Query parse error: " << parser.error_msg() << std::endl;
+        return 2;
+    }
+
+    CaliperMetadataDB db;
+    std::vector<EntryList> records = make_records(db, num_records, num_keys);
+
+    std::cout << "Aggregating " << num_records << " records with " << num_keys << " keys\n"
+              << std::setw(8)  << "threads"
+              << std::setw(12) << "time (s)"
+              << std::setw(14) << "Mrecords/s"
+              << std::setw(10) << "speedup"
+              << std::endl;
+
+    double base = 0.0;
+
+    for (unsigned t = 1; t <= max_threads; t *= 2) {
+        std::size_t num_results = 0;
+        double time = run(db, parser.spec(), records, t, batch_size, &num_results);
+
+        if (t == 1)
+            base = time;
+
+        std::cout << std::setw(8)  << t
+                  << std::setw(12) << std::fixed << std::setprecision(3) << time
+                  << std::setw(14) << std::setprecision(2) << (num_records / time) / 1e6
+                  << std::setw(10) << std::setprecision(2) << base / time
+                  << std::endl;
+
+        if (num_results != num_keys)
+            std::cerr << "Warning: unexpected number of results (" << num_results << ")" << std::endl;
+    }
+}
@@ -6,6 +6,8 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+
 using namespace cali;
 
 namespace
@@ -1044,3 +1046,191 @@ TEST(AggregatorTest, PercentTotalKernel) {
     EXPECT_DOUBLE_EQ(dict[attr_pct.id()].value().to_double(), 0.0);
     EXPECT_DOUBLE_EQ(dict[attr_ipct.id()].value().to_double(), 100.0);
 }
+
+TEST(AggregatorTest, HistogramKernels) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute x_attr =
+        db.create_attribute("x", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    QuerySpec spec;
+
+    spec.groupby.selection = QuerySpec::SelectionList<std::string>::None;
+
+    spec.aggregate.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregate.list.push_back(::make_op("percentile", "x", "50"));
+    spec.aggregate.list.push_back(::make_op("percentile", "x", "99"));
+    spec.aggregate.list.push_back(::make_op("histogram", "x"));
+
+    // perform recursive aggregation from two aggregators
+
+    Aggregator a(spec), b(spec);
+
+    cali_id_t  attr_id = x_attr.id();
+
+    for (int i = 1; i <= 100; ++i) {
+        Variant v(static_cast<double>(i));
+        (i <= 50 ? a : b).add(db, db.merge_snapshot(0, nullptr, 1, &attr_id, &v, idmap));
+    }
+
+    // merge b into a
+    b.flush(db, a);
+
+    std::vector<EntryList> resdb;
+
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) {
+            resdb.push_back(list);
+        });
+
+    ASSERT_EQ(resdb.size(), 1);
+
+    Attribute attr_p50 = db.get_attribute("p50#x");
+    Attribute attr_p99 = db.get_attribute("p99#x");
+
+    ASSERT_NE(attr_p50, Attribute::invalid);
+    ASSERT_NE(attr_p99, Attribute::invalid);
+
+    auto dict = make_dict_from_entrylist(resdb.front());
+
+    EXPECT_NEAR(dict[attr_p50.id()].value().to_double(), 50.0, 50.0/16);
+    EXPECT_NEAR(dict[attr_p99.id()].value().to_double(), 99.0, 99.0/16);
+
+    // histogram bins must be written exactly once
+
+    uint64_t count = 0;
+
+    for (const Entry& e : resdb.front()) {
+        std::string name = db.get_attribute(e.attribute()).name();
+        if (name.compare(0, 8, "hdr.bin.") == 0)
+            count += e.value().to_uint();
+    }
+
+    EXPECT_EQ(count, 100);
+}
+
+TEST(AggregatorTest, InvalidPercentile) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute x_attr =
+        db.create_attribute("x", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    QuerySpec spec;
+
+    spec.groupby.selection = QuerySpec::SelectionList<std::string>::None;
+
+    spec.aggregate.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregate.list.push_back(::make_op("percentile", "x", "abc"));
+    spec.aggregate.list.push_back(::make_op("percentile", "x", "."));
+    spec.aggregate.list.push_back(::make_op("percentile", "x", "101"));
+    spec.aggregate.list.push_back(::make_op("percentile", "x", "90"));
+
+    // invalid percentiles are skipped instead of failing in flush()
+
+    Aggregator a(spec);
+
+    cali_id_t  attr_id = x_attr.id();
+    Variant    v(42.0);
+
+    a.add(db, db.merge_snapshot(0, nullptr, 1, &attr_id, &v, idmap));
+
+    std::vector<EntryList> resdb;
+
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) {
+            resdb.push_back(list);
+        });
+
+    ASSERT_EQ(resdb.size(), 1);
+
+    EXPECT_EQ(db.get_attribute("pabc#x"), Attribute::invalid);
+    EXPECT_EQ(db.get_attribute("p.#x"),   Attribute::invalid);
+    EXPECT_EQ(db.get_attribute("p101#x"), Attribute::invalid);
+    EXPECT_NE(db.get_attribute("p90#x"),  Attribute::invalid);
+}
+
+TEST(AggregatorTest, MultithreadedAddFlushTwice) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx_attr =
+        db.create_attribute("ctx", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    db.merge_node(100, ctx_attr.id(), CALI_INV_ID, Variant("a"), idmap);
+    db.merge_node(101, ctx_attr.id(), CALI_INV_ID, Variant("b"), idmap);
+
+    QuerySpec spec;
+
+    spec.groupby.selection = QuerySpec::SelectionList<std::string>::List;
+    spec.groupby.list.push_back("ctx");
+
+    spec.aggregate.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregate.list.push_back(::make_op("count"));
+    spec.aggregate.list.push_back(::make_op("sum", "val"));
+
+    Aggregator a(spec);
+
+    const int num_threads = 4;
+    const int num_records = 1000;
+
+    EntryList recs[2];
+    cali_id_t node_ids[2] = { 100, 101 };
+    cali_id_t val_id      = val_attr.id();
+    Variant   v_val(2);
+
+    for (int i = 0; i < 2; ++i)
+        recs[i] = db.merge_snapshot(1, &node_ids[i], 1, &val_id, &v_val, idmap);
+
+    auto add_records = [&](){
+            std::vector<std::thread> threads;
+
+            for (int t = 0; t < num_threads; ++t)
+                threads.emplace_back([&a,&db,&recs,num_records](){
+                        for (int i = 0; i < num_records; ++i)
+                            a.add(db, recs[i % 2]);
+                    });
+
+            for (std::thread& t : threads)
+                t.join();
+        };
+
+    auto flush = [&](){
+            std::map<std::string, std::pair<int, int>> res;
+
+            a.flush(db, [&](CaliperMetadataAccessInterface&, const EntryList& list) {
+                    auto dict = make_dict_from_entrylist(list);
+
+                    res[dict[ctx_attr.id()].value().to_string()] =
+                        std::make_pair(dict[db.get_attribute("count").id()].value().to_int(),
+                                       dict[db.get_attribute("sum#val").id()].value().to_int());
+                });
+
+            return res;
+        };
+
+    add_records();
+
+    // flushing again must not count the thread-local results twice
+
+    for (int f = 0; f < 2; ++f) {
+        auto res = flush();
+
+        ASSERT_EQ(res.size(), 2);
+        EXPECT_EQ(res["a"].first,  num_threads * num_records / 2);
+        EXPECT_EQ(res["a"].second, num_threads * num_records);
+        EXPECT_EQ(res["b"].first,  num_threads * num_records / 2);
+        EXPECT_EQ(res["b"].second, num_threads * num_records);
+    }
+
+    // records added after a flush accumulate with the flushed ones
+
+    add_records();
+
+    auto res = flush();
+
+    ASSERT_EQ(res.size(), 2);
+    EXPECT_EQ(res["a"].first,  num_threads * num_records);
+    EXPECT_EQ(res["b"].second, 2 * num_threads * num_records);
+}
@@ -0,0 +1,328 @@
+#include "caliper/reader/BatchProcessor.h"
+
+#include "caliper/reader/Aggregator.h"
+#include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/CalQLParser.h"
+#include "caliper/reader/Preprocessor.h"
+#include "caliper/reader/RecordSelector.h"
+
+#include "caliper/common/Node.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+// Flatten a record into a sorted list of "attribute=value" strings
+std::string to_string(CaliperMetadataAccessInterface& db, const EntryList& rec)
+{
+    std::vector<std::string> strs;
+
+    for (const Entry& e : rec) {
+        if (e.is_reference()) {
+            for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent())
+                strs.push_back(db.get_attribute(node->attribute()).name() + "=" + node->data().to_string());
+        } else {
+            strs.push_back(db.get_attribute(e.attribute()).name() + "=" + e.value().to_string());
+        }
+    }
+
+    std::sort(strs.begin(), strs.end());
+
+    std::string ret;
+
+    for (const std::string& s : strs)
+        ret.append(s).append(",");
+
+    return ret;
+}
+
+std::vector<EntryList> make_records(CaliperMetadataDB& db)
+{
+    Attribute reg_attr  = db.create_attribute("region",    CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute time_attr = db.create_attribute("time",      CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+    Attribute iter_attr = db.create_attribute("iteration", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    Variant v_main(CALI_TYPE_STRING, "main", 4);
+    Variant v_foo(CALI_TYPE_STRING,  "foo",  3);
+    Variant v_bar(CALI_TYPE_STRING,  "bar",  3);
+
+    Node* main_node = db.make_tree_entry(1, &reg_attr, &v_main);
+    Node* foo_node  = db.make_tree_entry(1, &reg_attr, &v_foo, main_node);
+    Node* bar_node  = db.make_tree_entry(1, &reg_attr, &v_bar, foo_node);
+
+    Node* nodes[] = { main_node, foo_node, bar_node };
+
+    std::vector<EntryList> recs;
+
+    for (int i = 0; i < 20; ++i) {
+        EntryList rec;
+
+        rec.push_back(Entry(nodes[i % 3]));
+
+        if (i % 4 != 3)
+            rec.push_back(Entry(time_attr, Variant(0.5 * i)));
+
+        rec.push_back(Entry(iter_attr, Variant(i / 3)));
+
+        recs.push_back(rec);
+    }
+
+    // a record without a region
+    recs.push_back(EntryList { Entry(time_attr, Variant(42.0)) });
+
+    return recs;
+}
+
+// Records where as-value attributes are (also) stored in the context tree,
+// below and above entries of the nested "region" and "loop" attributes
+std::vector<EntryList> make_reference_records(CaliperMetadataDB& db)
+{
+    Attribute reg_attr   = db.create_attribute("region", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute loop_attr  = db.create_attribute("loop",   CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute bytes_attr = db.create_attribute("bytes",  CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+    Attribute time_attr  = db.create_attribute("time",   CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    Variant v_main(CALI_TYPE_STRING, "main", 4);
+    Variant v_foo(CALI_TYPE_STRING,  "foo",  3);
+    Variant v_loop(CALI_TYPE_STRING, "loop", 4);
+
+    Node* main_node = db.make_tree_entry(1, &reg_attr,   &v_main);
+    Node* loop_node = db.make_tree_entry(1, &loop_attr,  &v_loop, main_node);
+    Node* foo_node  = db.make_tree_entry(1, &reg_attr,   &v_foo,  loop_node);
+
+    std::vector<EntryList> recs;
+
+    for (int i = 0; i < 24; ++i) {
+        // make_tree_entry() with attributes skips as-value attributes, so
+        // use the node list variant
+        Node tmp_node(CALI_INV_ID, bytes_attr.id(), Variant(8 * i));
+        const Node* tmp_list[] = { &tmp_node };
+
+        Variant v_bytes(8 * i);
+
+        Node* parent = (i % 3 == 0 ? main_node : (i % 3 == 1 ? loop_node : foo_node));
+        Node* bytes_node = db.make_tree_entry(1, tmp_list, parent);
+
+        EntryList rec;
+
+        switch (i % 4) {
+        case 0:
+            // bytes is a leaf of the region path
+            rec.push_back(Entry(bytes_node));
+            break;
+        case 1:
+            // bytes sits in the path above a region entry
+            rec.push_back(Entry(db.make_tree_entry(1, &reg_attr, &v_foo, bytes_node)));
+            break;
+        case 2:
+            // bytes in a separate tree branch
+            rec.push_back(Entry(parent));
+            rec.push_back(Entry(db.make_tree_entry(1, tmp_list)));
+            break;
+        default:
+            rec.push_back(Entry(parent));
+            rec.push_back(Entry(bytes_attr, v_bytes));
+        }
+
+        rec.push_back(Entry(time_attr, Variant(0.5 * i)));
+        recs.push_back(rec);
+    }
+
+    return recs;
+}
+
+// Run the query with the Preprocessor/RecordSelector/Aggregator chain and
+// with a BatchProcessor, and return the sorted results of both
+std::pair< std::vector<std::string>, std::vector<std::string> >
+run(const QuerySpec& spec, std::vector<EntryList> (*make_recs)(CaliperMetadataDB&) = make_records)
+{
+    bool do_aggregate = (spec.aggregate.selection != QuerySpec::AggregationSelection::None);
+
+    CaliperMetadataDB db;
+    std::vector<EntryList> recs = make_recs(db);
+
+    std::vector<std::string> expect;
+    std::vector<std::string> result;
+
+    {
+        Preprocessor   prp(spec);
+        RecordSelector filter(spec);
+        Aggregator     aggr(spec);
+
+        for (const EntryList& rec : recs) {
+            EntryList out = prp.process(db, rec);
+
+            if (filter.pass(db, out)) {
+                if (do_aggregate)
+                    aggr.add(db, out);
+                else
+                    expect.push_back(to_string(db, out));
+            }
+        }
+
+        aggr.flush(db, [&](CaliperMetadataAccessInterface& db, const EntryList& rec){
+                expect.push_back(to_string(db, rec));
+            });
+    }
+
+    {
+        Aggregator aggr(spec);
+        auto push = [&](CaliperMetadataAccessInterface& db, const EntryList& rec){
+                result.push_back(to_string(db, rec));
+            };
+
+        // small batches so that the last one is incomplete
+        BatchProcessor proc = do_aggregate ? BatchProcessor(spec, aggr, 4) : BatchProcessor(spec, push, 4);
+
+        for (const EntryList& rec : recs)
+            proc.add(db, rec);
+
+        proc.flush(db);
+        aggr.flush(db, push);
+    }
+
+    std::sort(expect.begin(), expect.end());
+    std::sort(result.begin(), result.end());
+
+    return std::make_pair(expect, result);
+}
+
+QuerySpec parse(const char* query)
+{
+    CalQLParser parser(query);
+    EXPECT_FALSE(parser.error()) << "Unexpected parse error: " << parser.error_msg();
+
+    return parser.spec();
+}
+
+std::pair< std::vector<std::string>, std::vector<std::string> >
+run(const char* query, std::vector<EntryList> (*make_recs)(CaliperMetadataDB&) = make_records)
+{
+    return run(parse(query), make_recs);
+}
+
+bool has_entry(const std::vector<std::string>& recs, const std::string& str)
+{
+    return std::any_of(recs.begin(), recs.end(), [&str](const std::string& rec){
+            return rec.find(str) != std::string::npos;
+        });
+}
+
+} // namespace [anonymous]
+
+TEST(BatchProcessorTest, Aggregate) {
+    auto res = run("aggregate count(),sum(time) group by region");
+
+    EXPECT_EQ(res.first.size(), 4u);
+    EXPECT_EQ(res.first, res.second);
+
+    res = run("aggregate count(),inclusive_sum(time) group by path,iteration");
+
+    EXPECT_EQ(res.first, res.second);
+}
+
+TEST(BatchProcessorTest, Where) {
+    auto res = run("where iteration>2,not region=bar aggregate count() group by region");
+
+    EXPECT_FALSE(res.first.empty());
+    EXPECT_EQ(res.first, res.second);
+
+    res = run("select * where not time");
+
+    EXPECT_EQ(res.first.size(), 5u);
+    EXPECT_EQ(res.first, res.second);
+
+    res = run("select * where region=foo,time<6");
+
+    EXPECT_FALSE(res.first.empty());
+    EXPECT_EQ(res.first, res.second);
+
+    res = run("select * where nosuchattribute");
+
+    EXPECT_TRUE(res.second.empty());
+}
+
+TEST(BatchProcessorTest, Let) {
+    auto res = run("let t2=scale(time,2),r=ratio(time,iteration,10),tr=truncate(time,2),i=truncate(iteration,2) "
+                   "aggregate sum(t2),sum(r),count() group by region,tr,i");
+
+    EXPECT_FALSE(res.first.empty());
+    EXPECT_EQ(res.first, res.second);
+
+    res = run("let f=first(time,iteration),s=sum(time,iteration),l=leaf(),lr=leaf(region) select *");
+
+    EXPECT_EQ(res.first.size(), 21u);
+    EXPECT_EQ(res.first, res.second);
+
+    // LET conditions and WHERE clauses on LET results
+    res = run("let t2=scale(time,2) if iteration>3,x=scale(t2,0.5) where x>6 select *");
+
+    EXPECT_FALSE(res.first.empty());
+    EXPECT_EQ(res.first, res.second);
+}
+
+TEST(BatchProcessorTest, KernelDispatch) {
+    // kernels are dispatched by ID, not by name
+    QuerySpec spec = parse("let t2=scale(time,2) aggregate sum(t2) group by region");
+
+    ASSERT_EQ(spec.preprocess_ops.size(), 1u);
+    spec.preprocess_ops[0].op.op.name = "renamed";
+
+    auto res = run(spec);
+
+    EXPECT_TRUE(has_entry(res.second, "sum#t2=")) << ::testing::PrintToString(res.second);
+    EXPECT_EQ(res.first, res.second);
+
+    // a kernel ID the BatchProcessor doesn't support: this exercises the
+    // fallback where all LET clauses run through the Preprocessor
+    spec = parse("let t2=scale(time,2),x=first(time) where time>1 aggregate sum(t2),count() group by region");
+
+    ASSERT_EQ(spec.preprocess_ops.size(), 2u);
+    spec.preprocess_ops[1].op.op.id = 99;
+
+    res = run(spec);
+
+    EXPECT_TRUE(has_entry(res.second, "sum#t2=")) << ::testing::PrintToString(res.second);
+    EXPECT_EQ(res.first, res.second);
+}
+
+TEST(BatchProcessorTest, ReferenceEntries) {
+    // as-value and nested attributes in reference entries are looked up
+    // in the context tree like the RecordSelector and Preprocessor do
+    auto res = run("where bytes>40 select *", make_reference_records);
+
+    EXPECT_FALSE(res.first.empty());
+    EXPECT_TRUE(has_entry(res.second, "bytes=64,")) << ::testing::PrintToString(res.second);
+    EXPECT_EQ(res.first, res.second);
+
+    res = run("where region=foo,not bytes<100 select *", make_reference_records);
+
+    EXPECT_FALSE(res.first.empty());
+    EXPECT_EQ(res.first, res.second);
+
+    res = run("where loop select *", make_reference_records);
+
+    EXPECT_FALSE(res.first.empty());
+    EXPECT_EQ(res.first, res.second);
+
+    res = run("let b2=scale(bytes,2),f=first(bytes,time),s=sum(bytes,time),l=leaf(bytes),lr=leaf(region) "
+              "if loop,tr=truncate(bytes,16) select *", make_reference_records);
+
+    EXPECT_EQ(res.first.size(), 24u);
+    EXPECT_TRUE(has_entry(res.second, "b2=128.000000,")) << ::testing::PrintToString(res.second);
+    EXPECT_EQ(res.first, res.second);
+
+    res = run("let b2=scale(bytes,2) where bytes>8 aggregate sum(b2),count() group by region,loop",
+              make_reference_records);
+
+    EXPECT_FALSE(res.first.empty());
+    EXPECT_TRUE(has_entry(res.second, "sum#b2=")) << ::testing::PrintToString(res.second);
+    EXPECT_EQ(res.first, res.second);
+}
@@ -1,9 +1,14 @@
 #include "caliper/reader/CaliReader.h"
+#include "caliper/reader/CaliWriter.h"
 #include "caliper/reader/CaliperMetadataDB.h"
 #include "caliper/common/Node.h"
+#include "caliper/common/OutputStream.h"
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <cstdio>
+#include <fstream>
 #include <sstream>
 
 using namespace cali;
@@ -75,4 +80,176 @@ TEST(CaliReader, BasicRead)
     auto globals = db.get_globals();
 
     EXPECT_FALSE(globals.empty());
-}
\ No newline at end of file
+}
+
+TEST(CaliReader, BinaryRoundTrip)
+{
+    CaliperMetadataDB db_txt;
+    std::vector<EntryList> records;
+
+    {
+        CaliReader reader;
+        std::istringstream is(cali_txt);
+
+        reader.read(is, db_txt, [](CaliperMetadataAccessInterface&,const Node*){ },
+                    [&records](CaliperMetadataAccessInterface&,const EntryList& rec){
+                        records.push_back(rec);
+                    });
+
+        ASSERT_FALSE(reader.error()) << reader.error_msg();
+    }
+
+    std::ostringstream os;
+
+    {
+        OutputStream stream;
+        stream.set_stream(&os);
+
+        CaliWriter writer(stream, CaliWriter::Binary);
+
+        for (const EntryList& rec : records)
+            writer.write_snapshot(db_txt, rec);
+
+        writer.write_globals(db_txt, db_txt.get_globals());
+    }
+
+    std::string buf = os.str();
+    ASSERT_GT(buf.size(), 8);
+    EXPECT_EQ(static_cast<unsigned char>(buf[0]), 0x89);
+
+    CaliperMetadataDB db_bin;
+    CaliReader reader;
+    std::istringstream is(buf);
+
+    unsigned rec_count = 0;
+    double   time_sum  = 0.0;
+    std::vector<std::string> regions;
+
+    reader.read(is, db_bin, [](CaliperMetadataAccessInterface&,const Node*){ },
+                [&](CaliperMetadataAccessInterface& db,const EntryList& rec){
+                    ++rec_count;
+
+                    Attribute time_attr   = db.get_attribute("sum#sum#time.duration");
+                    Attribute region_attr = db.get_attribute("region");
+
+                    for (const Entry& e : rec) {
+                        if (e.attribute() == time_attr.id())
+                            time_sum += e.value().to_double();
+
+                        Variant v = e.value(region_attr);
+
+                        if (!v.empty())
+                            regions.push_back(v.to_string());
+                    }
+                });
+
+    EXPECT_FALSE(reader.error()) << reader.error_msg();
+
+    EXPECT_EQ(rec_count, 5);
+    EXPECT_NEAR(time_sum, 0.001375, 1e-9);
+
+    ASSERT_EQ(regions.size(), 4);
+    EXPECT_EQ(regions[0], std::string("main"));
+    EXPECT_EQ(regions[1], std::string("init"));
+    EXPECT_EQ(regions[2], std::string("main"));
+    EXPECT_EQ(regions[3], std::string("foo"));
+
+    Attribute version_attr = db_bin.get_attribute("cali.caliper.version");
+    bool found_version = false;
+
+    for (const Entry& e : db_bin.get_globals())
+        if (!e.value(version_attr).empty()) {
+            EXPECT_EQ(e.value(version_attr).to_string(), std::string("2.11.0-dev"));
+            found_version = true;
+        }
+
+    EXPECT_TRUE(found_version);
+}
+
+TEST(CaliReader, ParallelRead)
+{
+    std::string filename = std::string(::testing::TempDir()) + "test_calireader_parallel.cali";
+
+    {
+        std::ofstream os(filename.c_str());
+        os << cali_txt;
+    }
+
+    CaliperMetadataDB db;
+    CaliReader reader;
+
+    std::atomic<unsigned> node_count(0);
+    std::vector<unsigned> rec_count(4, 0);
+    std::vector<SnapshotProcessFn> snap_procs;
+
+    for (unsigned t = 0; t < rec_count.size(); ++t)
+        snap_procs.push_back([&rec_count,t](CaliperMetadataAccessInterface&,const EntryList& rec){
+                EXPECT_FALSE(rec.empty());
+                ++rec_count[t];
+            });
+
+    reader.read(filename, db, [&node_count](CaliperMetadataAccessInterface&,const Node*){ ++node_count; },
+                snap_procs);
+
+    std::remove(filename.c_str());
+
+    EXPECT_FALSE(reader.error()) << reader.error_msg();
+
+    EXPECT_EQ(node_count.load(), 29);
+    EXPECT_EQ(rec_count[0] + rec_count[1] + rec_count[2] + rec_count[3], 5);
+    EXPECT_FALSE(db.get_globals().empty());
+}
+
+TEST(CaliReader, SegmentMode)
+{
+    // the second segment refers to nodes defined in the first one
+    const char* seg0 =
+        "__rec=node,id=40,attr=10,data=276,parent=3\n"
+        "__rec=node,id=41,attr=8,data=region,parent=40\n"
+        "__rec=node,id=42,attr=41,data=main\n"
+        "__rec=ctx,ref=42\n";
+    const char* seg1 =
+        "__rec=node,id=43,attr=41,data=foo,parent=42\n"
+        "__rec=ctx,ref=43\n";
+
+    auto read_segments = [seg0,seg1](bool segment_mode) {
+        CaliperMetadataDB db;
+        CaliReader reader;
+        std::vector<std::string> paths;
+
+        reader.set_segment_mode(segment_mode);
+
+        NodeProcessFn node_proc =
+            [](CaliperMetadataAccessInterface&,const Node*) { };
+        SnapshotProcessFn snap_proc =
+            [&paths](CaliperMetadataAccessInterface&,const EntryList& rec){
+                std::string path;
+                for (const Entry& e : rec)
+                    for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent())
+                        path = node->data().to_string() + (path.empty() ? "" : "/") + path;
+                paths.push_back(path);
+            };
+
+        std::istringstream is0(seg0);
+        reader.read(is0, db, node_proc, snap_proc);
+        std::istringstream is1(seg1);
+        reader.read(is1, db, node_proc, snap_proc);
+
+        return paths;
+    };
+
+    std::vector<std::string> paths = read_segments(true);
+
+    ASSERT_EQ(paths.size(), 2u);
+    EXPECT_EQ(paths[0], std::string("main"));
+    EXPECT_EQ(paths[1], std::string("main/foo"));
+
+    // without segment mode, each stream is read on its own
+    paths = read_segments(false);
+
+    ASSERT_GE(paths.size(), 1u);
+    EXPECT_EQ(paths[0], std::string("main"));
+
+    if (paths.size() > 1)
+        EXPECT_TRUE(paths[1].empty());
+}
@@ -588,3 +588,36 @@ TEST(CalQLParserTest, LetClauseErrors) {
     EXPECT_TRUE(p3.error());
     EXPECT_STREQ(p3.error_msg().c_str(), "a defined twice");
 }
+
+TEST(CalQLParserTest, LimitClause) {
+    {
+        CalQLParser p("select a order by a desc limit 10 format table");
+
+        EXPECT_FALSE(p.error()) << "Unexpected parse error: " << p.error_msg();
+
+        QuerySpec q = p.spec();
+
+        EXPECT_EQ(q.limit, 10);
+        ASSERT_EQ(q.sort.list.size(), 1);
+        EXPECT_EQ(q.sort.list[0].order, QuerySpec::SortSpec::Descending);
+        EXPECT_STREQ(q.format.formatter.name, "table");
+    }
+
+    {
+        CalQLParser p("select a");
+
+        EXPECT_FALSE(p.error()) << "Unexpected parse error: " << p.error_msg();
+        EXPECT_EQ(p.spec().limit, 0);
+    }
+
+    {
+        CalQLParser p1("select a limit 0");
+        EXPECT_TRUE(p1.error());
+        CalQLParser p2("select a limit -1");
+        EXPECT_TRUE(p2.error());
+        CalQLParser p3("select a limit");
+        EXPECT_TRUE(p3.error());
+        CalQLParser p4("limit ten");
+        EXPECT_TRUE(p4.error());
+    }
+}
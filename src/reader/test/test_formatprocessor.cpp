@@ -0,0 +1,121 @@
+#include "caliper/reader/FormatProcessor.h"
+
+#include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/CalQLParser.h"
+
+#include "caliper/common/Node.h"
+#include "caliper/common/OutputStream.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+using namespace cali;
+
+namespace
+{
+
+// Run the records ("main/region.<i>", time=t[i]) through a formatter with
+// the given query
+std::string format(const char* query, const std::vector<double>& t)
+{
+    CaliperMetadataDB db;
+
+    Attribute reg_attr  = db.create_attribute("region", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute time_attr = db.create_attribute("time",   CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    Variant v_main(CALI_TYPE_STRING, "main", 4);
+    Node*   main_node = db.make_tree_entry(1, &reg_attr, &v_main);
+
+    CalQLParser parser(query);
+    EXPECT_FALSE(parser.error()) << "Unexpected parse error: " << parser.error_msg();
+
+    std::ostringstream os;
+    OutputStream stream;
+    stream.set_stream(&os);
+
+    FormatProcessor formatter(parser.spec(), stream);
+
+    for (std::vector<double>::size_type i = 0; i < t.size(); ++i) {
+        std::string name = std::string("region.") + std::to_string(i);
+        Variant v_reg(CALI_TYPE_STRING, name.c_str(), name.size());
+
+        EntryList rec {
+            Entry(db.make_tree_entry(1, &reg_attr, &v_reg, main_node)),
+            Entry(time_attr, Variant(t[i]))
+        };
+
+        formatter.process_record(db, rec);
+    }
+
+    formatter.flush(db);
+
+    return os.str();
+}
+
+} // namespace [anonymous]
+
+TEST(FormatProcessorTest, TableLimit) {
+    const std::vector<double> t { 4.0, 1.0, 6.0, 3.0, 6.0, 2.0, 5.0 };
+
+    std::string top3 =
+        format("select region,time format table order by time desc limit 3", t);
+
+    std::string expect_top3 =
+        "region        time     \n"
+        "main/region.2 6.000000 \n"
+        "main/region.4 6.000000 \n"
+        "main/region.6 5.000000 \n";
+
+    EXPECT_EQ(top3, expect_top3);
+
+    std::string first2 =
+        format("select region,time format table limit 2", t);
+
+    std::string expect_first2 =
+        "region        time     \n"
+        "main/region.0 4.000000 \n"
+        "main/region.1 1.000000 \n";
+
+    EXPECT_EQ(first2, expect_first2);
+
+    // without a limit, output is the full sorted table
+    std::string all =
+        format("select region,time format table order by time", t);
+
+    std::istringstream is(all);
+    std::string line;
+    std::vector<std::string> lines;
+
+    while (std::getline(is, line))
+        lines.push_back(line);
+
+    ASSERT_EQ(lines.size(), t.size() + 1);
+    EXPECT_EQ(lines[1], "main/region.1 1.000000 ");
+    EXPECT_EQ(lines[7], "main/region.4 6.000000 ");
+}
+
+TEST(FormatProcessorTest, TreeLimit) {
+    const std::vector<double> t { 4.0, 1.0, 6.0, 3.0, 2.0 };
+
+    std::string out =
+        format("select time format tree order by time desc limit 2", t);
+
+    EXPECT_NE(out.find("region.0"), std::string::npos);
+    EXPECT_NE(out.find("region.2"), std::string::npos);
+    EXPECT_EQ(out.find("region.1"), std::string::npos);
+    EXPECT_EQ(out.find("region.3"), std::string::npos);
+    EXPECT_EQ(out.find("region.4"), std::string::npos);
+}
+
+TEST(FormatProcessorTest, ExpandLimit) {
+    const std::vector<double> t { 4.0, 1.0, 6.0 };
+
+    std::string out = format("format expand limit 2", t);
+
+    std::string expect =
+        "region=main/region.0,time=4.000000\n"
+        "region=main/region.1,time=1.000000\n";
+
+    EXPECT_EQ(out, expect);
+}
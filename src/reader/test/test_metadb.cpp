@@ -4,6 +4,8 @@
 
 #include <gtest/gtest.h>
 
+#include <map>
+
 using namespace cali;
 
 TEST(MetaDBTest, MergeSnapshotFromDB) {
@@ -76,6 +78,33 @@ int count_in_record(const std::vector<Entry>& rec, const Attribute& a, const Var
 
 }
 
+TEST(MetaDBTest, ImportAttribute) {
+    CaliperMetadataDB db1;
+
+    db1.add_attribute_aliases({ { "val.attr", "My Value" } });
+
+    Attribute val_attr =
+        db1.create_attribute("val.attr", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    CaliperMetadataDB db2;
+
+    Attribute out_attr = db2.import_attribute(db1, val_attr);
+
+    ASSERT_NE(out_attr, Attribute::invalid);
+    EXPECT_NE(out_attr.node(), val_attr.node());
+    EXPECT_EQ(out_attr, db2.get_attribute("val.attr"));
+    EXPECT_EQ(out_attr.type(), CALI_TYPE_DOUBLE);
+    EXPECT_TRUE(out_attr.store_as_value());
+
+    Attribute alias_attr = db2.get_attribute("attribute.alias");
+
+    ASSERT_NE(alias_attr, Attribute::invalid);
+    EXPECT_EQ(out_attr.get(alias_attr).to_string(), std::string("My Value"));
+
+    // importing again returns the same attribute
+    EXPECT_EQ(db2.import_attribute(db1, val_attr), out_attr);
+}
+
 TEST(MetaDBTest, SetGlobal) {
     CaliperMetadataDB db;
 
@@ -179,3 +208,112 @@ TEST(MetadataDBTest, AliasesAndUnits) {
     EXPECT_EQ(attr.get(alias_attr).to_string(), "x alias");
     EXPECT_EQ(attr.get(unit_attr).to_string(),  "x unit");
 }
+
+TEST(MetadataDBTest, IdMap) {
+    IdMap idmap;
+
+    EXPECT_TRUE(idmap.empty());
+    EXPECT_EQ(idmap.map(42), 42);
+    EXPECT_TRUE(idmap.find(42) == idmap.end());
+    EXPECT_TRUE(idmap.begin() == idmap.end());
+
+    idmap[42] = 7;
+    idmap[3]  = 1000;
+    idmap[cali_id_t(1) << 40] = 12;
+
+    EXPECT_EQ(idmap.size(), 3);
+    EXPECT_EQ(idmap.map(42), 7);
+    EXPECT_EQ(idmap.map(3), 1000);
+    EXPECT_EQ(idmap.map(cali_id_t(1) << 40), 12);
+    EXPECT_EQ(idmap.map(4), 4);
+    EXPECT_EQ(idmap.map((cali_id_t(1) << 40) + 1), (cali_id_t(1) << 40) + 1);
+
+    // std::map-style access
+    auto it = idmap.find(42);
+
+    ASSERT_TRUE(it != idmap.end());
+    EXPECT_EQ(it->first,  42);
+    EXPECT_EQ(it->second, 7);
+    EXPECT_EQ(idmap.count(4), 0);
+    EXPECT_EQ(idmap.count(cali_id_t(1) << 40), 1);
+
+    // insert() doesn't overwrite, operator[] does
+    auto ret = idmap.insert(std::make_pair(cali_id_t(42), cali_id_t(8)));
+
+    EXPECT_FALSE(ret.second);
+    EXPECT_EQ(ret.first->second, 7);
+
+    ret = idmap.insert(std::make_pair(cali_id_t(5), cali_id_t(50)));
+
+    EXPECT_TRUE(ret.second);
+    EXPECT_EQ(idmap.map(5), 50);
+
+    idmap[42] = 8;
+
+    EXPECT_EQ(idmap.size(), 4);
+    EXPECT_EQ(idmap.map(42), 8);
+
+    std::map<cali_id_t, cali_id_t> copy;
+    const IdMap& cref(idmap);
+
+    for (const auto& p : cref)
+        copy.insert(p);
+
+    EXPECT_EQ(copy.size(), 4);
+    EXPECT_EQ(copy[3], 1000);
+    EXPECT_EQ(copy[5], 50);
+    EXPECT_EQ(copy[42], 8);
+    EXPECT_EQ(copy[cali_id_t(1) << 40], 12);
+
+    EXPECT_EQ(idmap.erase(5), 1);
+    EXPECT_EQ(idmap.erase(5), 0);
+    EXPECT_EQ(idmap.size(), 3);
+    EXPECT_EQ(idmap.map(5), 5);
+
+    idmap.clear();
+
+    EXPECT_TRUE(idmap.empty());
+    EXPECT_EQ(idmap.map(42), 42);
+}
+
+TEST(MetadataDBTest, MergeNodes) {
+    CaliperMetadataDB db;
+
+    Attribute attr =
+        db.create_attribute("str.attr", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+
+    IdMap idmap;
+
+    // the string values aren't in the string DB yet
+    std::string a("a"), b("b");
+
+    CaliperMetadataDB::NodeInfo nodes[] = {
+        { 300, attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, a.data(), a.size()) },
+        { 301, attr.id(), 300,         Variant(CALI_TYPE_STRING, b.data(), b.size()) },
+        { 302, 9999,      300,         Variant(CALI_TYPE_STRING, b.data(), b.size()) }, // invalid attribute
+        { 303, attr.id(), 301,         Variant(CALI_TYPE_STRING, a.data(), a.size()) }
+    };
+
+    Node* out[4] = { nullptr, nullptr, nullptr, nullptr };
+
+    EXPECT_EQ(db.merge_nodes(4, nodes, idmap, out), 3);
+
+    ASSERT_NE(out[0], nullptr);
+    ASSERT_NE(out[1], nullptr);
+    EXPECT_EQ(out[2], nullptr);
+    ASSERT_NE(out[3], nullptr);
+
+    EXPECT_EQ(out[1]->parent(), out[0]);
+    EXPECT_EQ(out[3]->parent(), out[1]);
+    EXPECT_EQ(out[3]->data().to_string(), "a");
+    EXPECT_NE(out[3]->data().data(), static_cast<const void*>(a.data()));
+    EXPECT_EQ(out[3]->data().data(), out[0]->data().data());
+
+    EXPECT_EQ(idmap.map(300), out[0]->id());
+    EXPECT_EQ(idmap.map(303), out[3]->id());
+
+    // merging the same nodes again returns the existing ones
+    Node* again = db.merge_node(301, attr.id(), 300, Variant("b"), idmap);
+
+    EXPECT_EQ(again, out[1]);
+}
@@ -0,0 +1,74 @@
+#include "../TableFormatter.h"
+
+#include "caliper/reader/CalQLParser.h"
+#include "caliper/reader/CaliperMetadataDB.h"
+
+#include "caliper/common/Node.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+using namespace cali;
+
+TEST(TableFormatter, SortMixedCellsWithLimit) {
+    CaliperMetadataDB db;
+
+    Attribute str_attr = db.create_attribute("str", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    IdMap idmap;
+
+    // "a/c" is a path of two nodes, the other cells hold single values
+    Node* node_a  = db.merge_node(100, str_attr.id(), CALI_INV_ID, Variant("a"), idmap);
+    Node* node_ac = db.merge_node(101, str_attr.id(), 100,         Variant("c"), idmap);
+    Node* node_b  = db.merge_node(102, str_attr.id(), CALI_INV_ID, Variant("b"), idmap);
+    Node* node_c  = db.merge_node(103, str_attr.id(), CALI_INV_ID, Variant("c"), idmap);
+
+    CalQLParser parser("select str,val format table order by str limit 3");
+    ASSERT_FALSE(parser.error()) << parser.error_msg();
+
+    TableFormatter fmt(parser.spec());
+
+    fmt.process_record(db, { Entry(node_c),  Entry(val_attr, Variant(1)) });
+    fmt.process_record(db, { Entry(node_ac), Entry(val_attr, Variant(2)) });
+    fmt.process_record(db, { Entry(node_b),  Entry(val_attr, Variant(3)) });
+    fmt.process_record(db, { Entry(node_a),  Entry(val_attr, Variant(4)) });
+
+    std::ostringstream os;
+    fmt.flush(db, os);
+
+    std::string expect =
+        "str  val  \n"
+        "a       4 \n"
+        "a/c     2 \n"
+        "b       3 \n";
+
+    EXPECT_EQ(os.str(), expect);
+}
+
+TEST(TableFormatter, SortLargeInts) {
+    CaliperMetadataDB db;
+
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    CalQLParser parser("select val format table order by val desc");
+    ASSERT_FALSE(parser.error()) << parser.error_msg();
+
+    TableFormatter fmt(parser.spec());
+
+    fmt.process_record(db, { Entry(val_attr, Variant(cali_make_variant_from_int64(-4000000000000LL))) });
+    fmt.process_record(db, { Entry(val_attr, Variant(cali_make_variant_from_int64( 4000000000000LL))) });
+    fmt.process_record(db, { Entry(val_attr, Variant(cali_make_variant_from_int(0))) });
+
+    std::ostringstream os;
+    fmt.flush(db, os);
+
+    std::string expect =
+        "val            \n"
+        " 4000000000000 \n"
+        "             0 \n"
+        "-4000000000000 \n";
+
+    EXPECT_EQ(os.str(), expect);
+}
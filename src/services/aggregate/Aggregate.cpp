@@ -10,18 +10,23 @@
 #include "../Services.h"
 #include "../../common/util/unitfmt.h"
 #include "../../common/util/spinlock.hpp"
+#include "../../common/util/log_histogram.hpp"
 
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
 #include "caliper/common/Log.h"
 #include "caliper/common/RuntimeConfig.h"
+#include "caliper/common/StringConverter.h"
 #include "caliper/common/Variant.h"
 
 #include <algorithm>
 #include <cstring>
+#include <iterator>
+#include <map>
 #include <mutex>
 #include <sstream>
+#include <utility>
 
 using namespace aggregate;
 using namespace cali;
@@ -43,6 +48,11 @@ class Aggregate
     //   ThreadDB manages an aggregation DB for one thread.
     // All ThreadDBs belonging to a channel are linked so they
     // can be flushed, cleared, and deleted from any thread.
+    //   Rolling output flushes and clears the DBs while other threads
+    // keep taking snapshots, so a DB is only accessed under its lock.
+    // The flushing thread sets the stopped flag on its own DB: it drops
+    // snapshots that thread takes during the flush, which would
+    // otherwise deadlock on the lock.
 
     struct ThreadDB {
         //
@@ -52,6 +62,8 @@ class Aggregate
         std::atomic<bool> stopped;
         std::atomic<bool> retired;
 
+        util::spinlock    lock;
+
         ThreadDB*         next = nullptr;
         ThreadDB*         prev = nullptr;
 
@@ -78,6 +90,13 @@ class Aggregate
     std::vector<std::string>       key_attribute_names;
     std::vector<std::string>       aggr_attribute_names;
 
+    struct KernelConfig {
+        int kernels;
+        std::vector< std::pair<std::string, double> > percentiles; ///< (name, quantile)
+    };
+
+    std::map<std::string, KernelConfig> kernel_config;
+
     Attribute                      tdb_attr;
 
     size_t                         num_dropped_snapshots;
@@ -111,26 +130,54 @@ class Aggregate
         std::string name = attr.name();
         ResultAttributes res;
 
+        res.kernels = DefaultKernels;
+
+        auto it = kernel_config.find(name);
+
+        if (it != kernel_config.end()) {
+            res.kernels = it->second.kernels;
+
+            for (const auto& p : it->second.percentiles) {
+                res.percentiles.push_back(p.second);
+                res.percentile_attrs.push_back(
+                    c->create_attribute(std::string("p") + p.first + "#" + name, CALI_TYPE_DOUBLE,
+                                        CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS));
+            }
+        }
+
         int prop = CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS;
 
-        res.min_attr = c->create_attribute(std::string("min#") + name, CALI_TYPE_DOUBLE, prop);
-        res.max_attr = c->create_attribute(std::string("max#") + name, CALI_TYPE_DOUBLE, prop);
-        res.sum_attr = c->create_attribute(std::string("sum#") + name, CALI_TYPE_DOUBLE, prop);
-        res.avg_attr = c->create_attribute(std::string("avg#") + name, CALI_TYPE_DOUBLE, prop);
-    #ifdef CALIPER_ENABLE_HISTOGRAMS
-        for (int jj = 0; jj < CALI_AGG_HISTOGRAM_BINS; jj++) {
-            res.histogram_attr[jj] =
-                c->create_attribute(std::string("histogram.bin.") + std::to_string(jj) + std::string("#") + name,
-                                    CALI_TYPE_INT, prop);
+        if (res.kernels & MinKernel)
+            res.min_attr = c->create_attribute(std::string("min#") + name, CALI_TYPE_DOUBLE, prop);
+        if (res.kernels & MaxKernel)
+            res.max_attr = c->create_attribute(std::string("max#") + name, CALI_TYPE_DOUBLE, prop);
+        if (res.kernels & SumKernel)
+            res.sum_attr = c->create_attribute(std::string("sum#") + name, CALI_TYPE_DOUBLE, prop);
+        if (res.kernels & AvgKernel)
+            res.avg_attr = c->create_attribute(std::string("avg#") + name, CALI_TYPE_DOUBLE, prop);
+
+        if (res.kernels & VarianceKernel) {
+            // use the same attributes as the variance() kernel in the reader library
+            res.variance_attr =
+                c->create_attribute(std::string("variance#") + name,  CALI_TYPE_DOUBLE, prop);
+            res.var_count_attr =
+                c->create_attribute(std::string("var.count#") + name, CALI_TYPE_UINT,   prop | CALI_ATTR_HIDDEN);
+            res.var_sum_attr =
+                c->create_attribute(std::string("var.sum#") + name,   CALI_TYPE_DOUBLE, prop | CALI_ATTR_HIDDEN);
+            res.var_sqsum_attr =
+                c->create_attribute(std::string("var.sqsum#") + name, CALI_TYPE_DOUBLE, prop | CALI_ATTR_HIDDEN);
         }
-    #endif
 
         return res;
     }
 
     void check_aggregation_attribute(Caliper* c, const Attribute& attr) {
-        if (!(attr.properties() & CALI_ATTR_AGGREGATABLE))
-            return;
+        if (!(attr.properties() & CALI_ATTR_AGGREGATABLE)) {
+            //   Attributes with an explicit kernel configuration are
+            // aggregation attributes even without the aggregatable property
+            if (!attr.store_as_value() || kernel_config.count(attr.name()) == 0)
+                return;
+        }
 
         if (std::find(info.aggr_attrs.begin(), info.aggr_attrs.end(),
                       attr) != info.aggr_attrs.end())
@@ -140,6 +187,59 @@ class Aggregate
         info.result_attrs.push_back(make_result_attributes(c, attr));
     }
 
+    //   Parse the kernel configuration, e.g.
+    // "time.duration.ns:hdr,p99;bytes:sum". Each attribute name is
+    // followed by a colon and a comma-separated kernel list.
+    void parse_kernel_config(const std::string& str) {
+        const struct KernelName {
+            const char* name; int flag;
+        } kernel_names[] = {
+            { "min",       MinKernel       },
+            { "max",       MaxKernel       },
+            { "sum",       SumKernel       },
+            { "avg",       AvgKernel       },
+            { "variance",  VarianceKernel  },
+            { "hdr",       HistogramKernel },
+            { "histogram", HistogramKernel },
+            { "default",   DefaultKernels  }
+        };
+
+        for (const std::string& attr_cfg : StringConverter(str).to_stringlist(";")) {
+            auto pos = attr_cfg.rfind(':');
+
+            if (pos == std::string::npos || pos == 0) {
+                Log(0).stream() << "aggregate: invalid kernel configuration \"" << attr_cfg
+                                << "\": expected <attribute>:<kernel>,..." << std::endl;
+                continue;
+            }
+
+            KernelConfig cfg;
+            cfg.kernels = 0;
+
+            for (const std::string& k : StringConverter(attr_cfg.substr(pos+1)).to_stringlist(",")) {
+                auto it = std::find_if(std::begin(kernel_names), std::end(kernel_names), [&k](const KernelName& n){
+                        return k == n.name;
+                    });
+
+                double q = 0.0;
+
+                if (it != std::end(kernel_names)) {
+                    cfg.kernels |= it->flag;
+                } else if (k.size() > 1 && k[0] == 'p' && util::parse_percentile(k.substr(1), &q)) {
+                    cfg.kernels |= HistogramKernel;
+                    cfg.percentiles.push_back(std::make_pair(k.substr(1), q));
+                } else if (k.size() > 1 && k[0] == 'p' && k.find_first_not_of("0123456789.", 1) == std::string::npos) {
+                    Log(0).stream() << "aggregate: invalid percentile \"" << k
+                                    << "\": expected p<0..100>" << std::endl;
+                } else {
+                    Log(0).stream() << "aggregate: unknown aggregation kernel \"" << k << "\"" << std::endl;
+                }
+            }
+
+            kernel_config[attr_cfg.substr(0, pos)] = cfg;
+        }
+    }
+
     void init_aggregation_attributes(Caliper* c) {
         auto attrs = c->find_attributes_with_prop(CALI_ATTR_AGGREGATABLE);
 
@@ -155,6 +255,7 @@ class Aggregate
     }
 
     void flush_cb(Caliper* c, Channel* chn, SnapshotFlushFn proc_fn) {
+        ThreadDB* own_tdb = acquire_tdb(c, chn, false);
         ThreadDB* tdb = nullptr;
 
         {
@@ -166,16 +267,24 @@ class Aggregate
 
         size_t num_written = 0;
 
+        if (own_tdb)
+            own_tdb->stopped.store(true);
+
         for ( ; tdb; tdb = tdb->next) {
-            tdb->stopped.store(true);
+            std::lock_guard<util::spinlock>
+                g(tdb->lock);
+
             num_written += tdb->db.flush(info, c, proc_fn);
-            tdb->stopped.store(false);
         }
 
+        if (own_tdb)
+            own_tdb->stopped.store(false);
+
         Log(1).stream() << chn->name() << ": Aggregate: flushed " << num_written << " snapshots." << std::endl;
     }
 
     void clear_cb(Caliper* c, Channel* chn) {
+        ThreadDB* own_tdb = acquire_tdb(c, chn, false);
         ThreadDB* tdb = nullptr;
 
         {
@@ -189,20 +298,29 @@ class Aggregate
         size_t num_kernels    = 0;
         size_t bytes_reserved = 0;
         size_t num_dropped    = 0;
+        size_t num_rehashes   = 0;
         size_t max_hash_len   = 0;
 
+        if (own_tdb)
+            own_tdb->stopped.store(true);
+
         while (tdb) {
-            tdb->stopped.store(true);
+            {
+                std::lock_guard<util::spinlock>
+                    g(tdb->lock);
 
-            num_entries    += tdb->db.num_entries();
-            num_kernels    += tdb->db.num_kernels();
-            bytes_reserved += tdb->db.bytes_reserved();
-            num_dropped    += tdb->db.num_dropped();
-            max_hash_len    = std::max(max_hash_len, tdb->db.max_hash_len());
+                num_entries    += tdb->db.num_entries();
+                num_kernels    += tdb->db.num_kernels();
+                bytes_reserved += tdb->db.bytes_reserved();
+                num_dropped    += tdb->db.num_dropped();
+                num_rehashes   += tdb->db.num_rehashes();
+                max_hash_len    = std::max(max_hash_len, tdb->db.max_hash_len());
 
-            tdb->db.clear();
+                if (Log::verbosity() >= 3)
+                    tdb->db.print_statistics(Log(3).stream() << chn->name() << ": Aggregate: thread DB: ") << std::endl;
 
-            tdb->stopped.store(false);
+                tdb->db.clear();
+            }
 
             if (tdb->retired) {
                 ThreadDB* tmp = tdb->next;
@@ -217,6 +335,9 @@ class Aggregate
                         tdb_list = tmp;
                 }
 
+                if (tdb == own_tdb)
+                    own_tdb = nullptr;
+
                 delete tdb;
                 tdb = tmp;
             } else {
@@ -224,13 +345,17 @@ class Aggregate
             }
         }
 
+        if (own_tdb)
+            own_tdb->stopped.store(false);
+
         if (Log::verbosity() >= 2) {
             unitfmt_result bytes_reserved_fmt =
                 unitfmt(bytes_reserved, unitfmt_bytes);
 
             Log(2).stream() << chn->name()  << ": Aggregate: Releasing aggregation DB.\n"
-                            << "  max hash len: "
+                            << "  max probe len: "
                             << max_hash_len << ", "
+                            << num_rehashes << " rehashes, "
                             << num_entries  << " entries, "
                             << num_kernels  << " kernels, "
                             << bytes_reserved_fmt.val    << " "
@@ -240,17 +365,22 @@ class Aggregate
 
         if (num_dropped > 0)
             Log(1).stream() << chn->name() << ": Aggregate: " << num_dropped
-                            << " entries dropped because aggregation buffers are full!"
+                            << " records dropped because aggregation buffers were full in signal handlers."
+                            << " Set CALI_LOG_VERBOSITY=3 for per-thread aggregation DB statistics."
                             << std::endl;
     }
 
     void process_snapshot_cb(Caliper* c, Channel* chn, SnapshotView rec) {
         ThreadDB* tdb = acquire_tdb(c, chn, !c->is_signal());
 
-        if (tdb && !tdb->stopped.load())
+        if (tdb && !tdb->stopped.load()) {
+            std::lock_guard<util::spinlock>
+                g(tdb->lock);
+
             tdb->db.process_snapshot(c, rec, info);
-        else
+        } else {
             ++num_dropped_snapshots;
+        }
     }
 
     void check_key_attribute(const Attribute& attr) {
@@ -369,6 +499,8 @@ class Aggregate
             key_attribute_names = config.get("key").to_stringlist(",");
             apply_key_config();
 
+            parse_kernel_config(config.get("kernels").to_string());
+
             tdb_attr =
                 c->create_attribute(std::string("aggregate.tdb.") + std::to_string(chn->id()),
                                     CALI_TYPE_PTR,
@@ -448,6 +580,10 @@ const char* Aggregate::s_spec = R"json(
       { "name"        : "key",
         "description" : "Attributes in the aggregation key (i.e., group by)",
         "type"        : "string"
+      },
+      { "name"        : "kernels",
+        "description" : "Aggregation kernels per attribute, e.g. time.duration.ns:sum,variance,hdr,p99;bytes:sum",
+        "type"        : "string"
       }
     ]
 }
@@ -9,11 +9,18 @@
 #include "caliper/common/Log.h"
 #include "caliper/common/Variant.h"
 
+#include "../../common/util/log_histogram.hpp"
+
 #include <algorithm>
+#include <cstdint>
 #include <cstring>
 #include <limits>
 #include <vector>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace cali;
 using namespace aggregate;
 
@@ -28,76 +35,211 @@ struct AggregateKernel {
     double   sum;
     int      count;
 
-#ifdef CALIPER_ENABLE_HISTOGRAMS
-    int histogram_max;
-    int histogram[CALI_AGG_HISTOGRAM_BINS] = {0};
-
-    // Quick way to get expoent out of a double.
-    struct getExponent {
-       union {
-          double val;
-          std::uint16_t sh[4];
-       };
-    };
-#endif
+    // Welford's online variance
+    double   mean;
+    double   m2;
+
+    // index into the histogram buffer, or NoHistogram
+    size_t   hist_idx;
+
+    static const size_t NoHistogram = ~static_cast<size_t>(0);
 
     AggregateKernel()
         : min(std::numeric_limits<double>::max()),
-          max(std::numeric_limits<double>::min()),
-          sum(0), count(0)
-#ifdef CALIPER_ENABLE_HISTOGRAMS
-          , histogram_max(0)
-#endif
+          max(std::numeric_limits<double>::lowest()),
+          sum(0), count(0),
+          mean(0), m2(0),
+          hist_idx(NoHistogram)
         { }
 
-    void update(double val) {
+    void update(double val, int kernels, util::log_histogram* histograms) {
         min  = std::min(min, val);
         max  = std::max(max, val);
         sum += val;
         ++count;
 
-#ifdef CALIPER_ENABLE_HISTOGRAMS
-        //grab the shifted exponent from double, cast as int.
-        std::uint64_t val_uint;
-        std::memcpy(&val_uint, &val, 8);
-        val_uint >>= 52;
-        val_uint &= 0x7FF;
-        //The bias for double is 1023, which means histogram
-        //boundaries at 4x would lie at -0.5, 2.  To make things even
-        //powers of 4 for ease of documentation, we need the bias to
-        //be 1024.
-        //making bins of size 4x, which means dividing exponent by 2.
-        int exponent = (val_uint+1)/2;
-        if (exponent > histogram_max) {
-            //shift down values as necessary.
-            int shift = std::min(exponent - histogram_max,CALI_AGG_HISTOGRAM_BINS-1);
-            for (int ii=1; ii<shift+1; ii++) {
-                histogram[0] += histogram[ii];
-            }
-            for (int ii=shift+1; ii<CALI_AGG_HISTOGRAM_BINS; ii++) {
-                int jj = ii-shift;
-                histogram[jj] = histogram[ii];
-            }
-            for (int jj=CALI_AGG_HISTOGRAM_BINS-shift; jj<CALI_AGG_HISTOGRAM_BINS; jj++) {
-               histogram[jj] = 0;
-            }
-            histogram_max = exponent;
+        if (kernels & VarianceKernel) {
+            double delta = val - mean;
+            mean += delta / count;
+            m2   += delta * (val - mean);
         }
-        int index = std::max(CALI_AGG_HISTOGRAM_BINS-1 - (histogram_max-exponent), 0);
-        histogram[index]++;
-#endif
+
+        if (hist_idx != NoHistogram)
+            histograms[hist_idx].add(val);
     }
 };
 
+const size_t AggregateKernel::NoHistogram;
+
 struct AggregateEntry {
     size_t count;
     size_t key_idx;
     size_t key_len;
     size_t kernels_idx;
     size_t num_kernels;
-    size_t next_entry_idx;
+    size_t hash;
+};
+
+inline size_t hash_combine(size_t h, uint64_t v)
+{
+    v *= 0x9E3779B97F4A7C15ull;
+    v ^= v >> 32;
+    return (h ^ static_cast<size_t>(v)) * 0xBF58476D1CE4E5B9ull;
+}
+
+//   Open-addressing hash index mapping key hashes to entry indices.
+// Slots are organized in groups of 16 with one control byte per slot:
+// either Empty or the low 7 bits of the hash (the "tag"). A probe
+// compares all tags in a group at once, and only compares keys of slots
+// with matching tags. There are no deletions; the index is either
+// cleared completely or replaced by a larger one.
+
+class EntryIndex
+{
+public:
+
+    static const size_t  GroupSize = 16;
+    static const int8_t  Empty     = -128;
+
+private:
+
+    std::vector<int8_t>   m_ctrl;
+    std::vector<uint32_t> m_slots;
+
+    size_t m_group_mask;
+    size_t m_size;
+
+    static inline int8_t tag(size_t hash) {
+        return static_cast<int8_t>(hash & 0x7F);
+    }
+
+    static inline size_t group(size_t hash) {
+        return hash >> 7;
+    }
+
+    static inline unsigned match(const int8_t* ctrl, int8_t t) {
+#ifdef __SSE2__
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(t))));
+#else
+        unsigned mask = 0;
+        for (size_t i = 0; i < GroupSize; ++i)
+            mask |= static_cast<unsigned>(ctrl[i] == t) << i;
+        return mask;
+#endif
+    }
+
+    static inline unsigned lowest_bit(unsigned mask) {
+#if defined(__GNUC__)
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#else
+        unsigned i = 0;
+        while (!(mask & 1)) {
+            mask >>= 1;
+            ++i;
+        }
+        return i;
+#endif
+    }
+
+public:
+
+    EntryIndex()
+        : m_group_mask(0), m_size(0)
+        { }
+
+    explicit EntryIndex(size_t num_slots)
+        : m_ctrl(num_slots, Empty),
+          m_slots(num_slots, 0),
+          m_group_mask(num_slots / GroupSize - 1),
+          m_size(0)
+        { }
+
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_slots.size(); }
+    bool   empty() const { return m_slots.empty(); }
+    size_t num_groups() const { return m_slots.empty() ? 0 : m_group_mask + 1; }
+
+    size_t bytes_reserved() const {
+        return m_ctrl.capacity() * sizeof(int8_t) + m_slots.capacity() * sizeof(uint32_t);
+    }
+
+    /// \brief Return the entry index for \a hash where \a eq(idx) is true,
+    ///   or 0 if there is none.
+    template<typename EqFn>
+    uint32_t find(size_t hash, EqFn eq) const {
+        if (m_slots.empty())
+            return 0;
+
+        const int8_t t = tag(hash);
+        size_t g = group(hash) & m_group_mask;
+
+        for (size_t p = 1; p <= m_group_mask + 1; ++p) {
+            const int8_t* ctrl = m_ctrl.data() + g * GroupSize;
+
+            for (unsigned m = match(ctrl, t); m; m &= m - 1) {
+                uint32_t idx = m_slots[g * GroupSize + lowest_bit(m)];
+                if (eq(idx))
+                    return idx;
+            }
+
+            if (match(ctrl, Empty))
+                return 0;
+
+            g = (g + p) & m_group_mask;
+        }
+
+        return 0;
+    }
+
+    /// \brief Insert entry index \a idx for \a hash. The caller must
+    ///   make sure there is room. Returns the number of groups probed.
+    size_t insert(size_t hash, uint32_t idx) {
+        size_t g = group(hash) & m_group_mask;
+        size_t p = 1;
+
+        for ( ; p <= m_group_mask + 1; ++p) {
+            unsigned m = match(m_ctrl.data() + g * GroupSize, Empty);
+
+            if (m) {
+                size_t s = g * GroupSize + lowest_bit(m);
+                m_ctrl[s]  = tag(hash);
+                m_slots[s] = idx;
+                ++m_size;
+                break;
+            }
+
+            g = (g + p) & m_group_mask;
+        }
+
+        return p;
+    }
+
+    /// \brief Call \a fn(idx) for each entry index in group \a g.
+    template<typename Fn>
+    void for_each_in_group(size_t g, Fn fn) const {
+        for (size_t s = g * GroupSize; s < (g + 1) * GroupSize; ++s)
+            if (m_ctrl[s] != Empty)
+                fn(m_slots[s]);
+    }
+
+    void clear() {
+        std::fill(m_ctrl.begin(), m_ctrl.end(), Empty);
+        m_size = 0;
+    }
+
+    void swap(EntryIndex& other) {
+        m_ctrl.swap(other.m_ctrl);
+        m_slots.swap(other.m_slots);
+        std::swap(m_group_mask, other.m_group_mask);
+        std::swap(m_size, other.m_size);
+    }
 };
 
+const size_t EntryIndex::GroupSize;
+const int8_t EntryIndex::Empty;
+
+
 bool key_equal(SnapshotView lhs, SnapshotView rhs)
 {
     if (lhs.size() != rhs.size())
@@ -115,14 +257,35 @@ bool key_equal(SnapshotView lhs, SnapshotView rhs)
 
 struct AggregationDB::AggregationDBImpl
 {
-    Node                         m_aggr_root_node;
+    // Number of probe-length histogram bins. The last bin counts all
+    // inserts that needed ProbeHistBins or more group probes.
+    static const size_t ProbeHistBins = 8;
 
-    size_t                       m_max_hash_len;
+    // Initial sizes of the entry, key, and kernel buffers and the index
+    static const size_t InitialEntries = 4096;
+    static const size_t InitialKeyents = 16384;
+    static const size_t InitialKernels = 16384;
+    static const size_t InitialSlots   = 8192;
+
+    Node                         m_aggr_root_node;
 
     std::vector<AggregateEntry>  m_entries;
     std::vector<Entry>           m_keyents;
     std::vector<AggregateKernel> m_kernels;
-    std::vector<size_t>          m_hashmap;
+    std::vector<util::log_histogram> m_histograms;
+
+    //   The index is resized incrementally: when it gets too full, a new
+    // index twice the size becomes m_index and the old one moves to
+    // m_old_index. Each subsequent (non-signal) insert migrates a few
+    // groups from the old index until it is empty. Lookups check both.
+
+    EntryIndex                   m_index;
+    EntryIndex                   m_old_index;
+    size_t                       m_migrate_pos;
+
+    size_t                       m_num_rehashes;
+    size_t                       m_max_probe_len;
+    size_t                       m_probe_hist[ProbeHistBins];
 
     //
     // ---
@@ -162,32 +325,104 @@ struct AggregationDB::AggregationDBImpl
         return key_node == &m_aggr_root_node ? nullptr : key_node;
     }
 
-    AggregateEntry* find_or_create_entry(SnapshotView key, std::size_t hash, std::size_t num_aggr_attrs, bool can_alloc) {
-        hash = hash % m_hashmap.size();
-        size_t count = 0;
+    // Number of old index groups to migrate per insert during a rehash.
+    // The new index has twice the capacity and we start the rehash at
+    // 3/4 load, so migration always completes long before the new index
+    // itself needs to grow.
+    static const size_t MigrateGroupsPerInsert = 4;
 
-        for (std::size_t idx = m_hashmap[hash]; idx != 0; idx = m_entries[idx].next_entry_idx) {
-            AggregateEntry* e = &m_entries[idx];
-            if (key_equal(key, SnapshotView(e->key_len, &m_keyents[e->key_idx])))
-                return e;
-            ++count;
-        }
+    void finish_migration(size_t max_groups) {
+        size_t end = std::min(m_old_index.num_groups(), m_migrate_pos + max_groups);
 
-        // --- entry not found, check if we can create a new entry
-        //
+        for ( ; m_migrate_pos < end; ++m_migrate_pos)
+            m_old_index.for_each_in_group(m_migrate_pos, [this](uint32_t idx){
+                    m_index.insert(m_entries[idx].hash, idx);
+                });
 
-        if (!can_alloc) {
-            if (m_kernels.size() + num_aggr_attrs >= m_kernels.capacity())
-                return &m_entries[0];
-            if (m_keyents.size() + key.size() >= m_keyents.capacity())
-                return &m_entries[0];
-            if (m_entries.size() + 1 >= m_entries.capacity())
-                return &m_entries[0];
+        if (m_migrate_pos >= m_old_index.num_groups()) {
+            EntryIndex tmp;
+            m_old_index.swap(tmp);
+            m_migrate_pos = 0;
         }
+    }
+
+    void start_rehash() {
+        if (!m_old_index.empty())
+            finish_migration(m_old_index.num_groups());
+
+        EntryIndex tmp(2 * m_index.capacity());
+
+        m_index.swap(tmp);
+        m_old_index.swap(tmp);
+        m_migrate_pos = 0;
+
+        ++m_num_rehashes;
+    }
+
+    template<typename T>
+    static void reserve_spare(std::vector<T>& vec, size_t n) {
+        //   Keep at least a quarter of the buffer capacity free so that
+        // inserts in signal handlers (which can't allocate) find room.
+        if (4 * (vec.size() + n) > 3 * vec.capacity())
+            vec.reserve(std::max(2 * vec.capacity(), vec.size() + n));
+    }
+
+    void grow(size_t key_len, size_t num_kernels, size_t num_histograms) {
+        reserve_spare(m_entries, 1);
+        reserve_spare(m_keyents, key_len);
+        reserve_spare(m_kernels, num_kernels);
+        reserve_spare(m_histograms, num_histograms);
+
+        if (4 * (m_index.size() + 1) > 3 * m_index.capacity())
+            start_rehash();
+    }
+
+    bool has_room(size_t key_len, size_t num_kernels, size_t num_histograms) const {
+        return m_entries.size() + 1                 <= m_entries.capacity()
+            && m_keyents.size() + key_len           <= m_keyents.capacity()
+            && m_kernels.size() + num_kernels       <= m_kernels.capacity()
+            && m_histograms.size() + num_histograms <= m_histograms.capacity()
+            && 16 * (m_index.size() + 1)      <= 15 * m_index.capacity();
+    }
+
+    AggregateEntry* find_or_create_entry(SnapshotView key, std::size_t hash, const AttributeInfo& info, bool can_alloc) {
+        auto eq = [this,key,hash](uint32_t idx) {
+            const AggregateEntry& e = m_entries[idx];
+            return e.hash == hash && key_equal(key, SnapshotView(e.key_len, &m_keyents[e.key_idx]));
+        };
+
+        uint32_t idx = m_index.find(hash, eq);
+
+        if (idx == 0 && !m_old_index.empty())
+            idx = m_old_index.find(hash, eq);
+        if (idx != 0)
+            return &m_entries[idx];
+
+        // --- entry not found, create a new one
+        //   Outside of signal handlers we can grow the buffers and the index.
+        // In signal handlers, we can only use the spare room reserved earlier.
+
+        size_t num_aggr_attrs = info.aggr_attrs.size();
+        size_t num_histograms = 0;
+
+        for (const ResultAttributes& res : info.result_attrs)
+            if (res.kernels & HistogramKernel)
+                ++num_histograms;
+
+        if (can_alloc)
+            grow(key.size(), num_aggr_attrs, num_histograms);
+        else if (!has_room(key.size(), num_aggr_attrs, num_histograms))
+            return &m_entries[0];
 
         size_t kernels_idx = m_kernels.size();
         m_kernels.resize(m_kernels.size() + num_aggr_attrs, AggregateKernel());
 
+        for (size_t a = 0; a < num_aggr_attrs; ++a)
+            if (info.result_attrs[a].kernels & HistogramKernel) {
+                m_kernels[kernels_idx + a].hist_idx = m_histograms.size();
+                m_histograms.push_back(util::log_histogram());
+            }
+
         size_t key_idx = m_keyents.size();
         std::copy(key.begin(), key.end(), std::back_inserter(m_keyents));
 
@@ -198,13 +433,18 @@ struct AggregationDB::AggregationDBImpl
         e.key_len        = key.size();
         e.kernels_idx    = kernels_idx;
         e.num_kernels    = num_aggr_attrs;
-        e.next_entry_idx = m_hashmap[hash];
+        e.hash           = hash;
 
         size_t entry_idx = m_entries.size();
         m_entries.push_back(e);
-        m_hashmap[hash] = entry_idx;
 
-        m_max_hash_len = std::max(m_max_hash_len, count+1);
+        size_t probe_len = m_index.insert(hash, static_cast<uint32_t>(entry_idx));
+
+        m_max_probe_len = std::max(m_max_probe_len, probe_len);
+        ++m_probe_hist[std::min(probe_len, ProbeHistBins) - 1];
+
+        if (can_alloc && !m_old_index.empty())
+            finish_migration(MigrateGroupsPerInsert);
 
         return &m_entries[entry_idx];
     }
@@ -222,7 +462,7 @@ struct AggregationDB::AggregationDBImpl
             for (const Entry& e : rec)
                 if (e.is_reference()) {
                     key.builder().append(e);
-                    hash += e.node()->id();
+                    hash = hash_combine(hash, e.node()->id());
                 }
         } else {
             if (info.group_nested) {
@@ -230,7 +470,7 @@ struct AggregationDB::AggregationDBImpl
                 for (const Entry& e : rec)
                     if (e.is_reference() && c->get_attribute(e.node()->attribute()).is_nested()) {
                         key.builder().append(e);
-                        hash += e.node()->id();
+                        hash = hash_combine(hash, e.node()->id());
                         break;
                     }
             }
@@ -238,7 +478,7 @@ struct AggregationDB::AggregationDBImpl
             Node* node = make_key_node(c, rec, info.ref_key_attrs);
             if (node) {
                 key.builder().append(Entry(node));
-                hash += node->id();
+                hash = hash_combine(hash, node->id());
             }
         }
 
@@ -246,12 +486,12 @@ struct AggregationDB::AggregationDBImpl
             Entry e = rec.get_immediate_entry(attr);
             if (!e.empty()) {
                 key.builder().append(e);
-                hash += e.node()->id();
-                hash += e.value().to_uint();
+                hash = hash_combine(hash, e.node()->id());
+                hash = hash_combine(hash, e.value().to_uint());
             }
         }
 
-        AggregateEntry* entry = find_or_create_entry(key.view(), hash, info.aggr_attrs.size(), !c->is_signal());
+        AggregateEntry* entry = find_or_create_entry(key.view(), hash, info, !c->is_signal());
 
         // --- update values
 
@@ -263,19 +503,71 @@ struct AggregationDB::AggregationDBImpl
             if (e.empty())
                 continue;
 
-            m_kernels[entry->kernels_idx + a].update(e.value().to_double());
+            m_kernels[entry->kernels_idx + a].update(e.value().to_double(), info.result_attrs[a].kernels, m_histograms.data());
         }
     }
 
     void clear() {
-        m_hashmap.assign(m_hashmap.size(), 0);
+        if (!m_old_index.empty()) {
+            EntryIndex tmp;
+            m_old_index.swap(tmp);
+            m_migrate_pos = 0;
+        }
+
+        m_index.clear();
         m_entries.resize(1);
         m_kernels.resize(0);
+        m_histograms.resize(0);
         m_keyents.resize(0);
 
         m_entries[0].count = 0;
     }
 
+    void append_results(Caliper* c, const Attribute& attr, const ResultAttributes& res, const AggregateKernel& k, std::vector<Entry>& rec) {
+        if (res.kernels & MinKernel)
+            rec.push_back(Entry(res.min_attr, Variant(k.min)));
+        if (res.kernels & MaxKernel)
+            rec.push_back(Entry(res.max_attr, Variant(k.max)));
+        if (res.kernels & SumKernel)
+            rec.push_back(Entry(res.sum_attr, Variant(k.sum)));
+        if (res.kernels & AvgKernel)
+            rec.push_back(Entry(res.avg_attr, Variant(k.sum / k.count)));
+
+        if (res.kernels & VarianceKernel) {
+            //   Also write count, sum, and sum of squares so that readers
+            // (cali-query, aggregate_over_mpi) can merge the results
+            double sqsum = k.m2 + k.count * k.mean * k.mean;
+
+            rec.push_back(Entry(res.variance_attr,  Variant(k.m2 / k.count)));
+            rec.push_back(Entry(res.var_count_attr, cali_make_variant_from_uint(k.count)));
+            rec.push_back(Entry(res.var_sum_attr,   Variant(k.mean * k.count)));
+            rec.push_back(Entry(res.var_sqsum_attr, Variant(sqsum)));
+        }
+
+        if (k.hist_idx != AggregateKernel::NoHistogram) {
+            const util::log_histogram& hist = m_histograms[k.hist_idx];
+
+            for (size_t p = 0; p < res.percentiles.size(); ++p)
+                rec.push_back(Entry(res.percentile_attrs[p], Variant(hist.quantile(res.percentiles[p]))));
+
+            //   Write the histogram bins as hdr.bin.<index>#<attr> entries.
+            // Bin attributes are created on demand; there is one per bin
+            // index actually in use.
+            const int prop = CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS;
+
+            if (hist.zero_count() > 0)
+                rec.push_back(Entry(c->create_attribute(std::string("hdr.bin.zero#") + attr.name(), CALI_TYPE_UINT, prop),
+                                    cali_make_variant_from_uint(hist.zero_count())));
+
+            hist.for_each_bin([c,&attr,&rec](int index, uint64_t count){
+                    Attribute bin_attr =
+                        c->create_attribute(std::string("hdr.bin.") + std::to_string(index) + "#" + attr.name(),
+                                            CALI_TYPE_UINT, prop);
+                    rec.push_back(Entry(bin_attr, cali_make_variant_from_uint(count)));
+                });
+        }
+    }
+
     size_t flush(const AttributeInfo& info, Caliper* c, SnapshotFlushFn proc_fn) {
         size_t num_written = 0;
 
@@ -286,27 +578,17 @@ struct AggregationDB::AggregationDBImpl
             SnapshotView kv(entry.key_len, &m_keyents[entry.key_idx]);
 
             std::vector<Entry> rec;
-            rec.reserve(kv.size() + entry.num_kernels + 2);
+            rec.reserve(kv.size() + 4 * entry.num_kernels + 2);
 
             std::copy(kv.begin(), kv.end(), std::back_inserter(rec));
 
             for (std::size_t a = 0; a < entry.num_kernels; ++a) {
-                AggregateKernel* k = &m_kernels[entry.kernels_idx + a];
+                const AggregateKernel* k = &m_kernels[entry.kernels_idx + a];
 
                 if (k->count == 0)
                     continue;
 
-                double avg = k->sum / k->count;
-
-                rec.push_back(Entry(info.result_attrs[a].min_attr, Variant(k->min)));
-                rec.push_back(Entry(info.result_attrs[a].max_attr, Variant(k->max)));
-                rec.push_back(Entry(info.result_attrs[a].sum_attr, Variant(k->sum)));
-                rec.push_back(Entry(info.result_attrs[a].avg_attr, Variant(avg)));
-    #ifdef CALIPER_ENABLE_HISTOGRAMS
-                for (int ii=0; ii<CALI_AGG_HISTOGRAM_BINS; ii++) {
-                    rec.push_back(Entry(info.stats_attributes[a].histogram_attr[ii], Variant(cali_make_variant_from_uint(k->histogram[ii]))));
-                }
-    #endif
+                append_results(c, info.aggr_attrs[a], info.result_attrs[a], *k, rec);
             }
 
             rec.push_back(Entry(info.count_attr, cali_make_variant_from_uint(entry.count)));
@@ -320,14 +602,34 @@ struct AggregationDB::AggregationDBImpl
         return num_written;
     }
 
+    std::ostream& print_statistics(std::ostream& os) const {
+        size_t num_entries = m_entries.size() - 1;
+        double load = m_index.capacity() > 0 ? static_cast<double>(m_index.size()) / m_index.capacity() : 0.0;
+
+        os << num_entries << " entries, "
+           << m_index.capacity() << " slots (load factor " << load << "), "
+           << m_num_rehashes << " rehashes, "
+           << m_entries[0].count << " records dropped"
+           << "\n  probe lengths:";
+
+        for (size_t i = 0; i < ProbeHistBins; ++i)
+            os << " " << (i + 1) << (i + 1 == ProbeHistBins ? "+" : "") << ":" << m_probe_hist[i];
+
+        return os << ", max " << m_max_probe_len;
+    }
+
     AggregationDBImpl(Caliper* c)
         : m_aggr_root_node(CALI_INV_ID, CALI_INV_ID, Variant()),
-          m_max_hash_len(0)
+          m_index(InitialSlots),
+          m_migrate_pos(0),
+          m_num_rehashes(0),
+          m_max_probe_len(0)
         {
-            m_kernels.reserve(16384);
-            m_keyents.reserve(16384);
-            m_entries.reserve(4096);
-            m_hashmap.assign(8192, static_cast<std::size_t>(0));
+            std::fill_n(m_probe_hist, ProbeHistBins, static_cast<size_t>(0));
+
+            m_kernels.reserve(InitialKernels);
+            m_keyents.reserve(InitialKeyents);
+            m_entries.reserve(InitialEntries);
 
             Attribute attr =
                 c->create_attribute("skipped.records", CALI_TYPE_STRING, CALI_ATTR_DEFAULT | CALI_ATTR_SKIP_EVENTS);
@@ -343,12 +645,14 @@ struct AggregationDB::AggregationDBImpl
             e.key_len        = 1;
             e.kernels_idx    = 0;
             e.num_kernels    = 0;
-            e.next_entry_idx = 0;
+            e.hash           = 0;
 
             m_entries.push_back(e);
         }
 };
 
+const size_t AggregationDB::AggregationDBImpl::ProbeHistBins;
+
 //
 // --- AggregationDB public interface
 //
@@ -389,7 +693,13 @@ AggregationDB::num_dropped() const
 size_t
 AggregationDB::max_hash_len() const
 {
-    return mP->m_max_hash_len;
+    return mP->m_max_probe_len;
+}
+
+size_t
+AggregationDB::num_rehashes() const
+{
+    return mP->m_num_rehashes;
 }
 
 size_t
@@ -407,8 +717,16 @@ AggregationDB::num_kernels() const
 size_t
 AggregationDB::bytes_reserved() const
 {
-    return mP->m_hashmap.capacity() * sizeof(size_t)
+    return mP->m_index.bytes_reserved()
+        + mP->m_old_index.bytes_reserved()
         + mP->m_kernels.capacity() * sizeof(AggregateKernel)
+        + mP->m_histograms.capacity() * sizeof(util::log_histogram)
         + mP->m_keyents.capacity() * sizeof(Entry)
         + mP->m_entries.capacity() * sizeof(AggregateEntry);
 }
+
+std::ostream&
+AggregationDB::print_statistics(std::ostream& os) const
+{
+    return mP->print_statistics(os);
+}
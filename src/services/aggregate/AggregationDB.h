@@ -10,23 +10,45 @@
 
 #include "caliper/common/Attribute.h"
 
+#include <iostream>
 #include <memory>
 #include <vector>
 
-#define CALI_AGG_HISTOGRAM_BINS      10
-
 namespace aggregate
 {
 
+/// \brief Aggregation kernels that can be enabled per attribute
+enum KernelFlags {
+    MinKernel       = 1,
+    MaxKernel       = 2,
+    SumKernel       = 4,
+    AvgKernel       = 8,
+    VarianceKernel  = 16,
+    HistogramKernel = 32,
+
+    DefaultKernels  = MinKernel | MaxKernel | SumKernel | AvgKernel
+#ifdef CALIPER_ENABLE_HISTOGRAMS
+                    | HistogramKernel
+#endif
+};
+
 struct ResultAttributes
 {
+    int kernels; ///< enabled KernelFlags
+
     cali::Attribute min_attr;
     cali::Attribute max_attr;
     cali::Attribute sum_attr;
     cali::Attribute avg_attr;
-#ifdef CALIPER_ENABLE_HISTOGRAMS
-    cali::Attribute histogram_attr[CALI_AGG_HISTOGRAM_BINS];
-#endif
+
+    cali::Attribute variance_attr;
+    cali::Attribute var_count_attr;
+    cali::Attribute var_sum_attr;
+    cali::Attribute var_sqsum_attr;
+
+    /// requested percentiles (0..1); these require HistogramKernel
+    std::vector<double>          percentiles;
+    std::vector<cali::Attribute> percentile_attrs;
 };
 
 struct AttributeInfo
@@ -69,7 +91,12 @@ public:
     size_t max_hash_len() const;
     size_t num_entries() const;
     size_t num_kernels() const;
+    size_t num_rehashes() const;
     size_t bytes_reserved() const;
+
+    /// \brief Print hash index load factor, probe length histogram,
+    ///   rehash count, and number of dropped records to \a os.
+    std::ostream& print_statistics(std::ostream& os) const;
 };
 
 } // namespace aggregate
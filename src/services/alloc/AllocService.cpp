@@ -3,7 +3,7 @@
 
 // Service for hooking memory allocation calls
 
-#include "SplayTree.hpp"
+#include "IntervalIndex.hpp"
 
 #include "caliper/CaliperService.h"
 #include "../Services.h"
@@ -18,7 +18,6 @@
 #include <algorithm>
 #include <atomic>
 #include <cstring>
-#include <mutex>
 #include <numeric>
 
 #define NUM_TRACKED_ALLOC_ATTRS 2
@@ -41,6 +40,8 @@ namespace
 struct AllocInfo {
     uint64_t                 start_addr;
     uint64_t                 total_size;
+    uint64_t                 scaled_size;   ///< total_size * sample_weight
+    double                   sample_weight; ///< set by sampling allocation trackers
     Variant                  v_uid;
     size_t                   elem_size;
     size_t                   num_elems;
@@ -54,54 +55,6 @@ struct AllocInfo {
     }
 };
 
-/// Three-way predicate to tell if given address is within AllocInfo's address range, less, or higher
-class ContainsAddress {
-    uint64_t address;
-
-public:
-
-    ContainsAddress(uint64_t a)
-        : address(a) { }
-
-    inline int operator ()(const AllocInfo& info) const {
-        if (address < info.start_addr)
-            return -1;
-        else if (address >= info.start_addr && address < info.start_addr + info.total_size)
-            return 0;
-        else
-            return +1;
-    }
-};
-
-/// Three-way predicate to tell if given address is AllocInfo's start address, less, or higher
-class HasStartAddress {
-    uint64_t address;
-
-public:
-
-    HasStartAddress(uint64_t a)
-        : address(a) { }
-
-    inline int operator ()(const AllocInfo& info) const {
-        if (address < info.start_addr)
-            return -1;
-        else if (address == info.start_addr)
-            return 0;
-        else
-            return +1;
-    }
-};
-
-struct AllocInfoCmp {
-    int operator ()(const AllocInfo& lhs, const AllocInfo& rhs) const {
-        if (lhs.start_addr < rhs.start_addr)
-            return -1;
-        else if (lhs.start_addr == rhs.start_addr)
-            return 0;
-        return 1;
-    }
-};
-
 class AllocService
 {
     bool g_resolve_addresses        { false };
@@ -118,6 +71,7 @@ class AllocService
     Attribute alloc_num_elems_attr  { Attribute::invalid };
     Attribute alloc_total_size_attr { Attribute::invalid };
     Attribute active_mem_attr       { Attribute::invalid };
+    Attribute sample_weight_attr    { Attribute::invalid };
 
     Attribute region_hwm_attr       { Attribute::invalid };
 
@@ -134,33 +88,40 @@ class AllocService
 
     cali::Node                 g_alloc_root_node { CALI_INV_ID, CALI_INV_ID, Variant() };
 
-    util::SplayTree<AllocInfo, AllocInfoCmp> g_tree;
-    std::mutex                 g_tree_lock;
+    util::IntervalIndex<AllocInfo> g_index;
 
-    uint64_t                   g_active_mem      { 0 };
-    uint64_t                   g_hwm             { 0 };
-    uint64_t                   g_region_hwm      { 0 };
-    std::mutex                 g_hwm_lock;
+    std::atomic<uint64_t>      g_active_mem      { 0 };
+    std::atomic<uint64_t>      g_hwm             { 0 };
+    std::atomic<uint64_t>      g_region_hwm      { 0 };
 
-    unsigned long              g_current_tracked { 0 };
-    unsigned long              g_max_tracked     { 0 };
-    unsigned long              g_total_tracked   { 0 };
-    unsigned                   g_failed_untrack  { 0 };
+    std::atomic<unsigned long> g_current_tracked { 0 };
+    std::atomic<unsigned long> g_max_tracked     { 0 };
+    std::atomic<unsigned long> g_total_tracked   { 0 };
+    std::atomic<unsigned>      g_failed_untrack  { 0 };
+
+    template<typename U>
+    static void atomic_max(std::atomic<U>& a, U val) {
+        U prev = a.load(std::memory_order_relaxed);
+        while (prev < val && !a.compare_exchange_weak(prev, val, std::memory_order_relaxed))
+            ;
+    }
 
     void track_mem_snapshot(Caliper* c,
                             Channel* chn,
                             cali::Node*    label_node,
                             const Variant& v_size,
                             const Variant& v_uid,
-                            const Variant& v_addr) {
+                            const Variant& v_addr,
+                            double         weight) {
         Entry data[] = {
             { alloc_total_size_attr, v_size },
             { alloc_uid_attr,        v_uid  },
             { alloc_addr_attr,       v_addr },
-            { label_node }
+            { label_node },
+            { sample_weight_attr,    Variant(weight) }
         };
 
-        c->push_snapshot(chn, SnapshotView(4, data));
+        c->push_snapshot(chn, SnapshotView(weight == 1.0 ? 4 : 5, data));
     }
 
     void track_mem_cb(Caliper* c, Channel* chn, const void* ptr, const char* label, size_t elem_size, size_t ndims, const size_t* dims,
@@ -170,18 +131,29 @@ class AllocService
 
         AllocInfo info;
 
-        info.start_addr = reinterpret_cast<uint64_t>(ptr);
-        info.total_size = total_size;
-        info.v_uid      = Variant(cali_make_variant_from_uint(++g_alloc_uid));
-        info.elem_size  = elem_size;
-        info.num_elems  = total_size / elem_size;
+        info.start_addr    = reinterpret_cast<uint64_t>(ptr);
+        info.total_size    = total_size;
+        info.scaled_size   = total_size;
+        info.sample_weight = 1.0;
+        info.v_uid         = Variant(cali_make_variant_from_uint(++g_alloc_uid));
+        info.elem_size     = elem_size;
+        info.num_elems     = total_size / elem_size;
 
         Variant v_label(label);
 
         Node* root_node = &g_alloc_root_node;
 
-        for (size_t i = 0; i < nextra; ++i)
+        for (size_t i = 0; i < nextra; ++i) {
+            //   Sampling trackers (e.g. sysalloc) pass the sample weight,
+            // scale the size outputs with it to get unbiased estimates
+            if (extra_attrs[i] == sample_weight_attr) {
+                info.sample_weight = extra_vals[i].to_double();
+                info.scaled_size   = static_cast<uint64_t>(total_size * info.sample_weight + 0.5);
+                continue;
+            }
+
             root_node = c->make_tree_entry(extra_attrs[i], extra_vals[i], root_node);
+        }
 
         info.alloc_label_node =
             c->make_tree_entry(mem_alloc_attr, v_label, root_node);
@@ -197,62 +169,42 @@ class AllocService
 
         if (g_track_allocations)
             track_mem_snapshot(c, chn, info.alloc_label_node,
-                               Variant(static_cast<int>(total_size)),
+                               Variant(static_cast<int>(info.scaled_size)),
                                info.v_uid,
-                               Variant(CALI_TYPE_ADDR, &ptr, sizeof(void*)));
+                               Variant(CALI_TYPE_ADDR, &ptr, sizeof(void*)),
+                               info.sample_weight);
 
         {
-            std::lock_guard<std::mutex>
-                g(g_hwm_lock);
+            uint64_t active = (g_active_mem += info.scaled_size);
 
-            g_active_mem  += total_size;
-            g_hwm          = std::max(g_hwm, g_active_mem);
-            g_region_hwm   = std::max(g_region_hwm, g_active_mem);
+            atomic_max(g_hwm, active);
+            atomic_max(g_region_hwm, active);
         }
 
-        {
-            std::lock_guard<std::mutex>
-                g(g_tree_lock);
-
-            g_tree.insert(info);
+        g_index.insert(info.start_addr, info.start_addr + info.total_size, info);
 
-            g_max_tracked  = std::max(++g_current_tracked, g_max_tracked);
-            ++g_total_tracked;
-        }
+        atomic_max(g_max_tracked, ++g_current_tracked);
+        ++g_total_tracked;
     }
 
     void untrack_mem_cb(Caliper* c, Channel* chn, const void* ptr) {
         AllocInfo info;
 
-        {
-            std::lock_guard<std::mutex>
-                g(g_tree_lock);
-
-            auto tree_node = g_tree.find(HasStartAddress(reinterpret_cast<uint64_t>(ptr)));
-
-            if (!tree_node) {
-                ++g_failed_untrack;
-                return;
-            }
-
-            info = *tree_node;
-            g_tree.remove(tree_node);
-
-            --g_current_tracked;
+        if (!g_index.remove(reinterpret_cast<uint64_t>(ptr), &info)) {
+            ++g_failed_untrack;
+            return;
         }
 
+        --g_current_tracked;
+
         if (g_track_allocations)
             track_mem_snapshot(c, chn, info.free_label_node,
-                               Variant(-static_cast<int>(info.total_size)),
+                               Variant(-static_cast<int>(info.scaled_size)),
                                info.v_uid,
-                               Variant(CALI_TYPE_ADDR, &ptr, sizeof(void*)));
+                               Variant(CALI_TYPE_ADDR, &ptr, sizeof(void*)),
+                               info.sample_weight);
 
-        {
-            std::lock_guard<std::mutex>
-                g(g_hwm_lock);
-
-            g_active_mem -= info.total_size;
-        }
+        g_active_mem -= info.scaled_size;
     }
 
     void resolve_addresses(Caliper* c, const SnapshotView trigger_info, SnapshotBuilder& snapshot) {
@@ -264,43 +216,25 @@ class AllocService
 
             uint64_t addr = e.value().to_uint();
 
-            Entry       data[2];
-            cali::Node* label_node = nullptr;
+            AllocInfo info;
 
-            {
-                std::lock_guard<std::mutex>
-                    g(g_tree_lock);
-
-                auto tree_node = g_tree.find(ContainsAddress(addr));
-
-                if (!tree_node)
-                    continue;
-
-                data[0] = Entry(g_memoryaddress_attrs[i].alloc_uid_attr,
-                                (*tree_node).v_uid);
-                data[1] = Entry(g_memoryaddress_attrs[i].alloc_index_attr,
-                                cali_make_variant_from_uint((*tree_node).index_1D(addr)));
+            if (!g_index.find(addr, &info))
+                continue;
 
-                label_node = (*tree_node).addr_label_nodes[i];
-            }
+            Entry data[2] = {
+                Entry(g_memoryaddress_attrs[i].alloc_uid_attr,   info.v_uid),
+                Entry(g_memoryaddress_attrs[i].alloc_index_attr, cali_make_variant_from_uint(info.index_1D(addr)))
+            };
 
             snapshot.append(2, data);
 
-            if (label_node)
-                snapshot.append(Entry(label_node));
+            if (info.addr_label_nodes[i])
+                snapshot.append(Entry(info.addr_label_nodes[i]));
         }
     }
 
     void record_highwatermark(Caliper* c, Channel* chn, SnapshotBuilder& rec) {
-        uint64_t hwm = 0;
-
-        {
-            std::lock_guard<std::mutex>
-                g(g_hwm_lock);
-
-            hwm          = g_region_hwm;
-            g_region_hwm = g_active_mem;
-        }
+        uint64_t hwm = g_region_hwm.exchange(g_active_mem.load());
 
         rec.append(region_hwm_attr, Variant(hwm));
     }
@@ -308,7 +242,7 @@ class AllocService
     void snapshot_cb(Caliper* c, Channel* chn, SnapshotView info, SnapshotBuilder& snapshot) {
         // Record currently active amount of allocated memory
         if (g_record_active_mem)
-            snapshot.append(active_mem_attr, Variant(cali_make_variant_from_uint(g_active_mem)));
+            snapshot.append(active_mem_attr, Variant(cali_make_variant_from_uint(g_active_mem.load())));
 
         if (g_resolve_addresses && !info.empty())
             resolve_addresses(c, info, snapshot);
@@ -361,9 +295,9 @@ class AllocService
 
     void finish_cb(Caliper* c, Channel* chn) {
         Log(1).stream() << chn->name() << ": alloc: "
-                        << g_total_tracked  << " memory allocations tracked (max "
-                        << g_max_tracked    << " simultaneous), "
-                        << g_failed_untrack << " untrack lookups failed."
+                        << g_total_tracked.load()  << " memory allocations tracked (max "
+                        << g_max_tracked.load()    << " simultaneous), "
+                        << g_failed_untrack.load() << " untrack lookups failed."
                         << std::endl;
     }
 
@@ -416,6 +350,11 @@ class AllocService
                   0, nullptr, nullptr,
                   &region_hwm_attr
                 },
+                { "alloc.sample_weight", CALI_TYPE_DOUBLE,
+                  CALI_ATTR_SCOPE_THREAD  | CALI_ATTR_ASVALUE | CALI_ATTR_AGGREGATABLE,
+                  0, nullptr, nullptr,
+                  &sample_weight_attr
+                },
                 { 0, CALI_TYPE_INV, CALI_ATTR_DEFAULT, 0, nullptr, nullptr, nullptr }
             };
 
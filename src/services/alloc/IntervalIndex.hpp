@@ -0,0 +1,364 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file  IntervalIndex.hpp
+/// \brief Concurrent address interval index
+
+#pragma once
+
+#include "../../common/util/spinlock.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace util
+{
+
+/// \brief Maps non-overlapping address intervals [start, end) to values
+///
+/// The address space is cut into 64 KiB granules, which are hashed onto
+/// a fixed number of shards. An interval is stored in every shard that
+/// one of its granules maps to, so the interval containing an address
+/// can always be found in the address's shard. Each shard keeps its
+/// intervals in a skip list ordered by start address, so inserts,
+/// removals, and lookups take O(log n) time.
+///
+/// Writers (insert() and remove()) lock only the shards they modify,
+/// so threads working on different address ranges don't contend.
+/// Readers (find()) never lock or write shared memory: each shard is
+/// protected by a sequence lock, and readers retry if a writer modified
+/// the shard while they were reading it. Skip list links are published
+/// with release stores and followed with acquire loads. Nodes come from
+/// a per-shard pool and are reused but never freed until the index is
+/// destroyed, so a reader racing with a writer never touches freed
+/// memory. A reader also gives up on a traversal that takes more steps
+/// than the shard has nodes, so a modification in progress can't send
+/// it into a loop.
+///
+/// find() gives up and returns false after a bounded number of
+/// retries, which makes it safe to use in a signal handler that
+/// interrupted a writer.
+///
+/// \a T must be trivially copyable.
+template<class T>
+class IntervalIndex
+{
+    static const int      NumShards   = 64;
+    static const int      GranuleBits = 16;
+    static const int      MaxLevel    = 12;
+    static const int      SpinTries   = 64;
+    static const int      MaxTries    = 10000;
+    static const unsigned NumWords    = (sizeof(T) + 7) / 8;
+    static const unsigned BlockSize   = 64; ///< skip list nodes per pool block
+
+#if !defined(__GNUC__) || defined(__clang__) || __GNUC__ >= 5
+    static_assert(std::is_trivially_copyable<T>::value, "IntervalIndex requires a trivially copyable type");
+#endif
+
+    struct Node {
+        std::atomic<uint64_t> start;
+        std::atomic<uint64_t> end;
+        std::atomic<uint64_t> words[NumWords];
+        std::atomic<Node*>    next[MaxLevel];
+        int                   level;
+
+        Node()
+            : start(0), end(0), level(MaxLevel)
+            {
+                for (unsigned i = 0; i < NumWords; ++i)
+                    words[i].store(0, std::memory_order_relaxed);
+                for (int l = 0; l < MaxLevel; ++l)
+                    next[l].store(nullptr, std::memory_order_relaxed);
+            }
+
+        void store(uint64_t s, uint64_t e, const T& val) {
+            uint64_t buf[NumWords] = { 0 };
+            std::memcpy(buf, &val, sizeof(T));
+
+            start.store(s, std::memory_order_relaxed);
+            end.store(e, std::memory_order_relaxed);
+
+            for (unsigned i = 0; i < NumWords; ++i)
+                words[i].store(buf[i], std::memory_order_relaxed);
+        }
+
+        void load(T* val) const {
+            uint64_t buf[NumWords];
+
+            for (unsigned i = 0; i < NumWords; ++i)
+                buf[i] = words[i].load(std::memory_order_relaxed);
+
+            std::memcpy(val, buf, sizeof(T));
+        }
+    };
+
+    struct Shard {
+        std::atomic<unsigned>     seq;
+        std::atomic<std::size_t>  num_nodes;  ///< nodes in the pool; bounds reader traversals
+
+        Node                      head;
+
+        // writer side; protected by the shard lock
+        spinlock                  lock;
+        std::vector< std::unique_ptr<Node[]> > blocks;
+        unsigned                  block_used;
+        Node*                     free_list;  ///< linked through next[0]
+        uint32_t                  rng;
+
+        char                      padding[64];      ///< avoid false sharing between shards
+
+        Shard()
+            : seq(0), num_nodes(0), block_used(BlockSize), free_list(nullptr), rng(0x9E3779B9u)
+            { }
+
+        // --- writer side; requires the shard lock
+
+        void begin_write() {
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        void end_write() {
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        Node* alloc_node() {
+            if (free_list) {
+                Node* node = free_list;
+                free_list  = node->next[0].load(std::memory_order_relaxed);
+                return node;
+            }
+
+            if (block_used == BlockSize) {
+                blocks.emplace_back(new Node[BlockSize]);
+                block_used = 0;
+                num_nodes.store(blocks.size() * BlockSize, std::memory_order_relaxed);
+            }
+
+            return &blocks.back()[block_used++];
+        }
+
+        int random_level() {
+            int level = 1;
+
+            // xorshift32; each level has 1/4 of the nodes of the one below
+            do {
+                rng ^= rng << 13;
+                rng ^= rng >> 17;
+                rng ^= rng << 5;
+            } while ((rng & 3) == 0 && ++level < MaxLevel);
+
+            return level;
+        }
+
+        /// \brief Find the last node before \a start on each level
+        void find_preds(uint64_t start, Node* preds[]) {
+            Node* x = &head;
+
+            for (int l = MaxLevel - 1; l >= 0; --l) {
+                for (Node* n = x->next[l].load(std::memory_order_relaxed);
+                     n && n->start.load(std::memory_order_relaxed) < start;
+                     n = x->next[l].load(std::memory_order_relaxed))
+                    x = n;
+
+                preds[l] = x;
+            }
+        }
+
+        void insert(uint64_t start, uint64_t end, const T& val) {
+            Node* preds[MaxLevel];
+            find_preds(start, preds);
+
+            Node* node  = alloc_node();
+            int   level = random_level();
+
+            begin_write();
+
+            node->store(start, end, val);
+            node->level = level;
+
+            for (int l = 0; l < level; ++l)
+                node->next[l].store(preds[l]->next[l].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            // release: readers that follow the link see the node's contents
+            for (int l = 0; l < level; ++l)
+                preds[l]->next[l].store(node, std::memory_order_release);
+
+            end_write();
+        }
+
+        bool remove(uint64_t start, T* val) {
+            Node* preds[MaxLevel];
+            find_preds(start, preds);
+
+            Node* node = preds[0]->next[0].load(std::memory_order_relaxed);
+
+            if (!node || node->start.load(std::memory_order_relaxed) != start)
+                return false;
+
+            if (val)
+                node->load(val);
+
+            begin_write();
+
+            for (int l = 0; l < node->level; ++l)
+                if (preds[l]->next[l].load(std::memory_order_relaxed) == node)
+                    preds[l]->next[l].store(node->next[l].load(std::memory_order_relaxed), std::memory_order_release);
+
+            node->next[0].store(free_list, std::memory_order_relaxed);
+            free_list = node;
+
+            end_write();
+
+            return true;
+        }
+
+        bool get_end(uint64_t start, uint64_t* end) {
+            Node* preds[MaxLevel];
+            find_preds(start, preds);
+
+            Node* node = preds[0]->next[0].load(std::memory_order_relaxed);
+
+            if (!node || node->start.load(std::memory_order_relaxed) != start)
+                return false;
+
+            *end = node->end.load(std::memory_order_relaxed);
+            return true;
+        }
+
+        // --- reader side
+
+        bool find(uint64_t addr, T* val) const {
+            for (int tries = 0; tries < MaxTries; ++tries) {
+                //   Give the CPU to a writer that was preempted in the
+                // middle of an update if spinning doesn't help
+                if (tries >= SpinTries)
+                    std::this_thread::yield();
+
+                unsigned s0 = seq.load(std::memory_order_acquire);
+
+                if (s0 & 1)
+                    continue;
+
+                // find the last node with a start address <= addr
+                const Node* x         = &head;
+                std::size_t max_steps = MaxLevel * (num_nodes.load(std::memory_order_relaxed) + 1);
+                std::size_t steps     = 0;
+
+                for (int l = MaxLevel - 1; l >= 0 && steps <= max_steps; --l)
+                    for (const Node* n = x->next[l].load(std::memory_order_acquire);
+                         n && n->start.load(std::memory_order_relaxed) <= addr && ++steps <= max_steps;
+                         n = x->next[l].load(std::memory_order_acquire))
+                        x = n;
+
+                bool found = false;
+
+                if (x != &head && addr < x->end.load(std::memory_order_relaxed)) {
+                    x->load(val);
+                    found = true;
+                }
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (steps <= max_steps && seq.load(std::memory_order_relaxed) == s0)
+                    return found;
+            }
+
+            return false;
+        }
+    };
+
+    Shard m_shards[NumShards];
+
+    static int shard_index(uint64_t granule) {
+        return static_cast<int>((granule * 0x9E3779B97F4A7C15ull) >> 58);
+    }
+
+    /// \brief Bitmask of the shards covering [start, end)
+    static uint64_t shard_mask(uint64_t start, uint64_t end) {
+        uint64_t first = start >> GranuleBits;
+        uint64_t last  = (std::max(end, start + 1) - 1) >> GranuleBits;
+
+        //   Large intervals (almost) certainly cover every shard, so we
+        // just use all of them. Extra entries are harmless: intervals
+        // don't overlap, so an interval in a shard that it doesn't cover
+        // never hides the one that contains a looked-up address.
+        if (last - first >= 4 * NumShards)
+            return ~static_cast<uint64_t>(0);
+
+        uint64_t mask = 0;
+
+        for (uint64_t g = first; g <= last && mask != ~static_cast<uint64_t>(0); ++g)
+            mask |= static_cast<uint64_t>(1) << shard_index(g);
+
+        return mask;
+    }
+
+public:
+
+    IntervalIndex()
+        { }
+
+    IntervalIndex(const IntervalIndex&) = delete;
+    IntervalIndex& operator = (const IntervalIndex&) = delete;
+
+    /// \brief Add the interval [\a start, \a end) with value \a val.
+    ///   Replaces an existing interval with the same start address.
+    void insert(uint64_t start, uint64_t end, const T& val) {
+        remove(start, nullptr);
+
+        uint64_t mask = shard_mask(start, end);
+
+        for (int i = 0; i < NumShards; ++i)
+            if (mask & (static_cast<uint64_t>(1) << i)) {
+                std::lock_guard<spinlock>
+                    g(m_shards[i].lock);
+
+                m_shards[i].insert(start, end, val);
+            }
+    }
+
+    /// \brief Remove the interval starting at \a start. Copies its value
+    ///   into \a val if \a val is not null. Returns false if there is no
+    ///   interval starting at \a start.
+    bool remove(uint64_t start, T* val) {
+        Shard&   first = m_shards[shard_index(start >> GranuleBits)];
+        uint64_t end   = 0;
+
+        {
+            std::lock_guard<spinlock>
+                g(first.lock);
+
+            if (!first.get_end(start, &end))
+                return false;
+        }
+
+        uint64_t mask  = shard_mask(start, end);
+        bool     found = false;
+
+        for (int i = 0; i < NumShards; ++i)
+            if (mask & (static_cast<uint64_t>(1) << i)) {
+                std::lock_guard<spinlock>
+                    g(m_shards[i].lock);
+
+                found = m_shards[i].remove(start, val) || found;
+            }
+
+        return found;
+    }
+
+    /// \brief Find the interval containing \a addr and copy its value into
+    ///   \a val. Lock-free; can be called concurrently with insert() and
+    ///   remove().
+    bool find(uint64_t addr, T* val) const {
+        return m_shards[shard_index(addr >> GranuleBits)].find(addr, val);
+    }
+};
+
+} // namespace util
@@ -0,0 +1,191 @@
+#include "../IntervalIndex.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace util;
+
+namespace
+{
+
+struct Value {
+    uint64_t start;
+    uint64_t check;
+};
+
+Value make_value(uint64_t start)
+{
+    return Value { start, 3 * start + 1 };
+}
+
+}
+
+TEST(IntervalIndexTest, InsertRemoveFind) {
+    IntervalIndex<Value> index;
+    Value val { 0, 0 };
+
+    EXPECT_FALSE(index.find(0x1000, &val));
+
+    index.insert(0x1000, 0x1100, make_value(0x1000));
+    index.insert(0x1100, 0x1180, make_value(0x1100));
+    index.insert(0x2000, 0x2010, make_value(0x2000));
+
+    EXPECT_TRUE(index.find(0x1000, &val));
+    EXPECT_EQ(val.start, 0x1000u);
+    EXPECT_TRUE(index.find(0x10ff, &val));
+    EXPECT_EQ(val.start, 0x1000u);
+    EXPECT_TRUE(index.find(0x1100, &val));
+    EXPECT_EQ(val.start, 0x1100u);
+    EXPECT_FALSE(index.find(0x1180, &val));
+    EXPECT_FALSE(index.find(0x0fff, &val));
+    EXPECT_TRUE(index.find(0x200f, &val));
+    EXPECT_EQ(val.start, 0x2000u);
+
+    EXPECT_TRUE(index.remove(0x1000, &val));
+    EXPECT_EQ(val.start, 0x1000u);
+    EXPECT_FALSE(index.find(0x1000, &val));
+    EXPECT_FALSE(index.remove(0x1000, nullptr));
+    EXPECT_FALSE(index.remove(0x1101, nullptr));
+    EXPECT_TRUE(index.find(0x1100, &val));
+
+    // re-inserting an interval with the same start replaces it
+    index.insert(0x2000, 0x2100, make_value(0x2000));
+    EXPECT_TRUE(index.find(0x20ff, &val));
+    EXPECT_TRUE(index.remove(0x2000, nullptr));
+    EXPECT_FALSE(index.find(0x2000, &val));
+}
+
+TEST(IntervalIndexTest, ManyIntervals) {
+    IntervalIndex<Value> index;
+    const uint64_t N = 20000;
+
+    // many small intervals in few granules, inserted out of order
+    for (uint64_t i = 0; i < N; ++i) {
+        uint64_t start = 0x100000 + ((i * 7919) % N) * 16;
+        index.insert(start, start + 8, make_value(start));
+    }
+
+    Value val { 0, 0 };
+
+    for (uint64_t i = 0; i < N; ++i) {
+        uint64_t start = 0x100000 + i * 16;
+
+        ASSERT_TRUE(index.find(start + 7, &val));
+        EXPECT_EQ(val.start, start);
+        EXPECT_EQ(val.check, 3 * start + 1);
+        EXPECT_FALSE(index.find(start + 8, &val));
+    }
+
+    for (uint64_t i = 0; i < N; i += 2)
+        EXPECT_TRUE(index.remove(0x100000 + i * 16, nullptr));
+
+    for (uint64_t i = 0; i < N; ++i)
+        EXPECT_EQ(index.find(0x100000 + i * 16, &val), i % 2 == 1);
+
+    // removed nodes are reused
+    for (uint64_t i = 0; i < N; i += 2) {
+        uint64_t start = 0x100000 + i * 16;
+        index.insert(start, start + 8, make_value(start));
+    }
+
+    for (uint64_t i = 0; i < N; ++i) {
+        ASSERT_TRUE(index.find(0x100000 + i * 16, &val));
+        EXPECT_EQ(val.start, 0x100000 + i * 16);
+    }
+}
+
+TEST(IntervalIndexTest, MultiGranule) {
+    IntervalIndex<Value> index;
+    Value val { 0, 0 };
+
+    const uint64_t small_start = 0x7f0000001000ull;
+    const uint64_t small_end   = small_start + 10 * 65536 + 100;
+    const uint64_t large_start = 0x7f1000000000ull;
+    const uint64_t large_end   = large_start + (1ull << 30);
+
+    index.insert(small_start, small_end, make_value(small_start));
+    index.insert(large_start, large_end, make_value(large_start));
+
+    for (uint64_t addr = small_start; addr < small_end; addr += 4096) {
+        ASSERT_TRUE(index.find(addr, &val));
+        EXPECT_EQ(val.start, small_start);
+    }
+
+    EXPECT_TRUE(index.find(small_end - 1, &val));
+    EXPECT_FALSE(index.find(small_end, &val));
+
+    for (uint64_t addr = large_start; addr < large_end; addr += 65536 + 8) {
+        ASSERT_TRUE(index.find(addr, &val));
+        EXPECT_EQ(val.start, large_start);
+    }
+
+    EXPECT_TRUE(index.find(large_end - 1, &val));
+    EXPECT_FALSE(index.find(large_end, &val));
+
+    // an interval in the same shard as part of the large one
+    index.insert(large_end, large_end + 64, make_value(large_end));
+    EXPECT_TRUE(index.find(large_end, &val));
+    EXPECT_EQ(val.start, large_end);
+
+    EXPECT_TRUE(index.remove(large_start, &val));
+    EXPECT_EQ(val.start, large_start);
+
+    for (uint64_t addr = large_start; addr < large_end; addr += 65536)
+        ASSERT_FALSE(index.find(addr, &val));
+
+    EXPECT_TRUE(index.find(small_start + 65536 * 5, &val));
+    EXPECT_TRUE(index.remove(small_start, nullptr));
+    EXPECT_FALSE(index.find(small_start + 65536 * 5, &val));
+}
+
+TEST(IntervalIndexTest, ConcurrentFind) {
+    IntervalIndex<Value> index;
+
+    const uint64_t base   = 0x200000;
+    const uint64_t N      = 4096;
+
+    // even intervals stay in the index; odd ones come and go
+    for (uint64_t i = 0; i < N; i += 2)
+        index.insert(base + i * 64, base + i * 64 + 32, make_value(base + i * 64));
+
+    std::atomic<bool> stop(false);
+    std::atomic<int>  errors(0);
+
+    auto reader = [&](){
+            Value val { 0, 0 };
+
+            for (uint64_t iter = 0; !stop.load(); ++iter) {
+                uint64_t i     = (iter * 2) % N;
+                uint64_t start = base + i * 64;
+
+                if (!index.find(start + 31, &val) || val.start != start || val.check != 3 * start + 1)
+                    ++errors;
+                if (index.find(start + 32, &val))
+                    ++errors;
+                if (index.find(start + 64, &val) && (val.start != start + 64 || val.check != 3 * (start + 64) + 1))
+                    ++errors;
+            }
+        };
+
+    std::vector<std::thread> readers;
+
+    for (int t = 0; t < 3; ++t)
+        readers.emplace_back(reader);
+
+    for (int round = 0; round < 20; ++round) {
+        for (uint64_t i = 1; i < N; i += 2)
+            index.insert(base + i * 64, base + i * 64 + 32, make_value(base + i * 64));
+        for (uint64_t i = 1; i < N; i += 2)
+            index.remove(base + i * 64, nullptr);
+    }
+
+    stop.store(true);
+
+    for (auto& t : readers)
+        t.join();
+
+    EXPECT_EQ(errors.load(), 0);
+}
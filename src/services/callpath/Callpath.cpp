@@ -14,21 +14,29 @@
 #include "caliper/common/Node.h"
 #include "caliper/common/RuntimeConfig.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <mutex>
 #include <string>
 #include <sstream>
 #include <type_traits>
+#include <vector>
 
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
 
+#include <dlfcn.h>
+
 #ifdef CALIPER_HAVE_LIBDW
 #include <elfutils/libdwfl.h>
 #include <unistd.h>
 #endif
 
-#define MAX_PATH 40
-#define NAMELEN  100
+#define MAX_PATH   40
+#define MAX_FRAMES 128
+#define NAMELEN    100
+#define CACHE_SIZE 256
 
 using namespace cali;
 using namespace std;
@@ -38,12 +46,39 @@ namespace
 
 class Callpath
 {
+    struct CacheEntry {
+        uint64_t  hash;
+        size_t    n;
+        uint64_t  ips[MAX_PATH];
+        Node*     addr_node;
+        Node*     name_node;
+    };
+
+    /// \brief Per-thread cache of call paths
+    ///
+    /// A direct-mapped table from the (filtered) return address vector
+    /// of a call stack to the callpath nodes built for it. A hit skips
+    /// name lookup and context tree construction. The table is allocated
+    /// up front so it can be used in signal handlers. A snapshot must
+    /// claim \a busy before it reads or updates the table, so a signal
+    /// handler skips the cache while the interrupted thread uses it.
+    struct StackCache {
+        CacheEntry        entries[CACHE_SIZE];
+        std::atomic<bool> busy;
+
+        unsigned          num_hits;
+        unsigned          num_misses;
+    };
+
     Attribute callpath_name_attr { Attribute::invalid };
     Attribute callpath_addr_attr { Attribute::invalid };
     Attribute ucursor_attr       { Attribute::invalid };
+    Attribute stack_attr         { Attribute::invalid };
+    Attribute cache_attr         { Attribute::invalid };
 
     bool      use_name { false };
     bool      use_addr { false };
+    bool      use_cache { false };
     bool      skip_internal { false };
 
     unsigned  skip_frames { 0 };
@@ -53,80 +88,267 @@ class Callpath
     uintptr_t caliper_start_addr { 0 };
     uintptr_t caliper_end_addr   { 0 };
 
-    void snapshot_cb(Caliper* c, Channel* chn, SnapshotView info, SnapshotBuilder& snapshot) {
-        Variant v_addr[MAX_PATH];
-        Variant v_name[MAX_PATH];
+    std::vector<StackCache*> cache_list;
+    std::mutex               cache_list_mutex;
+
+    // hit/miss counts of the caches of released threads
+    unsigned long            released_hits   { 0 };
+    unsigned long            released_misses { 0 };
+
+    StackCache* acquire_cache(Caliper* c) {
+        StackCache* cache =
+            static_cast<StackCache*>(c->get(cache_attr).value().get_ptr());
+
+        if (!cache && !c->is_signal()) {
+            cache = new StackCache();
+            cache->busy.store(false);
+
+            c->set(cache_attr, Variant(cali_make_variant_from_ptr(cache)));
+
+            std::lock_guard<std::mutex>
+                g(cache_list_mutex);
+
+            cache_list.push_back(cache);
+        }
+
+        return cache;
+    }
+
+    static uint64_t hash_ips(const uint64_t* ips, size_t n) {
+        uint64_t h = 0xcbf29ce484222325ull ^ n;
+
+        for (size_t i = 0; i < n; ++i) {
+            h ^= ips[i];
+            h *= 0x9E3779B97F4A7C15ull;
+            h ^= h >> 29;
+        }
+
+        return h;
+    }
+
+    /// \brief Copy the addresses in \a raw that are not inside Caliper
+    ///   into \a ips, innermost frame first. Returns the number of
+    ///   addresses copied.
+    template<typename T>
+    size_t filter_ips(const T* raw, size_t num, uint64_t* ips) {
+        size_t n = 0;
+
+        for (size_t i = 0; i < num && n < MAX_PATH; ++i) {
+            uint64_t ip = (uint64_t) (uintptr_t) raw[i];
+
+            if (skip_internal && (ip >= caliper_start_addr && ip < caliper_end_addr))
+                continue;
+
+            ips[n++] = ip;
+        }
 
-        char    strbuf[MAX_PATH][NAMELEN];
+        return n;
+    }
+
+    /// \brief Find function names for \a ips by walking \a cursor.
+    ///   \a ips must be a subsequence of the frames \a cursor walks over.
+    void get_names(unw_cursor_t* cursor, const uint64_t* ips, size_t n, char (*strbuf)[NAMELEN]) {
+        for (size_t i = 0; i < n; ++i)
+            strncpy(strbuf[i], "UNKNOWN", NAMELEN);
+
+        size_t i = 0;
+
+        while (i < n && unw_step(cursor) > 0) {
+            unw_word_t ip;
+            unw_get_reg(cursor, UNW_REG_IP, &ip);
+
+            if (ip != ips[i])
+                continue;
+
+            unw_word_t offs;
+
+            if (unw_get_proc_name(cursor, strbuf[i], NAMELEN, &offs) < 0)
+                strncpy(strbuf[i], "UNKNOWN", NAMELEN);
+
+            ++i;
+        }
+    }
+
+    /// \brief Get function names for \a ips from the dynamic symbol
+    ///   table. Used for stacks without a libunwind cursor.
+    void get_dynamic_names(const uint64_t* ips, size_t n, char (*strbuf)[NAMELEN]) {
+        for (size_t i = 0; i < n; ++i) {
+            Dl_info dli;
+            const char* name = "UNKNOWN";
+
+            if (dladdr(reinterpret_cast<void*>(ips[i]), &dli) && dli.dli_sname)
+                name = dli.dli_sname;
+
+            strncpy(strbuf[i], name, NAMELEN);
+            strbuf[i][NAMELEN-1] = '\0';
+        }
+    }
+
+    void snapshot_cb(Caliper* c, Channel* chn, SnapshotView info, SnapshotBuilder& snapshot) {
+        uint64_t ips[MAX_PATH];
+        size_t   n = 0;
 
         // Init unwind context
+        unw_context_t unw_ctx;
         unw_cursor_t  unw_cursor;
+        bool          have_cursor = false;
+        bool          from_sampler_stack = false;
 
         Entry e;
-        if (ucursor_attr != Attribute::invalid)
-            e = info.get(ucursor_attr);
+        if (stack_attr != Attribute::invalid)
+            e = info.get(stack_attr);
+
         if (!e.empty()) {
-            unw_cursor = *static_cast<unw_cursor_t*>(e.value().get_ptr());
+            // stack captured by the sampler in deferred mode: [n, ip_0, ..., ip_n-1]
+            const uint64_t* stack = static_cast<const uint64_t*>(e.value().get_ptr());
+
+            if (stack[0] > skip_frames)
+                n = filter_ips(stack+1+skip_frames, stack[0]-skip_frames, ips);
+
+            from_sampler_stack = true;
         } else {
-            unw_context_t unw_ctx;
+            if (ucursor_attr != Attribute::invalid)
+                e = info.get(ucursor_attr);
+
+            if (!e.empty()) {
+                unw_cursor = *static_cast<unw_cursor_t*>(e.value().get_ptr());
+                have_cursor = true;
+            } else if (use_cache && skip_frames + 1 < MAX_FRAMES) {
+                //   unw_backtrace() uses libunwind's cached frame
+                // information and is much faster than stepping through
+                // the stack with a cursor. The first frame is this one.
+                void* raw[MAX_FRAMES];
+                int   num = unw_backtrace(raw, MAX_FRAMES);
+
+                if (num > static_cast<int>(skip_frames + 1))
+                    n = filter_ips(raw+skip_frames+1, num-(skip_frames+1), ips);
+            } else {
+                #ifdef __aarch64__
+                unw_getcontext(unw_ctx);
+                #else
+                unw_getcontext(&unw_ctx);
+                #endif
+
+                if (unw_init_local(&unw_cursor, &unw_ctx) < 0) {
+                    Log(0).stream() << "callpath: unable to init libunwind cursor" << endl;
+                    return;
+                }
+
+                have_cursor = true;
+            }
 
-            #ifdef __aarch64__
-            unw_getcontext(unw_ctx);
-            #else
-            unw_getcontext(&unw_ctx);
-            #endif
+            if (have_cursor) {
+                // walk a copy, we may need the original for name lookup
+                unw_cursor_t walk_cursor = unw_cursor;
 
-            if (unw_init_local(&unw_cursor, &unw_ctx) < 0) {
-                Log(0).stream() << "callpath: unable to init libunwind cursor" << endl;
-                return;
+                // skip n frames
+
+                size_t skip = 0;
+
+                for (skip = skip_frames; skip > 0 && unw_step(&walk_cursor) > 0; --skip)
+                    ;
+
+                if (skip > 0)
+                    return;
+
+                while (n < MAX_PATH && unw_step(&walk_cursor) > 0) {
+                    unw_word_t ip;
+                    unw_get_reg(&walk_cursor, UNW_REG_IP, &ip);
+
+                    // skip stack frames inside caliper
+                    if (skip_internal && (ip >= caliper_start_addr && ip < caliper_end_addr))
+                        continue;
+
+                    ips[n++] = ip;
+                }
             }
         }
 
-        // skip n frames
+        if (n == 0)
+            return;
 
-        size_t n = 0;
+        // Look up the path in the cache
 
-        for (n = skip_frames; n > 0 && unw_step(&unw_cursor) > 0; --n)
-            ;
+        StackCache* cache = use_cache ? acquire_cache(c) : nullptr;
+        CacheEntry* entry = nullptr;
+        uint64_t    hash  = 0;
 
-        if (n > 0)
-            return;
+        if (cache && !cache->busy.exchange(true)) {
+            hash  = hash_ips(ips, n);
+            entry = &cache->entries[hash % CACHE_SIZE];
 
-        while (n < MAX_PATH && unw_step(&unw_cursor) > 0) {
+            if (entry->hash == hash && entry->n == n && memcmp(entry->ips, ips, n * sizeof(uint64_t)) == 0) {
+                ++cache->num_hits;
 
-            // skip stack frames inside caliper
-            unw_word_t ip;
-            unw_get_reg(&unw_cursor, UNW_REG_IP, &ip);
+                if (use_addr)
+                    snapshot.append(Entry(entry->addr_node));
+                if (use_name)
+                    snapshot.append(Entry(entry->name_node));
 
-            if (skip_internal && (ip >= caliper_start_addr && ip < caliper_end_addr))
-                continue;
+                cache->busy.store(false);
+                return;
+            }
+
+            ++cache->num_misses;
+        }
+
+        // Cache miss: build the path
+
+        Node* addr_node = nullptr;
+        Node* name_node = nullptr;
+
+        if (use_addr) {
+            Variant v_addr[MAX_PATH];
 
             // store path from top to bottom
-            if (use_addr) {
-                uint64_t uint = ip;
-                v_addr[MAX_PATH-(n+1)] = Variant(CALI_TYPE_ADDR, &uint, sizeof(uint64_t));
-            }
-            if (use_name) {
-                unw_word_t offs;
+            for (size_t i = 0; i < n; ++i)
+                v_addr[n-(i+1)] = Variant(CALI_TYPE_ADDR, ips+i, sizeof(uint64_t));
 
-                if (unw_get_proc_name(&unw_cursor, strbuf[n], NAMELEN, &offs) < 0)
-                    strncpy(strbuf[n], "UNKNOWN", NAMELEN);
+            addr_node =
+                c->make_tree_entry(callpath_addr_attr, n, v_addr, &callpath_root_node);
+            snapshot.append(Entry(addr_node));
+        }
 
-                v_name[MAX_PATH-(n+1)] = Variant(CALI_TYPE_STRING, strbuf[n], strlen(strbuf[n]));
+        if (use_name) {
+            char    strbuf[MAX_PATH][NAMELEN];
+            Variant v_name[MAX_PATH];
+
+            if (from_sampler_stack) {
+                get_dynamic_names(ips, n, strbuf);
+            } else {
+                if (!have_cursor) {
+                    #ifdef __aarch64__
+                    unw_getcontext(unw_ctx);
+                    #else
+                    unw_getcontext(&unw_ctx);
+                    #endif
+
+                    have_cursor = (unw_init_local(&unw_cursor, &unw_ctx) >= 0);
+                }
+
+                if (have_cursor)
+                    get_names(&unw_cursor, ips, n, strbuf);
+                else
+                    for (size_t i = 0; i < n; ++i)
+                        strncpy(strbuf[i], "UNKNOWN", NAMELEN);
             }
 
-            ++n;
+            for (size_t i = 0; i < n; ++i)
+                v_name[n-(i+1)] = Variant(CALI_TYPE_STRING, strbuf[i], strlen(strbuf[i]));
+
+            name_node =
+                c->make_tree_entry(callpath_name_attr, n, v_name, &callpath_root_node);
+            snapshot.append(Entry(name_node));
         }
 
-        if (n > 0) {
-            if (use_addr)
-                snapshot.append(
-                    Entry(c->make_tree_entry(callpath_addr_attr, n, v_addr+(MAX_PATH-n),
-                                             &callpath_root_node)));
-            if (use_name)
-                snapshot.append(
-                    Entry(c->make_tree_entry(callpath_name_attr, n, v_name+(MAX_PATH-n),
-                                             &callpath_root_node)));
+        if (entry) {
+            entry->hash = hash;
+            entry->n    = n;
+            memcpy(entry->ips, ips, n * sizeof(uint64_t));
+            entry->addr_node = addr_node;
+            entry->name_node = name_node;
+
+            cache->busy.store(false);
         }
     }
 
@@ -182,8 +404,34 @@ class Callpath
 #endif
     }
 
+    void release_thread_cb(Caliper* c, Channel*) {
+        StackCache* cache =
+            static_cast<StackCache*>(c->get(cache_attr).value().get_ptr());
+
+        if (!cache)
+            return;
+
+        c->set(cache_attr, Variant(cali_make_variant_from_ptr(nullptr)));
+
+        {
+            std::lock_guard<std::mutex>
+                g(cache_list_mutex);
+
+            released_hits   += cache->num_hits;
+            released_misses += cache->num_misses;
+
+            auto it = std::find(cache_list.begin(), cache_list.end(), cache);
+
+            if (it != cache_list.end())
+                cache_list.erase(it);
+        }
+
+        delete cache;
+    }
+
     void post_init_evt(Caliper* c, Channel*) {
         ucursor_attr = c->get_attribute("cali.unw_cursor");
+        stack_attr   = c->get_attribute("cali.sampler.stack");
     }
 
     Callpath(Caliper* c, Channel* chn)
@@ -195,6 +443,7 @@ class Callpath
             use_addr      = config.get("use_address").to_bool();
             skip_frames   = config.get("skip_frames").to_uint();
             skip_internal = config.get("skip_internal").to_bool();
+            use_cache     = config.get("use_cache").to_bool();
 
             Attribute symbol_class_attr = c->get_attribute("class.symboladdress");
             Variant v_true(true);
@@ -208,6 +457,12 @@ class Callpath
                 c->create_attribute("callpath.regname", CALI_TYPE_STRING,
                                     CALI_ATTR_SCOPE_THREAD |
                                     CALI_ATTR_SKIP_EVENTS);
+            cache_attr =
+                c->create_attribute(std::string("callpath.cache.")+std::to_string(chn->id()), CALI_TYPE_PTR,
+                                    CALI_ATTR_SCOPE_THREAD |
+                                    CALI_ATTR_SKIP_EVENTS  |
+                                    CALI_ATTR_ASVALUE      |
+                                    CALI_ATTR_HIDDEN);
 
 #ifdef CALIPER_HAVE_LIBDW
             if (skip_internal)
@@ -217,6 +472,27 @@ class Callpath
 #endif
         }
 
+    ~Callpath() {
+        for (StackCache* cache : cache_list)
+            delete cache;
+    }
+
+    void finish_cb(Caliper*, Channel* chn) {
+        if (!use_cache)
+            return;
+
+        unsigned long hits = released_hits, misses = released_misses;
+
+        for (const StackCache* cache : cache_list) {
+            hits   += cache->num_hits;
+            misses += cache->num_misses;
+        }
+
+        Log(2).stream() << chn->name() << ": callpath: "
+                        << hits   << " cache hits, "
+                        << misses << " cache misses" << std::endl;
+    }
+
 public:
 
     static const char* s_spec;
@@ -232,8 +508,13 @@ public:
             [instance](Caliper* c, Channel* chn, SnapshotView info, SnapshotBuilder& snapshot){
                 instance->snapshot_cb(c, chn, info, snapshot);
             });
+        chn->events().release_thread_evt.connect(
+            [instance](Caliper* c, Channel* chn){
+                instance->release_thread_cb(c, chn);
+            });
         chn->events().finish_evt.connect(
             [instance](Caliper* c, Channel* chn){
+                instance->finish_cb(c, chn);
                 delete instance;
             });
 
@@ -265,6 +546,11 @@ const char* Callpath::s_spec = R"json(
           "type"        : "bool",
           "description" : "Skip internal (inside Caliper library) stack frames",
           "value"       : "true"
+        },
+        { "name"        : "use_cache",
+          "type"        : "bool",
+          "description" : "Use fast unwinding and cache call paths per thread",
+          "value"       : "true"
         }
     ]
 }
@@ -18,9 +18,11 @@
 #include "caliper/common/RuntimeConfig.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -39,6 +41,83 @@ namespace
 
 class EventTrigger
 {
+    /// \brief The event info attributes of a marked (trigger) attribute
+    struct MarkerInfo {
+        Attribute begin_attr;
+        Attribute set_attr;
+        Attribute end_attr;
+    };
+
+    /// \brief Dense attribute id -> MarkerInfo table
+    ///
+    /// Lookups are lock-free: they read the currently published slot
+    /// array. Inserts are serialized with a mutex. When an attribute id
+    /// doesn't fit, the insert copies the slots into an array of at least
+    /// twice the size and publishes it. Old arrays and the MarkerInfo
+    /// objects are kept until the table is destroyed, so readers never
+    /// see freed memory.
+    class MarkerTable {
+        struct Slots {
+            std::size_t size;
+            std::unique_ptr< std::atomic<const MarkerInfo*>[] > ptrs;
+
+            explicit Slots(std::size_t n)
+                : size(n), ptrs(new std::atomic<const MarkerInfo*>[n])
+                {
+                    for (std::size_t i = 0; i < n; ++i)
+                        ptrs[i].store(nullptr, std::memory_order_relaxed);
+                }
+        };
+
+        std::atomic<const Slots*>                m_slots;
+
+        std::mutex                               m_lock;
+        std::vector< std::unique_ptr<Slots> >      m_slot_arrays;
+        std::vector< std::unique_ptr<MarkerInfo> > m_infos;
+
+    public:
+
+        MarkerTable()
+            : m_slots(nullptr)
+            {
+                m_slot_arrays.emplace_back(new Slots(256));
+                m_slots.store(m_slot_arrays.back().get(), std::memory_order_release);
+            }
+
+        const MarkerInfo* find(cali_id_t id) const {
+            const Slots* s = m_slots.load(std::memory_order_acquire);
+            return id < s->size ? s->ptrs[id].load(std::memory_order_acquire) : nullptr;
+        }
+
+        /// \brief Add \a info for attribute \a id. Returns false if \a id
+        ///   is already in the table.
+        bool insert(cali_id_t id, const MarkerInfo& info) {
+            std::lock_guard<std::mutex>
+                g(m_lock);
+
+            const Slots* s = m_slot_arrays.back().get();
+
+            if (id < s->size && s->ptrs[id].load(std::memory_order_relaxed))
+                return false;
+
+            if (id >= s->size) {
+                Slots* n = new Slots(std::max<std::size_t>(2 * s->size, id + 1));
+
+                for (std::size_t i = 0; i < s->size; ++i)
+                    n->ptrs[i].store(s->ptrs[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+                m_slot_arrays.emplace_back(n);
+                m_slots.store(n, std::memory_order_release);
+                s = n;
+            }
+
+            m_infos.emplace_back(new MarkerInfo(info));
+            s->ptrs[id].store(m_infos.back().get(), std::memory_order_release);
+
+            return true;
+        }
+    };
+
     //
     // --- Per-channel instance data
     //
@@ -47,7 +126,7 @@ class EventTrigger
     Attribute                trigger_end_attr   { Attribute::invalid };
     Attribute                trigger_set_attr   { Attribute::invalid };
 
-    Attribute                marker_attr        { Attribute::invalid };
+    MarkerTable              marker_table;
 
     Attribute                region_count_attr  { Attribute::invalid };
     Entry                    region_count_entry;
@@ -89,35 +168,24 @@ class EventTrigger
     }
 
     void mark_attribute(Caliper* c, Channel* chn, const Attribute& attr) {
-        cali_id_t evt_attr_ids[3] = { CALI_INV_ID };
-
-        struct evt_attr_setup_t {
-            std::string prefix;
-            int         index;
-        } evt_attr_setup[] = {
-            { "event.begin#", 0 },
-            { "event.set#",   1 },
-            { "event.end#",   2 }
-        };
-
-        cali_attr_type type = attr.type();
-        int            prop = attr.properties();
-
-        for ( evt_attr_setup_t setup : evt_attr_setup ) {
-            std::string s = setup.prefix;
-            s.append(attr.name());
+        if (marker_table.find(attr.id()))
+            return;
 
-            int delete_flags = CALI_ATTR_NESTED | CALI_ATTR_GLOBAL;
+        cali_attr_type type  = attr.type();
+        int            prop  = attr.properties();
+        int            flags = (prop & ~(CALI_ATTR_NESTED | CALI_ATTR_GLOBAL)) | CALI_ATTR_SKIP_EVENTS;
 
-            evt_attr_ids[setup.index] =
-                c->create_attribute(s, type, (prop & ~delete_flags) | CALI_ATTR_SKIP_EVENTS).id();
-        }
+        MarkerInfo info;
 
-        c->make_tree_entry(marker_attr,
-                           Variant(CALI_TYPE_USR, evt_attr_ids, sizeof(evt_attr_ids)),
-                           attr.node());
+        info.begin_attr =
+            c->create_attribute(std::string("event.begin#") + attr.name(), type, flags);
+        info.set_attr   =
+            c->create_attribute(std::string("event.set#")   + attr.name(), type, flags);
+        info.end_attr   =
+            c->create_attribute(std::string("event.end#")   + attr.name(), type, flags);
 
-        Log(2).stream() << chn->name() << ": event: Marked attribute " << attr.name() << std::endl;
+        if (marker_table.insert(attr.id(), info))
+            Log(2).stream() << chn->name() << ": event: Marked attribute " << attr.name() << std::endl;
     }
 
     void check_attribute(Caliper* c, Channel* chn, const Attribute& attr) {
@@ -134,16 +202,6 @@ class EventTrigger
         mark_attribute(c, chn, attr);
     }
 
-    const Node* find_marker(const Attribute& attr) {
-        cali_id_t marker_id = marker_attr.id();
-
-        for (const Node* node = attr.node()->first_child(); node; node = node->next_sibling())
-            if (node->attribute() == marker_id)
-                return node;
-
-        return nullptr;
-    }
-
     static inline bool is_subscription_attribute(const Attribute& attr) {
         return attr.get(cali::subscription_event_attr).to_bool();
     }
@@ -153,9 +211,9 @@ class EventTrigger
     //
 
     void pre_begin_cb(Caliper* c, Channel* chn, const Attribute& attr, const Variant& value) {
-        const Node* marker_node = find_marker(attr);
+        const MarkerInfo* marker = marker_table.find(attr.id());
 
-        if (!marker_node)
+        if (!marker)
             return;
         if (attr.type() == CALI_TYPE_STRING && !region_filter.pass(value))
             return;
@@ -167,20 +225,9 @@ class EventTrigger
         }
 
         if (enable_snapshot_info) {
-            assert(!marker_node->data().empty());
-
-            const cali_id_t* evt_info_attr_ids =
-                static_cast<const cali_id_t*>(marker_node->data().data());
-
-            assert(evt_info_attr_ids != nullptr);
-
-            Attribute begin_attr = c->get_attribute(evt_info_attr_ids[0]);
-
-            assert(begin_attr != Attribute::invalid);
-
             // Construct the trigger info entry
 
-            Attribute attrs[2] = { trigger_begin_attr, begin_attr };
+            Attribute attrs[2] = { trigger_begin_attr, marker->begin_attr };
             Variant    vals[2] = { Variant(attr.id()), value };
 
             FixedSizeSnapshotRecord<2> trigger_info;
@@ -193,9 +240,9 @@ class EventTrigger
     }
 
     void pre_set_cb(Caliper* c, Channel* chn, const Attribute& attr, const Variant& value) {
-        const Node* marker_node = find_marker(attr);
+        const MarkerInfo* marker = marker_table.find(attr.id());
 
-        if (!marker_node)
+        if (!marker)
             return;
         if (attr.type() == CALI_TYPE_STRING && !region_filter.pass(value))
             return;
@@ -207,20 +254,9 @@ class EventTrigger
         }
 
         if (enable_snapshot_info) {
-            assert(!marker_node->data().empty());
-
-            const cali_id_t* evt_info_attr_ids =
-                static_cast<const cali_id_t*>(marker_node->data().data());
-
-            assert(evt_info_attr_ids != nullptr);
-
-            Attribute set_attr = c->get_attribute(evt_info_attr_ids[1]);
-
-            assert(set_attr != Attribute::invalid);
-
             // Construct the trigger info entry
 
-            Attribute attrs[2] = { trigger_set_attr,   set_attr };
+            Attribute attrs[2] = { trigger_set_attr,   marker->set_attr };
             Variant    vals[2] = { Variant(attr.id()), value    };
 
             FixedSizeSnapshotRecord<2> trigger_info;
@@ -233,12 +269,17 @@ class EventTrigger
     }
 
     void pre_end_cb(Caliper* c, Channel* chn, const Attribute& attr, const Variant& value) {
-        const Node* marker_node = find_marker(attr);
+        const MarkerInfo* marker = marker_table.find(attr.id());
 
-        if (!marker_node)
-            return;
-        if (attr.type() == CALI_TYPE_STRING && !region_filter.pass(value))
+        if (!marker)
             return;
+        if (attr.type() == CALI_TYPE_STRING) {
+            //   For reference attributes, the value on end comes from
+            // the context tree, so we can use the cached verdict
+            bool pass = attr.store_as_value() ? region_filter.pass(value) : region_filter.pass_node_value(value);
+            if (!pass)
+                return;
+        }
         if (branch_filter.has_filters()) {
             if (branch_filter_stack.empty())
                 return;
@@ -247,18 +288,9 @@ class EventTrigger
         }
 
         if (enable_snapshot_info) {
-            assert(!marker_node->data().empty());
-
-            const cali_id_t* evt_info_attr_ids =
-                static_cast<const cali_id_t*>(marker_node->data().data());
-
-            assert(evt_info_attr_ids != nullptr);
-
-            Attribute end_attr = c->get_attribute(evt_info_attr_ids[2]);
-
             // Construct the trigger info entry with previous level
 
-            Attribute attrs[3] = { trigger_end_attr, end_attr, region_count_attr };
+            Attribute attrs[3] = { trigger_end_attr, marker->end_attr, region_count_attr };
             Variant    vals[3] = { Variant(attr.id()), value, cali_make_variant_from_uint(1) };
 
             FixedSizeSnapshotRecord<3> trigger_info;
@@ -340,12 +372,6 @@ class EventTrigger
             trigger_end_attr =
                 c->create_attribute("cali.event.end",
                                     CALI_TYPE_UINT, CALI_ATTR_SKIP_EVENTS | CALI_ATTR_HIDDEN);
-            marker_attr =
-                c->create_attribute(std::string("event.marker#")+std::to_string(channel->id()),
-                                    CALI_TYPE_USR,
-                                    CALI_ATTR_SKIP_EVENTS |
-                                    CALI_ATTR_HIDDEN);
-
             check_existing_attributes(c, channel);
         }
 
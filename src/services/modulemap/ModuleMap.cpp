@@ -0,0 +1,141 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+// ModuleMap.cpp
+// Records the process's module map for offline symbol lookup
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Attribute.h"
+#include "caliper/common/Log.h"
+
+#include <algorithm>
+#include <fstream>
+#include <list>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+
+using namespace cali;
+
+namespace
+{
+
+/// \brief Read the file-backed mappings from /proc/self/maps
+///
+/// Returns a ';'-separated list of "start-end path" entries (with
+/// hexadecimal addresses) covering all mappings of each file. This is
+/// the format symbollookup::Lookup::parse_module_map() reads.
+std::string read_module_map()
+{
+    std::ifstream is("/proc/self/maps");
+    std::map< std::string, std::pair<uint64_t, uint64_t> > modules;
+
+    std::string line;
+
+    while (std::getline(is, line)) {
+        // start-end perms offset dev inode path
+        std::istringstream ls(line);
+        std::string range, perms, offset, dev, inode, path;
+
+        ls >> range >> perms >> offset >> dev >> inode;
+        std::getline(ls >> std::ws, path);
+
+        if (path.empty() || path[0] != '/')
+            continue;
+
+        std::string::size_type p = range.find('-');
+
+        if (p == std::string::npos)
+            continue;
+
+        uint64_t start = std::stoull(range.substr(0, p), nullptr, 16);
+        uint64_t end   = std::stoull(range.substr(p+1), nullptr, 16);
+
+        auto it = modules.find(path);
+
+        if (it == modules.end())
+            modules.emplace(path, std::make_pair(start, end));
+        else {
+            it->second.first  = std::min(it->second.first,  start);
+            it->second.second = std::max(it->second.second, end);
+        }
+    }
+
+    std::ostringstream os;
+    os << std::hex;
+
+    int count = 0;
+
+    for (const auto& p : modules)
+        os << (count++ > 0 ? ";" : "") << p.second.first << '-' << p.second.second << ' ' << p.first;
+
+    return os.str();
+}
+
+class ModuleMapService
+{
+    Attribute   m_map_attr;
+
+    //   The module.map entry refers to the string data directly, and
+    // snapshots buffered before an update still refer to the old map.
+    // Maps change rarely, so we keep all of them until the service is
+    // deleted.
+    std::list<std::string> m_maps;
+
+    void update(Caliper* c, Channel* chn) {
+        //   Libraries may be loaded or unloaded at runtime, so update the
+        // map before every flush
+        std::string map = read_module_map();
+
+        if (!m_maps.empty() && map == m_maps.back())
+            return;
+
+        m_maps.push_back(std::move(map));
+        c->set(chn, m_map_attr, Variant(CALI_TYPE_STRING, m_maps.back().data(), m_maps.back().size()));
+    }
+
+    ModuleMapService(Caliper* c, Channel* chn)
+        {
+            m_map_attr =
+                c->create_attribute("module.map", CALI_TYPE_STRING,
+                                    CALI_ATTR_GLOBAL      |
+                                    CALI_ATTR_ASVALUE     |
+                                    CALI_ATTR_SKIP_EVENTS);
+        }
+
+public:
+
+    static void modulemap_register(Caliper* c, Channel* chn) {
+        ModuleMapService* instance = new ModuleMapService(c, chn);
+
+        chn->events().post_init_evt.connect(
+            [instance](Caliper* c, Channel* chn){
+                instance->update(c, chn);
+            });
+        chn->events().pre_flush_evt.connect(
+            [instance](Caliper* c, Channel* chn, SnapshotView){
+                instance->update(c, chn);
+            });
+        chn->events().finish_evt.connect(
+            [instance](Caliper*, Channel*){
+                delete instance;
+            });
+
+        Log(1).stream() << chn->name() << ": Registered modulemap service" << std::endl;
+    }
+};
+
+} // namespace [anonymous]
+
+
+namespace cali
+{
+
+CaliperService modulemap_service = { "modulemap", ::ModuleMapService::modulemap_register };
+
+}
@@ -6,7 +6,12 @@
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
+#include "caliper/common/Log.h"
+
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstring>
 #include <mutex>
 #include <numeric>
 #include <unordered_map>
@@ -35,9 +40,55 @@ struct MpiTracing::MpiTracingImpl
     Attribute comm_list_attr;
     Attribute comm_size_attr;
 
+    Attribute hist_kind_attr;
+    Attribute hist_bin_attr;
+    Attribute hist_count_attr;
+
+    Attribute thread_info_attr;
+
+    // --- Histograms
+    //
+
+    /// \brief A log2-scale histogram. Bin 0 counts zeros, bin i > 0
+    ///   counts values in [2^(i-1), 2^i), and the last bin is open-ended.
+    struct Histogram {
+        static const int NumBins = 40;
+
+        std::atomic<uint64_t> bins[NumBins];
+
+        Histogram() {
+            for (int i = 0; i < NumBins; ++i)
+                bins[i].store(0, std::memory_order_relaxed);
+        }
+
+        static int bin(uint64_t val) {
+            int i = 0;
+
+            for ( ; val && i < NumBins-1; val >>= 1)
+                ++i;
+
+            return i;
+        }
+
+        static uint64_t lower_bound(int i) {
+            return i == 0 ? 0 : (static_cast<uint64_t>(1) << (i-1));
+        }
+
+        void add(uint64_t val) {
+            bins[bin(val)].fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
     // --- MPI object mappings
     //
 
+    struct CommInfo {
+        Node*        node;
+
+        Histogram    msg_size;  ///< point-to-point message sizes in bytes
+        Histogram    wait_time; ///< request post-to-completion times in nsec
+    };
+
     struct RequestInfo {
         enum {
             Unknown, Send, Recv
@@ -51,24 +102,324 @@ struct MpiTracing::MpiTracingImpl
         MPI_Datatype type;
         int          size;
 
-        Node*        comm_node;
+        CommInfo*    comm;
+
+        uint64_t     post_time; ///< time the request was posted/started, in nsec
+    };
+
+    /// \brief Per-thread request table and communicator cache
+    ///
+    /// Requests are stored in the table of the thread that posted them,
+    /// so the common case (the same thread posts and completes a request)
+    /// doesn't touch shared memory. Other threads can still find and
+    /// complete the request: each slot has an atomic state, and a thread
+    /// takes exclusive ownership of a full slot with a CAS before reading
+    /// or modifying its request info. Only the owner thread fills empty
+    /// slots. The table is bucketed without probing across buckets, so
+    /// removing an entry never disturbs other entries. Requests that
+    /// don't fit into their bucket go into the shared overflow map.
+    ///
+    ///   Applications may never complete a send request through an
+    /// instrumented call (e.g., fire-and-forget MPI_Isend), so the overflow
+    /// map is bounded. We only keep send requests to measure their wait
+    /// time: when the overflow map is full, a new request replaces a send
+    /// request in its bucket.
+    ///
+    ///   Other threads may still be walking the list of tables, so the
+    /// tables are never freed while the service is active. When a thread
+    /// is released, its table is handed to the next new thread instead.
+    struct ThreadInfo {
+        static const int NumBuckets = 256;
+        static const int BucketSize = 4;
+
+        enum SlotState {
+            Empty = 0, Full = 1, Busy = 2
+        };
+
+        struct Slot {
+            std::atomic<unsigned> state;
+            std::atomic<uint64_t> key;
+            RequestInfo           info;
+
+            Slot()
+                : state(Empty), key(0)
+                { }
+        };
+
+        Slot        slots[NumBuckets * BucketSize];
+
+        ThreadInfo* next; ///< next table in the list of all threads' tables
+
+        std::atomic<bool> in_use; ///< owned by a thread
+
+        // small direct-mapped communicator cache
+        static const int CommCacheSize = 8;
+
+        uint64_t    comm_keys[CommCacheSize];
+        CommInfo*   comm_infos[CommCacheSize];
+
+        ThreadInfo()
+            : next(nullptr), in_use(true)
+            {
+                std::fill_n(comm_keys,  CommCacheSize, 0);
+                std::fill_n(comm_infos, CommCacheSize, nullptr);
+            }
+
+        static size_t hash(uint64_t key) {
+            return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 56); // 256 buckets
+        }
+
+        Slot* bucket(uint64_t key) {
+            return slots + hash(key) * BucketSize;
+        }
+
+        /// \brief Take exclusive ownership of the slot for \a key and call
+        ///   \a fn on its request info. \a fn returns true to keep the
+        ///   request in the table, false to remove it. Can be called from
+        ///   any thread.
+        template<class Fn>
+        bool access(uint64_t key, Fn fn) {
+            Slot* b = bucket(key);
+
+            for (int i = 0; i < BucketSize; ++i) {
+                Slot& s = b[i];
+
+                if (s.state.load(std::memory_order_acquire) != Full || s.key.load(std::memory_order_relaxed) != key)
+                    continue;
+
+                unsigned expected = Full;
+
+                if (!s.state.compare_exchange_strong(expected, Busy, std::memory_order_acquire))
+                    continue;
+
+                // the slot may have been re-used for another request in the meantime
+                if (s.key.load(std::memory_order_relaxed) != key) {
+                    s.state.store(Full, std::memory_order_release);
+                    continue;
+                }
+
+                bool keep = fn(s.info);
+
+                s.state.store(keep ? Full : Empty, std::memory_order_release);
+                return true;
+            }
+
+            return false;
+        }
+
+        static bool is_send(const RequestInfo& info) {
+            return info.op == RequestInfo::Send && !info.is_persistent;
+        }
+
+        /// \brief Add a request. Returns false if the bucket is full. Must
+        ///   only be called by the owner thread.
+        bool insert(uint64_t key, const RequestInfo& info) {
+            //   Replace a stale entry for the same handle, e.g. from a
+            // request that completed through an uninstrumented call
+            if (access(key, [&info](RequestInfo& i){ i = info; return true; }))
+                return true;
+
+            Slot* b = bucket(key);
+
+            for (int i = 0; i < BucketSize; ++i) {
+                Slot& s = b[i];
+
+                //   Other threads never touch empty slots, so we can fill
+                // them without a CAS
+                if (s.state.load(std::memory_order_relaxed) == Empty) {
+                    s.key.store(key, std::memory_order_relaxed);
+                    s.info = info;
+                    s.state.store(Full, std::memory_order_release);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /// \brief Add a request in place of a non-persistent send request.
+        ///   Returns false if there is none in the bucket. Must only be
+        ///   called by the owner thread.
+        bool replace_send(uint64_t key, const RequestInfo& info) {
+            Slot* b = bucket(key);
+
+            for (int i = 0; i < BucketSize; ++i) {
+                Slot& s = b[i];
+                unsigned expected = Full;
+
+                if (!s.state.compare_exchange_strong(expected, Busy, std::memory_order_acquire))
+                    continue;
+
+                if (is_send(s.info)) {
+                    s.key.store(key, std::memory_order_relaxed);
+                    s.info = info;
+                    s.state.store(Full, std::memory_order_release);
+                    return true;
+                }
+
+                s.state.store(Full, std::memory_order_release);
+            }
+
+            return false;
+        }
     };
 
     std::atomic<int>                             comm_id;
 
-    // We hope that whatever MPI_Comm and MPI_Request is is default-hashable.
+    // We hope that whatever MPI_Comm is is default-hashable.
     // So far it works ...
 
-    std::unordered_map<MPI_Comm,    cali::Node*> comm_map; ///< Communicator map
+    std::unordered_map< MPI_Comm, std::unique_ptr<CommInfo> > comm_map; ///< Communicator map
     std::mutex                                   comm_map_lock;
 
-    std::unordered_map<MPI_Request, RequestInfo> req_map;
-    std::mutex                                   req_map_lock;
+    std::atomic<ThreadInfo*>                     thread_infos;   ///< list of all threads' tables
+
+    std::unordered_map<uint64_t, RequestInfo>    overflow_map;   ///< requests that didn't fit into a thread table
+    std::mutex                                   overflow_lock;
+    std::atomic<int>                             overflow_count;
+
+    static const size_t MaxOverflowRequests = 16384;
+
+    std::atomic<unsigned>                        num_untracked;  ///< requests dropped because the tables were full
+
+    static const cali_id_t MaxCachedChannels = 16;
+
+    //   Per-thread shortcut to the ThreadInfo objects, indexed by channel
+    // id. Channel ids are not reused, so an entry can't refer to another
+    // channel's data.
+    static thread_local ThreadInfo* sT_info[MaxCachedChannels];
+
+    static uint64_t request_key(MPI_Request req) {
+        static_assert(sizeof(MPI_Request) <= sizeof(uint64_t), "MPI_Request doesn't fit into 64 bits");
+
+        uint64_t key = 0;
+        std::memcpy(&key, &req, sizeof(MPI_Request));
+        return key;
+    }
+
+    static uint64_t comm_key(MPI_Comm comm) {
+        static_assert(sizeof(MPI_Comm) <= sizeof(uint64_t), "MPI_Comm doesn't fit into 64 bits");
+
+        uint64_t key = 0;
+        std::memcpy(&key, &comm, sizeof(MPI_Comm));
+        return key;
+    }
+
+    static uint64_t now_nsec() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    ThreadInfo* acquire_thread_info(Caliper* c, Channel* chn) {
+        cali_id_t chn_id = chn->id();
+
+        if (chn_id < MaxCachedChannels && sT_info[chn_id])
+            return sT_info[chn_id];
+
+        ThreadInfo* ti =
+            static_cast<ThreadInfo*>(c->get(thread_info_attr).value().get_ptr());
+
+        if (!ti) {
+            // re-use the table of a released thread if there is one
+            for (ThreadInfo* p = thread_infos.load(); p && !ti; p = p->next) {
+                bool expected = false;
+
+                if (!p->in_use.load(std::memory_order_relaxed) && p->in_use.compare_exchange_strong(expected, true))
+                    ti = p;
+            }
+
+            if (!ti) {
+                ti = new ThreadInfo;
+
+                ti->next = thread_infos.load();
+                while (!thread_infos.compare_exchange_weak(ti->next, ti))
+                    ;
+            }
+
+            c->set(thread_info_attr, Variant(cali_make_variant_from_ptr(ti)));
+        }
+
+        if (chn_id < MaxCachedChannels)
+            sT_info[chn_id] = ti;
+
+        return ti;
+    }
+
+    void release_thread_info(Caliper* c, Channel* chn) {
+        cali_id_t chn_id = chn->id();
+
+        ThreadInfo* ti =
+            static_cast<ThreadInfo*>(c->get(thread_info_attr).value().get_ptr());
+
+        if (chn_id < MaxCachedChannels)
+            sT_info[chn_id] = nullptr;
+
+        if (!ti)
+            return;
+
+        c->set(thread_info_attr, Variant(cali_make_variant_from_ptr(nullptr)));
+        ti->in_use.store(false);
+    }
+
+    void add_request(ThreadInfo* ti, MPI_Request req, const RequestInfo& info) {
+        uint64_t key = request_key(req);
+
+        if (ti->insert(key, info))
+            return;
+
+        {
+            std::lock_guard<std::mutex>
+                g(overflow_lock);
+
+            auto it = overflow_map.find(key);
+
+            if (it != overflow_map.end()) {
+                it->second = info;
+                return;
+            } else if (overflow_map.size() < MaxOverflowRequests) {
+                overflow_map.emplace(key, info);
+                ++overflow_count;
+                return;
+            }
+        }
+
+        if (!ti->replace_send(key, info))
+            ++num_untracked;
+    }
+
+    /// \brief Find request \a key in any thread's table or the overflow
+    ///   map and call \a fn on it (see ThreadInfo::access()).
+    template<class Fn>
+    bool access_request(ThreadInfo* own, uint64_t key, Fn fn) {
+        if (own && own->access(key, fn))
+            return true;
+
+        for (ThreadInfo* ti = thread_infos.load(); ti; ti = ti->next)
+            if (ti != own && ti->access(key, fn))
+                return true;
+
+        if (overflow_count.load(std::memory_order_relaxed) == 0)
+            return false;
+
+        std::lock_guard<std::mutex>
+            g(overflow_lock);
+
+        auto it = overflow_map.find(key);
+
+        if (it == overflow_map.end())
+            return false;
+
+        if (!fn(it->second)) {
+            overflow_map.erase(it);
+            --overflow_count;
+        }
+
+        return true;
+    }
 
     // --- initialization
     //
 
-    void init_attributes(Caliper* c) {
+    void init_attributes(Caliper* c, Channel* chn) {
         const struct attr_info_t {
             const char* name; cali_attr_type type; int prop; Attribute* ptr;
         } attr_info_tbl[] = {
@@ -102,15 +453,28 @@ struct MpiTracing::MpiTracingImpl
             { "mpi.coll.count",    CALI_TYPE_INT,   CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_AGGREGATABLE,
               &coll_count_attr },
 
+            { "mpi.hist.kind",     CALI_TYPE_STRING, CALI_ATTR_DEFAULT | CALI_ATTR_SKIP_EVENTS,
+              &hist_kind_attr  },
+            { "mpi.hist.bin",      CALI_TYPE_UINT,  CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+              &hist_bin_attr   },
+            { "mpi.hist.count",    CALI_TYPE_UINT,  CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_AGGREGATABLE,
+              &hist_count_attr },
+
             { nullptr, CALI_TYPE_INV, 0, nullptr }
         };
 
         for (const struct attr_info_t* a = attr_info_tbl; a && a->name; a++)
             *(a->ptr) = c->create_attribute(a->name, a->type, a->prop);
+
+        thread_info_attr =
+            c->create_attribute(std::string("mpi.tracing.info.") + std::to_string(chn->id()), CALI_TYPE_PTR,
+                                CALI_ATTR_ASVALUE       |
+                                CALI_ATTR_SCOPE_THREAD  |
+                                CALI_ATTR_SKIP_EVENTS   |
+                                CALI_ATTR_HIDDEN);
     }
 
     void init_mpi(Caliper* c, Channel* chn) {
-        req_map.reserve(100);
         comm_map.reserve(100);
 
         make_comm_entry(c, MPI_COMM_WORLD);
@@ -156,38 +520,87 @@ struct MpiTracing::MpiTracingImpl
         return c->make_tree_entry(comm_attr, Variant(id), node);
     }
 
-    Node* lookup_comm(Caliper* c, MPI_Comm comm) {
-        std::lock_guard<std::mutex>
-            g(comm_map_lock);
+    CommInfo* lookup_comm(Caliper* c, ThreadInfo* ti, MPI_Comm comm) {
+        uint64_t key = comm_key(comm);
+        size_t   i   = static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 61); // 8 cache entries
 
-        auto it = comm_map.find(comm);
+        if (ti->comm_infos[i] && ti->comm_keys[i] == key)
+            return ti->comm_infos[i];
 
-        if (it != comm_map.end())
-            return it->second;
+        CommInfo* info = nullptr;
 
-        Node* node = make_comm_entry(c, comm);
-        comm_map[comm] = node;
+        {
+            std::lock_guard<std::mutex>
+                g(comm_map_lock);
 
-        return node;
+            auto it = comm_map.find(comm);
+
+            if (it != comm_map.end()) {
+                info = it->second.get();
+            } else {
+                info = new CommInfo;
+                info->node = make_comm_entry(c, comm);
+                comm_map[comm].reset(info);
+            }
+        }
+
+        ti->comm_keys[i]  = key;
+        ti->comm_infos[i] = info;
+
+        return info;
     }
 
 
     // --- point-to-point
     //
 
-    void push_send_event(Caliper* c, Channel* channel, int size, int dest, int tag, cali::Node* comm_node) {
+    void push_send_event(Caliper* c, Channel* channel, int size, int dest, int tag, CommInfo* comm) {
         const Entry data[] = {
-            { comm_node },
+            { comm->node },
             { msg_dst_attr,    Variant(dest) },
             { msg_tag_attr,    Variant(tag)  },
             { msg_size_attr,   Variant(size) },
             { send_count_attr, Variant(1)    }
         };
 
+        comm->msg_size.add(static_cast<uint64_t>(size));
+
         c->push_snapshot(channel, SnapshotView(5, data));
     }
 
+    void handle_send(Caliper* c, Channel* chn, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm) {
+        int size = 0;
+        PMPI_Type_size(type, &size);
+        size *= count;
+
+        push_send_event(c, chn, size, dest, tag, lookup_comm(c, acquire_thread_info(c, chn), comm));
+    }
+
+    void handle_isend(Caliper* c, Channel* chn, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* req) {
+        ThreadInfo* ti = acquire_thread_info(c, chn);
+        RequestInfo info;
+
+        info.op            = RequestInfo::Send;
+        info.is_persistent = false;
+        info.target        = dest;
+        info.tag           = tag;
+        info.count         = count;
+        info.type          = type;
+        info.comm          = lookup_comm(c, ti, comm);
+        info.post_time     = now_nsec();
+
+        PMPI_Type_size(type, &info.size);
+        info.size *= count;
+
+        push_send_event(c, chn, info.size, dest, tag, info.comm);
+
+        //   The send event is recorded right away; we only keep the request
+        // to measure its wait time
+        add_request(ti, *req, info);
+    }
+
     void handle_send_init(Caliper* c, Channel* chn, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* req) {
+        ThreadInfo* ti = acquire_thread_info(c, chn);
         RequestInfo info;
 
         info.op            = RequestInfo::Send;
@@ -196,26 +609,26 @@ struct MpiTracing::MpiTracingImpl
         info.tag           = tag;
         info.count         = count;
         info.type          = type;
-        info.comm_node     = lookup_comm(c, comm);
+        info.comm          = lookup_comm(c, ti, comm);
+        info.post_time     = 0;
 
         PMPI_Type_size(type, &info.size);
         info.size *= count;
 
-        std::lock_guard<std::mutex>
-            g(req_map_lock);
-
-        req_map[*req] = info;
+        add_request(ti, *req, info);
     }
 
-    void push_recv_event(Caliper* c, Channel* channel, int src, int size, int tag, Node* comm_node) {
+    void push_recv_event(Caliper* c, Channel* channel, int src, int size, int tag, CommInfo* comm) {
         const Entry data[] = {
-            { comm_node },
+            { comm->node },
             { msg_src_attr,    Variant(src)  },
             { msg_tag_attr,    Variant(tag)  },
             { msg_size_attr,   Variant(size) },
             { recv_count_attr, Variant(1)    }
         };
 
+        comm->msg_size.add(static_cast<uint64_t>(size));
+
         c->push_snapshot(channel, SnapshotView(5, data));
     }
 
@@ -225,98 +638,186 @@ struct MpiTracing::MpiTracingImpl
         int count = 0;
         PMPI_Get_count(status, type, &count);
 
-        push_recv_event(c, chn, status->MPI_SOURCE, size*count, status->MPI_TAG, lookup_comm(c, comm));
+        push_recv_event(c, chn, status->MPI_SOURCE, size*count, status->MPI_TAG, lookup_comm(c, acquire_thread_info(c, chn), comm));
     }
 
-    void handle_irecv(Caliper* c, Channel* chn, int count, MPI_Datatype type, int src, int tag, MPI_Comm comm, MPI_Request* req) {
+    void handle_irecv(Caliper* c, Channel* chn, int count, MPI_Datatype type, int src, int tag, MPI_Comm comm, MPI_Request* req, bool persistent) {
+        ThreadInfo* ti = acquire_thread_info(c, chn);
         RequestInfo info;
 
         info.op            = RequestInfo::Recv;
-        info.is_persistent = false;
+        info.is_persistent = persistent;
         info.target        = src;
         info.tag           = tag;
         info.type          = type;
         info.count         = count;
-        info.comm_node     = lookup_comm(c, comm);
-
-        std::lock_guard<std::mutex>
-            g(req_map_lock);
+        info.comm          = lookup_comm(c, ti, comm);
+        info.size          = 0;
+        info.post_time     = persistent ? 0 : now_nsec();
 
-        req_map[*req] = info;
+        add_request(ti, *req, info);
     }
 
-    void handle_recv_init(Caliper* c, Channel* chn, int count, MPI_Datatype type, int src, int tag, MPI_Comm comm, MPI_Request* req) {
-        RequestInfo info;
+    void handle_start(Caliper* c, Channel* chn, int nreq, MPI_Request* reqs) {
+        ThreadInfo* ti  = acquire_thread_info(c, chn);
+        uint64_t    now = now_nsec();
 
-        info.op            = RequestInfo::Recv;
-        info.is_persistent = true;
-        info.target        = src;
-        info.tag           = tag;
-        info.type          = type;
-        info.count         = count;
-        info.comm_node     = lookup_comm(c, comm);
-        info.size          = 0;
+        for (int i = 0; i < nreq; ++i) {
+            RequestInfo info;
 
-        std::lock_guard<std::mutex>
-            g(req_map_lock);
+            bool found = access_request(ti, request_key(reqs[i]), [&info,now](RequestInfo& r){
+                    r.post_time = now;
+                    info = r;
+                    return true;
+                });
 
-        req_map[*req] = info;
+            if (found && info.op == RequestInfo::Send)
+                push_send_event(c, chn, info.size, info.target, info.tag, info.comm);
+        }
     }
 
-    void handle_start(Caliper* c, Channel* chn, int nreq, MPI_Request* reqs) {
-        for (int i = 0; i < nreq; ++i) {
-            std::lock_guard<std::mutex>
-                g(req_map_lock);
+    void handle_completion(Caliper* c, Channel* chn, int nreq, MPI_Request* reqs, MPI_Status* statuses) {
+        //   Process the requests in batches: look up the whole batch in
+        // our own table first, then do a single pass over the other
+        // threads' tables and the overflow map for the ones we didn't
+        // find, and finally record everything.
 
-            auto it = req_map.find(reqs[i]);
+        const int BatchSize = 64;
 
-            if (it == req_map.end())
-                continue;
+        ThreadInfo* ti  = acquire_thread_info(c, chn);
+        uint64_t    now = now_nsec();
 
-            RequestInfo info = it->second;
+        for (int b = 0; b < nreq; b += BatchSize) {
+            int n = std::min(BatchSize, nreq - b);
 
-            if (info.op == RequestInfo::Send)
-                push_send_event(c, chn, info.size, info.target, info.tag, info.comm_node);
-        }
-    }
+            RequestInfo infos[BatchSize];
+            bool        found[BatchSize];
+            int         num_missing = 0;
 
-    void handle_completion(Caliper* c, Channel* chn, int nreq, MPI_Request* reqs, MPI_Status* statuses) {
-        for (int i = 0; i < nreq; ++i) {
-            std::lock_guard<std::mutex>
-                g(req_map_lock);
+            for (int i = 0; i < n; ++i) {
+                RequestInfo& info = infos[i];
 
-            auto it = req_map.find(reqs[i]);
+                found[i] = (reqs[b+i] != MPI_REQUEST_NULL) &&
+                    ti->access(request_key(reqs[b+i]), [&info](RequestInfo& r){
+                            info = r;
+                            return r.is_persistent;
+                        });
 
-            if (it == req_map.end())
-                continue;
+                if (!found[i] && reqs[b+i] != MPI_REQUEST_NULL)
+                    ++num_missing;
+            }
+
+            if (num_missing > 0) {
+                for (ThreadInfo* other = thread_infos.load(); other && num_missing > 0; other = other->next) {
+                    if (other == ti)
+                        continue;
 
-            RequestInfo info = it->second;
+                    for (int i = 0; i < n; ++i) {
+                        if (found[i] || reqs[b+i] == MPI_REQUEST_NULL)
+                            continue;
 
-            if (info.op == RequestInfo::Recv) {
-                int size  = 0;
-                PMPI_Type_size(info.type, &size);
-                int count = 0;
-                PMPI_Get_count(statuses+i, info.type, &count);
+                        RequestInfo& info = infos[i];
 
-                push_recv_event(c, chn, statuses[i].MPI_SOURCE, size*count, statuses[i].MPI_TAG, info.comm_node);
+                        found[i] = other->access(request_key(reqs[b+i]), [&info](RequestInfo& r){
+                                info = r;
+                                return r.is_persistent;
+                            });
+
+                        if (found[i])
+                            --num_missing;
+                    }
+                }
             }
 
-            if (!info.is_persistent)
-                req_map.erase(it);
+            if (num_missing > 0 && overflow_count.load(std::memory_order_relaxed) > 0) {
+                std::lock_guard<std::mutex>
+                    g(overflow_lock);
+
+                for (int i = 0; i < n; ++i) {
+                    if (found[i] || reqs[b+i] == MPI_REQUEST_NULL)
+                        continue;
+
+                    auto it = overflow_map.find(request_key(reqs[b+i]));
+
+                    if (it == overflow_map.end())
+                        continue;
+
+                    infos[i] = it->second;
+                    found[i] = true;
+
+                    if (!it->second.is_persistent) {
+                        overflow_map.erase(it);
+                        --overflow_count;
+                    }
+                }
+            }
+
+            for (int i = 0; i < n; ++i) {
+                if (!found[i])
+                    continue;
+
+                const RequestInfo& info = infos[i];
+
+                if (info.post_time > 0 && now >= info.post_time)
+                    info.comm->wait_time.add(now - info.post_time);
+
+                if (info.op == RequestInfo::Recv) {
+                    int size  = 0;
+                    PMPI_Type_size(info.type, &size);
+                    int count = 0;
+                    PMPI_Get_count(statuses+b+i, info.type, &count);
+
+                    push_recv_event(c, chn, statuses[b+i].MPI_SOURCE, size*count, statuses[b+i].MPI_TAG, info.comm);
+                }
+            }
         }
     }
 
-    void request_free(MPI_Request* req) {
+    void request_free(Caliper* c, Channel* chn, MPI_Request* req) {
+        access_request(acquire_thread_info(c, chn), request_key(*req), [](RequestInfo&){ return false; });
+    }
+
+    // --- histograms
+    //
+
+    void push_histograms(Caliper* c, Channel* chn) {
         std::lock_guard<std::mutex>
-            g(req_map_lock);
+            g(comm_map_lock);
+
+        for (auto &p : comm_map) {
+            const struct hist_info_t {
+                const char* kind; const Histogram* hist;
+            } hists[] = {
+                { "msg.size",  &p.second->msg_size  },
+                { "wait.time", &p.second->wait_time }
+            };
+
+            for (const hist_info_t& h : hists) {
+                Node* node = c->make_tree_entry(hist_kind_attr, Variant(h.kind), p.second->node);
+
+                for (int i = 0; i < Histogram::NumBins; ++i) {
+                    uint64_t count = h.hist->bins[i].load(std::memory_order_relaxed);
+
+                    if (count == 0)
+                        continue;
+
+                    const Entry data[] = {
+                        { node },
+                        { hist_bin_attr,   Variant(cali_make_variant_from_uint(Histogram::lower_bound(i))) },
+                        { hist_count_attr, Variant(cali_make_variant_from_uint(count)) }
+                    };
 
-        req_map.erase(*req);
+                    c->push_snapshot(chn, SnapshotView(3, data));
+                }
+            }
+        }
     }
 
     // --- collectives
     //
 
-    void push_coll_event(Caliper* c, Channel* channel, CollectiveType coll_type, int size, int root, Node* comm_node) {
+    void push_coll_event(Caliper* c, Channel* channel, CollectiveType coll_type, int size, int root, MPI_Comm comm) {
+        Node* comm_node = lookup_comm(c, acquire_thread_info(c, channel), comm)->node;
         Node* node = c->make_tree_entry(coll_type_attr, Variant(static_cast<int>(coll_type)), comm_node);
 
         const Entry data[] = {
@@ -336,14 +837,35 @@ struct MpiTracing::MpiTracingImpl
         c->push_snapshot(channel, SnapshotView(ne, data));
     }
 
+    // --- finish
+    //
+
+    void finish(Caliper*, Channel* chn) {
+        if (num_untracked.load() > 0)
+            Log(1).stream() << chn->name() << ": mpi: " << num_untracked.load()
+                            << " requests not tracked (request tables full)" << std::endl;
+    }
+
     // --- constructor
     //
 
     MpiTracingImpl()
-        : comm_id(0)
+        : comm_id(0), thread_infos(nullptr), overflow_count(0), num_untracked(0)
     { }
+
+    ~MpiTracingImpl() {
+        ThreadInfo* ti = thread_infos.load();
+
+        while (ti) {
+            ThreadInfo* next = ti->next;
+            delete ti;
+            ti = next;
+        }
+    }
 };
 
+thread_local MpiTracing::MpiTracingImpl::ThreadInfo* MpiTracing::MpiTracingImpl::sT_info[MpiTracing::MpiTracingImpl::MaxCachedChannels] = { nullptr };
+
 
 MpiTracing::MpiTracing()
     : mP(new MpiTracingImpl)
@@ -357,7 +879,7 @@ MpiTracing::~MpiTracing()
 void
 MpiTracing::init(Caliper* c, Channel* chn)
 {
-    mP->init_attributes(c);
+    mP->init_attributes(c, chn);
 }
 
 void
@@ -369,11 +891,13 @@ MpiTracing::init_mpi(Caliper* c, Channel* chn)
 void
 MpiTracing::handle_send(Caliper* c, Channel* chn, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm)
 {
-    int size = 0;
-    PMPI_Type_size(type, &size);
-    size *= count;
+    mP->handle_send(c, chn, count, type, dest, tag, comm);
+}
 
-    mP->push_send_event(c, chn, size, dest, tag, mP->lookup_comm(c, comm));
+void
+MpiTracing::handle_isend(Caliper* c, Channel* chn, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* req)
+{
+    mP->handle_isend(c, chn, count, type, dest, tag, comm, req);
 }
 
 void
@@ -391,13 +915,13 @@ MpiTracing::handle_recv(Caliper* c, Channel* chn, int, MPI_Datatype type, int, i
 void
 MpiTracing::handle_irecv(Caliper* c, Channel* chn, int count, MPI_Datatype type, int src, int tag, MPI_Comm comm, MPI_Request* req)
 {
-    mP->handle_irecv(c, chn, count, type, src, tag, comm, req);
+    mP->handle_irecv(c, chn, count, type, src, tag, comm, req, false);
 }
 
 void
 MpiTracing::handle_recv_init(Caliper* c, Channel* chn, int count, MPI_Datatype type, int src, int tag, MPI_Comm comm, MPI_Request* req)
 {
-    mP->handle_recv_init(c, chn, count, type, src, tag, comm, req);
+    mP->handle_irecv(c, chn, count, type, src, tag, comm, req, true);
 }
 
 void
@@ -413,9 +937,27 @@ MpiTracing::handle_completion(Caliper* c, Channel* chn, int nreq, MPI_Request* r
 }
 
 void
-MpiTracing::request_free(Caliper*, Channel*, MPI_Request* req)
+MpiTracing::request_free(Caliper* c, Channel* chn, MPI_Request* req)
+{
+    mP->request_free(c, chn, req);
+}
+
+void
+MpiTracing::push_histograms(Caliper* c, Channel* chn)
+{
+    mP->push_histograms(c, chn);
+}
+
+void
+MpiTracing::release_thread(Caliper* c, Channel* chn)
+{
+    mP->release_thread_info(c, chn);
+}
+
+void
+MpiTracing::finish(Caliper* c, Channel* chn)
 {
-    mP->request_free(req);
+    mP->finish(c, chn);
 }
 
 void
@@ -426,7 +968,7 @@ MpiTracing::handle_12n(Caliper* c, Channel* chn, int count, MPI_Datatype type, i
     int rank = 0;
     PMPI_Comm_rank(comm, &rank);
 
-    mP->push_coll_event(c, chn, Coll_12N, (rank == root ? count : 0) * size, root, mP->lookup_comm(c, comm));
+    mP->push_coll_event(c, chn, Coll_12N, (rank == root ? count : 0) * size, root, comm);
 }
 
 void
@@ -437,7 +979,7 @@ MpiTracing::handle_n21(Caliper* c, Channel* chn, int count, MPI_Datatype type, i
     int rank = 0;
     PMPI_Comm_rank(comm, &rank);
 
-    mP->push_coll_event(c, chn, Coll_N21, (rank != root ? count : 0) * size, root, mP->lookup_comm(c, comm));
+    mP->push_coll_event(c, chn, Coll_N21, (rank != root ? count : 0) * size, root, comm);
 }
 
 void
@@ -446,23 +988,23 @@ MpiTracing::handle_n2n(Caliper* c, Channel* chn, int count, MPI_Datatype type, M
     int size = 0;
     PMPI_Type_size(type, &size);
 
-    mP->push_coll_event(c, chn, Coll_NxN, count*size, 0, mP->lookup_comm(c, comm));
+    mP->push_coll_event(c, chn, Coll_NxN, count*size, 0, comm);
 }
 
 void
 MpiTracing::handle_barrier(Caliper* c, Channel* chn, MPI_Comm comm)
 {
-    mP->push_coll_event(c, chn, Coll_Barrier, 0, 0, mP->lookup_comm(c, comm));
+    mP->push_coll_event(c, chn, Coll_Barrier, 0, 0, comm);
 }
 
 void
 MpiTracing::handle_init(Caliper* c, Channel* chn)
 {
-    mP->push_coll_event(c, chn, Coll_Init, 0, 0, mP->lookup_comm(c, MPI_COMM_WORLD));
+    mP->push_coll_event(c, chn, Coll_Init, 0, 0, MPI_COMM_WORLD);
 }
 
 void
 MpiTracing::handle_finalize(Caliper* c, Channel* chn)
 {
-    mP->push_coll_event(c, chn, Coll_Finalize, 0, 0, mP->lookup_comm(c, MPI_COMM_WORLD));
+    mP->push_coll_event(c, chn, Coll_Finalize, 0, 0, MPI_COMM_WORLD);
 }
@@ -37,6 +37,7 @@ public:
     // --- point-to-point
 
     void handle_send(Caliper* c, Channel* chn, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm);
+    void handle_isend(Caliper* c, Channel* chn, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* req);
     void handle_send_init(Caliper* c, Channel* chn, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* req);
 
     void handle_recv(Caliper* c, Channel* chn, int count, MPI_Datatype type, int src, int tag, MPI_Comm comm, MPI_Status* status);
@@ -44,10 +45,24 @@ public:
     void handle_recv_init(Caliper* c, Channel* chn, int count, MPI_Datatype type, int src, int tag, MPI_Comm comm, MPI_Request* req);
 
     void handle_start(Caliper* c, Channel* chn, int nreq, MPI_Request* reqs);
+    /// \brief Process the completed requests \a reqs with statuses
+    ///   \a statuses. Skips MPI_REQUEST_NULL entries.
     void handle_completion(Caliper* c, Channel* chn, int nreq, MPI_Request* reqs, MPI_Status* statuses);
 
     void request_free(Caliper* c, Channel* chn, MPI_Request* req);
 
+    // --- histograms
+
+    /// \brief Push snapshot records with the per-communicator message
+    ///   size and wait time histograms. Called in MPI_Finalize, so the
+    ///   records carry the annotation context active at that point.
+    void push_histograms(Caliper* c, Channel* chn);
+
+    /// \brief Hand the calling thread's request table to the next new thread
+    void release_thread(Caliper* c, Channel* chn);
+
+    void finish(Caliper* c, Channel* chn);
+
     // --- collectives
 
     void handle_12n(Caliper* c, Channel* chn, int count, MPI_Datatype type, int root, MPI_Comm comm);
@@ -285,7 +285,7 @@ post_init_cb(Caliper* c, Channel* channel)
 // --- Point-to-Point
 //
 
-{{fn func MPI_Send MPI_Bsend MPI_Rsend MPI_Ssend MPI_Isend MPI_Ibsend MPI_Irsend MPI_Issend}}{
+{{fn func MPI_Send MPI_Bsend MPI_Rsend MPI_Ssend}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
     if (::enable_wrapper) {
 #endif
@@ -306,6 +306,27 @@ post_init_cb(Caliper* c, Channel* channel)
 #endif
 }{{endfn}}
 
+{{fn func MPI_Isend MPI_Ibsend MPI_Irsend MPI_Issend}}{
+#ifndef CALIPER_MPIWRAP_USE_GOTCHA
+    if (::enable_wrapper) {
+#endif
+        Caliper c;
+        ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
+
+        {{callfn}}
+
+        for (MpiWrapperConfig* mwc = MpiWrapperConfig::get_wrapper_config(); mwc; mwc = mwc->next)
+            if (mwc->enable_{{func}} && mwc->channel->is_active() && mwc->enable_msg_tracing)
+                    mwc->tracing.handle_isend(&c, mwc->channel, {{1}}, {{2}}, {{3}}, {{4}}, {{5}}, {{6}});
+
+        ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
+#ifndef CALIPER_MPIWRAP_USE_GOTCHA
+    } else {
+        {{callfn}}
+    }
+#endif
+}{{endfn}}
+
 {{fn func MPI_Send_init MPI_Bsend_init MPI_Rsend_init MPI_Ssend_init}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
     if (::enable_wrapper) {
@@ -648,10 +669,22 @@ post_init_cb(Caliper* c, Channel* channel)
 
         {{callfn}}
 
-        for (MpiWrapperConfig* mwc = MpiWrapperConfig::get_wrapper_config(); mwc; mwc = mwc->next)
-            if (mwc->enable_msg_tracing && mwc->enable_{{func}} && mwc->channel->is_active())
-                for (int i = 0; i < *{{2}}; ++i)
-                    mwc->tracing.handle_completion(&c, mwc->channel, 1, tmp_req+{{3}}[i], {{4}}+{{3}}[i]);
+        if (any_msg_tracing && *{{2}} != MPI_UNDEFINED) {
+            //   Gather the completed requests so we can process them in
+            // batches. The statuses are already in outcount order.
+            MPI_Request done[64];
+
+            for (int b = 0; b < *{{2}}; b += 64) {
+                int n = std::min(64, *{{2}} - b);
+
+                for (int i = 0; i < n; ++i)
+                    done[i] = tmp_req[{{3}}[b+i]];
+
+                for (MpiWrapperConfig* mwc = MpiWrapperConfig::get_wrapper_config(); mwc; mwc = mwc->next)
+                    if (mwc->enable_msg_tracing && mwc->enable_{{func}} && mwc->channel->is_active())
+                        mwc->tracing.handle_completion(&c, mwc->channel, n, done, {{4}}+b);
+            }
+        }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
 
@@ -1173,6 +1206,10 @@ post_init_cb(Caliper* c, Channel* channel)
 
     ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
 
+    for (MpiWrapperConfig* mwc = MpiWrapperConfig::get_wrapper_config(); mwc; mwc = mwc->next)
+        if (mwc->enable_msg_tracing && mwc->channel->is_active())
+            mwc->tracing.push_histograms(&c, mwc->channel);
+
     for (MpiWrapperConfig* mwc = MpiWrapperConfig::get_wrapper_config(); mwc; mwc = mwc->next)
         mwc->mpi_events.mpi_finalize_evt(&c, mwc->channel);
 
@@ -1249,7 +1286,10 @@ void mpiwrap_init(Caliper* c, Channel* chn, ConfigSet& cfg)
     chn->events().finish_evt.connect(
         [](Caliper* c, Channel* channel){
             Log(2).stream() << channel->name() << ": Finishing mpi service" << std::endl;
-            MpiWrapperConfig::get_wrapper_config(channel)->dec_wrap_counters();
+            MpiWrapperConfig* mwc = MpiWrapperConfig::get_wrapper_config(channel);
+            if (mwc->enable_msg_tracing)
+                mwc->tracing.finish(c, channel);
+            mwc->dec_wrap_counters();
             MpiWrapperConfig::delete_wrapper_config(channel);
         });
 
@@ -1261,9 +1301,15 @@ void mpiwrap_init(Caliper* c, Channel* chn, ConfigSet& cfg)
 
     mwc->mpi_events.mpi_init_evt.connect(::mpi_init_cb);
 
-    if (mwc->enable_msg_tracing)
+    if (mwc->enable_msg_tracing) {
         mwc->tracing.init(c, chn);
 
+        chn->events().release_thread_evt.connect(
+            [](Caliper* c, Channel* channel){
+                MpiWrapperConfig::get_wrapper_config(channel)->tracing.release_thread(c, channel);
+            });
+    }
+
 #ifdef CALIPER_MPIWRAP_USE_GOTCHA
     Log(2).stream() << chn->name() << ": mpiwrap: Using GOTCHA wrappers." << std::endl;
 
@@ -20,7 +20,9 @@
 
 #include "../../common/util/file_util.h"
 
+#include <cstdio>
 #include <iostream>
+#include <memory>
 #include <string>
 
 using namespace cali;
@@ -40,48 +42,146 @@ const char* spec = R"json(
             { "name"        : "directory",
               "type"        : "string",
               "description" : "Directory to write .cali files to."
+            },
+            { "name"        : "format",
+              "type"        : "string",
+              "description" : "Output format: 'text' or 'binary'",
+              "value"       : "text"
             }
         ]
     }
 )json";
 
-void write_output_cb(Caliper* c, Channel* chn, SnapshotView flush_info)
+/// \brief Insert segment number \a segment into \a filename, before
+///   the ".cali" extension if there is one
+std::string
+make_segment_filename(const std::string& filename, uint64_t segment)
 {
-    ConfigSet cfg = services::init_config_from_spec(chn->config(), spec);
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), ".%04llu", static_cast<unsigned long long>(segment));
 
-    std::string filename  = cfg.get("filename").to_string();
-    std::string directory = cfg.get("directory").to_string();
+    std::string::size_type pos = filename.size();
 
-    if (filename.empty())
-        filename = cali::util::create_filename();
-    if (!directory.empty())
-        filename = directory + "/" + filename;
+    if (pos > 5 && filename.compare(pos - 5, 5, ".cali") == 0)
+        pos -= 5;
 
-    OutputStream stream;
-    stream.set_filename(filename.c_str(), *c, std::vector<Entry>(flush_info.begin(), flush_info.end()));
+    return std::string(filename).insert(pos, buf);
+}
 
-    CaliWriter writer(stream);
+class Recorder
+{
+    ConfigSet          m_cfg;
+    CaliWriter::Format m_format;
 
-    c->flush(chn, flush_info, [&writer](CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec){
-            writer.write_snapshot(db, rec);
-        });
+    //   In rolling output mode, we keep the writer across flushes so
+    // that each segment only contains the nodes that are new.
+    std::unique_ptr<CaliWriter> m_writer;
+    std::string        m_segment_filename;
 
-    writer.write_globals(*c, c->get_globals(chn));
+    std::string get_filename() {
+        std::string filename  = m_cfg.get("filename").to_string();
+        std::string directory = m_cfg.get("directory").to_string();
 
-    Log(1).stream() << chn->name()
-                    << ": Recorder: Wrote " << writer.num_written() << " records." << std::endl;
-}
+        if (filename.empty())
+            filename = cali::util::create_filename();
+        if (!directory.empty())
+            filename = directory + "/" + filename;
 
-void recorder_register(Caliper* c, Channel* chn)
-{
-    chn->events().write_output_evt.connect(::write_output_cb);
-}
+        return filename;
+    }
+
+    void write_segment(Caliper* c, Channel* chn, SnapshotView flush_info, uint64_t segment) {
+        // generate the base filename only once so all segments share it
+        if (m_segment_filename.empty())
+            m_segment_filename = get_filename();
+
+        std::string filename = m_segment_filename;
+
+        if (filename.find("%cali.segment%") == std::string::npos && filename != "stdout" && filename != "stderr")
+            filename = make_segment_filename(filename, segment);
+
+        OutputStream stream;
+        stream.set_filename(filename.c_str(), *c, std::vector<Entry>(flush_info.begin(), flush_info.end()));
+
+        if (m_writer)
+            m_writer->next_segment(stream);
+        else
+            m_writer.reset(new CaliWriter(stream, m_format));
+
+        size_t num_written = m_writer->num_written();
+
+        c->flush(chn, flush_info, [this](CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec){
+                m_writer->write_snapshot(db, rec);
+            });
+
+        m_writer->write_globals(*c, c->get_globals(chn));
+
+        Log(1).stream() << chn->name()
+                        << ": Recorder: Wrote " << m_writer->num_written() - num_written
+                        << " records to segment " << segment << "." << std::endl;
+    }
+
+    void write_output_cb(Caliper* c, Channel* chn, SnapshotView flush_info) {
+        Attribute segment_attr = c->get_attribute("cali.segment");
+
+        if (segment_attr) {
+            Entry e = flush_info.get(segment_attr);
+
+            if (!e.empty()) {
+                write_segment(c, chn, flush_info, e.value().to_uint());
+                return;
+            }
+        }
+
+        OutputStream stream;
+        stream.set_filename(get_filename().c_str(), *c, std::vector<Entry>(flush_info.begin(), flush_info.end()));
+
+        CaliWriter writer(stream, m_format);
+
+        c->flush(chn, flush_info, [&writer](CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec){
+                writer.write_snapshot(db, rec);
+            });
+
+        writer.write_globals(*c, c->get_globals(chn));
+
+        Log(1).stream() << chn->name()
+                        << ": Recorder: Wrote " << writer.num_written() << " records." << std::endl;
+    }
+
+    Recorder(Channel* chn)
+        : m_cfg(services::init_config_from_spec(chn->config(), spec)),
+          m_format(CaliWriter::Text)
+    {
+        std::string format = m_cfg.get("format").to_string();
+
+        if (format == "binary")
+            m_format = CaliWriter::Binary;
+        else if (format != "text")
+            Log(0).stream() << chn->name() << ": Recorder: Unknown format \"" << format
+                            << "\", using text format" << std::endl;
+    }
+
+public:
+
+    static void recorder_register(Caliper* c, Channel* chn) {
+        Recorder* instance = new Recorder(chn);
+
+        chn->events().write_output_evt.connect(
+            [instance](Caliper* c, Channel* chn, SnapshotView flush_info){
+                instance->write_output_cb(c, chn, flush_info);
+            });
+        chn->events().finish_evt.connect(
+            [instance](Caliper*, Channel*){
+                delete instance;
+            });
+    }
+};
 
 } // namespace
 
 namespace cali
 {
 
-CaliperService recorder_service { ::spec, ::recorder_register };
+CaliperService recorder_service { ::spec, ::Recorder::recorder_register };
 
 }
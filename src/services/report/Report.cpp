@@ -9,10 +9,11 @@
 
 #include "../Services.h"
 
+#include "../../caliper/ChannelMetadataAccess.h"
+
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
-#include "caliper/reader/CaliperMetadataDB.h"
 #include "caliper/reader/CalQLParser.h"
 #include "caliper/reader/QueryProcessor.h"
 
@@ -60,18 +61,18 @@ class Report {
         if (config.get("append").to_bool() == true)
             stream.set_mode(OutputStream::Mode::Append);
 
-        CaliperMetadataDB db;
+        //   Run the query directly on the runtime metadata, without copying
+        // the records' nodes into a CaliperMetadataDB
+        ChannelMetadataAccess db(c, channel);
         QueryProcessor queryP(spec, stream);
 
         db.add_attribute_aliases(spec.aliases);
         db.add_attribute_units(spec.units);
 
-        c->flush(channel, flush_info, [&queryP,&db](CaliperMetadataAccessInterface& in_db, const std::vector<Entry>& rec){
-                queryP.process_record(db, db.merge_snapshot(in_db, rec));
+        c->flush(channel, flush_info, [&queryP,&db](CaliperMetadataAccessInterface&, const std::vector<Entry>& rec){
+                queryP.process_record(db, rec);
             } );
 
-        db.import_globals(*c, c->get_globals(channel));
-
         queryP.flush(db);
     }
 
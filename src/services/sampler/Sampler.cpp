@@ -14,6 +14,8 @@
 #include "caliper/common/Log.h"
 #include "caliper/common/RuntimeConfig.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
 #include <signal.h>
@@ -42,14 +44,45 @@ namespace
 Attribute   timer_attr   { Attribute::invalid };
 Attribute   sampler_attr { Attribute::invalid };
 Attribute   ucursor_attr { Attribute::invalid };
+Attribute   stack_attr   { Attribute::invalid };
+Attribute   delay_attr   { Attribute::invalid };
 
 int         nsec_interval       = 0;
 
-int         n_samples           = 0;
-int         n_processed_samples = 0;
+std::atomic<int> n_samples           { 0 };
+std::atomic<int> n_processed_samples { 0 };
+std::atomic<int> n_deferred_samples  { 0 };
 
 Channel* channel          = nullptr;
 
+const unsigned MaxStackDepth = 64;
+
+bool        deferred            = false;
+unsigned    buffer_size         = 0;
+unsigned    stack_depth         = 0;
+
+/// \brief Per-thread ring buffer for deferred sample processing
+///
+/// Only the owning thread uses a buffer: its SIGPROF handler appends
+/// samples at \a head, and drain_buffer() removes them at \a tail.
+/// Each sample takes \a stride words: the CLOCK_MONOTONIC time the
+/// sample was taken, the interrupted PC, the number of stack frames, and
+/// up to stride-3 instruction pointers. The buffer holds only PODs so
+/// the signal handler can use it safely.
+struct SampleBuffer
+{
+    std::atomic<unsigned> head;
+    std::atomic<unsigned> tail;
+    std::atomic<bool>     draining;
+
+    unsigned              mask;   ///< capacity - 1; capacity is a power of two
+    unsigned              stride;
+
+    uint64_t*             data;
+};
+
+thread_local SampleBuffer* t_buffer = nullptr;
+
 const char* spec = R"json(
 {   "name": "sampler",
     "description": "Trigger snapshots via sampling timer",
@@ -58,6 +91,21 @@ const char* spec = R"json(
           "description": "Sampling frequency in Hz",
           "type": "int",
           "value": "50"
+        },
+        { "name": "deferred",
+          "description": "Buffer samples in the signal handler and process them outside of it",
+          "type": "bool",
+          "value": "false"
+        },
+        { "name": "buffer_size",
+          "description": "Number of samples buffered per thread in deferred mode",
+          "type": "uint",
+          "value": "256"
+        },
+        { "name": "stack_depth",
+          "description": "Max. number of call stack frames recorded per sample in deferred mode",
+          "type": "uint",
+          "value": "32"
         }
     ]
 }
@@ -99,6 +147,106 @@ void on_prof(int sig, siginfo_t *info, void *context)
     ++n_processed_samples;
 }
 
+inline uint64_t monotonic_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+void process_buffered_sample(Caliper* c, const uint64_t* rec, uint64_t now)
+{
+    Entry data[3];
+    unsigned count = 0;
+
+    //   Time since the sample was taken. The timer service subtracts it
+    // from its own clock so the sample gets the timestamp and duration
+    // of the time it was taken, not of the time it is processed.
+    data[count++] = Entry(delay_attr, cali_make_variant_from_uint(now > rec[0] ? now - rec[0] : 0));
+
+#ifdef CALI_SAMPLER_GET_PC
+    Variant v_pc(CALI_TYPE_ADDR, rec+1, sizeof(uint64_t));
+    data[count++] = Entry(sampler_attr, v_pc);
+#endif
+
+    // the stack is passed as [n, ip_0, ..., ip_n-1] to the callpath service
+    if (rec[2] > 0)
+        data[count++] = Entry(stack_attr, Variant(cali_make_variant_from_ptr(const_cast<uint64_t*>(rec+2))));
+
+    c->push_snapshot(channel, SnapshotView(count, data));
+    ++n_processed_samples;
+}
+
+/// \brief Turn the samples in \a buf into snapshots.
+///
+/// Must run on the thread that owns \a buf. Returns immediately if it
+/// interrupted another drain on this thread.
+void drain_buffer(Caliper* c, SampleBuffer* buf)
+{
+    if (buf->draining.exchange(true))
+        return;
+
+    unsigned tail = buf->tail.load(std::memory_order_relaxed);
+
+    while (tail != buf->head.load(std::memory_order_acquire)) {
+        process_buffered_sample(c, buf->data + (tail & buf->mask) * buf->stride, monotonic_nsec());
+        buf->tail.store(++tail, std::memory_order_release);
+    }
+
+    buf->draining.store(false);
+}
+
+void on_prof_deferred(int sig, siginfo_t *info, void *context)
+{
+    ++n_samples;
+
+    SampleBuffer* buf = t_buffer;
+
+    if (!buf)
+        return;
+
+    unsigned head = buf->head.load(std::memory_order_relaxed);
+
+    if (head - buf->tail.load(std::memory_order_acquire) > buf->mask) {
+        //   The buffer is full because no annotation event came along to
+        // drain it. Process the buffered samples here, unless we
+        // interrupted Caliper or a drain on this thread.
+        Caliper c = Caliper::sigsafe_instance();
+
+        if (c)
+            drain_buffer(&c, buf);
+        if (head - buf->tail.load(std::memory_order_acquire) > buf->mask)
+            return;
+    }
+
+    uint64_t* rec = buf->data + (head & buf->mask) * buf->stride;
+
+    rec[0] = monotonic_nsec();
+#ifdef CALI_SAMPLER_GET_PC
+    rec[1] = static_cast<uint64_t>( CALI_SAMPLER_GET_PC(context) );
+#else
+    rec[1] = 0;
+#endif
+    rec[2] = 0;
+
+#ifdef CALIPER_HAVE_LIBUNWIND
+    if (buf->stride > 3) {
+        void* ips[MaxStackDepth+2];
+        int   n = unw_backtrace(ips, static_cast<int>(buf->stride - 1));
+
+        // skip the sample handler and signal trampoline frames
+        for (int i = 2; i < n; ++i)
+            rec[i+1] = reinterpret_cast<uint64_t>(ips[i]);
+
+        rec[2] = n > 2 ? static_cast<uint64_t>(n - 2) : 0;
+    }
+#endif
+
+    buf->head.store(head + 1, std::memory_order_release);
+    ++n_deferred_samples;
+}
+
 void setup_signal()
 {
     sigset_t sigset;
@@ -111,7 +259,7 @@ void setup_signal()
 
     memset(&act, 0, sizeof(act));
 
-    act.sa_sigaction = on_prof;
+    act.sa_sigaction = deferred ? on_prof_deferred : on_prof;
     act.sa_flags     = SA_RESTART | SA_SIGINFO;
 
     sigaction(SIGPROF, &act, NULL);
@@ -181,27 +329,83 @@ void clear_timer(Caliper* c, Channel* chn) {
     delete twrap;
 }
 
+void setup_buffer()
+{
+    if (!deferred || t_buffer)
+        return;
+
+    unsigned capacity = 1;
+
+    while (capacity < buffer_size)
+        capacity *= 2;
+
+    SampleBuffer* buf = new SampleBuffer;
+
+    buf->head.store(0);
+    buf->tail.store(0);
+    buf->draining.store(false);
+    buf->mask   = capacity - 1;
+    buf->stride = stack_depth + 3;
+    buf->data   = new uint64_t[capacity * buf->stride];
+
+    t_buffer = buf;
+}
+
+void clear_buffer(Caliper* c)
+{
+    SampleBuffer* buf = t_buffer;
+
+    if (!buf)
+        return;
+
+    drain_buffer(c, buf);
+
+    t_buffer = nullptr;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    delete[] buf->data;
+    delete buf;
+}
+
+void drain_cb(Caliper* c, Channel*, const Attribute&, const Variant&) {
+    //   The thread's blackboard still holds the context the buffered
+    // samples were taken in, so we can process them now.
+    if (t_buffer)
+        drain_buffer(c, t_buffer);
+}
+
+void pre_flush_cb(Caliper* c, Channel*, SnapshotView) {
+    if (t_buffer)
+        drain_buffer(c, t_buffer);
+}
+
 void create_thread_cb(Caliper* c, Channel* chn) {
+    setup_buffer();
     setup_settimer(c);
 }
 
 void release_thread_cb(Caliper* c, Channel* chn) {
     clear_timer(c, chn);
+    clear_buffer(c);
 }
 
 void pre_finish_cb(Caliper* c, Channel* chn) {
     clear_timer(c, chn);
     clear_signal();
+    clear_buffer(c);
 }
 
 void finish_cb(Caliper* c, Channel* chn) {
     Log(1).stream() << chn->name()
-                    << ": Sampler: processed " << n_processed_samples << " samples ("
-                    << n_samples << " total, "
-                    << n_samples - n_processed_samples << " dropped)." << endl;
+                    << ": Sampler: processed " << n_processed_samples.load() << " samples ("
+                    << n_samples.load() << " total, "
+                    << n_samples.load() - n_processed_samples.load() << " dropped"
+                    << (deferred ? ", " + std::to_string(n_deferred_samples.load()) + " deferred" : std::string())
+                    << ")." << endl;
 
-    n_samples = 0;
-    n_processed_samples = 0;
+    n_samples.store(0);
+    n_processed_samples.store(0);
+    n_deferred_samples.store(0);
 
     channel = nullptr;
 }
@@ -239,6 +443,18 @@ void sampler_register(Caliper* c, Channel* chn)
                             CALI_ATTR_SKIP_EVENTS  |
                             CALI_ATTR_ASVALUE      |
                             CALI_ATTR_HIDDEN);
+    stack_attr =
+        c->create_attribute("cali.sampler.stack", CALI_TYPE_PTR,
+                            CALI_ATTR_SCOPE_THREAD |
+                            CALI_ATTR_SKIP_EVENTS  |
+                            CALI_ATTR_ASVALUE      |
+                            CALI_ATTR_HIDDEN);
+    delay_attr =
+        c->create_attribute("cali.sampler.delay", CALI_TYPE_UINT,
+                            CALI_ATTR_SCOPE_THREAD |
+                            CALI_ATTR_SKIP_EVENTS  |
+                            CALI_ATTR_ASVALUE      |
+                            CALI_ATTR_HIDDEN);
 
     int frequency = config.get("frequency").to_int();
 
@@ -246,6 +462,13 @@ void sampler_register(Caliper* c, Channel* chn)
     frequency     = std::min(std::max(frequency, 1), 10000);
     nsec_interval = 1000000000 / frequency;
 
+    deferred      = config.get("deferred").to_bool();
+    buffer_size   = static_cast<unsigned>(std::min<uint64_t>(std::max<uint64_t>(config.get("buffer_size").to_uint(), 1), 1 << 20));
+    stack_depth   = 0;
+#ifdef CALIPER_HAVE_LIBUNWIND
+    stack_depth   = static_cast<unsigned>(std::min<uint64_t>(config.get("stack_depth").to_uint(), MaxStackDepth));
+#endif
+
     c->set(chn, c->create_attribute("sample.frequency", CALI_TYPE_INT, CALI_ATTR_GLOBAL),
            Variant(frequency));
 
@@ -254,13 +477,25 @@ void sampler_register(Caliper* c, Channel* chn)
     chn->events().pre_finish_evt.connect(pre_finish_cb);
     chn->events().finish_evt.connect(finish_cb);
 
+    if (deferred) {
+        //   Drain before other services (e.g., the event service) take
+        // their snapshot for the annotation event, so the samples come
+        // first in the thread's snapshot sequence
+        chn->events().pre_begin_evt.connect_front(drain_cb);
+        chn->events().pre_set_evt.connect_front(drain_cb);
+        chn->events().pre_end_evt.connect_front(drain_cb);
+        chn->events().pre_flush_evt.connect_front(pre_flush_cb);
+    }
+
     channel = chn;
 
     setup_signal();
+    setup_buffer();
     setup_settimer(c);
 
     Log(1).stream() << chn->name() << ": Registered sampler service. Using "
-                    << frequency << "Hz sampling frequency." << endl;
+                    << frequency << "Hz sampling frequency"
+                    << (deferred ? " with deferred processing." : ".") << endl;
 }
 
 } // namespace
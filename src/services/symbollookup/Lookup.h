@@ -6,8 +6,10 @@
 #ifndef CALI_SYMBOLLOOKUP_LOOKUP_H
 #define CALI_SYMBOLLOOKUP_LOOKUP_H
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace cali
 {
@@ -33,9 +35,34 @@ public:
         bool success;
     };
 
+    /// \brief An entry in a process's module map: the file \a path is
+    ///   mapped at [\a start, \a end).
+    struct ModuleInfo {
+        uint64_t    start;
+        uint64_t    end;
+        std::string path;
+    };
+
     Result lookup(uint64_t address, int what) const;
 
+    /// \brief Look up a batch of addresses
+    ///
+    /// \a addresses must be sorted. Returns the results in the same order.
+    /// The addresses are grouped by module, and each module's symbol
+    /// and line tables are loaded once. Modules are processed in parallel
+    /// with up to \a max_threads threads.
+    std::vector<Result> lookup(const std::vector<uint64_t>& addresses, int what, unsigned max_threads) const;
+
+    /// \brief Parse a module map string as written by the modulemap service
+    static std::vector<ModuleInfo> parse_module_map(const std::string& str);
+
+    /// \brief Look up symbols in the current process
     Lookup();
+
+    /// \brief Look up symbols offline, using the ELF files and load
+    ///   addresses in the module map \a modules
+    explicit Lookup(const std::vector<ModuleInfo>& modules);
+
     ~Lookup();
 };
 
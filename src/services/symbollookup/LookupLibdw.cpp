@@ -10,7 +10,11 @@
 #include <elfutils/libdwfl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <cstring>
+#include <thread>
 
 using namespace cali;
 using namespace symbollookup;
@@ -35,6 +39,64 @@ Dwfl_Callbacks* get_dwfl_callbacks()
     return &callbacks;
 }
 
+//   Modules with at least this many addresses to look up get their line
+// table read in one pass instead of one dwfl_module_getsrc() call per
+// address.
+const size_t LineTableWalkThreshold = 256;
+
+struct LineRow {
+    uint64_t    addr;
+    const char* file;
+    int         line;
+    bool        end_sequence;
+
+    bool operator < (const LineRow& other) const {
+        //   At equal addresses, sort end-of-sequence rows first so a
+        // sequence starting where another one ends takes precedence
+        return addr < other.addr || (addr == other.addr && end_sequence && !other.end_sequence);
+    }
+};
+
+/// \brief Read the line tables of all CUs in \a mod, sorted by address
+std::vector<LineRow> read_line_table(Dwfl_Module* mod)
+{
+    std::vector<LineRow> rows;
+
+    Dwarf_Addr bias = 0;
+    Dwarf_Die* cu   = nullptr;
+
+    while ((cu = dwfl_module_nextcu(mod, cu, &bias)) != nullptr) {
+        size_t nlines = 0;
+
+        if (dwfl_getsrclines(cu, &nlines) != 0)
+            continue;
+
+        for (size_t i = 0; i < nlines; ++i) {
+            Dwfl_Line* line = dwfl_onesrcline(cu, i);
+
+            if (!line)
+                continue;
+
+            Dwarf_Addr  addr   = 0;
+            int         lineno = 0;
+            const char* src    = dwfl_lineinfo(line, &addr, &lineno, nullptr, nullptr, nullptr);
+
+            Dwarf_Addr  lbias  = 0;
+            Dwarf_Line* dline  = dwfl_dwarf_line(line, &lbias);
+            bool        endseq = false;
+
+            if (dline)
+                dwarf_lineendsequence(dline, &endseq);
+
+            rows.push_back(LineRow { static_cast<uint64_t>(addr), src, lineno, endseq });
+        }
+    }
+
+    std::stable_sort(rows.begin(), rows.end());
+
+    return rows;
+}
+
 } // namespace [anonymous]
 
 
@@ -42,6 +104,10 @@ struct Lookup::LookupImpl
 {
     Dwfl* dwfl { nullptr };
 
+    // offline lookups use the given modules instead of the current process's
+    bool                    offline { false };
+    std::vector<ModuleInfo> modules;
+
     Lookup::Result
     lookup(uintptr_t address, int what) {
         Result result { "UNKNOWN", "UNKNOWN", 0, "UNKNOWN", false };
@@ -54,6 +120,13 @@ struct Lookup::LookupImpl
         if (!mod)
             return result;
 
+        lookup_in_module(mod, address, what, result);
+
+        return result;
+    }
+
+    void
+    lookup_in_module(Dwfl_Module* mod, uintptr_t address, int what, Result& result) {
         result.success = true;
 
         if (what & Kind::Name)
@@ -79,31 +152,174 @@ struct Lookup::LookupImpl
             if (name)
                 result.module = name;
         }
-
-        return result;
     }
 
-    LookupImpl() {
-        Log(2).stream() << "symbollookup: Loading debug info" << std::endl;
+    /// \brief Look up the sorted addresses [\a begin, \a end) in \a mod
+    void
+    lookup_module_batch(Dwfl_Module* mod, const uint64_t* begin, const uint64_t* end, int what, Result* results) {
+        size_t num = end - begin;
 
-        dwfl = dwfl_begin(get_dwfl_callbacks());
+        if (num < LineTableWalkThreshold || !(what & (Kind::File | Kind::Line))) {
+            for (size_t i = 0; i < num; ++i)
+                lookup_in_module(mod, begin[i], what, results[i]);
 
-        if (dwfl_linux_proc_report(dwfl, getpid()) != 0) {
-            Log(0).stream() << "symbollookup: dwfl_linux_proc_report() error: "
-                            << dwfl_errmsg(dwfl_errno())
-                            << std::endl;
-            dwfl_end(dwfl);
-            dwfl = nullptr;
             return;
         }
 
-        if (dwfl_report_end(dwfl, nullptr, nullptr) != 0) {
+        // Merge the sorted addresses with the module's sorted line table
+
+        std::vector<LineRow> rows = read_line_table(mod);
+        auto row = rows.begin();
+
+        for (size_t i = 0; i < num; ++i) {
+            lookup_in_module(mod, begin[i], what & ~(Kind::File | Kind::Line), results[i]);
+
+            while (row != rows.end() && row->addr <= begin[i])
+                ++row;
+
+            if (row != rows.begin()) {
+                const LineRow& r = *(row-1);
+
+                if (!r.end_sequence && r.file) {
+                    results[i].file = r.file;
+                    results[i].line = r.line;
+                }
+            }
+        }
+    }
+
+    std::vector<Lookup::Result>
+    lookup(const std::vector<uint64_t>& addresses, int what, unsigned max_threads) {
+        std::vector<Result> results(addresses.size(), Result { "UNKNOWN", "UNKNOWN", 0, "UNKNOWN", false });
+
+        if (!dwfl || addresses.empty())
+            return results;
+
+        // Group the addresses by module
+
+        struct ModuleRange {
+            Dwfl_Module* mod;
+            size_t       begin;
+            size_t       end;
+        };
+
+        std::vector<ModuleRange> ranges;
+
+        for (size_t i = 0; i < addresses.size(); ) {
+            Dwfl_Module* mod = dwfl_addrmodule(dwfl, addresses[i]);
+
+            if (!mod) {
+                ++i;
+                continue;
+            }
+
+            Dwarf_Addr mod_end = 0;
+            dwfl_module_info(mod, nullptr, nullptr, &mod_end, nullptr, nullptr, nullptr, nullptr);
+
+            size_t j = i + 1;
+
+            while (j < addresses.size() && addresses[j] < mod_end)
+                ++j;
+
+            ranges.push_back(ModuleRange { mod, i, j });
+            i = j;
+        }
+
+        //   Do the big modules first so they don't end up last on a
+        // thread and hold up the whole batch
+        std::sort(ranges.begin(), ranges.end(), [](const ModuleRange& a, const ModuleRange& b){
+                return (a.end - a.begin) > (b.end - b.begin);
+            });
+
+        std::atomic<size_t> next(0);
+
+        //   libdwfl objects are not thread-safe, so each helper thread
+        // reports the modules into its own Dwfl object and finds its
+        // modules there by address. Modules are loaded lazily, so each
+        // module is still read by only one thread.
+        auto thread_fn = [&](Dwfl* thread_dwfl){
+                for (size_t i = next++; i < ranges.size(); i = next++) {
+                    Dwfl_Module* mod = ranges[i].mod;
+
+                    if (thread_dwfl != dwfl)
+                        mod = thread_dwfl ? dwfl_addrmodule(thread_dwfl, addresses[ranges[i].begin]) : nullptr;
+                    if (!mod)
+                        continue;
+
+                    lookup_module_batch(mod,
+                                        addresses.data() + ranges[i].begin,
+                                        addresses.data() + ranges[i].end,
+                                        what,
+                                        results.data() + ranges[i].begin);
+                }
+            };
+
+        unsigned num_threads = std::min<size_t>(std::max(max_threads, 1u), ranges.size());
+        std::vector<std::thread> threads;
+
+        for (unsigned t = 1; t < num_threads; ++t)
+            threads.emplace_back([&](){
+                    Dwfl* thread_dwfl = make_dwfl();
+                    thread_fn(thread_dwfl);
+                    dwfl_end(thread_dwfl);
+                });
+
+        thread_fn(dwfl);
+
+        for (auto& t : threads)
+            t.join();
+
+        return results;
+    }
+
+    /// \brief Create a Dwfl object with the current process's modules,
+    ///   or with \a modules for offline lookups. Returns nullptr on error.
+    Dwfl* make_dwfl() const {
+        Dwfl* ret = dwfl_begin(get_dwfl_callbacks());
+
+        if (!offline) {
+            if (dwfl_linux_proc_report(ret, getpid()) != 0) {
+                Log(0).stream() << "symbollookup: dwfl_linux_proc_report() error: "
+                                << dwfl_errmsg(dwfl_errno())
+                                << std::endl;
+                dwfl_end(ret);
+                return nullptr;
+            }
+        } else {
+            //   Report the modules like dwfl_linux_proc_report() does for a
+            // live process: libdwfl opens the ELF files by name and computes
+            // the load bias from the module start address.
+
+            dwfl_report_begin(ret);
+
+            for (const ModuleInfo& m : modules)
+                if (!dwfl_report_module(ret, m.path.c_str(), m.start, m.end))
+                    Log(1).stream() << "symbollookup: Cannot add module " << m.path << ": "
+                                    << dwfl_errmsg(dwfl_errno())
+                                    << std::endl;
+        }
+
+        if (dwfl_report_end(ret, nullptr, nullptr) != 0) {
             Log(0).stream() << "symbollookup: dwfl_report_end() error: "
                             << dwfl_errmsg(dwfl_errno())
                             << std::endl;
-            dwfl_end(dwfl);
-            dwfl = nullptr;
+            dwfl_end(ret);
+            return nullptr;
         }
+
+        return ret;
+    }
+
+    LookupImpl() {
+        Log(2).stream() << "symbollookup: Loading debug info" << std::endl;
+
+        dwfl = make_dwfl();
+    }
+
+    LookupImpl(const std::vector<ModuleInfo>& mods)
+        : offline(true), modules(mods)
+    {
+        dwfl = make_dwfl();
     }
 
     ~LookupImpl() {
@@ -118,11 +334,57 @@ Lookup::lookup(uint64_t address, int what) const
     return mP->lookup(static_cast<uintptr_t>(address), what);
 }
 
+std::vector<Lookup::Result>
+Lookup::lookup(const std::vector<uint64_t>& addresses, int what, unsigned max_threads) const
+{
+    return mP->lookup(addresses, what, max_threads);
+}
+
+std::vector<Lookup::ModuleInfo>
+Lookup::parse_module_map(const std::string& str)
+{
+    //   The module map is a ';'-separated list of "start-end path"
+    // entries with hexadecimal addresses
+
+    std::vector<ModuleInfo> modules;
+    std::string::size_type pos = 0;
+
+    while (pos < str.size()) {
+        std::string::size_type next = str.find(';', pos);
+
+        if (next == std::string::npos)
+            next = str.size();
+
+        std::string entry = str.substr(pos, next - pos);
+        pos = next + 1;
+
+        char* p = nullptr;
+        uint64_t start = std::strtoull(entry.c_str(), &p, 16);
+
+        if (*p != '-')
+            continue;
+
+        uint64_t end = std::strtoull(p + 1, &p, 16);
+
+        if (*p != ' ' || end <= start)
+            continue;
+
+        modules.push_back(ModuleInfo { start, end, std::string(p + 1) });
+    }
+
+    return modules;
+}
+
 Lookup::Lookup()
     : mP(new LookupImpl)
 {
 }
 
+Lookup::Lookup(const std::vector<ModuleInfo>& modules)
+    : mP(new LookupImpl(modules))
+{
+}
+
 Lookup::~Lookup()
 {
 }
@@ -22,6 +22,7 @@
 #include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 
 using namespace cali;
 using namespace symbollookup;
@@ -58,6 +59,17 @@ class SymbolLookup
     std::vector<std::string> m_addr_attr_names;
 
     Lookup   m_lookup;
+    unsigned m_max_threads;
+
+    // addresses collected for the batch lookup in the current flush,
+    // per symbol attribute
+    std::vector< std::shared_ptr<SymbolAttributeInfo> > m_batch_attrs;
+    std::vector< std::unordered_set<uint64_t> >        m_batch_addrs;
+    std::vector< std::unordered_set<const Node*> >     m_batch_visited;
+
+    // results of the batch lookup for the current flush
+    std::unordered_map<uint64_t, Lookup::Result> m_batch_results;
+    std::mutex m_batch_mutex;
 
     unsigned m_num_lookups;
     unsigned m_num_cached;
@@ -129,6 +141,103 @@ class SymbolLookup
             make_symbol_attributes(c, a);
     }
 
+    int lookup_kind() const {
+        int what = 0;
+
+        if (m_lookup_functions)
+            what |= Lookup::Name;
+        if (m_lookup_file || m_lookup_sourceloc)
+            what |= Lookup::File;
+        if (m_lookup_line || m_lookup_sourceloc)
+            what |= Lookup::Line;
+        if (m_lookup_mod)
+            what |= Lookup::Module;
+
+        return what;
+    }
+
+    /// \brief Start collecting the addresses of a new flush
+    void begin_batch() {
+        std::vector< std::shared_ptr<SymbolAttributeInfo> > attrs;
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_sym_attr_mutex);
+
+            for (auto& it : m_sym_attr_map)
+                attrs.push_back(it.second);
+        }
+
+        std::lock_guard<std::mutex>
+            g(m_batch_mutex);
+
+        m_batch_attrs = std::move(attrs);
+        m_batch_addrs.assign(m_batch_attrs.size(), std::unordered_set<uint64_t>());
+        m_batch_visited.assign(m_batch_attrs.size(), std::unordered_set<const Node*>());
+    }
+
+    /// \brief Collect the addresses in flushed record \a rec
+    void collect_batch(SnapshotView rec) {
+        std::lock_guard<std::mutex>
+            g(m_batch_mutex);
+
+        for (size_t i = 0; i < m_batch_attrs.size(); ++i) {
+            const Attribute& target_attr = m_batch_attrs[i]->target_attr;
+            Entry e = rec.get(target_attr);
+
+            if (e.is_reference()) {
+                //   Walk up the path; stop at nodes we've already
+                // seen in an earlier record
+                for (const Node* node = e.node(); node && m_batch_visited[i].insert(node).second; node = node->parent())
+                    if (node->attribute() == target_attr.id())
+                        m_batch_addrs[i].insert(node->data().to_uint());
+            } else if (e.is_immediate()) {
+                m_batch_addrs[i].insert(e.value().to_uint());
+            }
+        }
+    }
+
+    /// \brief Look up all collected addresses that we haven't seen
+    ///   before as one batch
+    void prepare_batch() {
+        std::unordered_set<uint64_t> addr_set;
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_batch_mutex);
+
+            for (size_t i = 0; i < m_batch_attrs.size(); ++i) {
+                SymbolAttributeInfo& sym_info = *(m_batch_attrs[i]);
+
+                std::lock_guard<std::mutex>
+                    g(sym_info.lookup_cache_mutex);
+
+                for (uint64_t addr : m_batch_addrs[i])
+                    if (sym_info.lookup_cache.count(addr) == 0)
+                        addr_set.insert(addr);
+            }
+
+            m_batch_addrs.clear();
+            m_batch_visited.clear();
+        }
+
+        if (addr_set.empty())
+            return;
+
+        std::vector<uint64_t> addrs(addr_set.begin(), addr_set.end());
+        std::sort(addrs.begin(), addrs.end());
+
+        std::vector<Lookup::Result> results = m_lookup.lookup(addrs, lookup_kind(), m_max_threads);
+
+        std::lock_guard<std::mutex>
+            g(m_batch_mutex);
+
+        m_batch_results.reserve(m_batch_results.size() + addrs.size());
+
+        for (size_t i = 0; i < addrs.size(); ++i)
+            m_batch_results.emplace(addrs[i], std::move(results[i]));
+    }
+
     Node* perform_lookup(Caliper* c, Entry e, SymbolAttributeInfo& sym_info, Node* parent) {
         if (e.empty())
             return nullptr;
@@ -148,18 +257,24 @@ class SymbolLookup
             }
         }
 
-        int what = 0;
+        Lookup::Result result;
+        bool found = false;
 
-        if (m_lookup_functions)
-            what |= Lookup::Name;
-        if (m_lookup_file || m_lookup_sourceloc)
-            what |= Lookup::File;
-        if (m_lookup_line || m_lookup_sourceloc)
-            what |= Lookup::Line;
-        if (m_lookup_mod)
-            what |= Lookup::Module;
+        {
+            std::lock_guard<std::mutex>
+                g(m_batch_mutex);
+
+            auto bit = m_batch_results.find(addr);
+
+            if (bit != m_batch_results.end()) {
+                result = bit->second;
+                found  = true;
+            }
+        }
+
+        if (!found)
+            result = m_lookup.lookup(addr, lookup_kind());
 
-        Lookup::Result result = m_lookup.lookup(addr, what);
         if (!result.success)
             ++m_num_failed;
 
@@ -265,6 +380,14 @@ class SymbolLookup
         m_num_failed  = 0;
     }
 
+    void clear_batch() {
+        std::lock_guard<std::mutex>
+            g(m_batch_mutex);
+
+        m_batch_attrs.clear();
+        m_batch_results.clear();
+    }
+
     SymbolLookup(Caliper* c, Channel* chn)
         : m_root_node(CALI_INV_ID, CALI_INV_ID, Variant()),
           m_num_lookups(0),
@@ -280,6 +403,8 @@ class SymbolLookup
             m_lookup_file      = config.get("lookup_file").to_bool();
             m_lookup_line      = config.get("lookup_line").to_bool();
             m_lookup_mod       = config.get("lookup_module").to_bool();
+
+            m_max_threads      = std::max<unsigned>(config.get("threads").to_uint(), 1);
         }
 
 public:
@@ -293,11 +418,24 @@ public:
             [instance](Caliper* c, Channel* chn, SnapshotView){
                 instance->check_attributes(c);
                 instance->init_lookup();
+                instance->begin_batch();
+            });
+        chn->events().collect_postprocess.connect(
+            [instance](Caliper* c, Channel* chn, SnapshotView rec){
+                instance->collect_batch(rec);
+            });
+        chn->events().prepare_postprocess.connect(
+            [instance](Caliper* c, Channel* chn){
+                instance->prepare_batch();
             });
         chn->events().postprocess_snapshot.connect(
             [instance](Caliper* c, Channel* chn, std::vector<Entry>& rec){
                 instance->process_snapshot(c, rec);
             });
+        chn->events().post_flush_evt.connect(
+            [instance](Caliper* c, Channel* chn, SnapshotView){
+                instance->clear_batch();
+            });
         chn->events().finish_evt.connect(
             [instance](Caliper* c, Channel* chn){
                 instance->finish_log(c, chn);
@@ -341,6 +479,11 @@ const char* SymbolLookup::s_spec = R"json(
             "description": "Perform module lookup",
             "type": "bool",
             "value": "true"
+        },
+        {   "name": "threads",
+            "description": "Max. number of threads for looking up symbols in different modules in parallel",
+            "type": "uint",
+            "value": "1"
         }
     ]
 }
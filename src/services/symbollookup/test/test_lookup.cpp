@@ -0,0 +1,195 @@
+#include "../Lookup.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+using namespace cali;
+using namespace cali::symbollookup;
+
+extern "C" {
+
+__attribute__((noinline)) int test_lookup_fn_a(int x)
+{
+    return x * 3 + 1;
+}
+
+__attribute__((noinline)) int test_lookup_fn_b(int x)
+{
+    return x * 5 + 2;
+}
+
+}
+
+namespace
+{
+
+const int What = Lookup::Name | Lookup::File | Lookup::Line | Lookup::Module;
+
+std::string get_exe_path()
+{
+    char buf[4096];
+    ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf)-1);
+
+    return std::string(buf, len > 0 ? len : 0);
+}
+
+// Build a module map for this executable from /proc/self/maps
+std::string make_exe_module_map()
+{
+    std::string exe = get_exe_path();
+    std::ifstream is("/proc/self/maps");
+    std::string line;
+
+    uint64_t start = UINT64_MAX;
+    uint64_t end   = 0;
+
+    while (std::getline(is, line)) {
+        std::string::size_type pos = line.find('/');
+
+        if (pos == std::string::npos || line.substr(pos) != exe)
+            continue;
+
+        uint64_t s = std::stoull(line.substr(0, line.find('-')), nullptr, 16);
+        uint64_t e = std::stoull(line.substr(line.find('-')+1), nullptr, 16);
+
+        start = std::min(start, s);
+        end   = std::max(end, e);
+    }
+
+    std::ostringstream os;
+    os << std::hex << start << '-' << end << ' ' << exe;
+
+    return os.str();
+}
+
+std::vector<uint64_t> get_test_addresses()
+{
+    std::vector<uint64_t> addrs {
+        reinterpret_cast<uint64_t>(&test_lookup_fn_a),
+        reinterpret_cast<uint64_t>(&test_lookup_fn_b),
+        reinterpret_cast<uint64_t>(&test_lookup_fn_a) + 1,
+        reinterpret_cast<uint64_t>(&get_exe_path)
+    };
+
+    std::sort(addrs.begin(), addrs.end());
+
+    return addrs;
+}
+
+// Addresses in this executable and in shared libraries
+std::vector<uint64_t> get_multi_module_addresses()
+{
+    std::vector<uint64_t> addrs = get_test_addresses();
+
+    for (const char* sym : { "getpid", "write", "cali_begin", "cali_end" }) {
+        void* ptr = dlsym(RTLD_DEFAULT, sym);
+
+        if (ptr)
+            addrs.push_back(reinterpret_cast<uint64_t>(ptr));
+    }
+
+    std::sort(addrs.begin(), addrs.end());
+
+    return addrs;
+}
+
+void expect_same_results(const std::vector<Lookup::Result>& a, const std::vector<Lookup::Result>& b)
+{
+    ASSERT_EQ(a.size(), b.size());
+
+    for (size_t i = 0; i < a.size(); ++i) {
+        EXPECT_EQ(a[i].success, b[i].success) << "at " << i;
+        EXPECT_EQ(a[i].name,    b[i].name)    << "at " << i;
+        EXPECT_EQ(a[i].file,    b[i].file)    << "at " << i;
+        EXPECT_EQ(a[i].line,    b[i].line)    << "at " << i;
+        EXPECT_EQ(a[i].module,  b[i].module)  << "at " << i;
+    }
+}
+
+} // namespace [anonymous]
+
+TEST(SymbolLookupTest, ParseModuleMap) {
+    auto mods = Lookup::parse_module_map("400000-401000 /usr/bin/foo;7f0010-7f2000 /lib/lib bar.so");
+
+    ASSERT_EQ(mods.size(), 2u);
+
+    EXPECT_EQ(mods[0].start, 0x400000u);
+    EXPECT_EQ(mods[0].end,   0x401000u);
+    EXPECT_EQ(mods[0].path,  std::string("/usr/bin/foo"));
+    EXPECT_EQ(mods[1].start, 0x7f0010u);
+    EXPECT_EQ(mods[1].end,   0x7f2000u);
+    EXPECT_EQ(mods[1].path,  std::string("/lib/lib bar.so"));
+
+    // malformed entries are skipped
+    mods = Lookup::parse_module_map("xyz;500-400 /bad;600-700;600+700 /bad;;800-900 /good");
+
+    ASSERT_EQ(mods.size(), 1u);
+    EXPECT_EQ(mods[0].start, 0x800u);
+    EXPECT_EQ(mods[0].path,  std::string("/good"));
+
+    EXPECT_TRUE(Lookup::parse_module_map("").empty());
+}
+
+TEST(SymbolLookupTest, BatchLookup) {
+    Lookup lookup;
+    std::vector<uint64_t> addrs = get_multi_module_addresses();
+
+    std::vector<Lookup::Result> single;
+
+    for (uint64_t addr : addrs)
+        single.push_back(lookup.lookup(addr, What));
+
+    std::map<uint64_t, std::string> names;
+
+    for (size_t i = 0; i < addrs.size(); ++i)
+        names[addrs[i]] = single[i].name;
+
+    EXPECT_EQ(names[reinterpret_cast<uint64_t>(&test_lookup_fn_a)], std::string("test_lookup_fn_a"));
+    EXPECT_EQ(names[reinterpret_cast<uint64_t>(&test_lookup_fn_b)], std::string("test_lookup_fn_b"));
+
+    // the modules are looked up in parallel with more than one thread
+    expect_same_results(lookup.lookup(addrs, What, 1), single);
+    expect_same_results(lookup.lookup(addrs, What, 4), single);
+
+    // an address outside any module
+    auto res = lookup.lookup(std::vector<uint64_t> { 8 }, What, 1);
+
+    ASSERT_EQ(res.size(), 1u);
+    EXPECT_FALSE(res[0].success);
+}
+
+TEST(SymbolLookupTest, OfflineLookup) {
+    std::string map = make_exe_module_map();
+    auto mods = Lookup::parse_module_map(map);
+
+    ASSERT_EQ(mods.size(), 1u) << map;
+
+    Lookup offline(mods);
+    Lookup live;
+
+    std::vector<uint64_t> addrs = get_test_addresses();
+
+    auto res = offline.lookup(addrs, What, 2);
+
+    ASSERT_EQ(res.size(), addrs.size());
+
+    for (size_t i = 0; i < addrs.size(); ++i) {
+        Lookup::Result exp = live.lookup(addrs[i], Lookup::Name | Lookup::File | Lookup::Line);
+
+        EXPECT_TRUE(res[i].success);
+        EXPECT_EQ(res[i].name, exp.name);
+        EXPECT_EQ(res[i].file, exp.file);
+        EXPECT_EQ(res[i].line, exp.line);
+    }
+}
@@ -3,15 +3,20 @@
 
 #include "caliper/CaliperService.h"
 
+#include "../Services.h"
 #include "../util/ChannelList.hpp"
 
 #include "caliper/Caliper.h"
 
 #include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
 
 #include <gotcha/gotcha.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <vector>
 
@@ -49,23 +54,200 @@ struct gotcha_binding_t alloc_bindings[] = {
 
 ChannelList* sysalloc_channels = nullptr;
 
+//
+// --- Allocation sampling
+//
+//   With a sample interval T > 0, each thread counts down a random
+// number of allocated bytes drawn from an exponential distribution with
+// mean T, and an allocation is tracked when the countdown expires during
+// it. This samples a Poisson process over the allocated bytes (as in
+// tcmalloc's heap profiler): an allocation of s bytes is tracked with
+// probability p = 1 - exp(-s/T). Tracked allocations carry the weight
+// 1/p in the alloc.sample_weight attribute, which the alloc service
+// uses to scale its size and high-water mark outputs.
+//
+//   All sampler state must be POD, for the same reason as the
+// ChannelList above. The thread-local sampler state uses the
+// initial-exec TLS model so that accessing it from the malloc wrapper
+// never allocates (and recurses into the wrapper) in a dlopen'ed
+// libcaliper.
+//
+
+uint64_t  sample_interval = 0;
+Attribute sample_weight_attr;
+
+struct ThreadSampler {
+    int64_t  bytes_until_sample;
+    uint64_t rng;
+};
 
-void* cali_malloc_wrapper(size_t size)
+#if defined(__GNUC__)
+__attribute__((tls_model("initial-exec")))
+#endif
+thread_local ThreadSampler t_sampler = { 0, 0 };
+
+std::atomic<uint64_t> sampler_seed     { 0 };
+std::atomic<uint64_t> num_sampled      { 0 };
+std::atomic<uint64_t> num_set_full     { 0 };
+
+inline uint64_t
+splitmix64(uint64_t x)
 {
-    decltype(&std::malloc) orig_malloc =
-        reinterpret_cast<decltype(&std::malloc)>(gotcha_get_wrappee(orig_malloc_handle));
+    x += 0x9E3779B97F4A7C15ull;
+    x  = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x  = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
 
-    void *ret = (*orig_malloc)(size);
+inline int64_t
+next_sample_countdown(ThreadSampler& s)
+{
+    // xorshift64
+    s.rng ^= s.rng << 13;
+    s.rng ^= s.rng >> 7;
+    s.rng ^= s.rng << 17;
 
-    int saved_errno = errno;
+    // uniform in (0,1]
+    double u = (static_cast<double>(s.rng >> 11) + 1.0) / 9007199254740992.0;
+
+    return std::max<int64_t>(static_cast<int64_t>(-std::log(u) * static_cast<double>(sample_interval)), 1);
+}
+
+/// \brief Decide if an allocation of \a size bytes is tracked, and
+///   compute its sample weight
+inline bool
+sample_allocation(size_t size, double* weight)
+{
+    ThreadSampler& s = t_sampler;
+
+    if (s.rng == 0) {
+        s.rng = splitmix64(++sampler_seed ^ reinterpret_cast<uintptr_t>(&s)) | 1;
+        s.bytes_until_sample = next_sample_countdown(s);
+    }
+
+    s.bytes_until_sample -= static_cast<int64_t>(size);
+
+    if (s.bytes_until_sample > 0)
+        return false;
+
+    s.bytes_until_sample = next_sample_countdown(s);
+    *weight = 1.0 / -std::expm1(-static_cast<double>(size) / static_cast<double>(sample_interval));
+
+    ++num_sampled;
+
+    return true;
+}
+
+//
+//   A lock-free set of the addresses of tracked allocations. Frees of
+// untracked addresses can skip the alloc service entirely. The set is
+// global rather than per-thread because memory can be freed on a
+// different thread than it was allocated on. If an allocation's probe
+// sequence is full, the allocation is not tracked at all, so a free of an
+// address that is not in the set is never for a tracked allocation.
+//
+
+const size_t SampledSetSize   = 1 << 16;
+const size_t SampledSetProbes = 8;
+
+std::atomic<uintptr_t> sampled_set[SampledSetSize];
+
+inline size_t
+sampled_set_index(uintptr_t addr)
+{
+    return static_cast<size_t>((static_cast<uint64_t>(addr) * 0x9E3779B97F4A7C15ull) >> 48);
+}
+
+/// \brief Add \a ptr to the set. Returns false if the set is full.
+bool
+sampled_set_add(const void* ptr)
+{
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    size_t    idx  = sampled_set_index(addr);
+
+    for (size_t i = 0; i < SampledSetProbes; ++i) {
+        std::atomic<uintptr_t>& slot = sampled_set[(idx + i) & (SampledSetSize - 1)];
+        uintptr_t expected = 0;
+
+        if (slot.load(std::memory_order_relaxed) == 0 && slot.compare_exchange_strong(expected, addr, std::memory_order_relaxed))
+            return true;
+    }
+
+    return false;
+}
+
+/// \brief Remove \a ptr from the set. Returns false if \a ptr is
+///   not a tracked allocation.
+bool
+sampled_set_remove(const void* ptr)
+{
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    size_t    idx  = sampled_set_index(addr);
+
+    for (size_t i = 0; i < SampledSetProbes; ++i) {
+        std::atomic<uintptr_t>& slot = sampled_set[(idx + i) & (SampledSetSize - 1)];
+        uintptr_t expected = addr;
+
+        if (slot.load(std::memory_order_relaxed) == addr && slot.compare_exchange_strong(expected, 0, std::memory_order_relaxed))
+            return true;
+    }
+
+    return false;
+}
+
+void
+track_allocation(void* ptr, const char* label, size_t elem_size, size_t count)
+{
+    double weight = 1.0;
+
+    if (sample_interval > 0) {
+        if (!ptr || !sample_allocation(elem_size * count, &weight))
+            return;
+
+        if (!sampled_set_add(ptr)) {
+            ++num_set_full;
+            return;
+        }
+    }
+
+    Variant v_weight(weight);
 
     for (ChannelList* p = sysalloc_channels; p; p = p->next) {
         Caliper c = Caliper::sigsafe_instance(); // prevent reentry
 
+        if (c && p->channel->is_active()) {
+            if (sample_interval > 0)
+                c.memory_region_begin(p->channel, ptr, label, elem_size, 1, &count, 1, &sample_weight_attr, &v_weight);
+            else
+                c.memory_region_begin(p->channel, ptr, label, elem_size, 1, &count);
+        }
+    }
+}
+
+void
+untrack_allocation(void* ptr)
+{
+    if (sample_interval > 0 && (!ptr || !sampled_set_remove(ptr)))
+        return;
+
+    for (ChannelList* p = sysalloc_channels; p; p = p->next) {
+        Caliper c = Caliper::sigsafe_instance();
+
         if (c && p->channel->is_active())
-            c.memory_region_begin(p->channel, ret, "malloc", 1, 1, &size);
+            c.memory_region_end(p->channel, ptr);
     }
+}
+
 
+void* cali_malloc_wrapper(size_t size)
+{
+    decltype(&std::malloc) orig_malloc =
+        reinterpret_cast<decltype(&std::malloc)>(gotcha_get_wrappee(orig_malloc_handle));
+
+    void *ret = (*orig_malloc)(size);
+
+    int saved_errno = errno;
+    track_allocation(ret, "malloc", 1, size);
     errno = saved_errno;
 
     return ret;
@@ -79,14 +261,7 @@ void* cali_calloc_wrapper(size_t num, size_t size)
     void *ret = (*orig_calloc)(num, size);
 
     int saved_errno = errno;
-
-    for (ChannelList* p = sysalloc_channels; p; p = p->next) {
-        Caliper c = Caliper::sigsafe_instance(); // prevent reentry
-
-        if (c && p->channel->is_active())
-            c.memory_region_begin(p->channel, ret, "calloc", size, 1, &num);
-    }
-
+    track_allocation(ret, "calloc", size, num);
     errno = saved_errno;
 
     return ret;
@@ -97,24 +272,12 @@ void* cali_realloc_wrapper(void *ptr, size_t size)
     decltype(&std::realloc) orig_realloc =
         reinterpret_cast<decltype(&std::realloc)>(gotcha_get_wrappee(orig_realloc_handle));
 
-    for (ChannelList* p = sysalloc_channels; p; p = p->next) {
-        Caliper c = Caliper::sigsafe_instance();
-
-        if (c && p->channel->is_active())
-            c.memory_region_end(p->channel, ptr);
-    }
+    untrack_allocation(ptr);
 
     void *ret = (*orig_realloc)(ptr, size);
 
     int saved_errno = errno;
-
-    for (ChannelList* p = sysalloc_channels; p; p = p->next) {
-        Caliper c = Caliper::sigsafe_instance();
-
-        if (c && p->channel->is_active())
-            c.memory_region_begin(p->channel, ret, "realloc", 1, 1, &size);
-    }
-
+    track_allocation(ret, "realloc", 1, size);
     errno = saved_errno;
 
     return ret;
@@ -125,12 +288,7 @@ void cali_free_wrapper(void *ptr)
     decltype(&std::free) orig_free =
         reinterpret_cast<decltype(&std::free)>(gotcha_get_wrappee(orig_free_handle));
 
-    for (ChannelList* p = sysalloc_channels; p; p = p->next) {
-        Caliper c = Caliper::sigsafe_instance();
-
-        if (c && p->channel->is_active())
-            c.memory_region_end(p->channel, ptr);
-    }
+    untrack_allocation(ptr);
 
     (*orig_free)(ptr);
 }
@@ -171,17 +329,64 @@ void clear_alloc_hooks()
 }
 #endif
 
+const char* spec = R"json(
+    {   "name"        : "sysalloc",
+        "description" : "Wrap system memory allocation calls and track allocations with the alloc service",
+        "config"      : [
+            {   "name"        : "sample_interval",
+                "type"        : "uint",
+                "description" : "Track only a sample of the allocations, one per given number of allocated bytes on average. 0 tracks all allocations.",
+                "value"       : "0"
+            }
+        ]
+    }
+)json";
+
 void sysalloc_initialize(Caliper* c, Channel* chn) {
+    ConfigSet cfg = services::init_config_from_spec(chn->config(), spec);
+    uint64_t interval = cfg.get("sample_interval").to_uint();
+
     chn->events().post_init_evt.connect(
-        [](Caliper* c, Channel* chn){
-            if (!bindings_are_active)
+        [interval](Caliper* c, Channel* chn){
+            //   The wrappers and the sampling decision are global, so the
+            // first channel's sample interval applies to all channels
+            if (!bindings_are_active) {
+                sample_interval = interval;
+
+                if (sample_interval > 0) {
+                    // the alloc service owns the sample weight attribute
+                    sample_weight_attr = c->get_attribute("alloc.sample_weight");
+
+                    if (!sample_weight_attr) {
+                        Log(0).stream() << chn->name() << ": sysalloc: Allocation sampling requires the alloc service,"
+                                        << " tracking all allocations" << std::endl;
+                        sample_interval = 0;
+                    }
+                }
+
+                if (sample_interval > 0) {
+                    Log(1).stream() << chn->name() << ": sysalloc: Sampling allocations every "
+                                    << sample_interval << " bytes on average" << std::endl;
+                }
+
                 init_alloc_hooks();
+            } else if (interval != sample_interval) {
+                Log(0).stream() << chn->name() << ": sysalloc: Sample interval " << interval
+                                << " differs from the active interval " << sample_interval
+                                << ", using " << sample_interval << std::endl;
+            }
 
             ChannelList::add(&sysalloc_channels, chn);
         });
 
     chn->events().finish_evt.connect(
         [](Caliper* c, Channel* chn){
+            if (sample_interval > 0)
+                Log(1).stream() << chn->name() << ": sysalloc: "
+                                << num_sampled.load() << " allocations sampled, "
+                                << num_set_full.load() << " samples dropped (address set full)"
+                                << std::endl;
+
             Log(2).stream() << chn->name() << ": Removing sysalloc hooks" << std::endl;
             ChannelList::remove(&sysalloc_channels, chn);
         });
@@ -195,6 +400,6 @@ void sysalloc_initialize(Caliper* c, Channel* chn) {
 namespace cali
 {
 
-CaliperService sysalloc_service { "sysalloc", ::sysalloc_initialize };
+CaliperService sysalloc_service { ::spec, ::sysalloc_initialize };
 
 }
@@ -14,40 +14,216 @@
 #include "caliper/common/RuntimeConfig.h"
 #include "caliper/common/Log.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
-#include <map>
 #include <mutex>
 #include <ratio>
 #include <string>
 #include <type_traits>
 #include <vector>
 
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define CALI_TIMER_HAVE_TSC
+#endif
+
 using namespace cali;
 using namespace std;
 
 namespace
 {
 
+/// \brief Reads the clock selected for a timer service instance
+///
+/// Returns nanoseconds since the clock was initialized. The \c tsc and
+/// \c tscp sources read the CPU timestamp counter and convert ticks with
+/// a factor calibrated against CLOCK_MONOTONIC at startup. They require
+/// an invariant TSC (i.e., one that runs at a constant rate in all
+/// power states); without one, the clock falls back to \c monotonic.
+/// Even an invariant TSC is not necessarily synchronized across sockets,
+/// so a reading can be earlier than a previous one taken on another CPU.
+/// now() returns 0 for readings before the start time, and the timer
+/// service keeps each thread's timestamps from going backwards.
+class Clock
+{
+public:
+
+    enum Source {
+        Steady, Monotonic, MonotonicCoarse, TSC, TSCP
+    };
+
+private:
+
+    Source   m_source;
+    uint64_t m_start;
+    double   m_ns_per_tick;
+
+    using steady_clock = std::chrono::steady_clock;
+
+    static uint64_t read_timespec(clockid_t id) {
+        struct timespec ts;
+        clock_gettime(id, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    uint64_t read_raw() const {
+        switch (m_source) {
+        case Monotonic:
+            return read_timespec(CLOCK_MONOTONIC);
+#ifdef CLOCK_MONOTONIC_COARSE
+        case MonotonicCoarse:
+            return read_timespec(CLOCK_MONOTONIC_COARSE);
+#endif
+#ifdef CALI_TIMER_HAVE_TSC
+        case TSC:
+            return __rdtsc();
+        case TSCP:
+        {
+            unsigned int aux;
+            return __rdtscp(&aux);
+        }
+#endif
+        default:
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(steady_clock::now().time_since_epoch()).count();
+        }
+    }
+
+    static bool have_invariant_tsc() {
+#ifdef CALI_TIMER_HAVE_TSC
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+        if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+            return false;
+
+        __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+
+        return (edx & (1u << 8)) != 0;
+#else
+        return false;
+#endif
+    }
+
+    /// \brief Measure the TSC frequency against CLOCK_MONOTONIC
+    void calibrate() {
+        const uint64_t interval_ns = 10000000; // 10 msec
+
+        uint64_t t0   = read_timespec(CLOCK_MONOTONIC);
+        uint64_t tsc0 = read_raw();
+        uint64_t t1   = t0;
+
+        while (t1 - t0 < interval_ns)
+            t1 = read_timespec(CLOCK_MONOTONIC);
+
+        uint64_t tsc1 = read_raw();
+
+        m_ns_per_tick = static_cast<double>(t1 - t0) / static_cast<double>(tsc1 - tsc0);
+    }
+
+public:
+
+    Clock()
+        : m_source(Steady), m_start(0), m_ns_per_tick(1.0)
+        { }
+
+    /// \brief Select the clock source \a name and initialize the clock.
+    ///   Returns an error message if \a name is invalid or not available
+    ///   on this system.
+    std::string init(const std::string& name) {
+        std::string msg;
+
+        if (name == "steady") {
+            m_source = Steady;
+        } else if (name == "monotonic") {
+            m_source = Monotonic;
+        } else if (name == "monotonic_coarse") {
+#ifdef CLOCK_MONOTONIC_COARSE
+            m_source = MonotonicCoarse;
+#else
+            m_source = Monotonic;
+            msg = "CLOCK_MONOTONIC_COARSE is not available, using monotonic";
+#endif
+        } else if (name == "tsc" || name == "tscp") {
+            if (have_invariant_tsc()) {
+                m_source = (name == "tsc" ? TSC : TSCP);
+                calibrate();
+            } else {
+                m_source = Monotonic;
+                msg = "No invariant TSC, using monotonic";
+            }
+        } else {
+            m_source = Steady;
+            msg = std::string("Unknown clock source \"") + name + "\", using steady";
+        }
+
+        m_start = read_raw();
+
+        return msg;
+    }
+
+    Source source() const {
+        return m_source;
+    }
+
+    double ns_per_tick() const {
+        return m_ns_per_tick;
+    }
+
+    /// \brief Return the nanoseconds since init()
+    uint64_t now() const {
+        uint64_t raw = read_raw();
+
+        if (raw < m_start)
+            return 0;
+
+        uint64_t t = raw - m_start;
+
+        if (m_source == TSC || m_source == TSCP)
+            t = static_cast<uint64_t>(static_cast<double>(t) * m_ns_per_tick);
+
+        return t;
+    }
+};
+
 class TimerService
 {
+    //   Inclusive timers: each thread keeps a fixed-size timestamp stack
+    // for each attribute that triggers begin/end events. Attributes get
+    // a dense slot index the first time they are seen.
+    static constexpr int MaxSlots = 16;
+    static constexpr int MaxDepth = 128;
+
+    static constexpr int MaxCachedChannels = 16;
+
     //   This keeps per-thread per-channel timer data, which we can look up
     // on the thread-local blackboard
     struct TimerInfo {
         // The timestamp of the last snapshot on this channel+thread
         uint64_t prev_snapshot_timestamp;
 
-        // A per-attribute stack of timestamps for computing inclusive times
-        std::map< cali_id_t, std::vector<uint64_t> > inclusive_timer_stack;
+        // Per-slot stacks of begin timestamps for computing inclusive
+        // times. The depth keeps counting past MaxDepth so begin/end
+        // stay balanced, but those levels don't get a timestamp.
+        unsigned depth[MaxSlots];
+        uint64_t inclusive_timer_stack[MaxSlots][MaxDepth];
 
         TimerInfo()
             : prev_snapshot_timestamp(0)
-        { }
+        {
+            std::fill_n(depth, MaxSlots, 0u);
+        }
     };
 
-    using clock = std::chrono::steady_clock;
+    //   Per-thread shortcut to the TimerInfo objects, indexed by channel
+    // id. Avoids the blackboard lookup in the common case. Channel ids
+    // are not reused, so an entry can't refer to another channel's data.
+    static thread_local TimerInfo* sT_info[MaxCachedChannels];
 
-    chrono::time_point<clock> tstart;
+    Clock     clock;
 
     Attribute timeoffs_attr  { Attribute::invalid } ;
     Attribute timerinfo_attr { Attribute::invalid } ;
@@ -65,9 +241,31 @@ class TimerService
     Attribute begin_evt_attr { Attribute::invalid };
     Attribute end_evt_attr   { Attribute::invalid };
 
-    int       n_stack_errors { 0 };
+    // time since a deferred sample was taken, set by the sampler
+    Attribute sample_delay_attr { Attribute::invalid };
+
+    // attribute ids of the inclusive timer slots
+    std::atomic<cali_id_t> slot_attr_ids[MaxSlots];
+
+    std::atomic<int> n_stack_errors    { 0 };
+    std::atomic<int> n_stack_overflows { 0 };
+    std::atomic<int> n_clock_backsteps { 0 };
+
+    /// \brief Count an inclusive time we can't record, and warn the
+    ///   first time it happens
+    void stack_overflow(Channel* chn) {
+        if (n_stack_overflows++ == 0)
+            Log(0).stream() << chn->name() << ": timer: Warning: more than " << MaxSlots
+                            << " begin/end attributes or " << MaxDepth
+                            << " nesting levels, skipping some inclusive times" << std::endl;
+    }
+
+    TimerInfo* acquire_timerinfo(Caliper* c, Channel* chn) {
+        cali_id_t chn_id = chn->id();
+
+        if (chn_id < MaxCachedChannels && sT_info[chn_id])
+            return sT_info[chn_id];
 
-    TimerInfo* acquire_timerinfo(Caliper* c) {
         TimerInfo* ti =
             static_cast<TimerInfo*>(c->get(timerinfo_attr).value().get_ptr());
 
@@ -82,16 +280,56 @@ class TimerService
             info_obj_list.push_back(ti);
         }
 
+        if (ti && chn_id < MaxCachedChannels)
+            sT_info[chn_id] = ti;
+
         return ti;
     }
 
+    /// \brief Find or assign the inclusive timer slot for attribute \a id.
+    ///   Returns -1 if all slots are taken.
+    int find_slot(cali_id_t id) {
+        for (int i = 0; i < MaxSlots; ++i) {
+            cali_id_t slot_id = slot_attr_ids[i].load(std::memory_order_relaxed);
+
+            if (slot_id == id)
+                return i;
+            if (slot_id == CALI_INV_ID) {
+                if (slot_attr_ids[i].compare_exchange_strong(slot_id, id))
+                    return i;
+                if (slot_id == id) // another thread took it for the same attribute
+                    return i;
+            }
+        }
+
+        return -1;
+    }
+
     void snapshot_cb(Caliper* c, Channel* chn, SnapshotView info, SnapshotBuilder& rec) {
-        auto now = clock::now();
-        uint64_t nsec = chrono::duration_cast<chrono::nanoseconds>(now - tstart).count();
+        uint64_t nsec = clock.now();
 
-        rec.append(offset_attr, Variant(nsec));
+        TimerInfo* ti = acquire_timerinfo(c, chn);
+
+        //   Backdate deferred samples to the time they were taken, but
+        // not before the previous snapshot on this thread
+        if (sample_delay_attr && !info.empty()) {
+            Entry e = info.get(sample_delay_attr);
 
-        TimerInfo* ti = acquire_timerinfo(c);
+            if (!e.empty()) {
+                uint64_t delay = e.value().to_uint();
+                uint64_t prev  = ti ? ti->prev_snapshot_timestamp : 0;
+
+                nsec = nsec > prev + delay ? nsec - delay : std::min(prev, nsec);
+            }
+        }
+
+        // the clock may step back when a thread moves to a CPU with an unsynchronized TSC
+        if (ti && nsec < ti->prev_snapshot_timestamp) {
+            ++n_clock_backsteps;
+            nsec = ti->prev_snapshot_timestamp;
+        }
+
+        rec.append(offset_attr, Variant(nsec));
 
         if (!ti)
             return;
@@ -107,22 +345,36 @@ class TimerService
             if (event.empty())
                 return;
 
-            cali_id_t evt_attr_id = event.value().to_id();
+            int slot = find_slot(event.value().to_id());
+
+            if (slot < 0) {
+                if (event.attribute() == begin_evt_attr.id())
+                    stack_overflow(chn);
+                return;
+            }
+
+            unsigned& depth = ti->depth[slot];
 
             if (event.attribute() == begin_evt_attr.id()) {
                 // begin event: push current timestamp onto the inclusive timer stack
-                ti->inclusive_timer_stack[evt_attr_id].push_back(nsec);
+                if (depth < MaxDepth)
+                    ti->inclusive_timer_stack[slot][depth] = nsec;
+                else
+                    stack_overflow(chn);
+
+                ++depth;
             } else if (event.attribute() == end_evt_attr.id()) {
                 // end event: fetch begin timestamp from inclusive timer stack
-                auto stack_it = ti->inclusive_timer_stack.find(evt_attr_id);
-
-                if (stack_it == ti->inclusive_timer_stack.end() || stack_it->second.empty()) {
+                if (depth == 0) {
                     ++n_stack_errors;
                     return;
                 }
 
-                rec.append(inclusive_duration_attr, cali_make_variant_from_uint(nsec - stack_it->second.back()));
-                stack_it->second.pop_back();
+                --depth;
+
+                if (depth < MaxDepth)
+                    rec.append(inclusive_duration_attr,
+                               cali_make_variant_from_uint(nsec - ti->inclusive_timer_stack[slot][depth]));
             }
         }
     }
@@ -133,6 +385,8 @@ class TimerService
         begin_evt_attr = c->get_attribute("cali.event.begin");
         end_evt_attr   = c->get_attribute("cali.event.end");
 
+        sample_delay_attr = c->get_attribute("cali.sampler.delay");
+
         if (begin_evt_attr == Attribute::invalid || end_evt_attr == Attribute::invalid) {
             if (record_inclusive_duration)
                 Log(1).stream() << chn->name() << ": Timestamp: Note: event trigger attributes not registered,\n"
@@ -142,7 +396,7 @@ class TimerService
         }
 
         // Initialize timer info on this thread
-        acquire_timerinfo(c);
+        acquire_timerinfo(c, chn);
     }
 
     void finish_cb(Caliper*, Channel* chn) {
@@ -151,14 +405,40 @@ class TimerService
                             << n_stack_errors
                             << " inclusive time stack errors!"
                             << std::endl;
+        if (n_stack_overflows > 0)
+            Log(0).stream() << chn->name() << ": timestamp: Skipped "
+                            << n_stack_overflows
+                            << " inclusive times (more than " << MaxSlots << " attributes or "
+                            << MaxDepth << " nesting levels)"
+                            << std::endl;
+        if (n_clock_backsteps > 0)
+            Log(1).stream() << chn->name() << ": timestamp: Clock went backwards "
+                            << n_clock_backsteps
+                            << " times, check if the TSC is synchronized"
+                            << std::endl;
+
+        cali_id_t chn_id = chn->id();
+
+        if (chn_id < MaxCachedChannels)
+            sT_info[chn_id] = nullptr;
     }
 
     TimerService(Caliper* c, Channel* chn)
-        : tstart(clock::now())
         {
             ConfigSet config = services::init_config_from_spec(chn->config(), s_spec);
             record_inclusive_duration = config.get("inclusive_duration").to_bool();
 
+            for (int i = 0; i < MaxSlots; ++i)
+                slot_attr_ids[i].store(CALI_INV_ID);
+
+            std::string msg = clock.init(config.get("clock").to_string());
+
+            if (!msg.empty())
+                Log(0).stream() << chn->name() << ": timer: " << msg << std::endl;
+            if (clock.source() == Clock::TSC || clock.source() == Clock::TSCP)
+                Log(2).stream() << chn->name() << ": timer: TSC frequency "
+                                << 1.0 / clock.ns_per_tick() << " GHz" << std::endl;
+
             Attribute unit_attr =
                 c->create_attribute("time.unit", CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
             Variant   nsec_val  = Variant("nsec");
@@ -211,8 +491,8 @@ public:
                 instance->post_init_cb(c, chn);
             });
         chn->events().create_thread_evt.connect(
-            [instance](Caliper* c, Channel*){
-                instance->acquire_timerinfo(c);
+            [instance](Caliper* c, Channel* chn){
+                instance->acquire_timerinfo(c, chn);
             });
         chn->events().snapshot.connect(
             [instance](Caliper* c, Channel* chn, SnapshotView info, SnapshotBuilder& rec){
@@ -237,11 +517,18 @@ const char* TimerService::s_spec = R"json(
             "description": "Record inclusive duration of begin/end regions",
             "type": "bool",
             "value": "false"
+        },
+        {   "name": "clock",
+            "description": "Clock source: steady, monotonic, monotonic_coarse, tsc, or tscp",
+            "type": "string",
+            "value": "steady"
         }
     ]
 }
 )json";
 
+thread_local TimerService::TimerInfo* TimerService::sT_info[TimerService::MaxCachedChannels] = { nullptr };
+
 const char* timestamp_spec = R"json(
 {   "name": "timestamp",
     "description": "Deprecated name for 'timer' service"
@@ -0,0 +1,194 @@
+// Tests for the timer service
+
+#include "caliper/cali.h"
+#include "caliper/Caliper.h"
+
+#include "caliper/common/Node.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+struct TimerRecord {
+    bool     has_offset;
+    bool     has_duration;
+    bool     has_inclusive;
+    uint64_t offset;
+    uint64_t duration;
+    uint64_t inclusive;
+};
+
+std::vector<TimerRecord> flush_timer_records(Caliper& c, Channel* chn)
+{
+    Attribute offs_attr = c.get_attribute("time.offset.ns");
+    Attribute dur_attr  = c.get_attribute("time.duration.ns");
+    Attribute incl_attr = c.get_attribute("time.inclusive.duration.ns");
+
+    std::vector<TimerRecord> ret;
+
+    c.flush(chn, SnapshotView(), [&](CaliperMetadataAccessInterface&, const std::vector<Entry>& rec){
+            TimerRecord r { false, false, false, 0, 0, 0 };
+
+            for (const Entry& e : rec) {
+                if (e.attribute() == offs_attr.id()) {
+                    r.has_offset = true;
+                    r.offset     = e.value().to_uint();
+                } else if (e.attribute() == dur_attr.id()) {
+                    r.has_duration = true;
+                    r.duration     = e.value().to_uint();
+                } else if (e.attribute() == incl_attr.id()) {
+                    r.has_inclusive = true;
+                    r.inclusive     = e.value().to_uint();
+                }
+            }
+
+            ret.push_back(r);
+        });
+
+    c.clear(chn);
+
+    return ret;
+}
+
+} // namespace [anonymous]
+
+TEST(TimerServiceTest, ClockSources)
+{
+    for (const char* clock : { "steady", "monotonic", "monotonic_coarse", "tsc", "tscp" }) {
+        SCOPED_TRACE(clock);
+
+        cali_id_t chn_id =
+            cali::create_channel((std::string("timer.test.") + clock).c_str(), 0, {
+                    { "CALI_SERVICES_ENABLE", "event,timer,trace" },
+                    { "CALI_TIMER_INCLUSIVE_DURATION", "true" },
+                    { "CALI_TIMER_CLOCK", clock }
+                });
+
+        Caliper  c;
+        Channel* chn = c.get_channel(chn_id);
+
+        ASSERT_NE(chn, nullptr);
+
+        Attribute attr =
+            c.create_attribute(std::string("timer.test.clock.") + clock, CALI_TYPE_INT, CALI_ATTR_NESTED);
+
+        for (int i = 0; i < 4; ++i) {
+            c.begin(attr, Variant(i));
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            c.end(attr);
+        }
+
+        std::vector<TimerRecord> recs = flush_timer_records(c, chn);
+
+        ASSERT_EQ(recs.size(), 8u);
+
+        uint64_t prev = 0;
+        int num_inclusive = 0;
+
+        for (const TimerRecord& r : recs) {
+            ASSERT_TRUE(r.has_offset);
+            ASSERT_TRUE(r.has_duration);
+
+            // timestamps don't go backwards, and the durations add up
+            EXPECT_GE(r.offset, prev);
+            EXPECT_EQ(r.duration, r.offset - prev);
+
+            if (r.has_inclusive) {
+                ++num_inclusive;
+                // the coarse clock may be a few milliseconds off
+                EXPECT_GE(r.inclusive,  5000000u);
+                EXPECT_LT(r.inclusive, 10000000000u);
+            }
+
+            prev = r.offset;
+        }
+
+        EXPECT_EQ(num_inclusive, 4);
+
+        c.delete_channel(chn);
+    }
+}
+
+TEST(TimerServiceTest, InclusiveStackOverflow)
+{
+    cali_id_t chn_id =
+        cali::create_channel("timer.test.overflow", 0, {
+                { "CALI_SERVICES_ENABLE", "event,timer,trace" },
+                { "CALI_TIMER_INCLUSIVE_DURATION", "true" }
+            });
+
+    Caliper  c;
+    Channel* chn = c.get_channel(chn_id);
+
+    ASSERT_NE(chn, nullptr);
+
+    // more nesting levels than the inclusive timer stack holds
+
+    Attribute deep_attr =
+        c.create_attribute("timer.test.deep", CALI_TYPE_INT, CALI_ATTR_NESTED);
+
+    const int depth = 200;
+
+    for (int i = 0; i < depth; ++i)
+        c.begin(deep_attr, Variant(i));
+    for (int i = 0; i < depth; ++i)
+        c.end(deep_attr);
+
+    std::vector<TimerRecord> recs = flush_timer_records(c, chn);
+
+    ASSERT_EQ(recs.size(), 2u * depth);
+
+    int num_inclusive = 0;
+
+    for (const TimerRecord& r : recs)
+        if (r.has_inclusive)
+            ++num_inclusive;
+
+    EXPECT_EQ(num_inclusive, 128);
+
+    // begin/end stay balanced after the overflow
+
+    c.begin(deep_attr, Variant(-1));
+    c.end(deep_attr);
+
+    recs = flush_timer_records(c, chn);
+
+    ASSERT_EQ(recs.size(), 2u);
+    EXPECT_TRUE(recs[1].has_inclusive);
+
+    // more begin/end attributes than there are inclusive timer slots
+
+    std::vector<Attribute> attrs;
+
+    for (int i = 0; i < 20; ++i)
+        attrs.push_back(c.create_attribute(std::string("timer.test.attr.") + std::to_string(i),
+                                           CALI_TYPE_INT, CALI_ATTR_DEFAULT));
+
+    for (const Attribute& attr : attrs)
+        c.begin(attr, Variant(1));
+    for (auto it = attrs.rbegin(); it != attrs.rend(); ++it)
+        c.end(*it);
+
+    recs = flush_timer_records(c, chn);
+
+    ASSERT_EQ(recs.size(), 40u);
+
+    num_inclusive = 0;
+
+    for (const TimerRecord& r : recs)
+        if (r.has_inclusive)
+            ++num_inclusive;
+
+    // timer.test.deep took the first slot
+    EXPECT_EQ(num_inclusive, 15);
+
+    c.delete_channel(chn);
+}
@@ -14,14 +14,24 @@
 #include "caliper/SnapshotRecord.h"
 
 #include "caliper/common/Log.h"
+#include "caliper/common/OutputStream.h"
 #include "caliper/common/RuntimeConfig.h"
 
+#include "caliper/reader/CaliWriter.h"
+
+#include "../../common/util/file_util.h"
 #include "../../common/util/spinlock.hpp"
 #include "../../common/util/unitfmt.h"
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 using namespace trace;
 using namespace cali;
@@ -32,13 +42,17 @@ namespace
 class Trace
 {
     enum   BufferPolicy {
-        Flush, Grow, Stop
+        Flush, Grow, Stop, Async
     };
 
     struct TraceBuffer {
         std::atomic<bool>  stopped;
         std::atomic<bool>  retired;
 
+        //   Protects the chunks pointer. Only contended while a flush
+        // swaps the chunk list out.
+        ::util::spinlock     lock;
+
         TraceBufferChunk*  chunks;
         TraceBuffer*       next;
         TraceBuffer*       prev;
@@ -62,7 +76,7 @@ class Trace
     BufferPolicy   policy            = BufferPolicy::Grow;
     size_t         buffersize        = 2 * 1024 * 1024;
 
-    size_t         dropped_snapshots = 0;
+    std::atomic<size_t> dropped_snapshots;
 
     unsigned       num_acquired      = 0;
     unsigned       num_released      = 0;
@@ -71,10 +85,40 @@ class Trace
     Attribute      tbuf_attr;
 
     TraceBuffer*   tbuf_list = nullptr;
-    util::spinlock tbuf_lock;
+    ::util::spinlock tbuf_lock;
 
     std::mutex     flush_lock;
 
+    //   Async writer: full chunk lists are handed off to a background
+    // thread, which writes them to a .cali stream. Application threads
+    // continue recording into fresh chunks.
+
+    struct AsyncWriter {
+        std::string             filename;
+        CaliWriter::Format      format       = CaliWriter::Text;
+        size_t                  max_queue    = 16;
+
+        std::mutex              lock;
+        std::condition_variable cv;
+
+        std::deque<TraceBufferChunk*>  queue;
+        std::vector<TraceBufferChunk*> free_chunks;
+
+        bool                    stop         = false;
+        std::vector<Entry>      globals;
+
+        // statistics (protected by lock)
+        size_t                  chunks_queued  = 0;
+        size_t                  chunks_written = 0;
+        size_t                  records_written = 0;
+        size_t                  queue_highwater = 0;
+        size_t                  queue_full     = 0;
+
+        std::thread             thread;
+    };
+
+    std::unique_ptr<AsyncWriter> async;
+
     TraceBuffer* acquire_tbuf(Caliper* c, Channel* chn, bool can_alloc) {
         //   we store a pointer to the thread-local trace buffer for this channel
         // on the thread's blackboard
@@ -87,7 +131,7 @@ class Trace
 
             c->set(tbuf_attr, Variant(cali_make_variant_from_ptr(tbuf)));
 
-            std::lock_guard<util::spinlock>
+            std::lock_guard<::util::spinlock>
                 g(tbuf_lock);
 
             if (tbuf_list)
@@ -102,7 +146,153 @@ class Trace
         return tbuf;
     }
 
-    TraceBuffer* handle_overflow(Caliper* c, Channel* chn, TraceBuffer* tbuf) {
+    /// \brief Return a fresh chunk for the async writer mode, recycled
+    ///   from the writer's free list if possible
+    TraceBufferChunk* async_get_chunk() {
+        {
+            std::lock_guard<std::mutex>
+                g(async->lock);
+
+            if (!async->free_chunks.empty()) {
+                TraceBufferChunk* chunk = async->free_chunks.back();
+                async->free_chunks.pop_back();
+                return chunk;
+            }
+        }
+
+        return new TraceBufferChunk(buffersize);
+    }
+
+    /// \brief Put an unused chunk back on the async writer's free list
+    void async_recycle(TraceBufferChunk* chunk) {
+        std::lock_guard<std::mutex>
+            g(async->lock);
+
+        async->free_chunks.push_back(chunk);
+    }
+
+    /// \brief Check if the async writer's queue is full, and count it
+    ///   if it is
+    bool async_queue_full() {
+        std::lock_guard<std::mutex>
+            g(async->lock);
+
+        if (async->queue.size() >= async->max_queue) {
+            ++async->queue_full;
+            return true;
+        }
+
+        return false;
+    }
+
+    /// \brief Queue \a chunks for the async writer
+    void async_handoff(TraceBufferChunk* chunks) {
+        {
+            std::lock_guard<std::mutex>
+                g(async->lock);
+
+            async->queue.push_back(chunks);
+
+            ++async->chunks_queued;
+            async->queue_highwater = std::max(async->queue_highwater, async->queue.size());
+        }
+
+        async->cv.notify_one();
+    }
+
+    void async_writer_fn(Channel* chn) {
+        std::unique_ptr<OutputStream> stream;
+        std::unique_ptr<CaliWriter>   writer;
+
+        while (true) {
+            TraceBufferChunk* chunks = nullptr;
+
+            {
+                std::unique_lock<std::mutex>
+                    g(async->lock);
+
+                async->cv.wait(g, [this](){ return async->stop || !async->queue.empty(); });
+
+                if (async->queue.empty())
+                    break;
+
+                chunks = async->queue.front();
+                async->queue.pop_front();
+            }
+
+            // Create the Caliper thread data for this thread only once
+            // there is data, so we don't race with the channel setup.
+            Caliper c;
+
+            if (!writer) {
+                std::string filename = async->filename;
+
+                if (filename.empty())
+                    filename = cali::util::create_filename();
+
+                stream.reset(new OutputStream);
+                stream->set_filename(filename.c_str(), c, c.get_globals(chn));
+                writer.reset(new CaliWriter(*stream, async->format));
+            }
+
+            size_t n = chunks->flush(&c, [&writer](CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec){
+                    writer->write_snapshot(db, rec);
+                });
+
+            chunks->reset();
+
+            std::lock_guard<std::mutex>
+                g(async->lock);
+
+            ++async->chunks_written;
+            async->records_written += n;
+
+            if (async->free_chunks.size() < async->max_queue)
+                async->free_chunks.push_back(chunks);
+            else
+                delete chunks;
+        }
+
+        if (writer) {
+            Caliper c;
+            writer->write_globals(c, async->globals);
+        }
+    }
+
+    void async_finish(Caliper* c, Channel* chn) {
+        {
+            std::lock_guard<std::mutex>
+                g(async->lock);
+
+            async->globals = c->get_globals(chn);
+            async->stop    = true;
+        }
+
+        async->cv.notify_one();
+
+        if (async->thread.joinable())
+            async->thread.join();
+
+        for (TraceBufferChunk* chunk : async->free_chunks)
+            delete chunk;
+
+        async->free_chunks.clear();
+
+        Log(1).stream() << chn->name() << ": Trace: async writer wrote "
+                        << async->records_written << " records in "
+                        << async->chunks_written  << " chunks." << std::endl;
+
+        if (async->queue_full > 0)
+            Log(1).stream() << chn->name() << ": Trace: async writer queue was full "
+                            << async->queue_full << " times." << std::endl;
+        if (Log::verbosity() >= 2)
+            Log(2).stream() << chn->name() << ": Trace: async writer queue: "
+                            << async->chunks_queued   << " chunks queued, high-water mark "
+                            << async->queue_highwater << " of "
+                            << async->max_queue       << "." << std::endl;
+    }
+
+    TraceBuffer* handle_overflow(Caliper* c, Channel* chn, TraceBuffer* tbuf, std::unique_lock<::util::spinlock>& tbuf_g) {
         switch (policy) {
         case BufferPolicy::Stop:
             tbuf->stopped.store(true);
@@ -129,16 +319,70 @@ class Trace
         {
             Log(1).stream() << chn->name() << ": Trace buffer full: flushing." << std::endl;
 
+            // the flush needs our trace buffer lock
+            tbuf_g.unlock();
             c->flush_and_write(chn, SnapshotView());
+            tbuf_g.lock();
+
+            // make room for new records
+            tbuf->chunks->reset();
 
             return tbuf;
         }
 
+        case BufferPolicy::Async:
+            // handled in process_snapshot_async()
+            break;
+
         } // switch (policy)
 
         return 0;
     }
 
+    void process_snapshot_async(Caliper* c, TraceBuffer* tbuf, SnapshotView rec) {
+        {
+            std::lock_guard<::util::spinlock>
+                g(tbuf->lock);
+
+            if (tbuf->chunks->fits(rec)) {
+                tbuf->chunks->save_snapshot(rec);
+                return;
+            }
+        }
+
+        //   The chunk is full: hand it to the writer thread and continue in
+        // a fresh one. The fresh chunk may have to be allocated, so we get it
+        // before taking the buffer lock again. If the writer's queue is full,
+        // drop the snapshot instead of blocking the application.
+
+        if (c->is_signal() || async_queue_full()) {
+            ++dropped_snapshots;
+            return;
+        }
+
+        TraceBufferChunk* fresh = async_get_chunk();
+        TraceBufferChunk* full  = nullptr;
+
+        {
+            std::lock_guard<::util::spinlock>
+                g(tbuf->lock);
+
+            // a flush may have swapped in an empty chunk in the meantime
+            if (!tbuf->chunks->fits(rec)) {
+                full = tbuf->chunks;
+                tbuf->chunks = fresh;
+                fresh = nullptr;
+            }
+
+            tbuf->chunks->save_snapshot(rec);
+        }
+
+        if (full)
+            async_handoff(full);
+        if (fresh)
+            async_recycle(fresh);
+    }
+
     void process_snapshot_cb(Caliper* c, Channel* chn, SnapshotView rec) {
         TraceBuffer* tbuf = acquire_tbuf(c, chn, !c->is_signal());
 
@@ -147,22 +391,74 @@ class Trace
             return;
         }
 
+        if (policy == BufferPolicy::Async) {
+            process_snapshot_async(c, tbuf, rec);
+            return;
+        }
+
+        std::unique_lock<::util::spinlock>
+            g(tbuf->lock);
+
         if (!tbuf->chunks->fits(rec))
-            tbuf = handle_overflow(c, chn, tbuf);
-        if (!tbuf)
+            tbuf = handle_overflow(c, chn, tbuf, g);
+        if (!tbuf) {
+            ++dropped_snapshots;
             return;
+        }
 
         tbuf->chunks->save_snapshot(rec);
     }
 
+    /// \brief Hand all current chunk lists to the async writer
+    void async_flush(Channel* chn) {
+        TraceBuffer* tbuf = nullptr;
+
+        {
+            std::lock_guard<::util::spinlock>
+                g(tbuf_lock);
+
+            tbuf = tbuf_list;
+        }
+
+        size_t num_chunks = 0;
+
+        for (; tbuf; tbuf = tbuf->next) {
+            TraceBufferChunk* fresh = async_get_chunk();
+            TraceBufferChunk* old   = nullptr;
+
+            {
+                std::lock_guard<::util::spinlock>
+                    g(tbuf->lock);
+
+                old = tbuf->chunks;
+                tbuf->chunks = fresh;
+            }
+
+            if (old->empty()) {
+                async_recycle(old);
+            } else {
+                async_handoff(old);
+                ++num_chunks;
+            }
+        }
+
+        Log(1).stream() << chn->name() << ": Trace: Handed " << num_chunks
+                        << " buffers to the async writer." << std::endl;
+    }
+
     void flush_cb(Caliper* c, Channel* chn, SnapshotFlushFn proc_fn) {
         std::lock_guard<std::mutex>
             g(flush_lock);
 
+        if (policy == BufferPolicy::Async) {
+            async_flush(chn);
+            return;
+        }
+
         TraceBuffer* tbuf = nullptr;
 
         {
-            std::lock_guard<util::spinlock>
+            std::lock_guard<::util::spinlock>
                 g(tbuf_lock);
 
             tbuf = tbuf_list;
@@ -171,13 +467,36 @@ class Trace
         size_t num_written = 0;
 
         for (; tbuf; tbuf = tbuf->next) {
-            // Stop tracing while we flush: writers won't block
-            // but just drop the snapshot
+            //   Swap in a fresh chunk while we flush, so the thread can
+            // keep recording. Afterwards, append the flushed chunks to the
+            // list again: they are only discarded in clear().
 
-            tbuf->stopped.store(true);
+            TraceBufferChunk* fresh = new TraceBufferChunk(buffersize);
+            TraceBufferChunk* old   = nullptr;
+
+            {
+                std::lock_guard<::util::spinlock>
+                    g(tbuf->lock);
+
+                old = tbuf->chunks;
+                tbuf->chunks = fresh;
+            }
+
+            num_written += old->flush(c, proc_fn);
+
+            {
+                std::lock_guard<::util::spinlock>
+                    g(tbuf->lock);
+
+                if (tbuf->chunks == fresh && fresh->empty()) {
+                    tbuf->chunks = old;
+                } else {
+                    tbuf->chunks->append(old);
+                    fresh = nullptr;
+                }
+            }
 
-            num_written += tbuf->chunks->flush(c, proc_fn);
-            tbuf->stopped.store(false);
+            delete fresh;
         }
 
         Log(1).stream() << chn->name() << ": Trace: Flushed " << num_written << " snapshots." << std::endl;
@@ -190,7 +509,7 @@ class Trace
         TraceBuffer* tbuf = nullptr;
 
         {
-            std::lock_guard<util::spinlock>
+            std::lock_guard<::util::spinlock>
                 g(tbuf_lock);
 
             tbuf = tbuf_list;
@@ -199,25 +518,26 @@ class Trace
         TraceBufferChunk::UsageInfo aggregate_info { 0, 0, 0 };
 
         while (tbuf) {
-            tbuf->stopped.store(true);
+            {
+                std::lock_guard<::util::spinlock>
+                    g(tbuf->lock);
 
-            // Accumulate usage statistics before they're reset
-            TraceBufferChunk::UsageInfo info = tbuf->chunks->info();
+                // Accumulate usage statistics before they're reset
+                TraceBufferChunk::UsageInfo info = tbuf->chunks->info();
 
-            aggregate_info.nchunks  += info.nchunks;
-            aggregate_info.reserved += info.reserved;
-            aggregate_info.used     += info.used;
+                aggregate_info.nchunks  += info.nchunks;
+                aggregate_info.reserved += info.reserved;
+                aggregate_info.used     += info.used;
 
-            tbuf->chunks->reset();
-
-            tbuf->stopped.store(false);
+                tbuf->chunks->reset();
+            }
 
             if (tbuf->retired.load()) {
                 // delete retired thread's trace buffer
                 TraceBuffer* tmp = tbuf->next;
 
                 {
-                    std::lock_guard<util::spinlock>
+                    std::lock_guard<::util::spinlock>
                         g(tbuf_lock);
 
                     tbuf->unlink();
@@ -254,7 +574,8 @@ class Trace
         const std::map<std::string, BufferPolicy> polmap {
             { "grow",    BufferPolicy::Grow    },
             { "flush",   BufferPolicy::Flush   },
-            { "stop",    BufferPolicy::Stop    } };
+            { "stop",    BufferPolicy::Stop    },
+            { "async",   BufferPolicy::Async   } };
 
         auto it = polmap.find(polname);
 
@@ -275,7 +596,7 @@ class Trace
         if (tbuf) {
             tbuf->retired.store(true);
 
-            std::lock_guard<util::spinlock>
+            std::lock_guard<::util::spinlock>
                 g(tbuf_lock);
 
             ++num_retired;
@@ -283,9 +604,12 @@ class Trace
     }
 
     void finish_cb(Caliper* c, Channel* chn) {
-        if (dropped_snapshots > 0)
+        if (async)
+            async_finish(c, chn);
+
+        if (dropped_snapshots.load() > 0)
             Log(1).stream() << chn->name() << ": Trace: dropped "
-                            << dropped_snapshots << " snapshots." << std::endl;
+                            << dropped_snapshots.load() << " snapshots." << std::endl;
         if (Log::verbosity() >= 2)
             Log(2).stream() << chn->name() << ": Trace: "
                             << num_acquired << " thread trace buffers acquired, "
@@ -304,6 +628,23 @@ class Trace
             init_overflow_policy(cfg.get("buffer_policy").to_string());
             buffersize = cfg.get("buffer_size").to_uint() * 1024 * 1024;
 
+            if (policy == BufferPolicy::Async) {
+                async.reset(new AsyncWriter);
+
+                async->filename  = cfg.get("async_filename").to_string();
+                async->max_queue = std::max<uint64_t>(cfg.get("async_queue_size").to_uint(), 1);
+
+                std::string format = cfg.get("async_format").to_string();
+
+                if (format == "binary")
+                    async->format = CaliWriter::Binary;
+                else if (format != "text")
+                    Log(0).stream() << chn->name() << ": Trace: Unknown format \"" << format
+                                    << "\", using text format" << std::endl;
+
+                async->thread = std::thread(&Trace::async_writer_fn, this, chn);
+            }
+
             tbuf_attr =
                 c->create_attribute(std::string("trace.tbuf.")+std::to_string(chn->id()),
                                     CALI_TYPE_PTR,
@@ -351,6 +692,14 @@ public:
             [instance](Caliper* c, Channel* chn){
                 instance->clear_cb(c, chn);
             });
+        if (instance->policy == BufferPolicy::Async)
+            chn->events().write_output_evt.connect(
+                [instance](Caliper* c, Channel* chn, SnapshotView){
+                    std::lock_guard<std::mutex>
+                        g(instance->flush_lock);
+
+                    instance->async_flush(chn);
+                });
         chn->events().finish_evt.connect(
             [instance](Caliper* c, Channel* chn){
                 // sT.deactivate_chn(chn);
@@ -363,6 +712,11 @@ public:
         instance->acquire_tbuf(c, chn, true);
 
         Log(1).stream() << chn->name() << ": Registered trace service" << std::endl;
+
+        if (instance->policy == BufferPolicy::Async)
+            Log(1).stream() << chn->name() << ": Trace: async buffer policy: trace records are "
+                            << "written by the async writer and not passed to output services"
+                            << std::endl;
     }
 }; // class Trace
 
@@ -376,9 +730,23 @@ const char* Trace::s_spec = R"json(
             "value": "2"
         },
         {   "name": "buffer_policy",
-            "description": "What to do when the buffer is full ('flush', 'stop', 'grow')",
+            "description": "What to do when the buffer is full ('flush', 'stop', 'grow', 'async')",
             "type": "string",
             "value": "grow"
+        },
+        {   "name": "async_filename",
+            "description": "Output file name for the async buffer policy. If empty, auto-generate file.",
+            "type": "string"
+        },
+        {   "name": "async_format",
+            "description": "Output format for the async buffer policy: 'text' or 'binary'",
+            "type": "string",
+            "value": "text"
+        },
+        {   "name": "async_queue_size",
+            "description": "Max. number of full buffers waiting for the async writer",
+            "type": "uint",
+            "value": "16"
         }
     ]
 }
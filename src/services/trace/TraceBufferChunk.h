@@ -35,6 +35,12 @@ namespace trace
         void   save_snapshot(cali::SnapshotView s);
         bool   fits(cali::SnapshotView s) const;
 
+        /// \brief True if neither this chunk nor any chunk appended to it
+        ///   holds a record
+        bool   empty() const {
+            return m_nrec == 0 && (!m_next || m_next->empty());
+        }
+
         struct UsageInfo {
             size_t nchunks;
             size_t reserved;
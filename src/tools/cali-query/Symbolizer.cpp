@@ -0,0 +1,243 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+#include "Symbolizer.h"
+
+#include "../../services/symbollookup/Lookup.h"
+
+#include "caliper/reader/CaliperMetadataDB.h"
+
+#include "caliper/common/Node.h"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace cali;
+using namespace cali::symbollookup;
+
+struct Symbolizer::SymbolizerImpl
+{
+    struct SymbolAttributes {
+        Attribute target_attr;
+        Attribute func_attr;
+        Attribute loc_attr;
+        Attribute mod_attr;
+
+        std::unordered_map<const Node*, Node*> node_map;
+        std::unordered_map<uint64_t,    Node*> addr_map;
+    };
+
+    std::vector<EntryList> m_records;
+    std::mutex             m_records_lock;
+
+    unsigned               m_max_threads;
+
+    std::vector<SymbolAttributes> make_symbol_attributes(CaliperMetadataDB& db) {
+        std::vector<SymbolAttributes> ret;
+
+        Attribute class_attr = db.get_attribute("class.symboladdress");
+
+        if (!class_attr)
+            return ret;
+
+        for (const Attribute& attr : db.find_attributes_with(class_attr)) {
+            SymbolAttributes sym;
+
+            sym.target_attr = attr;
+            sym.func_attr   =
+                db.create_attribute("source.function#" + attr.name(), CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
+            sym.loc_attr    =
+                db.create_attribute("sourceloc#" + attr.name(), CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
+            sym.mod_attr    =
+                db.create_attribute("module#" + attr.name(), CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
+
+            ret.push_back(sym);
+        }
+
+        return ret;
+    }
+
+    Node* make_symbol_node(CaliperMetadataDB& db, const SymbolAttributes& sym, const Lookup::Result& result, Node* parent) {
+        std::string loc = result.file + ":" + std::to_string(result.line);
+
+        // Same layout as the symbollookup service with module lookup enabled
+        const Attribute attr[3] = { sym.mod_attr, sym.func_attr, sym.loc_attr };
+        const Variant   data[3] = {
+            Variant(result.module.c_str()), Variant(result.name.c_str()), Variant(loc.c_str())
+        };
+
+        return db.make_tree_entry(3, attr, data, parent);
+    }
+
+    Node* get_path_symbol_node(CaliperMetadataDB& db, SymbolAttributes& sym, const Node* node, const std::unordered_map<uint64_t, Lookup::Result>& results) {
+        if (!node)
+            return nullptr;
+
+        auto it = sym.node_map.find(node);
+
+        if (it != sym.node_map.end())
+            return it->second;
+
+        // find the parent's symbol node
+        const Node* parent = node->parent();
+
+        while (parent && parent->attribute() != sym.target_attr.id())
+            parent = parent->parent();
+
+        Node* sym_parent = get_path_symbol_node(db, sym, parent, results);
+        Node* sym_node   = sym_parent;
+
+        auto rit = results.find(node->data().to_uint());
+
+        if (rit != results.end())
+            sym_node = make_symbol_node(db, sym, rit->second, sym_parent);
+
+        sym.node_map[node] = sym_node;
+
+        return sym_node;
+    }
+
+    void flush(CaliperMetadataDB& db, SnapshotProcessFn push) {
+        std::vector<EntryList> records;
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_records_lock);
+
+            records.swap(m_records);
+        }
+
+        // Find the module map
+
+        std::string map;
+        Attribute   map_attr = db.get_attribute("module.map");
+
+        if (map_attr)
+            for (const Entry& e : db.get_globals()) {
+                Entry m = e.get(map_attr);
+
+                if (!m.empty()) {
+                    map = m.value().to_string();
+                    break;
+                }
+            }
+
+        std::vector<SymbolAttributes> sym_attrs = make_symbol_attributes(db);
+
+        if (map.empty() || sym_attrs.empty()) {
+            if (map.empty())
+                std::cerr << "cali-query: symbolize: No module map found. Enable the modulemap service to record one."
+                          << std::endl;
+
+            for (const EntryList& rec : records)
+                push(db, rec);
+
+            return;
+        }
+
+        // Collect the unique addresses
+
+        std::unordered_set<uint64_t> addr_set;
+
+        for (const SymbolAttributes& sym : sym_attrs) {
+            std::unordered_set<const Node*> visited;
+            cali_id_t attr_id = sym.target_attr.id();
+
+            for (const EntryList& rec : records)
+                for (const Entry& e : rec)
+                    if (e.is_reference()) {
+                        for (const Node* node = e.node(); node && visited.insert(node).second; node = node->parent())
+                            if (node->attribute() == attr_id)
+                                addr_set.insert(node->data().to_uint());
+                    } else if (e.attribute() == attr_id) {
+                        addr_set.insert(e.value().to_uint());
+                    }
+        }
+
+        std::vector<uint64_t> addrs(addr_set.begin(), addr_set.end());
+        std::sort(addrs.begin(), addrs.end());
+
+        // Look them up as one batch
+
+        Lookup lookup(Lookup::parse_module_map(map));
+        std::vector<Lookup::Result> lookup_results =
+            lookup.lookup(addrs, Lookup::Name | Lookup::File | Lookup::Line | Lookup::Module, m_max_threads);
+
+        std::unordered_map<uint64_t, Lookup::Result> results;
+        results.reserve(addrs.size());
+
+        for (size_t i = 0; i < addrs.size(); ++i)
+            results.emplace(addrs[i], std::move(lookup_results[i]));
+
+        // Add the symbol entries to the records
+
+        for (EntryList& rec : records) {
+            EntryList sym_entries;
+
+            for (SymbolAttributes& sym : sym_attrs) {
+                Entry e;
+
+                for (const Entry& r : rec) {
+                    e = r.get(sym.target_attr);
+                    if (!e.empty())
+                        break;
+                }
+
+                Node* sym_node = nullptr;
+
+                if (e.is_reference()) {
+                    sym_node = get_path_symbol_node(db, sym, e.node(), results);
+                } else if (e.is_immediate()) {
+                    uint64_t addr = e.value().to_uint();
+                    auto it = sym.addr_map.find(addr);
+
+                    if (it != sym.addr_map.end()) {
+                        sym_node = it->second;
+                    } else {
+                        auto rit = results.find(addr);
+
+                        if (rit != results.end())
+                            sym_node = make_symbol_node(db, sym, rit->second, nullptr);
+
+                        sym.addr_map[addr] = sym_node;
+                    }
+                }
+
+                if (sym_node)
+                    sym_entries.push_back(Entry(sym_node));
+            }
+
+            rec.insert(rec.end(), sym_entries.begin(), sym_entries.end());
+            push(db, rec);
+        }
+    }
+
+    SymbolizerImpl(unsigned max_threads)
+        : m_max_threads(max_threads)
+        { }
+};
+
+Symbolizer::Symbolizer(unsigned max_threads)
+    : mP { new SymbolizerImpl(max_threads) }
+{ }
+
+Symbolizer::~Symbolizer()
+{
+    mP.reset();
+}
+
+void Symbolizer::operator()(CaliperMetadataAccessInterface&, const EntryList& rec)
+{
+    std::lock_guard<std::mutex>
+        g(mP->m_records_lock);
+
+    mP->m_records.push_back(rec);
+}
+
+void Symbolizer::flush(CaliperMetadataDB& db, SnapshotProcessFn push)
+{
+    mP->flush(db, push);
+}
@@ -0,0 +1,45 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file Symbolizer.h
+/// \brief Offline symbol lookup for address attributes
+
+#pragma once
+
+#include "caliper/reader/RecordProcessor.h"
+
+#include <memory>
+
+namespace cali
+{
+
+class CaliperMetadataDB;
+
+/// \brief Offline symbol lookup for snapshot records
+///
+/// Buffers the snapshot records of an input stream. flush() looks up
+/// function names, source locations, and modules for their address
+/// attributes in one batch, using the module map that the modulemap
+/// service recorded in the stream's globals, and forwards the records
+/// with the symbol entries added. This way, .cali files with raw
+/// addresses can be symbolized on a different node than the one they
+/// were recorded on, as long as the same binaries are available.
+class Symbolizer
+{
+    struct SymbolizerImpl;
+    std::shared_ptr<SymbolizerImpl> mP;
+
+public:
+
+    Symbolizer(unsigned max_threads);
+
+    ~Symbolizer();
+
+    void operator()(CaliperMetadataAccessInterface&, const EntryList&);
+
+    /// \brief Symbolize and forward the buffered records to \a push,
+    ///   using the module map in \a db's globals
+    void flush(CaliperMetadataDB& db, SnapshotProcessFn push);
+};
+
+}
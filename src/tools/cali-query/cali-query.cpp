@@ -6,6 +6,9 @@
 #include "caliper/caliper-config.h"
 
 #include "AttributeExtract.h"
+#ifdef CALIPER_HAVE_LIBDW
+#include "Symbolizer.h"
+#endif
 #include "query_common.h"
 
 #include "caliper/tools-util/Args.h"
@@ -14,6 +17,7 @@
 #include "caliper/cali-manager.h"
 
 #include "caliper/reader/Aggregator.h"
+#include "caliper/reader/BatchProcessor.h"
 #include "caliper/reader/CaliReader.h"
 #include "caliper/reader/CaliperMetadataDB.h"
 #include "caliper/reader/FormatProcessor.h"
@@ -25,6 +29,7 @@
 #include "caliper/common/OutputStream.h"
 #include "caliper/common/StringConverter.h"
 
+#include <algorithm>
 #include <atomic>
 #include <fstream>
 #include <iostream>
@@ -93,10 +98,18 @@ namespace
           "Print given attributes in web-friendly json format",
           "ATTRIBUTES"
         },
+        { "segments", "segments", 0, false,
+          "Input files are consecutive segments of one rolling output stream",
+          nullptr
+        },
         { "threads", "threads", 0, true,
-          "Use this many threads (applicable only with multiple files)",
+          "Use this many threads (for multiple files or aggregation queries)",
           "THREADS"
         },
+        { "batch", "batch", 0, true,
+          "Process records in batches of this size with the columnar batch engine",
+          "SIZE"
+        },
         { "query", "query", 'q', true,
           "Execute a query in CalQL format",
           "QUERY STRING"
@@ -121,6 +134,12 @@ namespace
           "List global run metadata. Use with -j, -t, etc. to select output format.",
           nullptr
         },
+#ifdef CALIPER_HAVE_LIBDW
+        { "symbolize", "symbolize", 0, false,
+          "Look up symbols for address attributes using the module map recorded by the modulemap service",
+          nullptr
+        },
+#endif
         Args::Table::Terminator
     };
 
@@ -294,16 +313,83 @@ int main(int argc, const char* argv[])
 
     Aggregator        aggregate(spec);
 
+    std::vector<std::string> files = args.arguments();
+
+    if (files.empty())
+        files.push_back(""); // read from stdin if no files are given
+
+    unsigned max_threads = std::stoul(args.get("threads", "4"));
+    unsigned num_threads = std::min<unsigned>(files.size(), max_threads);
+
+    //   With more threads than files, split up aggregation queries within
+    // each file. Only do this if the user asked for threads explicitly:
+    // the default thread count is meant for reading multiple files.
+    // All reader threads share the Aggregator, which keeps thread-local
+    // aggregation tables, but each thread gets its own filter chain.
+
+    std::vector<SnapshotProcessFn> chunk_procs;
+
+    //   With --batch, each reader thread gets its own batch processor
+    // that runs the LET, WHERE, and aggregation steps on its batches.
+
+    std::size_t batch_size = std::stoul(args.get("batch", "0"));
+    std::vector<BatchProcessor> batch_procs;
+
+    bool symbolize = args.is_set("symbolize");
+
+    bool chunked =
+        !symbolize && args.is_set("threads") && max_threads > files.size() &&
+        !args.is_set("list-globals") && !args.is_set("list-attributes") &&
+        spec.aggregate.selection != QuerySpec::AggregationSelection::None;
+
+    //   Rolling output segments refer to nodes from previous segments,
+    // so they must be read in order with a single reader.
+    bool segments = args.is_set("segments");
+
+    //   The module map for symbolization is a per-file global, so files
+    // must be read and symbolized one after another.
+    if (segments || symbolize)
+        num_threads = 1;
+
+    if (chunked) {
+        num_threads = max_threads;
+
+        for (unsigned t = 0; t < num_threads && batch_size == 0; ++t) {
+            SnapshotProcessFn proc = aggregate;
+
+            if (spec.filter.selection == QuerySpec::FilterSelection::List)
+                proc = SnapshotFilterStep(RecordSelector(spec), proc);
+            if (!spec.preprocess_ops.empty())
+                proc = SnapshotFilterStep(Preprocessor(spec),   proc);
+
+            chunk_procs.push_back(proc);
+        }
+    }
+
     if (!args.is_set("list-globals")) {
-        if (spec.aggregate.selection == QuerySpec::AggregationSelection::None)
-            snap_proc = format;
-        else
-            snap_proc = aggregate;
+        if (batch_size > 0 && !args.is_set("list-attributes")) {
+            for (unsigned t = 0; t < num_threads; ++t) {
+                if (spec.aggregate.selection == QuerySpec::AggregationSelection::None)
+                    batch_procs.emplace_back(spec, format, batch_size);
+                else
+                    batch_procs.emplace_back(spec, aggregate, batch_size);
+            }
 
-        if (spec.filter.selection == QuerySpec::FilterSelection::List)
-            snap_proc = SnapshotFilterStep(RecordSelector(spec), snap_proc);
-        if (!spec.preprocess_ops.empty())
-            snap_proc = SnapshotFilterStep(Preprocessor(spec),   snap_proc);
+            snap_proc = batch_procs.front();
+
+            if (chunked)
+                chunk_procs.assign(batch_procs.begin(), batch_procs.end());
+        } else {
+            if (spec.aggregate.selection == QuerySpec::AggregationSelection::None)
+                snap_proc = format;
+            else
+                snap_proc = aggregate;
+
+            if (spec.filter.selection == QuerySpec::FilterSelection::List)
+                snap_proc = SnapshotFilterStep(RecordSelector(spec), snap_proc);
+            if (!spec.preprocess_ops.empty())
+                snap_proc = SnapshotFilterStep(Preprocessor(spec),   snap_proc);
+        }
 
         if (args.is_set("list-attributes")) {
             node_proc = AttributeExtract(snap_proc);
@@ -311,20 +397,21 @@ int main(int argc, const char* argv[])
         }
     }
 
-    node_proc = ::NodeFilterStep(::FilterDuplicateNodes(), node_proc);
-
-    std::vector<std::string> files = args.arguments();
+#ifdef CALIPER_HAVE_LIBDW
+    Symbolizer        symbolizer(max_threads);
+    SnapshotProcessFn symbolized_proc = snap_proc;
 
-    if (files.empty())
-        files.push_back(""); // read from stdin if no files are given
+    if (symbolize)
+        snap_proc = symbolizer;
+#endif
 
-    unsigned num_threads =
-        std::min<unsigned>(files.size(), std::stoul(args.get("threads", "4")));
+    node_proc = ::NodeFilterStep(::FilterDuplicateNodes(), node_proc);
 
     if (verbose)
         std::cerr << "cali-query: Processing " << files.size()
                   << " files using "
-                  << num_threads << " thread" << (num_threads == 1 ? "." : "s.")
+                  << num_threads << " thread" << (num_threads == 1 ? "" : "s")
+                  << (chunked ? " per file." : ".")
                   << std::endl;
 
     cali_set_global_int_byname("cali-query.num-threads", num_threads);
@@ -340,6 +427,9 @@ int main(int argc, const char* argv[])
     CaliperMetadataDB     metadb;
     std::atomic<unsigned> index(0);
     std::mutex            msgmutex;
+    CaliReader            segment_reader;
+
+    segment_reader.set_segment_mode(true);
 
     auto thread_fn = [&](unsigned t) {
         Annotation::Guard
@@ -358,8 +448,20 @@ int main(int argc, const char* argv[])
                 std::cerr << "cali-query: Reading " << filename << std::endl;
             }
 
-            CaliReader reader;
-            reader.read(files[i], metadb, node_proc, snap_proc);
+            CaliReader  file_reader;
+            CaliReader& reader = segments ? segment_reader : file_reader;
+
+            if (chunked)
+                reader.read(files[i], metadb, node_proc, chunk_procs);
+            else if (t < batch_procs.size() && !symbolize)
+                reader.read(files[i], metadb, node_proc, batch_procs[t]);
+            else
+                reader.read(files[i], metadb, node_proc, snap_proc);
+
+#ifdef CALIPER_HAVE_LIBDW
+            if (symbolize)
+                symbolizer.flush(metadb, symbolized_proc);
+#endif
 
             if (reader.error()) {
                 std::lock_guard<std::mutex>
@@ -377,12 +479,18 @@ int main(int argc, const char* argv[])
     // --- Fill thread vector and process
     //
 
-    for (unsigned t = 0; t < num_threads; ++t)
-        threads.emplace_back(thread_fn, t);
+    if (chunked)
+        thread_fn(0); // files are read one at a time with all threads
+    else
+        for (unsigned t = 0; t < num_threads; ++t)
+            threads.emplace_back(thread_fn, t);
 
     for (auto &t : threads)
         t.join();
 
+    for (BatchProcessor& proc : batch_procs)
+        proc.flush(metadb);
+
     CALI_MARK_END("Processing");
 
     //
@@ -20,6 +20,19 @@
 //
 // The benchmark is multi-threaded: the loop is statically divided
 // between threads using OpenMP.
+//
+// With --width-sweep, the benchmark first runs the timing loop for
+// tree widths 1, 4, 16, ... below the given width. This shows how the
+// cost of an annotation update changes as the context tree gets wider.
+//
+// With --byname, the benchmark uses the C by-name API
+// (cali_begin_string_byname/cali_end_byname) instead of a
+// cali::Annotation object, which exercises the attribute name lookup.
+//
+// With --event-sweep, the benchmark also runs the timing loop with an
+// extra event+aggregate channel, once with the event service's
+// enable_snapshot_info option on and once with it off. This measures
+// the cost of the event service's trigger path.
 
 #include <caliper/Caliper.h>
 #include <caliper/ChannelController.h>
@@ -54,6 +67,8 @@ struct Config
     int iter;
 
     int channels;
+
+    bool byname;
 };
 
 
@@ -68,13 +83,28 @@ int foo(int d, int w, const Config& cfg)
     return 2 + foo(d-1, w, cfg);
 }
 
+int foo_byname(int d, int w, const Config& cfg)
+{
+    if (d <= 0)
+        return 0;
+
+    cali_begin_string_byname("test.attr", annotation_strings[d*cfg.tree_width+w].c_str());
+    int ret = 2 + foo_byname(d-1, w, cfg);
+    cali_end_byname("test.attr");
+
+    return ret;
+}
+
 int run(const Config& cfg)
 {
     int n_updates = 0;
 
 #pragma omp parallel for schedule(static) reduction(+:n_updates)
     for (int i = 0; i < cfg.iter; ++i) {
-        n_updates += foo(cfg.tree_depth, i % cfg.tree_width, cfg);
+        if (cfg.byname)
+            n_updates += foo_byname(cfg.tree_depth, i % cfg.tree_width, cfg);
+        else
+            n_updates += foo(cfg.tree_depth, i % cfg.tree_width, cfg);
     }
 
     return n_updates;
@@ -101,6 +131,28 @@ void make_strings(const Config& cfg)
         }
 }
 
+void print_result(const Config& cfg, int updates, int threads, double msec, bool print_csv)
+{
+    double usec_per_update = (updates > 0 ? (1000.0*msec*threads)/updates : 0.0);
+    double updates_per_sec = (msec    > 0 ?  1000.0*updates/msec          : 0.0);
+
+    if (print_csv)
+        std::cout << cfg.channels
+                  << "," << cfg.tree_depth
+                  << "," << cfg.tree_width
+                  << "," << updates
+                  << "," << threads
+                  << "," << msec/1000.0
+                  << std::endl;
+    else
+        std::cout << "  " << updates << " annotation updates in "
+                  << msec/1000.0     << " sec ("
+                  << updates/threads << " per thread), "
+                  << updates_per_sec << " updates/sec, "
+                  << usec_per_update << " usec/update"
+                  << std::endl;
+}
+
 void record_globals(const Config& cfg, int threads, const cali::ConfigManager::argmap_t& extra_kv)
 {
 #ifdef CALIPER_HAVE_ADIAK
@@ -109,6 +161,7 @@ void record_globals(const Config& cfg, int threads, const cali::ConfigManager::a
     adiak::value("perftest.iterations", cfg.iter);
     adiak::value("perftest.threads",    threads);
     adiak::value("perftest.channels",   cfg.channels);
+    adiak::value("perftest.byname",     cfg.byname ? 1 : 0);
 
     adiak::value("perftest.services",
                  cali::RuntimeConfig::get_default_config().get("services", "enable").to_string());
@@ -133,6 +186,7 @@ void record_globals(const Config& cfg, int threads, const cali::ConfigManager::a
     cali_set_global_int_byname("perftest.iterations", cfg.iter);
     cali_set_global_int_byname("perftest.threads",    threads);
     cali_set_global_int_byname("perftest.channels",   cfg.channels);
+    cali_set_global_int_byname("perftest.byname",     cfg.byname ? 1 : 0);
 #endif
 }
 
@@ -158,6 +212,18 @@ int main(int argc, char* argv[])
           "Number of replicated channel instances",
           "CHANNELS"
         },
+        { "width-sweep",  "width-sweep", 's', false,
+          "Also run the timing loop for tree widths 1, 4, 16, ... below WIDTH",
+          nullptr
+        },
+        { "byname",       "byname",     'b', false,
+          "Use the C by-name annotation API instead of cali::Annotation",
+          nullptr
+        },
+        { "event-sweep",  "event-sweep", 'e', false,
+          "Also run the timing loop with an event channel with and without event snapshot info",
+          nullptr
+        },
         { "profile",       "profile",   'P', true,
           "Caliper profiling config (for profiling cali-annotation-perftest)",
           "CONFIGSTRING"
@@ -213,6 +279,7 @@ int main(int argc, char* argv[])
     cfg.tree_depth  = std::stoi(args.get("depth", "10"));
     cfg.iter        = std::stoi(args.get("iterations", "100000"));
     cfg.channels    = std::max(std::stoi(args.get("channels", "1")), 1);
+    cfg.byname      = args.is_set("byname");
 
     // set global attributes before other Caliper initialization
     record_globals(cfg, threads, extra_kv);
@@ -230,6 +297,7 @@ int main(int argc, char* argv[])
                   << "\n    Tree width: " << cfg.tree_width
                   << "\n    Tree depth: " << cfg.tree_depth
                   << "\n    Iterations: " << cfg.iter
+                  << "\n    API:        " << (cfg.byname ? "byname" : "annotation")
 #ifdef _OPENMP
                   << "\n    Threads:    " << omp_get_max_threads()
 #endif
@@ -255,6 +323,7 @@ int main(int argc, char* argv[])
     pre_cfg.tree_width = 1;
     pre_cfg.tree_depth = 0;
     pre_cfg.iter       = 100 * threads;
+    pre_cfg.byname     = cfg.byname;
 
     mgr.stop();
     run(pre_cfg);
@@ -262,6 +331,81 @@ int main(int argc, char* argv[])
 
     CALI_MARK_END("perftest.pre-timing");
 
+    // --- tree width sweep
+
+    if (args.is_set("width-sweep")) {
+        CALI_MARK_BEGIN("perftest.width-sweep");
+
+        for (int w = 1; w < cfg.tree_width; w *= 4) {
+            Config sweep_cfg = cfg;
+            sweep_cfg.tree_width = w;
+
+            make_strings(sweep_cfg);
+
+            mgr.stop();
+
+            auto stime = std::chrono::system_clock::now();
+            int updates = run(sweep_cfg);
+            auto etime = std::chrono::system_clock::now();
+
+            mgr.start();
+
+            auto msec = std::chrono::duration_cast<std::chrono::milliseconds>(etime-stime).count();
+
+            if (!quiet) {
+                if (!print_csv)
+                    std::cout << "  Tree width " << w << ":\n  ";
+
+                print_result(sweep_cfg, updates, threads, msec, print_csv);
+            }
+        }
+
+        make_strings(cfg);
+
+        CALI_MARK_END("perftest.width-sweep");
+    }
+
+    // --- event trigger sweep
+
+    if (args.is_set("event-sweep")) {
+        CALI_MARK_BEGIN("perftest.event-sweep");
+
+        for (bool snapshot_info : { true, false }) {
+            cali::RuntimeConfig chn_cfg;
+
+            chn_cfg.allow_read_env(false);
+            chn_cfg.set("CALI_SERVICES_ENABLE", "event,aggregate");
+            chn_cfg.set("CALI_EVENT_ENABLE_SNAPSHOT_INFO", snapshot_info ? "true" : "false");
+            chn_cfg.set("CALI_CHANNEL_FLUSH_ON_EXIT", "false");
+            chn_cfg.set("CALI_CHANNEL_CONFIG_CHECK", "false");
+
+            cali::Channel* chn =
+                c.create_channel(snapshot_info ? "perftest.event.info" : "perftest.event.noinfo", chn_cfg);
+
+            mgr.stop();
+
+            auto stime = std::chrono::system_clock::now();
+            int updates = run(cfg);
+            auto etime = std::chrono::system_clock::now();
+
+            mgr.start();
+
+            c.delete_channel(chn);
+
+            auto msec = std::chrono::duration_cast<std::chrono::milliseconds>(etime-stime).count();
+
+            if (!quiet) {
+                if (!print_csv)
+                    std::cout << "  Event channel, enable_snapshot_info="
+                              << (snapshot_info ? "true" : "false") << ":\n  ";
+
+                print_result(cfg, updates, threads, msec, print_csv);
+            }
+        }
+
+        CALI_MARK_END("perftest.event-sweep");
+    }
+
     // --- timing loop
 
     CALI_MARK_BEGIN("perftest.timing");
@@ -282,10 +426,10 @@ int main(int argc, char* argv[])
 
     auto msec  = std::chrono::duration_cast<std::chrono::milliseconds>(etime-stime).count();
 
+#ifdef CALIPER_HAVE_ADIAK
     double usec_per_update = (updates > 0 ? (1000.0*msec*threads)/updates : 0.0);
     double updates_per_sec = (msec    > 0 ?  1000.0*updates/msec          : 0.0);
 
-#ifdef CALIPER_HAVE_ADIAK
     adiak::value("perftest.usec_per_update", usec_per_update);
     adiak::value("perftest.updates_per_sec", updates_per_sec);
     adiak::value("perftest.time", msec / 1000.0);
@@ -293,20 +437,13 @@ int main(int argc, char* argv[])
 
     if (!quiet) {
         if (print_csv)
-            std::cout << cfg.channels
-                    << "," << cfg.tree_depth
-                    << "," << cfg.tree_width
-                    << "," << updates
-                    << "," << threads
-                    << "," << msec/1000.0
-                    << std::endl;
-        else
-            std::cout << "  " << updates << " annotation updates in "
-                    << msec/1000.0     << " sec ("
-                    << updates/threads << " per thread), "
-                    << updates_per_sec << " updates/sec, "
-                    << usec_per_update << " usec/update"
-                    << std::endl;
+            print_result(cfg, updates, threads, msec, true);
+        else {
+            if (args.is_set("width-sweep"))
+                std::cout << "  Tree width " << cfg.tree_width << ":\n  ";
+
+            print_result(cfg, updates, threads, msec, false);
+        }
     }
 
     CALI_MARK_FUNCTION_END;
@@ -0,0 +1,211 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+// -- cali-mpi-aggregate-perftest
+//
+// Runs a performance test for cross-process aggregation with
+// aggregate_over_mpi(). Run it with mpirun.
+//
+// Each rank creates a region tree with a number of regions common to
+// all ranks and a number of regions only it has, aggregates a record
+// for each region locally, and then runs the timed cross-process
+// aggregation. Rank 0 prints the time and checks the result.
+
+#include <caliper/cali-mpi.h>
+
+#include <caliper/reader/Aggregator.h>
+#include <caliper/reader/CaliperMetadataDB.h>
+#include <caliper/reader/CalQLParser.h>
+
+#include <caliper/common/Node.h>
+
+#include <caliper/tools-util/Args.h>
+
+#include <mpi.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+struct Config
+{
+    int      regions;
+    int      unique;
+    int      depth;
+    int      reps;
+    bool     check;
+
+    AggregateOverMpiOptions opts;
+};
+
+/// \brief Create the local input records and aggregate them into \a aggr
+void fill(const Config& cfg, int rank, CaliperMetadataDB& db, Aggregator& aggr)
+{
+    Attribute region_attr =
+        db.create_attribute("region", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute time_attr   =
+        db.create_attribute("time", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE | CALI_ATTR_AGGREGATABLE);
+
+    std::vector<Node*> stack;
+
+    auto add_region = [&](const std::string& name, int i) {
+        if (cfg.depth > 0 && i % cfg.depth == 0)
+            stack.clear();
+
+        Variant v(CALI_TYPE_STRING, name.c_str(), name.size());
+        Node*   node = db.make_tree_entry(1, &region_attr, &v, stack.empty() ? nullptr : stack.back());
+
+        stack.push_back(node);
+
+        EntryList rec { Entry(node), Entry(time_attr, Variant(1.0 + rank)) };
+        aggr.add(db, rec);
+    };
+
+    for (int i = 0; i < cfg.regions; ++i)
+        add_region(std::string("region.") + std::to_string(i), i);
+
+    stack.clear();
+
+    for (int i = 0; i < cfg.unique; ++i)
+        add_region(std::string("rank.") + std::to_string(rank) + ".region." + std::to_string(i), i);
+}
+
+} // namespace [anonymous]
+
+
+int main(int argc, char* argv[])
+{
+    MPI_Init(&argc, &argv);
+
+    const util::Args::Table option_table[] = {
+        { "regions",    "regions",    'r', true,
+          "Number of regions common to all ranks", "REGIONS" },
+        { "unique",     "unique",     'u', true,
+          "Number of regions unique to each rank", "UNIQUE" },
+        { "depth",      "depth",      'd', true,
+          "Maximum region nesting depth", "DEPTH" },
+        { "reps",       "reps",       'n', true,
+          "Number of repetitions", "REPS" },
+        { "fanout",     "fanout",     'k', true,
+          "Reduction tree fanout", "FANOUT" },
+        { "chunk-size", "chunk-size", 's', true,
+          "Transfer chunk size in bytes", "BYTES" },
+        { "flat",       "flat",       'f', false,
+          "Skip the node-local reduction stage", nullptr },
+        { "check",      "check",      'c', false,
+          "Check the aggregation result", nullptr },
+
+        { "help", "help", 'h', false, "Print help", nullptr },
+
+        util::Args::Table::Terminator
+    };
+
+    util::Args args(option_table);
+
+    int lastarg = args.parse(argc, argv);
+
+    int rank = 0;
+    int size = 1;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (lastarg < argc || args.is_set("help")) {
+        if (rank == 0) {
+            if (lastarg < argc)
+                std::cerr << "cali-mpi-aggregate-perftest: unknown option: " << argv[lastarg] << '\n';
+
+            std::cerr << "Available options: ";
+            args.print_available_options(std::cerr);
+        }
+
+        MPI_Finalize();
+        return lastarg < argc ? 1 : 2;
+    }
+
+    Config cfg;
+
+    cfg.regions = std::stoi(args.get("regions", "1000"));
+    cfg.unique  = std::stoi(args.get("unique",  "100"));
+    cfg.depth   = std::stoi(args.get("depth",   "10"));
+    cfg.reps    = std::stoi(args.get("reps",    "5"));
+    cfg.check   = args.is_set("check");
+
+    cfg.opts.fanout     = std::stoul(args.get("fanout", "2"));
+    cfg.opts.chunk_size = std::stoul(args.get("chunk-size", "1048576"));
+    cfg.opts.node_local = !args.is_set("flat");
+
+    if (rank == 0)
+        std::cout << "cali-mpi-aggregate-perftest:"
+                  << "\n    Ranks:      " << size
+                  << "\n    Regions:    " << cfg.regions
+                  << "\n    Unique:     " << cfg.unique
+                  << "\n    Depth:      " << cfg.depth
+                  << "\n    Fanout:     " << cfg.opts.fanout
+                  << "\n    Chunk size: " << cfg.opts.chunk_size
+                  << "\n    Node-local: " << (cfg.opts.node_local ? "yes" : "no")
+                  << std::endl;
+
+    QuerySpec spec = CalQLParser("aggregate sum(time),count() group by path").spec();
+
+    double total_sec = 0.0;
+    int    errors    = 0;
+
+    for (int r = 0; r < cfg.reps; ++r) {
+        CaliperMetadataDB db;
+        Aggregator        aggr(spec);
+
+        fill(cfg, rank, db, aggr);
+
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        auto stime = std::chrono::steady_clock::now();
+
+        aggregate_over_mpi(db, aggr, MPI_COMM_WORLD, cfg.opts);
+
+        auto etime = std::chrono::steady_clock::now();
+
+        total_sec += std::chrono::duration<double>(etime-stime).count();
+
+        if (cfg.check && rank == 0 && r == 0) {
+            Attribute count_attr = db.get_attribute("count");
+            size_t    num_recs   = 0;
+            long      count      = 0;
+
+            aggr.flush(db, [&](CaliperMetadataAccessInterface&, const EntryList& rec) {
+                    ++num_recs;
+
+                    for (const Entry& e : rec)
+                        if (e.attribute() == count_attr.id())
+                            count += e.value().to_int();
+                });
+
+            size_t expected_recs  = cfg.regions + static_cast<size_t>(size) * cfg.unique;
+            long   expected_count = static_cast<long>(size) * (cfg.regions + cfg.unique);
+
+            if (num_recs != expected_recs || count != expected_count) {
+                std::cerr << "cali-mpi-aggregate-perftest: expected " << expected_recs
+                          << " records with a total count of " << expected_count
+                          << ", got " << num_recs << " records with a total count of " << count
+                          << std::endl;
+                ++errors;
+            }
+        }
+    }
+
+    if (rank == 0)
+        std::cout << "  " << cfg.reps << " aggregations in " << total_sec << " sec, "
+                  << 1000.0*total_sec/cfg.reps << " msec/aggregation"
+                  << (cfg.check ? (errors ? " (check FAILED)" : " (check passed)") : "")
+                  << std::endl;
+
+    MPI_Finalize();
+
+    return errors ? 1 : 0;
+}
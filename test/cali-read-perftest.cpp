@@ -0,0 +1,176 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+// -- cali-read-perftest
+//
+// Runs a performance test for reading .cali files.
+//
+// The benchmark optionally generates a synthetic .cali file of a given
+// size first, then times reading the given files into a
+// CaliperMetadataDB. Like cali-query, it reads all files into the same
+// database, so node IDs in the second and later files typically need to
+// be remapped.
+
+#include <caliper/reader/CaliperMetadataDB.h>
+#include <caliper/reader/CaliReader.h>
+#include <caliper/reader/CaliWriter.h>
+
+#include <caliper/common/Node.h>
+#include <caliper/common/OutputStream.h>
+
+#include <caliper/tools-util/Args.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+/// \brief Write about \a mbytes MB of records with \a regions distinct
+///   region paths to \a filename
+bool generate(const std::string& filename, size_t mbytes, int regions, int depth, bool binary)
+{
+    std::ofstream ofs(filename, std::ios::binary);
+
+    if (!ofs)
+        return false;
+
+    OutputStream stream;
+    stream.set_stream(&ofs);
+
+    CaliWriter writer(stream, binary ? CaliWriter::Binary : CaliWriter::Text);
+
+    CaliperMetadataDB db;
+
+    Attribute region_attr =
+        db.create_attribute("region", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute time_attr   =
+        db.create_attribute("time", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+    Attribute iter_attr   =
+        db.create_attribute("iteration", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    std::vector<Node*> paths;
+    paths.reserve(regions);
+
+    for (int i = 0; i < regions; ++i) {
+        std::string name = std::string("region.") + std::to_string(i);
+        Variant v(CALI_TYPE_STRING, name.c_str(), name.size());
+        Node* parent = (depth > 1 && i % depth != 0) ? paths.back() : nullptr;
+
+        paths.push_back(db.make_tree_entry(1, &region_attr, &v, parent));
+    }
+
+    const size_t target = mbytes * 1024 * 1024;
+
+    for (int iter = 0; static_cast<size_t>(ofs.tellp()) < target; ++iter)
+        for (int i = 0; i < regions; ++i) {
+            std::vector<Entry> rec {
+                Entry(paths[i]),
+                Entry(time_attr, Variant(0.5 * (iter + i))),
+                Entry(iter_attr, Variant(iter))
+            };
+
+            writer.write_snapshot(db, rec);
+        }
+
+    return static_cast<bool>(ofs);
+}
+
+} // namespace [anonymous]
+
+
+int main(int argc, char* argv[])
+{
+    const util::Args::Table option_table[] = {
+        { "generate", "generate", 'g', true,
+          "Generate the last FILE as a synthetic file of SIZE megabytes first", "SIZE" },
+        { "regions",  "regions",  'r', true,
+          "Number of distinct regions in the generated file", "REGIONS" },
+        { "depth",    "depth",    'd', true,
+          "Region nesting depth in the generated file", "DEPTH" },
+        { "binary",   "binary",   'b', false,
+          "Generate a binary .cali file", nullptr },
+        { "reps",     "reps",     'n', true,
+          "Number of repetitions", "REPS" },
+
+        { "help", "help", 'h', false, "Print help", nullptr },
+
+        util::Args::Table::Terminator
+    };
+
+    util::Args args(option_table);
+
+    int lastarg = args.parse(argc, argv);
+
+    if (lastarg < argc) {
+        std::cerr << "cali-read-perftest: unknown option: " << argv[lastarg] << '\n'
+                  << "Available options: ";
+
+        args.print_available_options(std::cerr);
+
+        return 1;
+    }
+
+    std::vector<std::string> files = args.arguments();
+
+    if (args.is_set("help") || files.empty()) {
+        std::cerr << "Usage: cali-read-perftest [options] FILE...\nAvailable options: ";
+        args.print_available_options(std::cerr);
+        return 2;
+    }
+
+    const std::string& filename(files.back());
+
+    if (args.is_set("generate")) {
+        size_t mbytes  = std::stoul(args.get("generate", "1024"));
+        int    regions = std::stoi(args.get("regions", "100000"));
+        int    depth   = std::stoi(args.get("depth",   "10"));
+
+        if (!generate(filename, mbytes, regions, depth, args.is_set("binary"))) {
+            std::cerr << "cali-read-perftest: cannot write " << filename << std::endl;
+            return 1;
+        }
+    }
+
+    int reps = std::stoi(args.get("reps", "1"));
+
+    std::cout << "cali-read-perftest:"
+              << "\n    Files:      " << files.size()
+              << "\n    Reps:       " << reps
+              << std::endl;
+
+    for (int r = 0; r < reps; ++r) {
+        CaliperMetadataDB db;
+
+        size_t num_nodes = 0;
+        size_t num_recs  = 0;
+
+        auto stime = std::chrono::steady_clock::now();
+
+        for (const std::string& file : files) {
+            CaliReader reader;
+
+            reader.read(file, db,
+                        [&num_nodes](CaliperMetadataAccessInterface&, const Node*) { ++num_nodes; },
+                        [&num_recs](CaliperMetadataAccessInterface&, const std::vector<Entry>&) { ++num_recs; });
+
+            if (reader.error()) {
+                std::cerr << "cali-read-perftest: " << file << ": " << reader.error_msg() << std::endl;
+                return 1;
+            }
+        }
+
+        auto etime = std::chrono::steady_clock::now();
+
+        double sec = std::chrono::duration<double>(etime-stime).count();
+
+        std::cout << "  " << num_recs << " records, " << num_nodes << " nodes read in "
+                  << sec << " sec, " << 1e6*sec/(num_recs > 0 ? num_recs : 1) << " usec/record"
+                  << std::endl;
+    }
+}
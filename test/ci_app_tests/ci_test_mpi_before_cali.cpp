@@ -6,6 +6,9 @@
 
 #include <mpi.h>
 
+#include <cstdlib>
+#include <vector>
+
 int main(int argc, char* argv[])
 {
     cali_mpi_init();
@@ -44,6 +47,21 @@ int main(int argc, char* argv[])
         MPI_Reduce(&in, &out, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
         MPI_Barrier(MPI_COMM_WORLD);
         CALI_MARK_COMM_REGION_END("reduction");
+
+        // optional point-to-point messages to self to test message tracing
+
+        int num_msgs = (argc > 2 ? std::atoi(argv[2]) : 0);
+
+        std::vector<MPI_Request> reqs(2*num_msgs);
+        std::vector<int> sendbuf(num_msgs), recvbuf(num_msgs);
+
+        for (int i = 0; i < num_msgs; ++i)
+            MPI_Irecv(&recvbuf[i], 1, MPI_INT, rank, 7, MPI_COMM_WORLD, &reqs[i]);
+        for (int i = 0; i < num_msgs; ++i)
+            MPI_Isend(&sendbuf[i], 1, MPI_INT, rank, 7, MPI_COMM_WORLD, &reqs[num_msgs+i]);
+
+        if (num_msgs > 0)
+            MPI_Waitall(2*num_msgs, reqs.data(), MPI_STATUSES_IGNORE);
     }
 
     mgr.flush();
@@ -0,0 +1,40 @@
+// --- Caliper continuous integration test app: rolling output with threads
+
+#include "caliper/cali.h"
+
+#include <pthread.h>
+
+#include <cstdlib>
+
+int num_iterations = 20000;
+
+void* thread_proc(void*)
+{
+    CALI_CXX_MARK_FUNCTION;
+
+    for (int i = 0; i < num_iterations; ++i) {
+        CALI_MARK_BEGIN("work");
+        CALI_MARK_END("work");
+    }
+
+    return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    CALI_CXX_MARK_FUNCTION;
+
+    if (argc > 1)
+        num_iterations = std::atoi(argv[1]);
+
+    pthread_t thread[4];
+
+    for (int i = 0; i < 4; ++i)
+        pthread_create(&thread[i], NULL, thread_proc, NULL);
+
+    // any thread may write a segment while the others take snapshots
+    thread_proc(NULL);
+
+    for (int i = 0; i < 4; ++i)
+        pthread_join(thread[i], NULL);
+}
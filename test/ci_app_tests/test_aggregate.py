@@ -143,5 +143,31 @@ class CaliperAggregationTest(unittest.TestCase):
                 'iteration'  : '3',
                 'count'      : '1' }))
 
+    def test_aggregate_rolling_threads(self):
+        target_cmd = [ './ci_test_rolling', '20000' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'      : 'aggregate:event:recorder',
+            'CALI_AGGREGATE_KEY'        : 'region',
+            'CALI_CHANNEL_ROLLING_SIZE' : '1',
+            'CALI_RECORDER_FILENAME'    : 'stdout',
+            'CALI_LOG_VERBOSITY'        : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        work = [ s for s in snapshots if s.get('region') == 'thread_proc/work' ]
+
+        # one record per segment; snapshots taken between a segment's
+        # flush and clear are lost, but none may be counted twice
+        self.assertGreater(len(work), 1)
+
+        count = sum(int(s['count']) for s in work)
+
+        self.assertGreater(count, 0)
+        self.assertLessEqual(count, 4 * 20000)
+
 if __name__ == "__main__":
     unittest.main()
@@ -79,6 +79,43 @@ class CaliperAllocServiceTest(unittest.TestCase):
         self.helper_test_hook('calloc')
         self.helper_test_hook('realloc')
 
+    def test_alloc_hooks_sampled(self):
+        target_cmd = [ './ci_test_alloc_hooks' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_ALLOC_RESOLVE_ADDRESSES'  : 'true',
+            'CALI_SERVICES_ENABLE'          : 'alloc:recorder:sysalloc:trace',
+            'CALI_SYSALLOC_SAMPLE_INTERVAL' : '1',
+            'CALI_RECORDER_FILENAME'        : 'stdout',
+            'CALI_LOG_VERBOSITY'            : '0'
+        }
+
+        # with a 1-byte interval, every allocation is sampled
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        self.snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.helper_test_hook('malloc')
+        self.helper_test_hook('calloc')
+        self.helper_test_hook('realloc')
+
+        for s in self.snapshots:
+            if 'alloc.sample_weight' in s:
+                self.assertGreaterEqual(float(s['alloc.sample_weight']), 1.0)
+
+        # with a huge interval, no allocation is sampled
+
+        caliper_config['CALI_SYSALLOC_SAMPLE_INTERVAL'] = str(1 << 50)
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        self.snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(cat.has_snapshot_with_keys(
+            self.snapshots, { 'test_alloc.malloc_hook', 'test_alloc.allocated.0', 'ptr_in' }))
+        self.assertFalse(cat.has_snapshot_with_keys(
+            self.snapshots, { 'test_alloc.malloc_hook', 'alloc.uid#ptr_in' }))
+
 
     def test_mem_highwatermark_option(self):
         target_cmd = [ './ci_test_macros', '10', 'hatchet-region-profile,use.mpi=false,output=stdout,output.format=json,mem.highwatermark' ]
@@ -115,6 +115,26 @@ class CaliperBasicTraceTest(unittest.TestCase):
         self.assertTrue(cat.has_snapshot_with_attributes(
             snapshots, { 'region' : 'main/foo', 'event.end#loop': 'fooloop', 'count' : '400' }))
 
+    def test_async_trace(self):
+        target_cmd = [ './ci_test_macros', '0', 'none', '400' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-q', 'select region,event.end#loop,count() group by region,event.end#loop format expand' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'      : 'event,trace',
+            'CALI_TRACE_BUFFER_POLICY'  : 'async',
+            'CALI_TRACE_BUFFER_SIZE'    : '1',
+            'CALI_TRACE_ASYNC_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'        : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'region' : 'main/foo', 'event.end#loop': 'fooloop', 'count' : '400' }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'region' : 'main/foo/pre-loop/foo.init', 'count' : '400' }))
+
     def test_globals(self):
         target_cmd = [ './ci_test_basic' ]
         query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e', '--list-globals' ]
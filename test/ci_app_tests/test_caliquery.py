@@ -1,6 +1,9 @@
 # Some tests for the cali-query tool
 
+import glob
 import json
+import os
+import tempfile
 import unittest
 
 import calipertest as cat
@@ -42,6 +45,33 @@ class CaliperCaliQueryTest(unittest.TestCase):
             if not target in res:
                 self.fail('%s not found in log' % target)
 
+    def test_caliquery_segments(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            target_cmd = [ './ci_test_macros', '0', 'none', '100' ]
+
+            caliper_config = {
+                'CALI_SERVICES_ENABLE'      : 'event,trace,recorder',
+                'CALI_CHANNEL_ROLLING_SIZE' : '1',
+                'CALI_RECORDER_FILENAME'    : os.path.join(tmpdir, 'out.cali'),
+                'CALI_LOG_VERBOSITY'        : '0',
+            }
+
+            cat.run_test(target_cmd, caliper_config)
+
+            files = sorted(glob.glob(os.path.join(tmpdir, 'out.*.cali')))
+            self.assertGreaterEqual(len(files), 2)
+
+            query_cmd = [ '../../src/tools/cali-query/cali-query', '--segments',
+                          '-q', 'select region,count() group by region format expand' ] + files
+
+            query_output,_ = cat.run_test(query_cmd, None)
+            snapshots = cat.get_snapshots_from_text(query_output)
+
+            self.assertTrue(cat.has_snapshot_with_attributes(
+                snapshots, { 'region' : 'main/foo/pre-loop/foo.init', 'count' : '100' }))
+            self.assertTrue(cat.has_snapshot_with_attributes(
+                snapshots, { 'region' : 'main/bar', 'count' : '1' }))
+
 
 if __name__ == "__main__":
     unittest.main()
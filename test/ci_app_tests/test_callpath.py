@@ -30,5 +30,33 @@ class CaliperCallpathTest(unittest.TestCase):
 
         self.assertTrue('main' in sreg.get('callpath.regname'))
 
+    def test_callpath_cache(self):
+        target_cmd = [ './ci_test_macros', '20' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-q', 'select loop,function,callpath.regname,callpath.address format expand' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'callpath,event,trace,recorder',
+            'CALI_CALLPATH_USE_NAME' : 'true',
+            'CALI_CALLPATH_USE_CACHE': 'true',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        cached = cat.get_snapshots_from_text(cat.run_test_with_query(target_cmd, query_cmd, caliper_config))
+
+        caliper_config['CALI_CALLPATH_USE_CACHE'] = 'false'
+
+        uncached = cat.get_snapshots_from_text(cat.run_test_with_query(target_cmd, query_cmd, caliper_config))
+
+        # the loop repeats the same call paths, which hit the cache
+
+        self.assertTrue(len(cached) > 20)
+        self.assertTrue(cat.has_snapshot_with_keys(
+            cached, { 'callpath.address', 'callpath.regname', 'loop' }))
+        self.assertEqual(len(cached), len(uncached))
+
+        for a, b in zip(cached, uncached):
+            self.assertEqual(a.get('callpath.regname'), b.get('callpath.regname'))
+
 if __name__ == "__main__":
     unittest.main()
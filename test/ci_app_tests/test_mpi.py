@@ -167,6 +167,64 @@ class CaliperMPITest(unittest.TestCase):
             snapshots, { 'region', 'mpi.function', 'mpi.coll.type'
             }))
 
+    def test_mpi_msg_histograms(self):
+        target_cmd = [ './ci_test_mpi_before_cali', '', '100' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'PATH'                    : '/usr/bin', # for ssh/rsh
+            'CALI_LOG_VERBOSITY'      : '0',
+            'CALI_SERVICES_ENABLE'    : 'event,mpi,recorder,trace',
+            'CALI_MPI_MSG_TRACING'    : 'true',
+            'CALI_MPI_WHITELIST'      : 'all',
+            'CALI_RECORDER_FILENAME'  : 'stdout'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        sends = [ s for s in snapshots if 'mpi.send.count' in s and s.get('mpi.msg.tag') == '7' ]
+        recvs = [ s for s in snapshots if 'mpi.recv.count' in s and s.get('mpi.msg.tag') == '7' ]
+
+        self.assertEqual(len(sends), 100)
+        self.assertEqual(len(recvs), 100)
+
+        # histograms are pushed in MPI_Finalize
+        counts = {}
+        for s in snapshots:
+            if 'mpi.hist.kind' in s:
+                kind = s['mpi.hist.kind']
+                counts[kind] = counts.get(kind, 0) + int(s['mpi.hist.count'])
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'mpi.hist.kind' : 'msg.size',
+                         'mpi.hist.bin'  : '4',
+                         'mpi.hist.count': '200'
+            }))
+        self.assertEqual(counts.get('msg.size'), 200)
+        # MPI may hand out the same request handle for sends that complete
+        # right away, so not every send may have a separate wait time
+        self.assertGreaterEqual(counts.get('wait.time'), 100)
+        self.assertLessEqual(counts.get('wait.time'), 200)
+
+    def test_mpi_msg_untracked_requests(self):
+        # requests are never completed through a wrapped call: the request
+        # tables must stay bounded and the run must still succeed
+        target_cmd = [ './ci_test_mpi_before_cali', '', '20000' ]
+
+        caliper_config = {
+            'PATH'                    : '/usr/bin', # for ssh/rsh
+            'CALI_LOG_VERBOSITY'      : '1',
+            'CALI_SERVICES_ENABLE'    : 'event,mpi,trace',
+            'CALI_MPI_MSG_TRACING'    : 'true',
+            'CALI_MPI_WHITELIST'      : 'all',
+            'CALI_MPI_BLACKLIST'      : 'MPI_Waitall'
+        }
+
+        out,err = cat.run_test(target_cmd, caliper_config)
+
+        self.assertIn('requests not tracked', err.decode())
+
     def test_mpireport_controller(self):
         target_cmd = [ './ci_test_mpi_before_cali', 'mpi-report' ]
 
@@ -190,6 +248,22 @@ class CaliperMPITest(unittest.TestCase):
             else:
                 self.fail('%s not found in log' % target)
 
+    def test_mpi_hatchet_region_profile(self):
+        target_cmd = [ './ci_test_mpi_before_cali', 'hatchet-region-profile,output.format=json,output=stdout' ]
+
+        caliper_config = {
+            'PATH'                    : '/usr/bin', # for ssh/rsh
+            'CALI_LOG_VERBOSITY'      : '0',
+        }
+
+        report_out,_ = cat.run_test(target_cmd, caliper_config)
+        obj = json.loads(report_out.decode())
+
+        # the cross-process query aggregates the local query's LET result
+        # and reports it under its alias
+        self.assertTrue(any(r.get('path') == 'main' and 'time' in r for r in obj))
+        self.assertTrue(any(r.get('path') == 'main/reduction' and 'time' in r for r in obj))
+
     def test_mpi_inst_options(self):
         target_cmd = [ './ci_test_mpi_before_cali', 'spot,profile.mpi,mpi.exclude=MPI_Barrier,output=stdout' ]
         query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
@@ -23,5 +23,34 @@ class CaliperSamplerTest(unittest.TestCase):
         self.assertTrue(cat.has_snapshot_with_keys(
             snapshots, { 'loop', 'region' }))
 
+    def test_deferred_sample_timestamps(self):
+        target_cmd = [ './ci_test_macros', '20000' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'event:sampler:timer:trace:recorder',
+            'CALI_SAMPLER_DEFERRED'  : 'true',
+            'CALI_SAMPLER_FREQUENCY' : '1000',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = [ s for s in cat.get_snapshots_from_text(query_output) if 'time.offset.ns' in s ]
+
+        samples = [ s for s in snapshots if 'cali.sampler.delay' in s ]
+
+        self.assertTrue(len(samples) > 0)
+
+        #   Deferred samples are backdated to the time they were taken,
+        # so the trace stays in time order and each snapshot's duration
+        # covers exactly the time since the previous one
+        prev = 0
+        for s in snapshots:
+            offs = int(s['time.offset.ns'])
+            self.assertGreaterEqual(offs, prev)
+            self.assertEqual(int(s['time.duration.ns']), offs - prev)
+            prev = offs
+
 if __name__ == "__main__":
     unittest.main()